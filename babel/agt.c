@@ -38,7 +38,7 @@ static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, i
 
  /* Read the position of the game desciption block */
  l=read_agt_int(sf+32);
- if (extent<l+6) return INVALID_STORY_FILE_RV;
+ if (l<0 || extent<l+6) return INVALID_STORY_FILE_RV;
  game_version = read_agt_short(sf+l);
  game_sig=read_agt_int(sf+l+2);
  ASSERT_OUTPUT_SIZE(19);
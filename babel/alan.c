@@ -48,7 +48,7 @@ static int32 claim_story_file(void *story_file, int32 extent)
  if (memcmp(sf,"ALAN",4))
  { /* Identify Alan 2.x */
  bf=read_alan_int(sf+4);
- if (bf > extent/4) return INVALID_STORY_FILE_RV;
+ if (bf < 0 || bf > extent/4) return INVALID_STORY_FILE_RV;
  for (i=24;i<81;i+=4)
  if (read_alan_int(sf+i) > extent/4) return INVALID_STORY_FILE_RV;
  for (i=160;i<(bf*4);i++)
@@ -59,7 +59,7 @@ static int32 claim_story_file(void *story_file, int32 extent)
  else
  { /* Identify Alan 3 */
    bf=read_alan_int(sf+12);
-   if (bf > (extent/4)) return INVALID_STORY_FILE_RV;
+   if (bf < 0 || bf > (extent/4)) return INVALID_STORY_FILE_RV;
    for (i=184;i<(bf*4);i++)
     crc+=sf[i];
  if (crc!=read_alan_int(sf+176)) return INVALID_STORY_FILE_RV;
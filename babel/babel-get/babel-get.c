@@ -36,6 +36,9 @@ char * get_story(char *, char *);
 char * get_story_cover(char *, char *);
 char * get_url(char *, char *);
 char * get_url_cover(char *, char *);
+char * get_batch_dir(char *, char *);
+char * get_batch_store(char *, char *);
+char * get_batch_url(char *, char *);
 typedef char * (*getter)(char *, char *);
 /* For command line processing */
 struct get_info
@@ -52,6 +55,9 @@ struct get_info info[] = {
                 { "-ifiction", "-url", get_url, 1 },
                 { "-cover", "-story", get_story_cover, 0},
                 { "-cover", "-url", get_url_cover, 1},
+                { "-batch", "-dir", get_batch_dir, 0 },
+                { "-batch", "-store", get_batch_store, 0 },
+                { "-batch", "-url", get_batch_url, 0 },
                 { NULL, NULL, NULL }
                 };
 
@@ -60,9 +66,13 @@ void show_usage(void)
  int i;
  printf("Usage:\n");
  for(i=0;info[i].cmd;i++)
+ if (strcmp(info[i].cmd,"-batch")==0)
+  printf(" babel-get %s %s <source> < <ifids>\n", info[i].cmd, info[i].source);
+ else
   printf(" babel-get %s %s %s <source>%s\n",
            info[i].cmd, info[i].nonull ? "<ifid>": "[<ifid>]", info[i].source,
            info[i].cmd[1]=='c' ? " [-to <directory>]":"");
+ printf(" babel-get -ifiction @<ifid list file> -ifiction <source>\n");
 
 }
 int main(int argc, char **argv)
@@ -73,7 +83,7 @@ int main(int argc, char **argv)
  char cwd[512];
 
  if (argc<4 || argc > 7 || (argc >5 && strcmp(argv[argc-2],"-to")) ||
-   (strcmp(argv[argc-2],"-to")==0 && strcmp(argv[1],"-ifiction")==0))
+   (strcmp(argv[argc-2],"-to")==0 && strcmp(argv[1],"-cover")))
  {
   show_usage();
   return 1;
@@ -0,0 +1,425 @@
+/* get_batch.c : batch sources for babel-get
+ *
+ * babel-get -batch -dir <directory>
+ * babel-get -batch -store <ifiction file>
+ * babel-get -batch -url <http://host[:port][/path]>
+ *
+ * Reads IFIDs from stdin, one per line, and writes the stories found for
+ * them to stdout, as they are found, as a single iFiction record.  IFIDs
+ * which cannot be found are reported on stderr.
+ *
+ * A directory holds one <ifid>.iFiction file per story, either directly
+ * in the directory (as for babel-get -dir) or in a shard subdirectory
+ * named by the first two hex digits of the MD5 hash of the IFID in upper
+ * case (eg. <directory>/3f/<ifid>.iFiction).
+ *
+ * A store is a single iFiction file, looked up through its IFID index
+ * (see get_ifiction.c).
+ *
+ * A URL is fetched from as by babel-get -url (<url>/metadata/<ifid>), but
+ * over a single HTTP/1.1 connection which is kept open for all the IFIDs.
+ * Only plain http is supported, and only on platforms with BSD sockets
+ * (not if BABEL_NO_SOCKETS is defined).
+ */
+
+#include "ifiction.h"
+#include "md5.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_SOCKETS)
+#define BABEL_USE_SOCKETS
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#endif
+
+void *ifiction_store_open(char *from);
+char *ifiction_store_story(void *, char *ifid);
+void ifiction_store_close(void *);
+
+typedef char *(*batch_fetch)(char *ifid, void *ctx);
+
+static const char batch_head[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        " <!-- Metadata extracted from %s by babel-get -->\n"
+        "<ifindex version=\"1.0\" xmlns=\"http://babel.ifarchive.org/protocol/iFiction/\">\n";
+
+/* Reads a whole file, or returns NULL */
+static char *batch_read_file(char *name)
+{
+ FILE *f;
+ char *md;
+ long l;
+ f=fopen(name,"rb");
+ if (!f) return NULL;
+ fseek(f,0,SEEK_END);
+ l=ftell(f);
+ if (l<=0 || l>0x7FFFFFF0L || !(md=(char *)malloc(l+1)))
+ {
+  fclose(f);
+  return NULL;
+ }
+ fseek(f,0,SEEK_SET);
+ if (fread(md,1,l,f)!=(size_t) l)
+ {
+  free(md);
+  fclose(f);
+  return NULL;
+ }
+ md[l]=0;
+ fclose(f);
+ return md;
+}
+
+/* Prints the stories of an iFiction record, returning how many there were */
+static int32 batch_print_stories(char *md)
+{
+ struct ifiction_tree *tree;
+ int32 n=-1, found=0, offset, extent;
+ char *ep=strstr(md,"</ifindex>");
+ if (ep) *(ep+10)=0;
+ tree=ifiction_build_tree(md);
+ while((n=ifiction_find_tag(tree,"ifindex","story",n))>=0)
+ {
+  offset=ifiction_tag_offset(tree,n,&extent);
+  fputs(" <story>",stdout);
+  fwrite(md+offset,1,extent,stdout);
+  fputs(" </story>\n",stdout);
+  found++;
+ }
+ ifiction_release_tree(tree);
+ return found;
+}
+
+/* The directory source */
+static char *batch_fetch_dir(char *ifid, void *ctx)
+{
+ char *dir=(char *)ctx, *path, *md, *u;
+ md5_state_t md5;
+ md5_byte_t digest[16];
+ int32 i, l=strlen(ifid);
+
+ path=(char *)malloc(strlen(dir)+2*l+20);
+ u=(char *)malloc(l+1);
+ if (!path || !u)
+ {
+  if (path) free(path);
+  if (u) free(u);
+  return NULL;
+ }
+ for(i=0;i<=l;i++) u[i]=toupper((unsigned char) ifid[i]);
+ md5_init(&md5);
+ md5_append(&md5,(md5_byte_t *) u,l);
+ md5_finish(&md5,digest);
+ free(u);
+ sprintf(path,"%s/%02x/%s.iFiction",dir,digest[0],ifid);
+ md=batch_read_file(path);
+ if (!md)
+ {
+  sprintf(path,"%s/%s.iFiction",dir,ifid);
+  md=batch_read_file(path);
+ }
+ free(path);
+ return md;
+}
+
+#ifdef BABEL_USE_SOCKETS
+
+#define HTTP_BUFFER 65536
+#define HTTP_MAX_BODY 0x4000000L        /* the largest response accepted */
+
+/* Writing to a connection the server has dropped must fail rather than
+   raise SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define HTTP_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define HTTP_SEND_FLAGS 0
+#endif
+
+struct http_conn
+{
+ char host[256];
+ char port[16];
+ char *path;
+ int fd;
+ char buf[HTTP_BUFFER];
+ int32 pos, len;
+};
+
+static int http_connect(struct http_conn *c)
+{
+ struct addrinfo hints, *res, *r;
+ memset(&hints,0,sizeof(hints));
+ hints.ai_family=AF_UNSPEC;
+ hints.ai_socktype=SOCK_STREAM;
+ c->fd=-1;
+ c->pos=c->len=0;
+ if (getaddrinfo(c->host,c->port,&hints,&res)) return 0;
+ for(r=res;r;r=r->ai_next)
+ {
+  c->fd=socket(r->ai_family,r->ai_socktype,r->ai_protocol);
+  if (c->fd<0) continue;
+#ifdef SO_NOSIGPIPE
+  { int on=1; setsockopt(c->fd,SOL_SOCKET,SO_NOSIGPIPE,&on,sizeof(on)); }
+#endif
+  if (connect(c->fd,r->ai_addr,r->ai_addrlen)==0) break;
+  close(c->fd);
+  c->fd=-1;
+ }
+ freeaddrinfo(res);
+ return c->fd>=0;
+}
+
+static void http_close(struct http_conn *c)
+{
+ if (c->fd>=0) close(c->fd);
+ c->fd=-1;
+}
+
+/* Makes sure there is something in the buffer; returns 0 at the end of
+   the stream */
+static int http_fill(struct http_conn *c)
+{
+ ssize_t n;
+ if (c->pos<c->len) return 1;
+ n=read(c->fd,c->buf,HTTP_BUFFER);
+ if (n<=0) return 0;
+ c->pos=0;
+ c->len=n;
+ return 1;
+}
+
+/* Returns the next byte of the response, or -1 at the end of the stream */
+static int http_getc(struct http_conn *c)
+{
+ if (!http_fill(c)) return -1;
+ return (unsigned char) c->buf[c->pos++];
+}
+
+/* Reads a line of the response header, without its line ending */
+static int http_line(struct http_conn *c, char *line, int32 extent)
+{
+ int ch;
+ int32 l=0;
+ while((ch=http_getc(c))>=0 && ch!='\n')
+  if (ch!='\r' && l<extent-1) line[l++]=ch;
+ line[l]=0;
+ return ch>=0 || l;
+}
+
+/* Reads extent bytes of the body into b */
+static int http_read(struct http_conn *c, char *b, int32 extent)
+{
+ int32 n;
+ while(extent>0)
+ {
+  if (!http_fill(c)) return 0;
+  n=c->len-c->pos;
+  if (n>extent) n=extent;
+  memcpy(b,c->buf+c->pos,n);
+  c->pos+=n;
+  b+=n;
+  extent-=n;
+ }
+ return 1;
+}
+
+/* Appends extent bytes of the body to a growing buffer */
+static int http_append(struct http_conn *c, char **body, int32 *length, int32 extent)
+{
+ char *nb;
+ if (extent<0 || extent>HTTP_MAX_BODY-*length) return 0;
+ nb=(char *)realloc(*body,*length+extent+1);
+ if (!nb) return 0;
+ *body=nb;
+ if (!http_read(c,nb+*length,extent)) return 0;
+ *length+=extent;
+ nb[*length]=0;
+ return 1;
+}
+
+/* Sends one request and reads its response.  Returns 1 with the body
+   (or NULL if the status was not 200), or 0 if the connection failed */
+static int http_request(struct http_conn *c, char *ifid, char **body)
+{
+ char line[1024], *req;
+ int status=0;
+ int32 length=-1, chunked=0, keep=1, bad=0, l=0, i, n;
+ long cl;
+ size_t sent, total;
+
+ *body=NULL;
+ req=(char *)malloc(strlen(c->path)+strlen(c->host)+3*strlen(ifid)+128);
+ if (!req) return 0;
+ n=sprintf(req,"GET %s/metadata/",c->path);
+ for(i=0;ifid[i];i++)
+  if (isalnum((unsigned char) ifid[i]) || ifid[i]=='-' || ifid[i]=='.' || ifid[i]=='_')
+   req[n++]=ifid[i];
+  else n+=sprintf(req+n,"%%%02X",(unsigned char) ifid[i]);
+ sprintf(req+n," HTTP/1.1\r\nHost: %s\r\n\r\n",c->host);
+ total=strlen(req);
+ for(sent=0;sent<total;sent+=n)
+  if ((n=send(c->fd,req+sent,total-sent,HTTP_SEND_FLAGS))<=0) break;
+ free(req);
+ if (sent<total) return 0;
+
+ if (!http_line(c,line,sizeof(line)) || sscanf(line,"HTTP/%*d.%*d %d",&status)!=1)
+  return 0;
+ while(http_line(c,line,sizeof(line)) && line[0])
+ {
+  char *v=strchr(line,':');
+  if (!v) continue;
+  *v++=0;
+  while(*v==' ') v++;
+  for(i=0;line[i];i++) line[i]=tolower((unsigned char) line[i]);
+  if (strcmp(line,"content-length")==0)
+  {
+   cl=strtol(v,NULL,10);
+   if (cl<0 || cl>HTTP_MAX_BODY) bad=1;
+   else length=cl;
+  }
+  else if (strcmp(line,"transfer-encoding")==0 && strstr(v,"chunked")) chunked=1;
+  else if (strcmp(line,"connection")==0 && (v[0]=='c' || v[0]=='C')) keep=0;
+ }
+
+ if (bad)
+  /* The body cannot be read, nor the next response found */
+  keep=0;
+ else if (chunked)
+ {
+  while(http_line(c,line,sizeof(line)) && (cl=strtol(line,NULL,16))>0)
+  {
+   if (cl>HTTP_MAX_BODY || !http_append(c,body,&l,(int32) cl)) { bad=1; break; }
+   http_line(c,line,sizeof(line));
+  }
+  if (!bad) while(http_line(c,line,sizeof(line)) && line[0]);
+ }
+ else if (length>=0)
+ {
+  if (!http_append(c,body,&l,length)) bad=1;
+ }
+ else
+ {
+  /* Body runs to the end of the connection */
+  keep=0;
+  while(http_fill(c))
+   if (!http_append(c,body,&l,c->len-c->pos)) { bad=1; break; }
+ }
+ if (bad && *body) { free(*body); *body=NULL; }
+ if (bad || !keep) http_close(c);
+ if (status!=200 && *body) { free(*body); *body=NULL; }
+ return 1;
+}
+
+static char *batch_fetch_url(char *ifid, void *ctx)
+{
+ struct http_conn *c=(struct http_conn *)ctx;
+ char *body;
+ int tries;
+ /* A kept-alive connection may have been closed by the server since the
+    last request; if so, reconnect and try again */
+ for(tries=0;tries<2;tries++)
+ {
+  if (c->fd<0 && !http_connect(c)) return NULL;
+  if (http_request(c,ifid,&body)) return body;
+  if (body) free(body);
+  http_close(c);
+ }
+ return NULL;
+}
+
+static struct http_conn *batch_open_url(char *url)
+{
+ struct http_conn *c;
+ char *h, *p, *s;
+ if (strncmp(url,"http://",7)) return NULL;
+ c=(struct http_conn *)calloc(1,sizeof(struct http_conn));
+ if (!c) return NULL;
+ h=url+7;
+ s=strchr(h,'/');
+ if (!s) s=h+strlen(h);
+ p=memchr(h,':',s-h);
+ if ((p ? p : s)-h>=(int) sizeof(c->host) || (p && s-p>=(int) sizeof(c->port)))
+ {
+  free(c);
+  return NULL;
+ }
+ memcpy(c->host,h,(p ? p : s)-h);
+ if (p) memcpy(c->port,p+1,s-p-1);
+ else strcpy(c->port,"80");
+ c->path=s;
+ if (*c->path && c->path[strlen(c->path)-1]=='/') c->path[strlen(c->path)-1]=0;
+ c->fd=-1;
+ return c;
+}
+
+#endif
+
+/* Fetches each IFID on stdin and streams out what is found */
+static char *batch_run(char *from, batch_fetch fetch, void *ctx, int stories)
+{
+ char line[512], *md;
+ int32 l, found=0;
+
+ printf(batch_head,from);
+ while(fgets(line,sizeof(line),stdin))
+ {
+  l=strlen(line);
+  while(l && (line[l-1]=='\n' || line[l-1]=='\r' || line[l-1]==' ')) line[--l]=0;
+  if (!l) continue;
+  md=fetch(line,ctx);
+  if (md && stories)
+  {
+   printf(" <story>%s </story>\n",md);
+   found++;
+  }
+  else if (!md || !batch_print_stories(md))
+   fprintf(stderr,"%s not found in %s\n",line,from);
+  else found++;
+  if (md) free(md);
+  fflush(stdout);
+ }
+ printf("</ifindex>\n");
+ return found ? from : NULL;
+}
+
+static char *batch_fetch_store(char *ifid, void *ctx)
+{
+ return ifiction_store_story(ctx,ifid);
+}
+
+char *get_batch_dir(char *ifid, char *from)
+{
+ if (ifid) return NULL;
+ return batch_run(from,batch_fetch_dir,from,0);
+}
+
+char *get_batch_store(char *ifid, char *from)
+{
+ void *s;
+ char *rv;
+ if (ifid || !(s=ifiction_store_open(from))) return NULL;
+ rv=batch_run(from,batch_fetch_store,s,1);
+ ifiction_store_close(s);
+ return rv;
+}
+
+char *get_batch_url(char *ifid, char *from)
+{
+#ifdef BABEL_USE_SOCKETS
+ struct http_conn *c;
+ char *rv;
+ if (ifid || !(c=batch_open_url(from))) return NULL;
+ rv=batch_run(from,batch_fetch_url,c,0);
+ http_close(c);
+ free(c);
+ return rv;
+#else
+ if (ifid || from) { }
+ return NULL;
+#endif
+}
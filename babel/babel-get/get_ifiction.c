@@ -10,12 +10,16 @@
  * 543 Howard Street, 5th Floor,
  * San Francisco, California, 94105, USA.
  *
+ * An IFID given as @<file> names a file of IFIDs, one per line, all of
+ * whose stories are fetched at once.
  *
  */
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "ifiction.h"
 static const char xml_husk[] =
         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
@@ -26,27 +30,474 @@ static const char xml_husk[] =
 
 char *_get_ifiction_data(char *ifid, char *from, char *md)
 {
- char *st, *sta=NULL;
- char *xmlb, anifid[512];
- int32 ic;
+ struct ifiction_tree *tree;
+ char *st;
+ char *xmlb=NULL, anifid[512];
+ int32 ic, n=-1;
 
- while(1)
+ tree=ifiction_build_tree(md);
+ while((n=ifiction_find_tag(tree,"ifindex","story",n))>=0)
  {
-  st=ifiction_get_tag(md,"ifindex","story",sta);
-  if (sta) free(sta);
-  if (!st) { return NULL; }
+  st=ifiction_tag_content(tree,n);
   xmlb=(char *)malloc(strlen(xml_husk)+strlen(st)+strlen(from)+1);
-  if (!xmlb) { free(st); return NULL; }
+  if (!xmlb) { free(st); break; }
   sprintf(xmlb,xml_husk,from,st);
-  sta=st;
+  free(st);
   ic=ifiction_get_IFID(xmlb, anifid, 512);
-  if (ic<=0) { free(xmlb); continue; }
-  if (!ifid || strstr(anifid,ifid))
-   return xmlb;
+  if (ic>0 && (!ifid || strstr(anifid,ifid)))
+   break;
 
   free(xmlb);
+  xmlb=NULL;
  }
+ ifiction_release_tree(tree);
+ return xmlb;
+}
+
+/* The IFID index.  Looking a story up in a large catalogue by parsing it
+   is slow, so the first lookup in a file records the offset and extent of
+   each story under each of its IFIDs, sorted by IFID, in a sidecar file
+   (the catalogue's name with ".ifidx" appended).  Later lookups load the
+   sidecar, binary search it, and read just the story they want.  The
+   sidecar records the catalogue's size and modification time, and is
+   rebuilt when they change.
+
+   A sidecar is six words (magic, modification time as two words, size,
+   number of entries, heap extent), the entries, and a heap of the IFIDs,
+   in upper case.  Words are in native byte order. */
+
+#define IFIDX_MAGIC 0x42474958L
+#define IFIDX_HEADER 6
+
+struct ifidx_entry
+{
+ int32 ifid;                    /* offset in heap */
+ int32 offset;                  /* story's content in the catalogue */
+ int32 extent;
+};
+
+struct ifidx
+{
+ struct ifidx_entry *entries;
+ int32 count;
+ char *heap;
+ int32 heap_extent;
+ int32 size;                    /* entries allocated, while building */
+};
+
+static void ifidx_release(struct ifidx *ix)
+{
+ if (ix->entries) free(ix->entries);
+ if (ix->heap) free(ix->heap);
+ free(ix);
+}
+
+static void ifidx_upper(char *s)
+{
+ for(;*s;s++) if (*s>='a' && *s<='z') *s-='a'-'A';
+}
+
+static void ifidx_stamp(struct stat *st, int32 *h)
+{
+ h[0]=IFIDX_MAGIC;
+ h[1]=(int32)(st->st_mtime>>16>>16);
+ h[2]=(int32) st->st_mtime;
+ h[3]=(int32) st->st_size;
+}
+
+/* Loads the sidecar for a catalogue, if it is present and up to date */
+static struct ifidx *ifidx_load(char *name, struct stat *st)
+{
+ FILE *f;
+ int32 h[IFIDX_HEADER], want[IFIDX_HEADER], i;
+ struct ifidx *ix;
+
+ f=fopen(name,"rb");
+ if (!f) return NULL;
+ ifidx_stamp(st,want);
+ if (fread(h,sizeof(int32),IFIDX_HEADER,f)!=IFIDX_HEADER ||
+     memcmp(h,want,4*sizeof(int32)) || h[4]<0 || h[5]<1 ||
+     h[4]>0x7FFFFFF0L/(int32) sizeof(struct ifidx_entry))
+ {
+  fclose(f);
+  return NULL;
+ }
+ ix=(struct ifidx *)calloc(1,sizeof(struct ifidx));
+ ix->count=h[4];
+ ix->heap_extent=h[5];
+ ix->entries=(struct ifidx_entry *)malloc(ix->count*sizeof(struct ifidx_entry)+1);
+ ix->heap=(char *)malloc(ix->heap_extent);
+ if (!ix->entries || !ix->heap ||
+     fread(ix->entries,sizeof(struct ifidx_entry),ix->count,f)!=(size_t) ix->count ||
+     fread(ix->heap,1,ix->heap_extent,f)!=(size_t) ix->heap_extent ||
+     ix->heap[ix->heap_extent-1])
+ {
+  fclose(f);
+  ifidx_release(ix);
+  return NULL;
+ }
+ fclose(f);
+ for(i=0;i<ix->count;i++)
+  if (ix->entries[i].ifid<0 || ix->entries[i].ifid>=ix->heap_extent ||
+      ix->entries[i].offset<0 || ix->entries[i].extent<0 ||
+      ix->entries[i].extent>st->st_size-ix->entries[i].offset)
+  {
+   ifidx_release(ix);
+   return NULL;
+  }
+ return ix;
+}
+
+/* Entries are sorted paired with their IFIDs' addresses in the heap, so
+   that the comparison needs nothing else */
+struct ifidx_sortable
+{
+ char *ifid;
+ struct ifidx_entry entry;
+};
 
+static int ifidx_compare(const void *a, const void *b)
+{
+ struct ifidx_sortable *x=(struct ifidx_sortable *)a, *y=(struct ifidx_sortable *)b;
+ int r=strcmp(x->ifid,y->ifid);
+ if (r) return r;
+ return x->entry.offset < y->entry.offset ? -1 : x->entry.offset > y->entry.offset;
+}
+
+/* Sorts the entries by IFID (then by offset), returning 0 on failure */
+static int ifidx_sort(struct ifidx *ix)
+{
+ struct ifidx_sortable *s;
+ int32 i;
+ if (!ix->count) return 1;
+ s=(struct ifidx_sortable *)malloc(ix->count*sizeof(struct ifidx_sortable));
+ if (!s) return 0;
+ for(i=0;i<ix->count;i++)
+ {
+  s[i].ifid=ix->heap+ix->entries[i].ifid;
+  s[i].entry=ix->entries[i];
+ }
+ qsort(s,ix->count,sizeof(struct ifidx_sortable),ifidx_compare);
+ for(i=0;i<ix->count;i++) ix->entries[i]=s[i].entry;
+ free(s);
+ return 1;
+}
+
+/* Adds an entry, returning 0 if there is no memory for it */
+static int ifidx_add(struct ifidx *ix, char *ifid, int32 offset, int32 extent)
+{
+ int32 l=strlen(ifid)+1, size;
+ char *nh;
+ if (ix->count==ix->size)
+ {
+  struct ifidx_entry *ne;
+  size=ix->size ? ix->size*2 : 256;
+  ne=(struct ifidx_entry *)malloc(size*sizeof(struct ifidx_entry));
+  if (!ne) return 0;
+  if (ix->entries)
+  {
+   memcpy(ne,ix->entries,ix->count*sizeof(struct ifidx_entry));
+   free(ix->entries);
+  }
+  ix->entries=ne;
+  ix->size=size;
+ }
+ nh=(char *)realloc(ix->heap,ix->heap_extent+l);
+ if (!nh) return 0;
+ ix->heap=nh;
+ strcpy(ix->heap+ix->heap_extent,ifid);
+ ifidx_upper(ix->heap+ix->heap_extent);
+ ix->entries[ix->count].ifid=ix->heap_extent;
+ ix->entries[ix->count].offset=offset;
+ ix->entries[ix->count].extent=extent;
+ ix->count++;
+ ix->heap_extent+=l;
+ return 1;
+}
+
+/* Reads a catalogue of st->st_size bytes, up to its </ifindex> */
+static char *ifidx_catalogue(char *from, struct stat *st)
+{
+ FILE *f;
+ char *md, *p;
+ f=fopen(from,"rb");
+ if (!f) return NULL;
+ md=(char *)malloc(st->st_size+1);
+ if (!md || fread(md,1,st->st_size,f)!=(size_t) st->st_size)
+ {
+  if (md) free(md);
+  fclose(f);
+  return NULL;
+ }
+ fclose(f);
+ md[st->st_size]=0;
+ p=strstr(md,"</ifindex>");
+ if (p) *(p+10)=0;
+ return md;
+}
+
+/* Indexes a catalogue in a single parse, and tries to save the index.
+   Returns NULL, saving nothing, if the index could not be completed */
+static struct ifidx *ifidx_build(char *from, char *name, struct stat *st)
+{
+ FILE *f;
+ char *md, *st_text, *p, *q, anifid[512];
+ struct ifiction_tree *tree;
+ struct ifidx *ix;
+ int32 h[IFIDX_HEADER], n=-1, offset, extent, ok=1;
+
+ md=ifidx_catalogue(from,st);
+ if (!md) return NULL;
+ ix=(struct ifidx *)calloc(1,sizeof(struct ifidx));
+ if (!ix)
+ {
+  free(md);
+  return NULL;
+ }
+ tree=ifiction_build_tree(md);
+ while(ok && (n=ifiction_find_tag(tree,"ifindex","story",n))>=0)
+ {
+  offset=ifiction_tag_offset(tree,n,&extent);
+  st_text=ifiction_tag_content(tree,n);
+  if (ifiction_get_IFID(st_text,anifid,512)>0)
+   for(p=anifid;p && ok;p=q)
+   {
+    q=strchr(p,',');
+    if (q) *q++=0;
+    ok=ifidx_add(ix,p,offset,extent);
+   }
+  free(st_text);
+ }
+ ifiction_release_tree(tree);
+ free(md);
+
+ if (!ok || !ifidx_sort(ix))
+ {
+  ifidx_release(ix);
+  return NULL;
+ }
+
+ f=fopen(name,"wb");
+ if (f)
+ {
+  ifidx_stamp(st,h);
+  h[4]=ix->count;
+  h[5]=ix->heap_extent;
+  fwrite(h,sizeof(int32),IFIDX_HEADER,f);
+  fwrite(ix->entries,sizeof(struct ifidx_entry),ix->count,f);
+  fwrite(ix->heap,1,ix->heap_extent,f);
+  if (fclose(f) || !ix->heap_extent) remove(name);
+ }
+ return ix;
+}
+
+static struct ifidx *ifidx_open(char *from)
+{
+ struct stat st;
+ struct ifidx *ix;
+ char *name;
+ if (stat(from,&st) || st.st_size<=0 || st.st_size>0x7FFFFFF0L) return NULL;
+ name=(char *)malloc(strlen(from)+7);
+ if (!name) return NULL;
+ sprintf(name,"%s.ifidx",from);
+ ix=ifidx_load(name,&st);
+ if (!ix) ix=ifidx_build(from,name,&st);
+ free(name);
+ return ix;
+}
+
+/* Finds the first story with the given IFID, returning its entry */
+static struct ifidx_entry *ifidx_find(struct ifidx *ix, char *ifid)
+{
+ int32 lo=0, hi=ix->count, mid, r;
+ char *key=(char *)malloc(strlen(ifid)+1);
+ if (!key) return NULL;
+ strcpy(key,ifid);
+ ifidx_upper(key);
+ while(lo<hi)
+ {
+  mid=lo+(hi-lo)/2;
+  r=strcmp(key,ix->heap+ix->entries[mid].ifid);
+  if (r>0) lo=mid+1;
+  else hi=mid;
+ }
+ r=lo<ix->count ? strcmp(key,ix->heap+ix->entries[lo].ifid) : 1;
+ free(key);
+ return r ? NULL : ix->entries+lo;
+}
+
+/* Reads a story's content from the catalogue */
+static char *ifidx_story(FILE *f, struct ifidx_entry *e)
+{
+ char *st=(char *)malloc(e->extent+1);
+ if (!st) return NULL;
+ if (fseek(f,e->offset,SEEK_SET) || fread(st,1,e->extent,f)!=(size_t) e->extent)
+ {
+  free(st);
+  return NULL;
+ }
+ st[e->extent]=0;
+ return st;
+}
+
+/* Finds the content of the first story with the given IFID by parsing
+   the whole catalogue, for when it could not be indexed */
+static char *ifidx_scan(char *md, char *ifid)
+{
+ struct ifiction_tree *tree;
+ char *st=NULL, *key, *p, *q, anifid[512];
+ int32 n=-1;
+
+ key=(char *)malloc(strlen(ifid)+1);
+ if (!key) return NULL;
+ strcpy(key,ifid);
+ ifidx_upper(key);
+ tree=ifiction_build_tree(md);
+ while((n=ifiction_find_tag(tree,"ifindex","story",n))>=0)
+ {
+  st=ifiction_tag_content(tree,n);
+  if (ifiction_get_IFID(st,anifid,512)>0)
+   for(p=anifid;p;p=q)
+   {
+    q=strchr(p,',');
+    if (q) *q++=0;
+    ifidx_upper(p);
+    if (strcmp(p,key)==0) break;
+   }
+  else p=NULL;
+  if (p) break;
+  free(st);
+  st=NULL;
+ }
+ ifiction_release_tree(tree);
+ free(key);
+ return st;
+}
+
+/* A catalogue, open for any number of lookups: indexed, or else (if it
+   could not be indexed) read into memory to be parsed for each lookup */
+struct ifiction_store
+{
+ struct ifidx *ix;
+ FILE *f;
+ char *md;
+};
+
+void *ifiction_store_open(char *from)
+{
+ struct ifiction_store *s;
+ struct ifidx *ix=ifidx_open(from);
+ struct stat st;
+ FILE *f=NULL;
+ char *md=NULL;
+ if (ix) f=fopen(from,"rb");
+ else if (!stat(from,&st) && st.st_size>0 && st.st_size<=0x7FFFFFF0L)
+  md=ifidx_catalogue(from,&st);
+ s=(struct ifiction_store *)malloc(sizeof(struct ifiction_store));
+ if (!(f || md) || !s)
+ {
+  if (f) fclose(f);
+  if (md) free(md);
+  if (s) free(s);
+  if (ix) ifidx_release(ix);
+  return NULL;
+ }
+ s->ix=ix;
+ s->f=f;
+ s->md=md;
+ return s;
+}
+
+/* Returns the content of the story with the given IFID, or NULL */
+char *ifiction_store_story(void *sp, char *ifid)
+{
+ struct ifiction_store *s=(struct ifiction_store *)sp;
+ struct ifidx_entry *e;
+ if (!s->ix) return ifidx_scan(s->md,ifid);
+ e=ifidx_find(s->ix,ifid);
+ return e ? ifidx_story(s->f,e) : NULL;
+}
+
+void ifiction_store_close(void *sp)
+{
+ struct ifiction_store *s=(struct ifiction_store *)sp;
+ if (s->f) fclose(s->f);
+ if (s->ix) ifidx_release(s->ix);
+ if (s->md) free(s->md);
+ free(s);
+}
+
+static char *_get_ifiction_indexed(char *ifid, char *from)
+{
+ void *s;
+ char *st, *xmlb=NULL;
+
+ s=ifiction_store_open(from);
+ if (!s) return NULL;
+ st=ifiction_store_story(s,ifid);
+ ifiction_store_close(s);
+ if (st)
+ {
+  xmlb=(char *)malloc(strlen(xml_husk)+strlen(st)+strlen(from)+1);
+  if (xmlb) sprintf(xmlb,xml_husk,from,st);
+  free(st);
+ }
+ return xmlb;
+}
+
+/* Bulk lookup: list names a file of IFIDs, one per line, and the stories
+   found are gathered into a single iFiction record */
+static char *_get_ifiction_bulk(char *list, char *from)
+{
+ static const char head[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        " <!-- Metadata extracted from %s by babel-get -->\n"
+        "<ifindex version=\"1.0\" xmlns=\"http://babel.ifarchive.org/protocol/iFiction/\">\n";
+ void *s;
+ FILE *lf;
+ char line[512], *st, *rv, *nrv;
+ int32 l, rvl, found=0;
+
+ lf=fopen(list,"r");
+ if (!lf) return NULL;
+ s=ifiction_store_open(from);
+ if (!s)
+ {
+  fclose(lf);
+  return NULL;
+ }
+ rv=(char *)malloc(strlen(head)+strlen(from)+1);
+ if (rv) sprintf(rv,head,from);
+ while(rv && fgets(line,sizeof(line),lf))
+ {
+  l=strlen(line);
+  while(l && (line[l-1]=='\n' || line[l-1]=='\r' || line[l-1]==' ')) line[--l]=0;
+  if (!l) continue;
+  st=ifiction_store_story(s,line);
+  if (!st)
+  {
+   fprintf(stderr,"%s not found in %s\n",line,from);
+   continue;
+  }
+  rvl=strlen(rv);
+  nrv=(char *)realloc(rv,rvl+strlen(st)+24);
+  if (nrv)
+  {
+   rv=nrv;
+   sprintf(rv+rvl," <story>%s </story>\n",st);
+   found++;
+  }
+  free(st);
+ }
+ fclose(lf);
+ ifiction_store_close(s);
+ if (rv && found && (nrv=(char *)realloc(rv,strlen(rv)+11))!=NULL)
+ {
+  strcat(nrv,"</ifindex>");
+  return nrv;
+ }
+ if (rv) free(rv);
+ return NULL;
 }
 
 char *_get_ifiction(char *ifid, char *from)
@@ -82,7 +533,10 @@ void get_ifiction_data(char *ifid, char *from, char *md)
 }
 char * get_ifiction(char *ifid, char *from)
 {
- char *rv=_get_ifiction(ifid,from);
+ char *rv;
+ if (!ifid) rv=_get_ifiction(ifid,from);
+ else if (ifid[0]=='@') rv=_get_ifiction_bulk(ifid+1,from);
+ else rv=_get_ifiction_indexed(ifid,from);
  if (rv) printf("%s",rv);
  else return NULL;
  return rv;
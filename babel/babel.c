@@ -17,6 +17,7 @@
  */
 
 #include "babel.h"
+#include "babel_profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -82,12 +83,21 @@ static struct function_handler functions[] = {
         { NULL, NULL, NULL }
         };
 static struct multi_handler multifuncs[] = {
-        { "-blorb", "<storyfile> <ifictionfile> [<cover art>]", babel_multi_blorb, 2, 3, "Bundle story file and (sparse) iFiction into blorb" },
-        { "-blorbs", "<storyfile> <ifictionfile> [<cover art>]", babel_multi_blorb1, 2, 3, "Bundle story file and (sparse) iFiction into sensibly-named blorb" },
+        { "-blorb", "<storyfile> <ifictionfile> [<cover art> [<pictures and sounds>...]]", babel_multi_blorb, 2, 1024, "Bundle story file and (sparse) iFiction into blorb" },
+        { "-blorbs", "<storyfile> <ifictionfile> [<cover art> [<pictures and sounds>...]]", babel_multi_blorb1, 2, 1024, "Bundle story file and (sparse) iFiction into sensibly-named blorb" },
         { "-complete", "<storyfile> <ifictionfile>", babel_multi_complete, 2, 2, "Create complete iFiction file from sparse iFiction" },
+        { "-verify-registry", "", babel_multi_verify_registry, 0, 0, "Check the tables from which formats identify stories" },
+        { "-batch", "<directory|listfile> [-j <threads>] [-tsv] [-md5] [-cache <cachefile> [-verify]] [-ifiction]", babel_multi_batch, 1, 9, "Identify many story files, printing one JSON (or TSV) record per file" },
         { NULL, NULL, NULL, 0, 0, NULL }
 };
 
+/* Prints the treaty call profile when babel finishes */
+static void print_stats(void)
+{
+ fflush(stdout);
+ babel_profile_print(stderr);
+}
+
 int main(int argc, char **argv)
 {
  char *todir=".";
@@ -95,12 +105,25 @@ int main(int argc, char **argv)
  int ok=1,i, l, ll;
  FILE *f;
  char *md=NULL;
+ /* "-stats" may be given anywhere in the command line, to have the calls
+    to the treaty modules profiled and summarized when babel finishes
+ */
+ for(i=1;i<argc;i++)
+  if (strcmp(argv[i],"-stats")==0)
+  {
+   for(l=i;l<argc-1;l++) argv[l]=argv[l+1];
+   argc--;
+   babel_profile_enable(1);
+   atexit(print_stats);
+   break;
+  }
+
  /* Set the input filename.  Note that if this is invalid, babel should
    abort before anyone notices
  */
  fn=argv[2];
 
- if (argc < 3) ok=0;
+ if (argc < 2) ok=0;
  /* Detect the presence of the "-to <directory>" argument.
   */
  if (ok && argc >=5 && strcmp(argv[argc-2], "-to")==0)
@@ -153,6 +176,8 @@ int main(int argc, char **argv)
 
   printf ("\nFor functions which extract files, add \"-to <directory>\" to the command\n"
           "to set the output directory.\n"
+          "Add \"-stats\" to any command to print a summary of the calls made to\n"
+          "each format's module (to standard error) when it finishes.\n"
           "The input file can be specified as \"-\" to read from standard input\n"
           "(This may only work for .iFiction files)\n");
   return 1;
@@ -175,18 +200,17 @@ int main(int argc, char **argv)
   md[l-1]=0;
  }
  else
-  while(!feof(stdin))
+ {
+  int32 sl;
+  md=(char *)babel_read_stream(stdin,&sl);
+  if (!md)
   {
-   char *tt, mdb[1024];
-   int ii;
-   ii=fread(mdb,1,1024,stdin);
-   tt=(char *)my_malloc(ll+ii,"file buffer");
-   if (md) { memcpy(tt,md,ll); free(md); }
-   memcpy(tt+ll,mdb,ii);
-   md=tt;
-   ll+=ii;
-   if (ii<1024) break;
+   fprintf(stderr,"Error: could not read standard input\n");
+   return 1;
   }
+  ll=sl;
+  l=ll+1;
+ }
 
 
   if (strstr(md,"<?xml version=") && strstr(md,"<ifindex"))
@@ -210,15 +234,14 @@ int main(int argc, char **argv)
  free(md);
  fclose(f);
  }
+ else if (!l || !functions[i].story) free(md);
  if (l)
  { /* Appears to be a story */
    char *lt;
    if (functions[i].story)
    {
-    if (strcmp(fn,"-")) lt=babel_init(argv[2]);
-    else { lt=babel_init_raw(md,ll);
-           free(md);
-         }
+    if (strcmp(fn,"-")) lt=babel_init_mapped(argv[2]);
+    else lt=babel_init_raw_owned(md,ll);
 
     if (lt)
     {
@@ -51,6 +51,12 @@ void babel_ifiction_lint(char *);
 void babel_multi_blorb(char **, char * , int);
 void babel_multi_blorb1(char **, char * , int);
 void babel_multi_complete(char **, char *, int);
+void babel_multi_verify_registry(char **, char *, int);
+
+/* Functions from babel_batch_functions.c
+ *
+ */
+void babel_multi_batch(char **, char *, int);
 
 /* uncomment this line on platforms which limit extensions to 3 characters */
 /* #define THREE_LETTER_EXTENSIONS */
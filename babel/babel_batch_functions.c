@@ -0,0 +1,453 @@
+/* babel_batch_functions.c   babel's batch identification mode
+ *
+ * babel -batch <directory|listfile> [-j <threads>] [-tsv] [-md5]
+ *              [-cache <cachefile> [-verify]] [-ifiction]
+ *
+ * Identifies every story file in a directory tree (or named, one per line,
+ * in a list file), printing one record per file.  Each worker thread has
+ * its own babel context, and records are printed in input order whatever
+ * the number of threads, so the output of a run is reproducible.
+ *
+ * Records are JSON objects, one per line:
+ *  {"file":"...","format":"...","ifid":"...","authoritative":true,
+ *   "metadata":0,"cover":"png","cover_offset":1234}
+ * or, with -tsv, tab-separated fields in the same order, with "-" for
+ * missing values.  The cover offset is where the cover art begins in the
+ * file, so that it can be read from there without babel.
+ *
+ * With -ifiction, each JSON record also holds the story's iFiction (or
+ * null) as "ifiction".  -ifiction cannot be used with -tsv.
+ *
+ * With -md5, the files are not identified: each is hashed as it is read to
+ * give its MD5 IFID (as babel would generate for an unknown format), and
+ * the records hold just the file and IFID.
+ *
+ * With -cache, results are kept in the named cache file (see babel_cache.h),
+ * and files which have not changed since the last run are not read at all.
+ * The cache holds each story's iFiction too, so -ifiction is also answered
+ * from it.
+ * With -verify as well, files are only taken from the cache if their MD5
+ * hash is also unchanged.  The cache is not used with -md5.
+ *
+ * Threads are only used on platforms with POSIX threads; elsewhere (or if
+ * BABEL_NO_THREADS is defined), the files are processed one at a time.
+ */
+
+#include "babel.h"
+#include "babel_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_THREADS)
+#define BABEL_USE_THREADS
+#include <pthread.h>
+#endif
+
+void *my_malloc(int32, char *);
+
+#define BATCH_MAX_THREADS 64
+
+struct batch_record {
+ char *format;          /* NULL if unrecognized */
+ char ifid[TREATY_MINIMUM_EXTENT];
+ int32 auth;
+ int32 metadata;
+ int32 cover;
+ int32 cover_extent;
+ int32 cover_offset;    /* -1 if there is no cover art */
+ char *ifiction;        /* only fetched when caching or asked for */
+ char cached;
+ char done;
+};
+
+struct batch_job {
+ char **files;
+ int32 nfiles;
+ struct batch_record *records;
+ int32 next;            /* next file to be claimed by a worker */
+ int md5;               /* hash only */
+ int ifiction;          /* print the iFiction */
+ void *cache;
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_t lock;
+ pthread_cond_t ready;
+#endif
+};
+
+/* A growable list of file names */
+struct batch_list {
+ char **files;
+ int32 n, size;
+};
+
+static void batch_add(struct batch_list *l, char *name)
+{
+ if (l->n==l->size)
+ {
+  char **nf;
+  l->size=l->size ? l->size*2 : 256;
+  nf=(char **) my_malloc(l->size*sizeof(char *),"batch file list");
+  if (l->files) { memcpy(nf,l->files,l->n*sizeof(char *)); free(l->files); }
+  l->files=nf;
+ }
+ l->files[l->n]=(char *) my_malloc(strlen(name)+1,"batch file name");
+ strcpy(l->files[l->n++],name);
+}
+
+static int batch_compare(const void *a, const void *b)
+{
+ return strcmp(*(char **)a, *(char **)b);
+}
+
+/* Adds the files in dir and its subdirectories to l, in sorted order */
+static void batch_walk(struct batch_list *l, char *dir)
+{
+ DIR *d;
+ struct dirent *de;
+ struct stat st;
+ struct batch_list here;
+ int32 i;
+ char *path;
+
+ d=opendir(dir);
+ if (!d) return;
+ here.files=NULL;
+ here.n=here.size=0;
+ while((de=readdir(d))!=NULL)
+ {
+  if (de->d_name[0]=='.') continue;
+  path=(char *) my_malloc(strlen(dir)+strlen(de->d_name)+2,"batch path");
+  sprintf(path,"%s/%s",dir,de->d_name);
+  batch_add(&here,path);
+  free(path);
+ }
+ closedir(d);
+ if (here.n) qsort(here.files,here.n,sizeof(char *),batch_compare);
+ for(i=0;i<here.n;i++)
+ {
+  if (stat(here.files[i],&st)==0 && S_ISDIR(st.st_mode))
+   batch_walk(l,here.files[i]);
+  else if (stat(here.files[i],&st)==0 && S_ISREG(st.st_mode))
+   batch_add(l,here.files[i]);
+  free(here.files[i]);
+ }
+ if (here.files) free(here.files);
+}
+
+/* Reads file names, one per line, from a list file */
+static int batch_read_list(struct batch_list *l, char *name)
+{
+ FILE *f;
+ char buffer[4096];
+ f=fopen(name,"r");
+ if (!f) return 0;
+ while(fgets(buffer,sizeof(buffer),f))
+ {
+  int32 j=strlen(buffer);
+  while(j && (buffer[j-1]=='\n' || buffer[j-1]=='\r')) buffer[--j]=0;
+  if (j) batch_add(l,buffer);
+ }
+ fclose(f);
+ return 1;
+}
+
+static void batch_identify(char *file, struct batch_record *r, void *ctx, int ifiction)
+{
+ struct babel_image im;
+ char *b;
+ r->format=NULL;
+ r->ifid[0]=0;
+ r->auth=0;
+ r->metadata=0;
+ r->cover=0;
+ r->cover_extent=0;
+ r->cover_offset=-1;
+ r->ifiction=NULL;
+
+ b=babel_init_mapped_ctx(file,ctx);
+ if (b)
+ {
+  r->format=(char *) my_malloc(strlen(b)+1,"batch format name");
+  strcpy(r->format,b);
+  r->auth=babel_get_authoritative_ctx(ctx);
+  if (babel_treaty_ctx(GET_STORY_FILE_IFID_SEL,r->ifid,TREATY_MINIMUM_EXTENT,ctx)<=0)
+   r->ifid[0]=0;
+  r->metadata=babel_treaty_ctx(GET_STORY_FILE_METADATA_EXTENT_SEL,NULL,0,ctx);
+  if (r->metadata<0) r->metadata=0;
+  r->cover=babel_treaty_ctx(GET_STORY_FILE_COVER_FORMAT_SEL,NULL,0,ctx);
+  if (r->cover<0) r->cover=0;
+  if (r->cover)
+  {
+   r->cover_extent=babel_treaty_ctx(GET_STORY_FILE_COVER_EXTENT_SEL,NULL,0,ctx);
+   if (r->cover_extent<0) r->cover_extent=0;
+   if (babel_get_cover_ctx(&im,ctx)>0) r->cover_offset=im.offset;
+  }
+  if (ifiction && r->metadata)
+  {
+   r->ifiction=(char *) my_malloc(r->metadata+1,"batch metadata");
+   if (babel_treaty_ctx(GET_STORY_FILE_METADATA_SEL,r->ifiction,r->metadata,ctx)<=0)
+   {
+    free(r->ifiction);
+    r->ifiction=NULL;
+   }
+  }
+ }
+ else if (babel_get_length_ctx(ctx)>0) /* IFID is calculable for all files */
+ {
+  if (!babel_md5_ifid_ctx(r->ifid,TREATY_MINIMUM_EXTENT,ctx)) r->ifid[0]=0;
+ }
+ babel_release_ctx(ctx);
+}
+
+static char *batch_cover_name(int32 cover)
+{
+ if (cover==PNG_COVER_FORMAT) return "png";
+ if (cover==JPEG_COVER_FORMAT) return "jpeg";
+ return NULL;
+}
+
+static void json_string(char *s)
+{
+ if (!s || !*s) { printf("null"); return; }
+ putchar('"');
+ for(;*s;s++)
+  if (*s=='"' || *s=='\\') printf("\\%c",*s);
+  else if ((unsigned char) *s < 0x20) printf("\\u%04x",(unsigned char) *s);
+  else putchar(*s);
+ putchar('"');
+}
+
+static void batch_print(char *file, struct batch_record *r, int tsv, int md5, int ifiction)
+{
+ char *cover=batch_cover_name(r->cover);
+ if (md5)
+ {
+  if (tsv)
+   printf("%s\t%s\n", file, r->ifid[0] ? r->ifid : "-");
+  else
+  {
+   printf("{\"file\":");
+   json_string(file);
+   printf(",\"ifid\":");
+   json_string(r->ifid);
+   printf("}\n");
+  }
+  return;
+ }
+ if (tsv)
+ {
+  printf("%s\t%s\t%s\t%d\t%d\t%s\t", file,
+         r->format ? r->format : "-",
+         r->ifid[0] ? r->ifid : "-",
+         r->auth ? 1 : 0, r->metadata,
+         cover ? cover : "-");
+  if (r->cover_offset<0) printf("-\n");
+  else printf("%ld\n",(long) r->cover_offset);
+  return;
+ }
+ printf("{\"file\":");
+ json_string(file);
+ printf(",\"format\":");
+ json_string(r->format);
+ printf(",\"ifid\":");
+ json_string(r->ifid);
+ printf(",\"authoritative\":%s,\"metadata\":%d,\"cover\":",
+        r->auth ? "true" : "false", r->metadata);
+ json_string(cover);
+ printf(",\"cover_offset\":");
+ if (r->cover_offset<0) printf("null");
+ else printf("%ld",(long) r->cover_offset);
+ if (ifiction)
+ {
+  printf(",\"ifiction\":");
+  json_string(r->ifiction);
+ }
+ printf("}\n");
+}
+
+/* Fills a record from the cache, returning zero if the file is not cached
+   (or if its iFiction is wanted and not cached) */
+static int32 batch_lookup(char *file, struct batch_record *r, void *cache, int ifiction)
+{
+ struct babel_cache_record c;
+ if (!babel_cache_lookup(cache,file,&c)) return 0;
+ if (ifiction && c.metadata_extent && !c.ifiction) return 0;
+ r->format=NULL;
+ if (c.format)
+ {
+  r->format=(char *) my_malloc(strlen(c.format)+1,"batch format name");
+  strcpy(r->format,c.format);
+ }
+ r->ifid[0]=0;
+ if (c.ifid && strlen(c.ifid)<TREATY_MINIMUM_EXTENT) strcpy(r->ifid,c.ifid);
+ r->auth=c.authoritative;
+ r->metadata=c.metadata_extent;
+ r->cover=c.cover_format;
+ r->cover_extent=c.cover_extent;
+ r->cover_offset=c.cover_offset;
+ r->ifiction=NULL;
+ if (ifiction && c.ifiction)
+ {
+  r->ifiction=(char *) my_malloc(strlen(c.ifiction)+1,"batch metadata");
+  strcpy(r->ifiction,c.ifiction);
+ }
+ r->cached=1;
+ return 1;
+}
+
+static void batch_store(char *file, struct batch_record *r, void *cache)
+{
+ struct babel_cache_record c;
+ if (r->cached) return;
+ c.format=r->format;
+ c.ifid=r->ifid;
+ c.authoritative=r->auth;
+ c.metadata_extent=r->metadata;
+ c.cover_format=r->cover;
+ c.cover_extent=r->cover_extent;
+ c.cover_offset=r->cover_offset;
+ c.ifiction=r->ifiction;
+ babel_cache_store(cache,file,&c);
+}
+
+/* Records the result for one file and frees what it holds */
+static void batch_finish(char *file, struct batch_record *r, struct batch_job *job, int tsv)
+{
+ batch_print(file,r,tsv,job->md5,job->ifiction);
+ if (job->cache) batch_store(file,r,job->cache);
+ if (r->format) free(r->format);
+ if (r->ifiction) free(r->ifiction);
+}
+
+/* Claims the next file to identify, or returns -1 when there are none */
+static int32 batch_claim(struct batch_job *job)
+{
+ int32 i;
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_lock(&job->lock);
+#endif
+ i=job->next<job->nfiles ? job->next++ : -1;
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_unlock(&job->lock);
+#endif
+ return i;
+}
+
+static void *batch_worker(void *jp)
+{
+ struct batch_job *job=(struct batch_job *) jp;
+ void *ctx=get_babel_ctx();
+ int32 i;
+ while((i=batch_claim(job))>=0)
+ {
+  if (job->md5)
+  {
+   job->records[i].format=NULL;
+   if (!babel_md5_ifid_file(job->files[i],job->records[i].ifid,TREATY_MINIMUM_EXTENT))
+    job->records[i].ifid[0]=0;
+  }
+  else if (!job->cache || !batch_lookup(job->files[i],job->records+i,job->cache,job->ifiction))
+   batch_identify(job->files[i],job->records+i,ctx,job->cache || job->ifiction);
+#ifdef BABEL_USE_THREADS
+  pthread_mutex_lock(&job->lock);
+  job->records[i].done=1;
+  pthread_cond_broadcast(&job->ready);
+  pthread_mutex_unlock(&job->lock);
+#else
+  job->records[i].done=1;
+#endif
+ }
+ release_babel_ctx(ctx);
+ return NULL;
+}
+
+void babel_multi_batch(char **args, char *todir, int argc)
+{
+ struct batch_list l;
+ struct batch_job job;
+ struct stat st;
+ int32 i, threads=1;
+ int tsv=0, md5=0, verify=0, ifiction=0;
+ char *cachefile=NULL;
+#ifdef BABEL_USE_THREADS
+ pthread_t tid[BATCH_MAX_THREADS];
+ int32 started=0;
+#endif
+
+ for(i=1;i<argc;i++)
+  if (strcmp(args[i],"-tsv")==0) tsv=1;
+  else if (strcmp(args[i],"-md5")==0) md5=1;
+  else if (strcmp(args[i],"-verify")==0) verify=1;
+  else if (strcmp(args[i],"-ifiction")==0) ifiction=1;
+  else if (strcmp(args[i],"-j")==0 && i+1<argc) threads=atoi(args[++i]);
+  else if (strcmp(args[i],"-cache")==0 && i+1<argc) cachefile=args[++i];
+  else
+  {
+   fprintf(stderr,"Invalid usage\n");
+   return;
+  }
+ if (ifiction && tsv)
+ {
+  fprintf(stderr,"Invalid usage\n");
+  return;
+ }
+ if (threads<1) threads=1;
+ if (threads>BATCH_MAX_THREADS) threads=BATCH_MAX_THREADS;
+
+ l.files=NULL;
+ l.n=l.size=0;
+ if (stat(args[0],&st)==0 && S_ISDIR(st.st_mode))
+  batch_walk(&l,args[0]);
+ else if (!batch_read_list(&l,args[0]))
+ {
+  fprintf(stderr,"Error: Could not read %s\n",args[0]);
+  return;
+ }
+ if (!l.n) return;
+
+ job.files=l.files;
+ job.nfiles=l.n;
+ job.next=0;
+ job.md5=md5;
+ job.ifiction=ifiction;
+ job.cache=NULL;
+ if (cachefile && !md5)
+  job.cache=babel_cache_open(cachefile,verify ? BABEL_CACHE_VERIFY : 0);
+ job.records=(struct batch_record *) my_malloc(l.n*sizeof(struct batch_record),"batch records");
+
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_init(&job.lock,NULL);
+ pthread_cond_init(&job.ready,NULL);
+ if (threads>1)
+  for(started=0;started<threads;started++)
+   if (pthread_create(tid+started,NULL,batch_worker,&job)) break;
+ if (!started) batch_worker(&job);
+
+ /* Print the records in order as they become available */
+ for(i=0;i<l.n;i++)
+ {
+  pthread_mutex_lock(&job.lock);
+  while(!job.records[i].done) pthread_cond_wait(&job.ready,&job.lock);
+  pthread_mutex_unlock(&job.lock);
+  batch_finish(l.files[i],job.records+i,&job,tsv);
+  fflush(stdout);
+ }
+ while(started) pthread_join(tid[--started],NULL);
+ pthread_cond_destroy(&job.ready);
+ pthread_mutex_destroy(&job.lock);
+#else
+ batch_worker(&job);
+ for(i=0;i<l.n;i++)
+  batch_finish(l.files[i],job.records+i,&job,tsv);
+#endif
+
+ if (job.cache && !babel_cache_close(job.cache))
+  fprintf(stderr,"Warning: Could not write %s\n",cachefile);
+ for(i=0;i<l.n;i++) free(l.files[i]);
+ free(l.files);
+ free(job.records);
+}
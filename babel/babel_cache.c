@@ -0,0 +1,358 @@
+/* babel_cache.c   the babel result cache
+ *
+ * This file depends upon babel_cache.h, babel_handler.c, treaty.h and misc.c
+ *
+ * See babel_cache.h for usage.
+ *
+ * A cache file is a header of four words (magic, number of entries, heap
+ * extent and a reserved zero), the entries, sorted by key, and a heap of
+ * NUL-terminated strings to which the entries refer by offset.  Words are
+ * in native byte order; a cache from a machine of the other order fails the
+ * magic check and is simply rebuilt.  Lookups are a binary search in the
+ * mapped file, so opening a cache costs nothing however large it is.
+ */
+
+#include "babel_cache.h"
+#include "babel_handler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_CACHE)
+#define BABEL_USE_CACHE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void *my_malloc(int32, char *);
+
+#ifdef BABEL_USE_CACHE
+
+#define CACHE_MAGIC 0x42434332L /* "BCC2" */
+#define CACHE_HEADER 4
+#define CACHE_KEY 8             /* device, inode, size, mtime; two words each */
+#define CACHE_STRINGS 4
+
+/* Indices of the strings of an entry */
+#define CACHE_FORMAT 0
+#define CACHE_IFID 1
+#define CACHE_IFICTION 2
+#define CACHE_HASH 3
+
+struct cache_entry {
+ int32 key[CACHE_KEY];
+ int32 string[CACHE_STRINGS];   /* heap offsets, or -1 */
+ int32 authoritative;
+ int32 metadata_extent;
+ int32 cover_format;
+ int32 cover_extent;
+ int32 cover_offset;
+};
+
+/* An entry being written, whose strings may be in the old heap or new */
+struct cache_out {
+ struct cache_entry e;
+ char *string[CACHE_STRINGS];
+ int32 order;
+};
+
+struct babel_cache {
+ char *filename;
+ int32 flags;
+ void *map;
+ int32 map_extent;
+ struct cache_entry *entries;
+ int32 count;
+ char *heap;
+ int32 heap_extent;
+ struct cache_out *added;
+ int32 nadded, size;
+};
+
+#define CACHE_SPLIT(k,x) ((k)[0]=(int32)((x)>>16>>16), (k)[1]=(int32)(x))
+
+static int32 cache_key(char *filename, int32 *key)
+{
+ struct stat st;
+ if (stat(filename,&st) || !S_ISREG(st.st_mode)) return 0;
+ CACHE_SPLIT(key,st.st_dev);
+ CACHE_SPLIT(key+2,st.st_ino);
+ CACHE_SPLIT(key+4,st.st_size);
+ CACHE_SPLIT(key+6,st.st_mtime);
+ return 1;
+}
+
+/* Compares the first n words of two keys, as unsigned numbers */
+static int cache_compare_key(int32 *a, int32 *b, int32 n)
+{
+ int32 i;
+ for(i=0;i<n;i++)
+  if (a[i]!=b[i]) return (unsigned long) a[i] < (unsigned long) b[i] ? -1 : 1;
+ return 0;
+}
+
+static int cache_compare_out(const void *a, const void *b)
+{
+ struct cache_out *x=(struct cache_out *) a, *y=(struct cache_out *) b;
+ int r=cache_compare_key(x->e.key,y->e.key,CACHE_KEY);
+ if (r) return r;
+ return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static char *cache_string(struct babel_cache *c, int32 offset)
+{
+ if (offset<0 || offset>=c->heap_extent) return NULL;
+ return c->heap+offset;
+}
+
+/* Maps an existing cache file, leaving the cache empty if it is not valid */
+static void cache_map(struct babel_cache *c)
+{
+ int fd;
+ struct stat st;
+ int32 *h;
+ fd=open(c->filename,O_RDONLY);
+ if (fd<0) return;
+ if (fstat(fd,&st) || st.st_size<CACHE_HEADER*4 || st.st_size>0x7FFFFFF0L)
+ {
+  close(fd);
+  return;
+ }
+ c->map=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+ close(fd);
+ if (c->map==MAP_FAILED) { c->map=NULL; return; }
+ c->map_extent=st.st_size;
+ h=(int32 *) c->map;
+ if (h[0]!=CACHE_MAGIC || h[1]<0 || h[2]<0 ||
+     h[1]>(c->map_extent-CACHE_HEADER*4)/(int32) sizeof(struct cache_entry) ||
+     CACHE_HEADER*4+h[1]*(int32) sizeof(struct cache_entry)+h[2]!=c->map_extent)
+  return;
+ c->entries=(struct cache_entry *)(h+CACHE_HEADER);
+ c->heap=(char *)(c->entries+h[1]);
+ if (h[2] && c->heap[h[2]-1]) return;
+ c->count=h[1];
+ c->heap_extent=h[2];
+}
+
+void *babel_cache_open(char *filename, int32 flags)
+{
+ struct babel_cache *c;
+ c=(struct babel_cache *) my_malloc(sizeof(struct babel_cache),"babel cache");
+ c->filename=(char *) my_malloc(strlen(filename)+1,"babel cache name");
+ strcpy(c->filename,filename);
+ c->flags=flags;
+ cache_map(c);
+ return c;
+}
+
+int32 babel_cache_lookup(void *cp, char *filename, struct babel_cache_record *r)
+{
+ struct babel_cache *c=(struct babel_cache *) cp;
+ int32 key[CACHE_KEY];
+ int32 lo, hi, mid, cmp;
+ struct cache_entry *e;
+ char hash[TREATY_MINIMUM_EXTENT], *h;
+
+ if (!c || !c->count || !cache_key(filename,key)) return 0;
+ lo=0;
+ hi=c->count;
+ e=NULL;
+ while(lo<hi)
+ {
+  mid=lo+(hi-lo)/2;
+  cmp=cache_compare_key(key,c->entries[mid].key,CACHE_KEY);
+  if (cmp==0) { e=c->entries+mid; break; }
+  if (cmp<0) hi=mid;
+  else lo=mid+1;
+ }
+ if (!e) return 0;
+ if (c->flags & BABEL_CACHE_VERIFY)
+ {
+  h=cache_string(c,e->string[CACHE_HASH]);
+  if (!h || !babel_md5_ifid_file(filename,hash,TREATY_MINIMUM_EXTENT) ||
+      strcmp(h,hash))
+   return 0;
+ }
+ r->format=cache_string(c,e->string[CACHE_FORMAT]);
+ r->ifid=cache_string(c,e->string[CACHE_IFID]);
+ r->ifiction=cache_string(c,e->string[CACHE_IFICTION]);
+ r->authoritative=e->authoritative;
+ r->metadata_extent=e->metadata_extent;
+ r->cover_format=e->cover_format;
+ r->cover_extent=e->cover_extent;
+ r->cover_offset=e->cover_offset;
+ return 1;
+}
+
+static char *cache_copy(char *s)
+{
+ char *n;
+ if (!s) return NULL;
+ n=(char *) my_malloc(strlen(s)+1,"babel cache string");
+ strcpy(n,s);
+ return n;
+}
+
+int32 babel_cache_store(void *cp, char *filename, struct babel_cache_record *r)
+{
+ struct babel_cache *c=(struct babel_cache *) cp;
+ struct cache_out *o;
+ char hash[TREATY_MINIMUM_EXTENT];
+
+ if (!c) return 0;
+ if (c->nadded==c->size)
+ {
+  struct cache_out *n;
+  c->size=c->size ? c->size*2 : 64;
+  n=(struct cache_out *) my_malloc(c->size*sizeof(struct cache_out),"babel cache records");
+  if (c->added)
+  {
+   memcpy(n,c->added,c->nadded*sizeof(struct cache_out));
+   free(c->added);
+  }
+  c->added=n;
+ }
+ o=c->added+c->nadded;
+ if (!cache_key(filename,o->e.key)) return 0;
+ if (c->flags & BABEL_CACHE_VERIFY)
+ {
+  if (!babel_md5_ifid_file(filename,hash,TREATY_MINIMUM_EXTENT)) return 0;
+  o->string[CACHE_HASH]=cache_copy(hash);
+ }
+ else o->string[CACHE_HASH]=NULL;
+ o->string[CACHE_FORMAT]=cache_copy(r->format);
+ o->string[CACHE_IFID]=cache_copy(r->ifid);
+ o->string[CACHE_IFICTION]=cache_copy(r->ifiction);
+ o->e.authoritative=r->authoritative;
+ o->e.metadata_extent=r->metadata_extent;
+ o->e.cover_format=r->cover_format;
+ o->e.cover_extent=r->cover_extent;
+ o->e.cover_offset=r->cover_offset;
+ o->order=c->nadded++;
+ return 1;
+}
+
+/* Merges the old entries with the new, which replace any old entries for
+   the same file (device and inode), and writes the result to f */
+static int32 cache_write(struct babel_cache *c, FILE *f)
+{
+ struct cache_out *out, *o;
+ int32 i, j, k, n, cmp;
+ int32 h[CACHE_HEADER];
+ double heap;
+
+ out=(struct cache_out *) my_malloc((c->count+c->nadded)*sizeof(struct cache_out),"babel cache merge");
+ n=0;
+ for(i=0,j=0;i<c->count || j<c->nadded;)
+ {
+  if (j==c->nadded) cmp=-1;
+  else if (i==c->count) cmp=1;
+  else cmp=cache_compare_key(c->entries[i].key,c->added[j].e.key,4);
+  if (cmp<0)
+  {
+   o=out+n++;
+   o->e=c->entries[i++];
+   for(k=0;k<CACHE_STRINGS;k++) o->string[k]=cache_string(c,o->e.string[k]);
+  }
+  else
+  {
+   /* Skip the old entries for this file; keep only the latest new one */
+   while(i<c->count && cache_compare_key(c->entries[i].key,c->added[j].e.key,4)==0) i++;
+   while(j+1<c->nadded && cache_compare_key(c->added[j].e.key,c->added[j+1].e.key,CACHE_KEY)==0) j++;
+   out[n++]=c->added[j++];
+  }
+ }
+
+ heap=0;
+ for(i=0;i<n;i++)
+  for(k=0;k<CACHE_STRINGS;k++)
+   if (out[i].string[k])
+   {
+    out[i].e.string[k]=(int32) heap;
+    heap+=strlen(out[i].string[k])+1;
+   }
+   else out[i].e.string[k]=-1;
+ if (heap+CACHE_HEADER*4+n*(double) sizeof(struct cache_entry)>0x7FFFFFF0L)
+ {
+  free(out);
+  return 0;
+ }
+
+ h[0]=CACHE_MAGIC;
+ h[1]=n;
+ h[2]=(int32) heap;
+ h[3]=0;
+ fwrite(h,4,CACHE_HEADER,f);
+ for(i=0;i<n;i++) fwrite(&out[i].e,sizeof(struct cache_entry),1,f);
+ for(i=0;i<n;i++)
+  for(k=0;k<CACHE_STRINGS;k++)
+   if (out[i].string[k]) fwrite(out[i].string[k],1,strlen(out[i].string[k])+1,f);
+ free(out);
+ return !ferror(f);
+}
+
+int32 babel_cache_close(void *cp)
+{
+ struct babel_cache *c=(struct babel_cache *) cp;
+ FILE *f;
+ char *tmp;
+ int32 i, k, rv=1;
+
+ if (!c) return 0;
+ if (c->nadded)
+ {
+  qsort(c->added,c->nadded,sizeof(struct cache_out),cache_compare_out);
+  /* Write a new file and move it into place, so that readers only ever
+     see a complete cache */
+  tmp=(char *) my_malloc(strlen(c->filename)+32,"babel cache name");
+  sprintf(tmp,"%s.%ld.tmp",c->filename,(long) getpid());
+  f=fopen(tmp,"wb");
+  if (!f) rv=0;
+  else
+  {
+   rv=cache_write(c,f);
+   if (fclose(f)) rv=0;
+   if (!rv || rename(tmp,c->filename))
+   {
+    remove(tmp);
+    rv=0;
+   }
+  }
+  free(tmp);
+  for(i=0;i<c->nadded;i++)
+   for(k=0;k<CACHE_STRINGS;k++)
+    if (c->added[i].string[k]) free(c->added[i].string[k]);
+  free(c->added);
+ }
+ if (c->map) munmap(c->map,c->map_extent);
+ free(c->filename);
+ free(c);
+ return rv;
+}
+
+#else
+
+void *babel_cache_open(char *filename, int32 flags)
+{
+ return NULL;
+}
+
+int32 babel_cache_lookup(void *cache, char *filename, struct babel_cache_record *r)
+{
+ return 0;
+}
+
+int32 babel_cache_store(void *cache, char *filename, struct babel_cache_record *r)
+{
+ return 0;
+}
+
+int32 babel_cache_close(void *cache)
+{
+ return 0;
+}
+
+#endif
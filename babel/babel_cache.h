@@ -0,0 +1,56 @@
+/* babel_cache.h  declarations for the babel result cache
+ *
+ * This file depends upon treaty.h
+ *
+ * The babel cache remembers what babel found out about story files, so
+ * that unchanged files need not be identified again.  Files are known by
+ * their identity on disk (device, inode, size and modification time) and,
+ * if BABEL_CACHE_VERIFY is given, also by their MD5 hash.
+ *
+ * The cache is a single file, which is mapped into memory read-only when
+ * the cache is opened.  New results are kept in memory and written out
+ * when the cache is closed, to a new file which then replaces the old one.
+ * Readers therefore never see a partly written cache, and any number of
+ * processes may read it at once (if two write at once, the last to finish
+ * wins).
+ *
+ * babel_cache_lookup only reads the mapped file, and so may be called from
+ * any number of threads; babel_cache_store and babel_cache_close must be
+ * called from one thread at a time.
+ *
+ * On platforms without mmap and stat (or if BABEL_NO_CACHE is defined),
+ * babel_cache_open returns NULL and nothing is cached.
+ */
+
+#ifndef BABEL_CACHE_H
+#define BABEL_CACHE_H
+
+#include "treaty.h"
+
+/* Flags for babel_cache_open */
+#define BABEL_CACHE_VERIFY 1    /* also check files' MD5 hashes */
+
+struct babel_cache_record {
+ char *format;          /* format name, or NULL if not known */
+ char *ifid;
+ int32 authoritative;
+ int32 metadata_extent;
+ int32 cover_format;
+ int32 cover_extent;
+ int32 cover_offset;    /* where the cover art is in the file, or -1 */
+ char *ifiction;        /* the story's iFiction, or NULL */
+};
+
+void *babel_cache_open(char *filename, int32 flags);
+ /* Open (or create) a cache.  Returns NULL on failure */
+int32 babel_cache_lookup(void *cache, char *filename, struct babel_cache_record *);
+ /* Find the record for a file, returning zero if it is not cached or has
+    changed.  The strings in the record remain valid until the cache is
+    closed */
+int32 babel_cache_store(void *cache, char *filename, struct babel_cache_record *);
+ /* Record what is known about a file.  The record is copied */
+int32 babel_cache_close(void *cache);
+ /* Write out any new records and close the cache.  Returns zero if the
+    cache could not be written */
+
+#endif
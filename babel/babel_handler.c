@@ -10,7 +10,8 @@
  * 543 Howard Street, 5th Floor,
  * San Francisco, California, 94105, USA.
  *
- * This file depends upon register.c, misc.c, babel.h, and treaty.h
+ * This file depends upon register.c (or another provider of the functions
+ * of babel_registry.h), misc.c, babel.h, and treaty.h
  * and L. Peter Deutsch's md5.c
  * usage:
  *  char *babel_init(char *filename)
@@ -20,7 +21,8 @@
  *      babel_init returned a nonzero value.
  *      The returned string will be the name of a babel format, possibly
  *      prefixed by "blorbed " to indicate that babel will process this file
- *      as a blorb.
+ *      as a blorb.  The string belongs to babel, and remains valid until
+ *      babel_release is called.
  * int32 babel_treaty(int32 selector, void *output, void *output_extent)
  *      Dispatches the call to the treaty handler for the currently loaded
  *      file.
@@ -33,11 +35,41 @@
  *      You should do this even if babel_init returned NULL.
  *      After this is called, do not call babel_treaty until after
  *      another successful call to babel_init.
+ * char *babel_init_raw(void *sf, int32 extent)
+ *      As babel_init, but for a story already in memory, which is copied.
+ * char *babel_init_raw_owned(void *sf, int32 extent)
+ *      As babel_init_raw, but babel takes over the buffer (which must have
+ *      come from malloc, such as one from babel_read_stream) instead of
+ *      copying it, and frees it in babel_release.  The caller must not
+ *      free it, even if babel_init_raw_owned returns NULL.
+ * void *babel_read_stream(FILE *f, int32 *extent)
+ *      Reads the rest of a stream (such as stdin) into a buffer from malloc,
+ *      setting *extent to its length.  The buffer is followed by a zero
+ *      byte, not counted in *extent, so that text may be used as a string.
+ *      Returns NULL if the stream could not be read.  Does not use the
+ *      babel context.
+ * char *babel_init_mapped(char *filename)
+ *      As babel_init, but maps the file into memory read-only instead of
+ *      reading it into an allocated buffer.  Blorbed stories are then used
+ *      in place within the mapping rather than copied out.  On platforms
+ *      without mmap (or if the mapping fails) this behaves as babel_init.
+ *      babel_release unmaps the file.
  * char *babel_get_format()
  *      Returns the same value as the last call to babel_init (ie, the format name)
  * int32 babel_md5_ifid(char *buffer, int extent);
  *      Generates an MD5 IFID from the loaded story.  Returns zero if something
  *      went seriously wrong.
+ * int32 babel_md5_ifid_file(char *filename, char *buffer, int extent);
+ * int32 babel_md5_ifid_stream(FILE *f, char *buffer, int extent);
+ *      Generate the same IFID as babel_md5_ifid, reading the story from a
+ *      file a block at a time rather than loading it.  These do not use
+ *      the babel context, and may be called from any thread.
+ * int32 babel_get_cover(struct babel_image *image)
+ *      Finds the cover art of the loaded story without copying it out, and
+ *      describes it in *image (see babel_image.h), whose offset is from the
+ *      start of babel_get_file().  Returns the format of the image, or
+ *      zero if there is none or it is not stored whole in the loaded file;
+ *      GET_STORY_FILE_COVER_SEL may still be able to copy it out.
  *
  * If you wish to use babel in multiple threads, you must use the contextualized
  * versions of the above functions.
@@ -45,16 +77,36 @@
  * "babel_treaty_ctx") which takes one additional argument.  This argument is
  * the babel context. A new context is returned by void *ctx=get_babel_ctx(),
  * and should be released when finished by calling release_babel_ctx(ctx);
+ *
+ * A context holds on to the module registry from babel_init to
+ * babel_release, so the modules it uses stay loaded even if the registry
+ * changes in the meantime (see babel_registry.h).
+ *
+ * Every call made to a module goes through call_module, so that the calls
+ * can be profiled when babel_profile_enable has been called (see
+ * babel_profile.h).
  */
 
                       
 #include "treaty.h"
+#include "babel_registry.h"
+#include "babel_profile.h"
+#include "babel_image.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
 #include "md5.h"
 
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_MMAP)
+#define BABEL_USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 void *my_malloc(int, char *);
 
 struct babel_handler
@@ -68,41 +120,194 @@ struct babel_handler
  char blorb_mode;
  char *format_name;
  char auth;
+ char mapped;                   /* story_file is a read-only file mapping */
+ char blorb_view;               /* story_file_blorbed points into story_file */
+ void *container_index;         /* the container's index of story_file */
+ void *story_index;             /* the story module's index of its story */
+ char story_indexed;            /* story_index has been asked for */
+ void *registry;                /* the registry the modules came from */
+ TREATY *treaties;
+ TREATY *containers;
+ unsigned long *handler_calls;  /* call counters of the modules */
+ unsigned long *backup_calls;
 };
 
 static struct babel_handler default_ctx;
 
-extern TREATY treaty_registry[];
-extern TREATY container_registry[];
+/* Magic signatures, used to go straight to the likely module for a story
+   file before falling back on asking every module in turn (some of
+   whose claims scan the whole file).  An entry with no magic string
+   matches if the byte at offset lies between low and high.  A signature
+   is only a hint: the module must still claim the file as its own.
+
+   A signature settles the format unless one of its rivals, the modules
+   earlier in the registry whose claims only look at a header which a
+   file with this signature could also pass, claims the file first (as
+   it would when every module is asked in turn).  The heuristic claims,
+   such as level9's scan of the whole file, are never rivals.
+*/
+struct babel_signature {
+ char *format;
+ int32 offset;
+ int32 length;
+ char *magic;
+ char *rivals;                  /* space-separated formats, or NULL */
+ unsigned char low, high;
+};
+
+static struct babel_signature signatures[] = {
+ { "blorb", 0, 4, "FORM" },
+ { "glulx", 0, 4, "Glul" },
+ { "tads2", 0, 12, "TADS2 bin\012\015\032" },
+ { "tads3", 0, 11, "T3-image\015\012\032" },
+ { "magscrolls", 0, 4, "MaSc", "hugo alan" },
+ { "agt", 0, 4, "\x58\xC7\xC1\x51", "hugo alan" },
+ { "alan", 0, 4, "ALAN", "hugo" },
+ { "adrift", 0, 7, "\x3C\x42\x3F\xC9\x6A\x87\xC2", "alan" },   /* "Version", obfuscated */
+ { "advsys", 2, 6, "\xA0\x9D\x8B\x8E\x88\x8E", "zcode alan" }, /* "ADVSYS", obfuscated */
+ { "zcode", 0, 0, NULL, NULL, 1, 8 },                    /* Z-machine version */
+ { NULL }
+};
+
+/* Tells whether format is one of the space-separated formats in list */
+static int babel_listed(char *list, char *format)
+{
+ int l=strlen(format);
+ while(list && *list)
+ {
+  if (strncmp(list,format,l)==0 && (list[l]==' ' || !list[l])) return 1;
+  list=strchr(list,' ');
+  if (list) list++;
+ }
+ return 0;
+}
+
+
+/* Calls a module, through the profiler if it is on */
+static int32 call_module(TREATY t, int32 sel, void *story_file, int32 extent, void *output, int32 output_extent)
+{
+ if (babel_profiling)
+  return babel_profile_call(t,sel,story_file,extent,output,output_extent);
+ return t(sel,story_file,extent,output,output_extent);
+}
+
+/* Returns the index of the module in registry whose signature matches
+   story_file and which claims it, or -1.  As when every module is asked
+   in turn, a rival earlier in the registry which also claims the file
+   takes precedence */
+static int babel_sniff(TREATY *registry, void *story_file, int32 extent)
+{
+ struct babel_signature *s;
+ unsigned char *sf=(unsigned char *) story_file;
+ char buffer[TREATY_MINIMUM_EXTENT];
+ int i, j;
 
+ for(s=signatures;s->format;s++)
+ {
+  if (s->magic ? (s->offset+s->length>extent || memcmp(sf+s->offset,s->magic,s->length))
+               : (s->offset>=extent || sf[s->offset]<s->low || sf[s->offset]>s->high))
+   continue;
+  for(i=0;registry[i];i++)
+   if (call_module(registry[i],GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0 &&
+       strcmp(buffer,s->format)==0)
+   {
+    if (call_module(registry[i],CLAIM_STORY_FILE_SEL,story_file,extent,NULL,0)!=VALID_STORY_FILE_RV)
+     break;
+    for(j=0;j<i && s->rivals;j++)
+     if (call_module(registry[j],GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0 &&
+         babel_listed(s->rivals,buffer) &&
+         call_module(registry[j],CLAIM_STORY_FILE_SEL,story_file,extent,NULL,0)==VALID_STORY_FILE_RV)
+      return j;
+    return i;
+   }
+ }
+ return -1;
+}
+
+/* Passes a selector to the container, using its index if it has one */
+static int32 container_treaty(struct babel_handler *bh, int32 sel, void *output, int32 output_extent)
+{
+ struct treaty_indexed_query q;
+ int32 rv;
+ if (bh->container_index)
+ {
+  q.selector=sel;
+  q.index=bh->container_index;
+  q.output=output;
+  q.output_extent=output_extent;
+  rv=call_module(bh->treaty_handler,CONTAINER_INDEXED_QUERY_SEL,bh->story_file,bh->story_file_extent,&q,sizeof(q));
+  if (rv!=UNAVAILABLE_RV && rv!=INVALID_USAGE_RV) return rv;
+ }
+ return call_module(bh->treaty_handler,sel,bh->story_file,bh->story_file_extent,output,output_extent);
+}
+
+/* Passes a selector to a story module, using its index if it has one.
+   The index is only asked for when the first selector about the story
+   arrives, so that a context which is only asked the format of its story
+   does not pay for it */
+static int32 story_treaty(struct babel_handler *bh, TREATY t, int32 sel, void *story_file, int32 extent, void *output, int32 output_extent)
+{
+ struct treaty_indexed_query q;
+ int32 rv;
+ if (!(sel & TREATY_SELECTOR_INPUT))
+  return call_module(t,sel,story_file,extent,output,output_extent);
+ if (!bh->story_indexed)
+ {
+  bh->story_indexed=1;
+  if (call_module(t,STORY_GET_INDEX_SEL,story_file,extent,&bh->story_index,sizeof(void *))<=0)
+   bh->story_index=NULL;
+ }
+ if (bh->story_index)
+ {
+  q.selector=sel;
+  q.index=bh->story_index;
+  q.output=output;
+  q.output_extent=output_extent;
+  rv=call_module(t,STORY_INDEXED_QUERY_SEL,story_file,extent,&q,sizeof(q));
+  if (rv!=UNAVAILABLE_RV && rv!=INVALID_USAGE_RV) return rv;
+ }
+ return call_module(t,sel,story_file,extent,output,output_extent);
+}
+
+/* Identifies the story in bh, and records its format name in
+   bh->format_name, which is also returned.  Everything is kept in the
+   context (or on the stack) so that contexts may be used concurrently */
 static char *deeper_babel_init(char *story_name, void *bhp)
 {
  struct babel_handler *bh=(struct babel_handler *) bhp;
  int i;
  char *ext;
 
- static char buffer[TREATY_MINIMUM_EXTENT];
+ char buffer[TREATY_MINIMUM_EXTENT];
+ char extbuf[TREATY_MINIMUM_EXTENT];
  int best_candidate;
  char buffert[TREATY_MINIMUM_EXTENT];
+ TREATY *treaty_registry, *container_registry;
 
- if (story_name)
+ bh->registry=babel_registry_acquire(&bh->treaties,&bh->containers);
+ treaty_registry=bh->treaties;
+ container_registry=bh->containers;
+ ext=NULL;
+ if (story_name && (ext=strrchr(story_name,'.'))!=NULL)
   {
-   ext=strrchr(story_name,'.');
-   if (ext) for(i=0;ext[i];i++) ext[i]=tolower(ext[i]);
+   for(i=0;ext[i] && i<TREATY_MINIMUM_EXTENT-1;i++) extbuf[i]=tolower(ext[i]);
+   extbuf[i]=0;
+   ext=extbuf;
   }
- else ext=NULL;
  best_candidate=-1;
  if (ext) /* pass 1: try best candidates */
   for(i=0;container_registry[i];i++)
-   if (container_registry[i](GET_FILE_EXTENSIONS_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT) >=0 &&
+   if (call_module(container_registry[i],GET_FILE_EXTENSIONS_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT) >=0 &&
        strstr(buffer,ext) &&
-       container_registry[i](CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0)>=NO_REPLY_RV)
+       call_module(container_registry[i],CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0)>=NO_REPLY_RV)
     break;
-  if (!ext || !container_registry[i]) /* pass 2: try all candidates */
+  if (!ext || !container_registry[i])
   {
-  
+  /* pass 2: try the module whose signature matches */
+  i=babel_sniff(container_registry,bh->story_file,bh->story_file_extent);
+  if (i<0) /* pass 3: try all candidates */
   for(i=0;container_registry[i];i++)
-   {int l=container_registry[i](CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0);
+   {int l=call_module(container_registry[i],CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0);
     
     if (l==VALID_STORY_FILE_RV)
     break;
@@ -113,29 +318,57 @@ static char *deeper_babel_init(char *story_name, void *bhp)
  if (container_registry[i])
  {
    char buffer2[TREATY_MINIMUM_EXTENT];
-   
+   int32 offset;
+
    bh->treaty_handler=container_registry[i];
-   container_registry[i](GET_FORMAT_NAME_SEL,NULL,0,buffert,TREATY_MINIMUM_EXTENT);
+   bh->handler_calls=babel_registry_counter(bh->registry,bh->treaty_handler);
+   call_module(container_registry[i],GET_FORMAT_NAME_SEL,NULL,0,buffert,TREATY_MINIMUM_EXTENT);
    bh->blorb_mode=1;
 
-   bh->story_file_blorbed_extent=container_registry[i](CONTAINER_GET_STORY_EXTENT_SEL,bh->story_file,bh->story_file_extent,NULL,0);
-   if (bh->story_file_blorbed_extent>0) bh->story_file_blorbed=my_malloc(bh->story_file_blorbed_extent, "contained story file");
+   /* Have the container index itself once, if it can, so that later
+      queries need not search it again */
+   offset=call_module(container_registry[i],CONTAINER_GET_INDEX_EXTENT_SEL,bh->story_file,bh->story_file_extent,NULL,0);
+   if (offset>0)
+   {
+    bh->container_index=my_malloc(offset,"container index");
+    if (call_module(container_registry[i],CONTAINER_GET_INDEX_SEL,bh->story_file,bh->story_file_extent,bh->container_index,offset)<=0)
+    {
+     free(bh->container_index);
+     bh->container_index=NULL;
+    }
+   }
+
+   bh->story_file_blorbed_extent=container_treaty(bh,CONTAINER_GET_STORY_EXTENT_SEL,NULL,0);
    if (bh->story_file_blorbed_extent<=0 ||
-       container_registry[i](CONTAINER_GET_STORY_FORMAT_SEL,bh->story_file,bh->story_file_extent,buffer2,TREATY_MINIMUM_EXTENT)<0 ||
-       container_registry[i](CONTAINER_GET_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,bh->story_file_blorbed,bh->story_file_blorbed_extent)<=0
-      )
+       container_treaty(bh,CONTAINER_GET_STORY_FORMAT_SEL,buffer2,TREATY_MINIMUM_EXTENT)<0)
     return NULL;
+   /* Use the contained story in place if the container can tell us where
+      it is; otherwise, fall back on copying it out */
+   offset=container_treaty(bh,CONTAINER_GET_STORY_OFFSET_SEL,NULL,0);
+   if (offset>0 && offset <= bh->story_file_extent-bh->story_file_blorbed_extent)
+   {
+    bh->story_file_blorbed=(char *)bh->story_file+offset;
+    bh->blorb_view=1;
+   }
+   else
+   {
+    bh->story_file_blorbed=my_malloc(bh->story_file_blorbed_extent, "contained story file");
+    if (container_treaty(bh,CONTAINER_GET_STORY_FILE_SEL,bh->story_file_blorbed,bh->story_file_blorbed_extent)<=0)
+     return NULL;
+   }
  
    for(i=0;treaty_registry[i];i++)
-    if (treaty_registry[i](GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0 &&
+    if (call_module(treaty_registry[i],GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0 &&
         strcmp(buffer,buffer2)==0 &&
-        treaty_registry[i](CLAIM_STORY_FILE_SEL,bh->story_file_blorbed,bh->story_file_blorbed_extent,NULL,0)>=NO_REPLY_RV)
+        call_module(treaty_registry[i],CLAIM_STORY_FILE_SEL,bh->story_file_blorbed,bh->story_file_blorbed_extent,NULL,0)>=NO_REPLY_RV)
      break;
   if (!treaty_registry[i])
    return NULL;
   bh->treaty_backup=treaty_registry[i];
-  sprintf(buffer,"%sed %s",buffert,buffer2);
-  return buffer;
+  bh->backup_calls=babel_registry_counter(bh->registry,bh->treaty_backup);
+  bh->format_name=my_malloc(strlen(buffert)+strlen(buffer2)+4,"format name");
+  sprintf(bh->format_name,"%sed %s",buffert,buffer2);
+  return bh->format_name;
   }
 
  bh->blorb_mode=0;
@@ -143,16 +376,18 @@ static char *deeper_babel_init(char *story_name, void *bhp)
 
  if (ext) /* pass 1: try best candidates */
   for(i=0;treaty_registry[i];i++)
-   if (treaty_registry[i](GET_FILE_EXTENSIONS_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT) >=0 &&
+   if (call_module(treaty_registry[i],GET_FILE_EXTENSIONS_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT) >=0 &&
        strstr(buffer,ext) && 
-       treaty_registry[i](CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0)>=NO_REPLY_RV)
+       call_module(treaty_registry[i],CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0)>=NO_REPLY_RV)
     break;
-  if (!ext || !treaty_registry[i]) /* pass 2: try all candidates */
+  if (!ext || !treaty_registry[i])
   {
-  
+  /* pass 2: try the module whose signature matches */
+  i=babel_sniff(treaty_registry,bh->story_file,bh->story_file_extent);
+  if (i<0) /* pass 3: try all candidates */
   for(i=0;treaty_registry[i];i++)
    {int l;
-   l=treaty_registry[i](CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0);
+   l=call_module(treaty_registry[i],CLAIM_STORY_FILE_SEL,bh->story_file,bh->story_file_extent,NULL,0);
 
     if (l==VALID_STORY_FILE_RV)
     break;
@@ -160,22 +395,20 @@ static char *deeper_babel_init(char *story_name, void *bhp)
     }
   }
   if (!treaty_registry[i])
-   if (best_candidate>0) { i=best_candidate; bh->auth=0; }
+   if (best_candidate>=0) { i=best_candidate; bh->auth=0; }
    else return NULL;
   bh->treaty_handler=treaty_registry[i];
+  bh->handler_calls=babel_registry_counter(bh->registry,bh->treaty_handler);
 
-  if (bh->treaty_handler(GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0)
-  return buffer;
+  if (call_module(bh->treaty_handler,GET_FORMAT_NAME_SEL,NULL,0,buffer,TREATY_MINIMUM_EXTENT)>=0)
+  return bh->format_name=strdup(buffer);
   return NULL;
 
 
 }
 
-static char *deep_babel_init(char *story_name, void *bhp)
+static void clear_babel_ctx(struct babel_handler *bh)
 {
- struct babel_handler *bh=(struct babel_handler *) bhp;
- FILE *file;
-
  bh->treaty_handler=NULL;
  bh->treaty_backup=NULL;
  bh->story_file=NULL;
@@ -183,6 +416,24 @@ static char *deep_babel_init(char *story_name, void *bhp)
  bh->story_file_blorbed=NULL;
  bh->story_file_blorbed_extent=0;
  bh->format_name=NULL;
+ bh->mapped=0;
+ bh->blorb_view=0;
+ bh->container_index=NULL;
+ bh->story_index=NULL;
+ bh->story_indexed=0;
+ bh->registry=NULL;
+ bh->treaties=NULL;
+ bh->containers=NULL;
+ bh->handler_calls=NULL;
+ bh->backup_calls=NULL;
+}
+
+static char *deep_babel_init(char *story_name, void *bhp)
+{
+ struct babel_handler *bh=(struct babel_handler *) bhp;
+ FILE *file;
+
+ clear_babel_ctx(bh);
  file=fopen(story_name, "rb");
  if (!file) return NULL;
  fseek(file,0,SEEK_END);
@@ -198,70 +449,156 @@ static char *deep_babel_init(char *story_name, void *bhp)
 
 char *babel_init_ctx(char *sf, void *bhp)
 {
- struct babel_handler *bh=(struct babel_handler *) bhp;
- char *b;
- b=deep_babel_init(sf,bh);
- if (b) bh->format_name=strdup(b);
- return b;
+ return deep_babel_init(sf,bhp);
 }
 char *babel_init(char *sf)
 {
   return babel_init_ctx(sf, &default_ctx);
 }
 
-char *babel_init_raw_ctx(void *sf, int32 extent, void *bhp)
+char *babel_init_mapped_ctx(char *sf, void *bhp)
 {
+#ifdef BABEL_USE_MMAP
  struct babel_handler *bh=(struct babel_handler *) bhp;
- char *b;
- bh->treaty_handler=NULL;
- bh->treaty_backup=NULL;
- bh->story_file=NULL;
- bh->story_file_extent=0;
- bh->story_file_blorbed=NULL;
- bh->story_file_blorbed_extent=0;
- bh->format_name=NULL;
+ struct stat st;
+ void *map;
+ int fd;
+
+ fd=open(sf, O_RDONLY);
+ if (fd<0) { clear_babel_ctx(bh); return NULL; }
+ /* Empty and oversized files are left to the ordinary loader */
+ if (fstat(fd,&st) || st.st_size<=0 || st.st_size>0x7FFFFFFFL)
+ {
+  close(fd);
+  return babel_init_ctx(sf, bhp);
+ }
+ map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+ close(fd);
+ if (map==MAP_FAILED) return babel_init_ctx(sf, bhp);
+
+ clear_babel_ctx(bh);
+ bh->story_file=map;
+ bh->story_file_extent=st.st_size;
+ bh->mapped=1;
+ bh->auth=1;
+ return deeper_babel_init(sf, bhp);
+#else
+ return babel_init_ctx(sf, bhp);
+#endif
+}
+char *babel_init_mapped(char *sf)
+{
+  return babel_init_mapped_ctx(sf, &default_ctx);
+}
+
+char *babel_init_raw_owned_ctx(void *sf, int32 extent, void *bhp)
+{
+ struct babel_handler *bh=(struct babel_handler *) bhp;
+ clear_babel_ctx(bh);
  bh->story_file_extent=extent;
  bh->auth=1; 
- bh->story_file=my_malloc(bh->story_file_extent,"story file storage");
- memcpy(bh->story_file,sf,extent);
+ bh->story_file=sf;
 
- b=deeper_babel_init(NULL, bhp);
- if (b) bh->format_name=strdup(b);
- return b;
+ return deeper_babel_init(NULL, bhp);
+}
+char *babel_init_raw_owned(void *sf, int32 extent)
+{
+  return babel_init_raw_owned_ctx(sf, extent, &default_ctx);
+}
+
+char *babel_init_raw_ctx(void *sf, int32 extent, void *bhp)
+{
+ void *b=my_malloc(extent,"story file storage");
+ memcpy(b,sf,extent);
+ return babel_init_raw_owned_ctx(b, extent, bhp);
 }
 char *babel_init_raw(void *sf, int32 extent)
 {
   return babel_init_raw_ctx(sf, extent, &default_ctx);
 }
 
+/* Size of the first buffer babel_read_stream reads into.  The stream is
+   read straight into the buffer, which is doubled whenever it fills, so a
+   stream of any size is read in time proportional to its length */
+#define BABEL_STREAM_BUFFER 0x10000
+
+void *babel_read_stream(FILE *f, int32 *extent)
+{
+ char *b=NULL, *t;
+ int32 l=0, size=0;
+ size_t ii;
+ *extent=0;
+ if (!f) return NULL;
+ while(1)
+ {
+  if (l==size)
+  {
+   if (size==0x7FFFFFFEL) { free(b); return NULL; }
+   size=!size ? BABEL_STREAM_BUFFER :
+        size<0x3FFFFFFFL ? size*2 : 0x7FFFFFFEL;
+   t=(char *) realloc(b,size+1);
+   if (!t) { free(b); return NULL; }
+   b=t;
+  }
+  ii=fread(b+l,1,size-l,f);
+  if (!ii) break;
+  l+=ii;
+ }
+ if (ferror(f)) { free(b); return NULL; }
+ b[l]=0;
+ *extent=l;
+ return b;
+}
+
 void babel_release_ctx(void *bhp)
 {
  struct babel_handler *bh=(struct babel_handler *) bhp;
+ if (bh->story_file_blorbed && !bh->blorb_view) free(bh->story_file_blorbed);
+ bh->story_file_blorbed=NULL;
+ bh->blorb_view=0;
+#ifdef BABEL_USE_MMAP
+ if (bh->story_file && bh->mapped) munmap(bh->story_file, bh->story_file_extent);
+ else
+#endif
  if (bh->story_file) free(bh->story_file);
  bh->story_file=NULL;
- if (bh->story_file_blorbed) free(bh->story_file_blorbed);
- bh->story_file_blorbed=NULL;
+ bh->mapped=0;
+ if (bh->container_index) free(bh->container_index);
+ bh->container_index=NULL;
+ if (bh->story_index) free(bh->story_index);
+ bh->story_index=NULL;
+ bh->story_indexed=0;
  if (bh->format_name) free(bh->format_name);
  bh->format_name=NULL;
+ if (bh->registry) babel_registry_release(bh->registry);
+ bh->registry=NULL;
+ bh->treaty_handler=NULL;
+ bh->treaty_backup=NULL;
+ bh->handler_calls=NULL;
+ bh->backup_calls=NULL;
 }
 void babel_release()
 {
  babel_release_ctx(&default_ctx);
 }
+static void babel_md5_finish(md5_state_t *md5, char *buffer)
+{
+ int i;
+ unsigned char ob[16];
+ md5_finish(md5,ob);
+ for(i=0;i<16;i++)
+  sprintf(buffer+(2*i),"%02X",ob[i]);
+ buffer[32]=0;
+}
 int32 babel_md5_ifid_ctx(char *buffer, int32 extent, void *bhp)
 {
  struct babel_handler *bh=(struct babel_handler *) bhp;
  md5_state_t md5;
- int i;
- unsigned char ob[16];
  if (extent <33 || bh->story_file==NULL)
   return 0;
  md5_init(&md5);
  md5_append(&md5,bh->story_file,bh->story_file_extent);
- md5_finish(&md5,ob);
- for(i=0;i<16;i++)
-  sprintf(buffer+(2*i),"%02X",ob[i]);
- buffer[32]=0;
+ babel_md5_finish(&md5,buffer);
  return 1;
 
 }
@@ -271,17 +608,58 @@ int32 babel_md5_ifid(char *buffer, int32 extent)
                 &default_ctx);
 }
 
+/* Size of the reads made when hashing a file.  This is a multiple of
+   the MD5 block size, so that md5_append hashes the buffer in place */
+#define BABEL_MD5_BUFFER 0x100000
+
+int32 babel_md5_ifid_stream(FILE *f, char *buffer, int32 extent)
+{
+ md5_state_t md5;
+ char *b;
+ size_t l;
+ if (extent <33 || !f)
+  return 0;
+ b=(char *) my_malloc(BABEL_MD5_BUFFER,"MD5 buffer");
+ md5_init(&md5);
+ while((l=fread(b,1,BABEL_MD5_BUFFER,f))>0)
+  md5_append(&md5,(md5_byte_t *) b,l);
+ free(b);
+ if (ferror(f)) return 0;
+ babel_md5_finish(&md5,buffer);
+ return 1;
+}
+int32 babel_md5_ifid_file(char *filename, char *buffer, int32 extent)
+{
+ FILE *f;
+ int32 rv;
+ f=fopen(filename,"rb");
+ if (!f) return 0;
+ rv=babel_md5_ifid_stream(f,buffer,extent);
+ fclose(f);
+ return rv;
+}
+
 int32 babel_treaty_ctx(int32 sel, void *output, int32 output_extent,void *bhp)
 {
  int32 rv;
  struct babel_handler *bh=(struct babel_handler *) bhp;
  if (!(sel & TREATY_SELECTOR_INPUT) && bh->blorb_mode)
-  rv=bh->treaty_backup(sel,bh->story_file_blorbed,bh->story_file_blorbed_extent,output, output_extent);
+ {
+  BABEL_REGISTRY_COUNT(bh->backup_calls);
+  rv=call_module(bh->treaty_backup,sel,bh->story_file_blorbed,bh->story_file_blorbed_extent,output, output_extent);
+ }
  else
  {
-  rv=bh->treaty_handler(sel,bh->story_file,bh->story_file_extent,output,output_extent);
+  BABEL_REGISTRY_COUNT(bh->handler_calls);
+  if (bh->blorb_mode)
+   rv=container_treaty(bh,sel,output,output_extent);
+  else
+   rv=story_treaty(bh,bh->treaty_handler,sel,bh->story_file,bh->story_file_extent,output,output_extent);
   if ((!rv|| rv==UNAVAILABLE_RV) && bh->blorb_mode)
-   rv=bh->treaty_backup(sel,bh->story_file_blorbed,bh->story_file_blorbed_extent,output, output_extent);
+  {
+   BABEL_REGISTRY_COUNT(bh->backup_calls);
+   rv=story_treaty(bh,bh->treaty_backup,sel,bh->story_file_blorbed,bh->story_file_blorbed_extent,output, output_extent);
+  }
   }
  if (!rv && sel==GET_STORY_FILE_IFID_SEL)
   return babel_md5_ifid_ctx(output,output_extent, bh);
@@ -296,6 +674,62 @@ int32 babel_treaty(int32 sel, void *output, int32 output_extent)
 {
  return babel_treaty_ctx(sel, output, output_extent, &default_ctx);
 }
+
+/* Asks a cover selector of the container, or of the story module */
+static int32 cover_treaty(struct babel_handler *bh, int32 sel, int32 story)
+{
+ if (!story)
+ {
+  BABEL_REGISTRY_COUNT(bh->handler_calls);
+  return container_treaty(bh,sel,NULL,0);
+ }
+ if (bh->blorb_mode)
+ {
+  BABEL_REGISTRY_COUNT(bh->backup_calls);
+  return story_treaty(bh,bh->treaty_backup,sel,bh->story_file_blorbed,bh->story_file_blorbed_extent,NULL,0);
+ }
+ BABEL_REGISTRY_COUNT(bh->handler_calls);
+ return story_treaty(bh,bh->treaty_handler,sel,bh->story_file,bh->story_file_extent,NULL,0);
+}
+
+/* Finds the cover art which the container (or the story module) keeps
+   at base+offset in the loaded file, and reads its dimensions there */
+static int32 cover_in_place(struct babel_handler *bh, struct babel_image *im, int32 story, int32 base)
+{
+ int32 offset, length, format;
+ offset=cover_treaty(bh,GET_STORY_FILE_COVER_OFFSET_SEL,story);
+ if (offset<=0) return NO_REPLY_RV;
+ length=cover_treaty(bh,GET_STORY_FILE_COVER_EXTENT_SEL,story);
+ format=cover_treaty(bh,GET_STORY_FILE_COVER_FORMAT_SEL,story);
+ offset+=base;
+ if (length<=0 || format<=0 || offset>bh->story_file_extent ||
+     length>bh->story_file_extent-offset)
+  return NO_REPLY_RV;
+ im->format=format;
+ im->offset=offset;
+ im->length=length;
+ if (!babel_image_probe((char *)bh->story_file+offset,length,format,&im->width,&im->height))
+  im->width=im->height=0;
+ return format;
+}
+
+int32 babel_get_cover_ctx(struct babel_image *im, void *bhp)
+{
+ struct babel_handler *bh=(struct babel_handler *) bhp;
+ memset(im,0,sizeof(struct babel_image));
+ if (!bh->story_file || !bh->treaty_handler) return NO_REPLY_RV;
+ if (bh->blorb_mode)
+ {
+  if (cover_in_place(bh,im,0,0)) return im->format;
+  if (!bh->blorb_view) return NO_REPLY_RV;
+  return cover_in_place(bh,im,1,(char *)bh->story_file_blorbed-(char *)bh->story_file);
+ }
+ return cover_in_place(bh,im,1,0);
+}
+int32 babel_get_cover(struct babel_image *im)
+{
+ return babel_get_cover_ctx(im, &default_ctx);
+}
 char *babel_get_format_ctx(void *bhp)
 {
  struct babel_handler *bh=(struct babel_handler *) bhp;
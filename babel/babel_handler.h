@@ -16,12 +16,20 @@
 #define BABEL_HANDLER_H
 
 #include "treaty.h"
+#include "babel_image.h"
+#include <stdio.h>
 
 /* Functions from babel_handler.c */
 char *babel_init(char *filename);
  /* initialize the babel handler */
 char *babel_init_raw(void *sf, int32 extent);
  /* Initialize from loaded data */
+char *babel_init_raw_owned(void *sf, int32 extent);
+ /* Initialize from loaded data, which babel takes over and frees */
+void *babel_read_stream(FILE *f, int32 *extent);
+ /* Read a whole stream into a buffer for babel_init_raw_owned */
+char *babel_init_mapped(char *filename);
+ /* Initialize from a read-only mapping of the file */
 int32 babel_treaty(int32 selector, void *output, int32 output_extent);
  /* Dispatch treaty calls */
 void babel_release(void);
@@ -30,6 +38,9 @@ char *babel_get_format(void);
  /* return the format of the loaded file */
 int32 babel_md5_ifid(char *buffer, int32 extent);
  /* IFID generator of last resort */
+int32 babel_md5_ifid_file(char *filename, char *buffer, int32 extent);
+int32 babel_md5_ifid_stream(FILE *f, char *buffer, int32 extent);
+ /* The same, hashing a file without loading it */
 int32 babel_get_length(void);
  /* Fetch file length */
 int32 babel_get_story_length(void);
@@ -40,6 +51,8 @@ void *babel_get_file(void);
  /* Get loaded story file */
 void *babel_get_story_file(void);
  /* Get loaded story file */
+int32 babel_get_cover(struct babel_image *);
+ /* Find the cover art within the loaded file */
 
 /* threadsafe versions of above */
 char *babel_init_ctx(char *filename, void *);
@@ -58,6 +71,9 @@ void *babel_get_file_ctx(void *bhp);
 void *babel_get_story_ctx(void *bhp);
 int32 babel_get_authoritative_ctx(void *bhp);
 char *babel_init_raw_ctx(void *sf, int32 extent, void *bhp);
+char *babel_init_raw_owned_ctx(void *sf, int32 extent, void *bhp);
+char *babel_init_mapped_ctx(char *filename, void *bhp);
+int32 babel_get_cover_ctx(struct babel_image *, void *bhp);
 void *get_babel_ctx(void);
 void release_babel_ctx(void *);
  /* get and release babel contexts */
@@ -0,0 +1,82 @@
+/* babel_image.c   the babel image probe
+ *
+ * This file depends upon babel_image.h and treaty.h
+ *
+ * See babel_image.h for usage.
+ */
+
+#include "babel_image.h"
+#include <stdio.h>
+#include <string.h>
+
+static int32 read_int(unsigned char *mem)
+{
+  int32 i4 = mem[0],
+                    i3 = mem[1],
+                    i2 = mem[2],
+                    i1 = mem[3];
+  return i1 | (i2<<8) | (i3<<16) | (i4<<24);
+}
+
+static int32 png_dim(unsigned char *dp, int32 extent, int32 *w, int32 *h)
+{
+ if (extent<33 ||
+ !(dp[0]==137 && dp[1]==80 && dp[2]==78 && dp[3]==71 &&
+        dp[4]==13 && dp[5] == 10 && dp[6] == 26 && dp[7]==10)||
+ !(dp[12]=='I' && dp[13]=='H' && dp[14]=='D' && dp[15]=='R'))
+ return 0;
+ *w=read_int(dp+16);
+ *h=read_int(dp+20);
+ return PNG_COVER_FORMAT;
+}
+
+/* Walks the JPEG markers as far as the first start of frame (SOF0-SOF15,
+   other than DHT, JPG and DAC, which share their codes).  Markers without
+   a length are stepped over; reaching the start of scan, or the end of the
+   image, before a frame header means the image is not valid */
+static int32 jpeg_dim(unsigned char *dp, int32 extent, int32 *w, int32 *h)
+{
+ int32 i=2, l;
+ unsigned char m;
+
+ if (extent<4 || dp[0]!=0xFF || dp[1]!=0xD8) return 0;
+ while(i<extent)
+ {
+  if (dp[i++]!=0xFF) continue;
+  while(i<extent && dp[i]==0xFF) i++;
+  if (i>=extent) break;
+  m=dp[i++];
+  if (m==0xD8 || m==0xD9 || m==0xDA) break;
+  if (m==0x01 || (m>=0xD0 && m<=0xD7)) continue;
+  if (i+2>extent) break;
+  l=(dp[i]<<8) | dp[i+1];
+  if ((m & 0xF0)==0xC0 && !(m==0xC4 || m==0xC8 || m==0xCC))
+  {
+   if (i+7>extent) break;
+   *h=(dp[i+3]<<8) | dp[i+4];
+   *w=(dp[i+5]<<8) | dp[i+6];
+   return JPEG_COVER_FORMAT;
+  }
+  if (l<2) break;
+  i+=l;
+ }
+ return 0;
+}
+
+int32 babel_image_probe(void *img, int32 extent, int32 format, int32 *width, int32 *height)
+{
+ unsigned char *dp=(unsigned char *) img;
+ if (!dp || extent<=0) return 0;
+ if (format!=JPEG_COVER_FORMAT && png_dim(dp,extent,width,height))
+  return PNG_COVER_FORMAT;
+ if (format!=PNG_COVER_FORMAT && jpeg_dim(dp,extent,width,height))
+  return JPEG_COVER_FORMAT;
+ return 0;
+}
+
+char *babel_image_dim(struct babel_image *im, char *buffer)
+{
+ if (im->width<=0 || im->height<=0) strcpy(buffer,"(invalid)");
+ else sprintf(buffer,"(%dx%d)",(int) im->width,(int) im->height);
+ return buffer;
+}
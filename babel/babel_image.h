@@ -0,0 +1,31 @@
+/* babel_image.h  declarations for the babel image probe
+ *
+ * This file depends upon treaty.h
+ *
+ * Cover art is described by where it lies in the loaded story file, its
+ * format and its dimensions, which are read from the image header without
+ * decoding (or copying) the image.  A JPEG is only read as far as its
+ * first frame header.
+ */
+
+#ifndef BABEL_IMAGE_H
+#define BABEL_IMAGE_H
+
+#include "treaty.h"
+
+struct babel_image {
+ int32 format;          /* PNG_COVER_FORMAT or JPEG_COVER_FORMAT */
+ int32 width, height;
+ int32 offset;          /* of the image within the loaded file */
+ int32 length;
+};
+
+int32 babel_image_probe(void *img, int32 extent, int32 format, int32 *width, int32 *height);
+ /* Read the dimensions of a PNG or JPEG image.  format is the expected
+    format, or 0 to tell it from the signature.  Returns the format, or
+    zero if the image is not valid */
+char *babel_image_dim(struct babel_image *, char *buffer);
+ /* Describe an image's dimensions as "(WxH)", or "(invalid)" if they are
+    not known.  buffer must hold at least 32 bytes */
+
+#endif
@@ -1,4 +1,6 @@
 #include "babel.h"
+#include "blorb_writer.h"
+#include "babel_registry.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,7 +18,7 @@ char *getcwd(char *, int);
 
 void deep_ifiction_verify(char *md, int f);
 void * my_malloc(int32, char *);
-char *blorb_chunk_for_name(char *name);
+char *blorb_chunk_for_name(char *name, char *buffer);
 #ifndef THREE_LETTER_EXTENSIONS
 static char *ext_table[] = { "zcode", ".zblorb",
                              "glulx", ".gblorb",
@@ -118,31 +120,26 @@ char *deep_complete_ifiction(char *fn, char *ifid, char *format)
  return md;
 }
 
-void write_int(int32 i, FILE *f)
-{
- char bf[4];
- bf[0]=(((unsigned) i) >> 24) & 0xFF;
- bf[1]=(((unsigned) i) >> 16) & 0xFF;
- bf[2]=(((unsigned) i) >> 8) & 0xFF;
- bf[3]=(((unsigned) i)) & 0xFF;
- fwrite(bf,1,4,f);
-}
 static void _babel_multi_blorb(char *outfile, char **args, char *todir , int argc)
 {
- int32 total, storyl, coverl, i;
+ int32 storyl, i, l, pict, snd, cover;
  char buffer[TREATY_MINIMUM_EXTENT+10];
  char b2[TREATY_MINIMUM_EXTENT];
+ char chunk[5];
+ static char fspc[4] = { 0, 0, 0, 1 };
+ unsigned char head[1084];
 
  char cwd[512];
- char *cover, *md, *cvrf, *ep;
+ char *md, *ep, *sf, *file, *type, *usage;
+ struct blorb_writer *w;
 
  FILE *f, *c;
- if (argc!=2 && argc !=3)
+ if (argc<2)
  {
   fprintf(stderr,"Invalid usage\n");
   return;
  }
- if (!babel_init(args[0]))
+ if (!babel_init_mapped(args[0]))
  {
   fprintf(stderr,"Error: Could not determine the format of file %s\n",args[0]);
   return;
@@ -175,82 +172,59 @@ static void _babel_multi_blorb(char *outfile, char **args, char *todir , int arg
   fprintf(stderr,"Error: Error writing to file %s\n",buffer);
   return;
  }
+
+ w=blorb_writer_create();
+ /* The story is copied straight from its file (or from within its
+    container) where possible */
  storyl=babel_get_story_length();
- total=storyl + (storyl%2) + 36;
- if (md) total+=8+strlen(md)+strlen(md)%2;
- if (argc==3)
+ sf=(char *) babel_get_story_file();
+ file=(char *) babel_get_file();
+ if (!(sf>=file && sf+storyl<=file+babel_get_length() &&
+       blorb_writer_add_file(w,blorb_chunk_for_name(b2,chunk),"Exec",0,args[0],sf-file,storyl)))
+  blorb_writer_add_buffer(w,blorb_chunk_for_name(b2,chunk),"Exec",0,sf,storyl);
+
+ /* The first picture is the cover art; any others are added as
+    pictures or sounds, numbered in the order given */
+ pict=1;
+ snd=3;
+ cover=0;
+ for(i=2;i<argc;i++)
  {
-  c=fopen(args[2],"rb");
-  if (c)
+  c=fopen(args[i],"rb");
+  if (!c) continue;
+  l=fread(head,1,sizeof(head),c);
+  fclose(c);
+  if (i==2)
   {
-   fseek(c,0,SEEK_END);
-   coverl=ftell(c);
-   if (coverl > 5){
-
-   cover=(char *) my_malloc(coverl+2,"Cover art buffer");
-   fseek(c,0,SEEK_SET);
-   fread(cover,1,coverl,c);
-   if (memcmp(cover+1,"PNG",3)==0) cvrf="PNG ";
-   else cvrf="JPEG";
-   total += 32+coverl + (coverl%2);
-   }
-   else argc=2;
-   fclose(c);
+   if (l<=5) continue;
+   usage="Pict";
+   if (memcmp(head+1,"PNG",3)==0) type="PNG ";
+   else type="JPEG";
+  }
+  else if (!blorb_resource_type(head,l,&type,&usage))
+  {
+   fprintf(stderr,"Warning: Could not identify the type of %s\n",args[i]);
+   continue;
+  }
+  if (blorb_writer_add_file(w,type,usage,usage[0]=='P' ? pict : snd,args[i],0,-1))
+  {
+   if (i==2) cover=1;
+   if (usage[0]=='P') pict++;
+   else snd++;
   }
-  else argc=2;
- }
-/* printf("Writing header\n;");*/
- fwrite("FORM",1,4,f);
- write_int(total,f);
-/* printf("Writing index\n;");*/
- fwrite("IFRSRIdx",1,8,f);
- write_int(argc==3 ? 28:16,f);
- write_int(argc==3 ? 2:1,f);
-/* printf("Writing story\n;");*/
- fwrite("Exec", 1,4,f);
- write_int(0,f);
- write_int(argc==3 ? 48:36,f);
- if (argc==3)
- {
-/* printf("Writing image\n;"); */
- fwrite("Pict", 1,4,f);
- write_int(1,f);
- write_int(56+storyl+(storyl%2),f);
- }
-/* printf("Invoking chunk for name %s\n",b2); */
- fwrite(blorb_chunk_for_name(b2),1,4,f);
- write_int(storyl,f);
-/* printf("Writing story data\n"); */
- fwrite(babel_get_story_file(),1,storyl,f);
- if (storyl%2) fwrite("\0",1,1,f);
- if (argc==3)
- {
-/*  printf("Writing cover data header %s\n",cvrf); */
-  fwrite(cvrf,1,4,f);
-/*  printf("Writing cover data size %d\n",coverl); */
-  write_int(coverl,f);
-/*  printf("Writing cover data\n"); */
-  fwrite(cover,1,coverl,f);
-  if (coverl%2) fwrite("\0",1,1,f);
-/*  printf("Done with cover\n");*/
-/*  free(cover);*/
-/*  printf("Writing frontispiece\n;");*/
-  fwrite("Fspc\0\0\0\004\0\0\0\001",1,12,f);
  }
+ if (cover) blorb_writer_add_buffer(w,"Fspc",NULL,0,fspc,4);
 
- if (md) {
-/*  printf("Writing metadata\n;");*/
- fwrite("IFmd",1,4,f);
- write_int(strlen(md),f);
- fwrite(md,1,strlen(md),f);
- if (strlen(md)%2)
-  fwrite("\0",1,1,f);
- free(md);
- }
+ if (md) blorb_writer_add_buffer(w,"IFmd",NULL,0,md,strlen(md));
 
+ if (!blorb_writer_write(w,f))
+  fprintf(stderr,"Error: Error writing to file %s\n",buffer);
+ else
+  printf("Created %s\n",buffer);
  fclose(f);
- printf("Created %s\n",buffer);
- 
+ blorb_writer_release(w);
+ if (md) free(md);
+ babel_release();
 }
 void babel_multi_complete(char **args, char *todir, int argc)
 {
@@ -310,3 +284,27 @@ void babel_multi_blorb1(char **args, char *todir , int argc)
  
 
 }
+
+/* Asks each format to check the table from which it identifies stories,
+   and prints what they find.  Exits with status 1 if any problem is found
+*/
+void babel_multi_verify_registry(char **args, char *todir, int argc)
+{
+ TREATY *treaty_registry, *container_registry;
+ void *registry;
+ char *report;
+ int32 i, rv, problems=0;
+
+ registry=babel_registry_acquire(&treaty_registry,&container_registry);
+ report=(char *)my_malloc(65536,"registry report");
+ for(i=0;treaty_registry[i];i++)
+ {
+  rv=treaty_registry[i](VERIFY_REGISTRY_SEL,NULL,0,report,65536);
+  if (rv<0) continue;
+  fputs(report,stdout);
+  problems+=rv;
+ }
+ free(report);
+ babel_registry_release(registry);
+ if (problems) exit(1);
+}
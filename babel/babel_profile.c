@@ -0,0 +1,232 @@
+/* babel_profile.c   the babel treaty call profiler
+ *
+ * This file depends upon babel_profile.h, treaty.h and misc.c
+ *
+ * See babel_profile.h for usage.
+ *
+ * The groups are kept in a fixed hash table, keyed by module and selector.
+ * There are only as many groups as modules times selectors, so the table
+ * never fills in practice; calls which would need a new group once it is
+ * full are made but not recorded.
+ */
+
+#include "babel_profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_THREADS)
+#define BABEL_USE_THREADS
+#include <pthread.h>
+static pthread_mutex_t profile_lock=PTHREAD_MUTEX_INITIALIZER;
+#define PROFILE_LOCK() pthread_mutex_lock(&profile_lock)
+#define PROFILE_UNLOCK() pthread_mutex_unlock(&profile_lock)
+#else
+#define PROFILE_LOCK()
+#define PROFILE_UNLOCK()
+#endif
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && defined(CLOCK_MONOTONIC)
+#define BABEL_USE_MONOTONIC
+#endif
+
+void *my_malloc(int32, char *);
+
+#define PROFILE_SLOTS 512
+
+struct profile_group {
+ TREATY module;
+ int32 selector;
+ struct babel_profile_entry e;
+};
+
+static struct profile_group groups[PROFILE_SLOTS];
+static int32 ngroups;
+
+int32 babel_profiling;
+
+void babel_profile_enable(int32 on)
+{
+ babel_profiling=on;
+}
+
+void babel_profile_reset(void)
+{
+ PROFILE_LOCK();
+ memset(groups,0,sizeof(groups));
+ ngroups=0;
+ PROFILE_UNLOCK();
+}
+
+static double profile_now(void)
+{
+#ifdef BABEL_USE_MONOTONIC
+ struct timespec ts;
+ clock_gettime(CLOCK_MONOTONIC,&ts);
+ return ts.tv_sec+ts.tv_nsec/1e9;
+#else
+ return (double) clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* Finds the group for a call, making it if need be; profile_lock must be
+   held.  Returns NULL if the table is full */
+static struct profile_group *find_group(TREATY module, int32 selector)
+{
+ unsigned long h;
+ struct profile_group *g;
+ h=((unsigned long) module/16*31+(unsigned long) selector) % PROFILE_SLOTS;
+ while((g=groups+h)->module && (g->module!=module || g->selector!=selector))
+  h=(h+1) % PROFILE_SLOTS;
+ if (g->module) return g;
+ if (2*(ngroups+1)>PROFILE_SLOTS) return NULL;
+ ngroups++;
+ g->module=module;
+ g->selector=selector;
+ g->e.selector=selector;
+ if (module(GET_FORMAT_NAME_SEL,NULL,0,g->e.format,TREATY_MINIMUM_EXTENT)<0)
+  g->e.format[0]=0;
+ g->e.format[TREATY_MINIMUM_EXTENT-1]=0;
+ return g;
+}
+
+int32 babel_profile_call(TREATY module, int32 selector, void *story_file, int32 extent,
+                         void *output, int32 output_extent)
+{
+ struct profile_group *g;
+ double start, t;
+ int32 rv, key, i;
+
+ key=selector;
+ if ((selector==STORY_INDEXED_QUERY_SEL || selector==CONTAINER_INDEXED_QUERY_SEL) &&
+     output_extent>=(int32) sizeof(struct treaty_indexed_query))
+  key=((struct treaty_indexed_query *) output)->selector | BABEL_PROFILE_INDEXED;
+ start=profile_now();
+ rv=module(selector,story_file,extent,output,output_extent);
+ t=profile_now()-start;
+ if (t<0) t=0;
+
+ PROFILE_LOCK();
+ g=find_group(module,key);
+ if (g)
+ {
+  g->e.calls++;
+  if (story_file && ((key & TREATY_SELECTOR_INPUT) || (key & BABEL_PROFILE_INDEXED)))
+   g->e.bytes+=extent;
+  if (rv==INVALID_STORY_FILE_RV) g->e.invalid++;
+  else if (rv==NO_REPLY_RV) g->e.no_reply++;
+  g->e.seconds+=t;
+  if (t>g->e.slowest) g->e.slowest=t;
+  for(i=0;i<BABEL_PROFILE_BUCKETS-1 && t*1e6>=(double)(1L<<i);i++);
+  g->e.histogram[i]++;
+ }
+ PROFILE_UNLOCK();
+ return rv;
+}
+
+int32 babel_profile_entries(struct babel_profile_entry *entries, int32 n)
+{
+ int32 i, found=0;
+ PROFILE_LOCK();
+ for(i=0;i<PROFILE_SLOTS;i++)
+  if (groups[i].module)
+  {
+   if (found<n) entries[found]=groups[i].e;
+   found++;
+  }
+ PROFILE_UNLOCK();
+ return found;
+}
+
+double babel_profile_percentile(struct babel_profile_entry *e, double p)
+{
+ unsigned long seen=0;
+ double t;
+ int32 i;
+ if (!e->calls) return 0;
+ for(i=0;i<BABEL_PROFILE_BUCKETS-1;i++)
+ {
+  seen+=e->histogram[i];
+  if (seen>=p*e->calls)
+  {
+   t=(double)(1L<<i)/1e6;
+   return t<e->slowest ? t : e->slowest;
+  }
+ }
+ return e->slowest;
+}
+
+static struct {
+ int32 selector;
+ char *name;
+} selector_names[] = {
+ { GET_HOME_PAGE_SEL, "GET_HOME_PAGE" },
+ { GET_FORMAT_NAME_SEL, "GET_FORMAT_NAME" },
+ { GET_FILE_EXTENSIONS_SEL, "GET_FILE_EXTENSIONS" },
+ { CLAIM_STORY_FILE_SEL, "CLAIM_STORY_FILE" },
+ { GET_STORY_FILE_METADATA_EXTENT_SEL, "GET_STORY_FILE_METADATA_EXTENT" },
+ { GET_STORY_FILE_COVER_EXTENT_SEL, "GET_STORY_FILE_COVER_EXTENT" },
+ { GET_STORY_FILE_COVER_FORMAT_SEL, "GET_STORY_FILE_COVER_FORMAT" },
+ { GET_STORY_FILE_COVER_OFFSET_SEL, "GET_STORY_FILE_COVER_OFFSET" },
+ { GET_STORY_FILE_IFID_SEL, "GET_STORY_FILE_IFID" },
+ { GET_STORY_FILE_METADATA_SEL, "GET_STORY_FILE_METADATA" },
+ { GET_STORY_FILE_COVER_SEL, "GET_STORY_FILE_COVER" },
+ { GET_STORY_FILE_EXTENSION_SEL, "GET_STORY_FILE_EXTENSION" },
+ { STORY_GET_INDEX_SEL, "STORY_GET_INDEX" },
+ { STORY_INDEXED_QUERY_SEL, "STORY_INDEXED_QUERY" },
+ { VERIFY_REGISTRY_SEL, "VERIFY_REGISTRY" },
+ { CONTAINER_GET_STORY_FORMAT_SEL, "CONTAINER_GET_STORY_FORMAT" },
+ { CONTAINER_GET_STORY_EXTENT_SEL, "CONTAINER_GET_STORY_EXTENT" },
+ { CONTAINER_GET_STORY_FILE_SEL, "CONTAINER_GET_STORY_FILE" },
+ { CONTAINER_GET_STORY_OFFSET_SEL, "CONTAINER_GET_STORY_OFFSET" },
+ { CONTAINER_GET_INDEX_EXTENT_SEL, "CONTAINER_GET_INDEX_EXTENT" },
+ { CONTAINER_GET_INDEX_SEL, "CONTAINER_GET_INDEX" },
+ { CONTAINER_INDEXED_QUERY_SEL, "CONTAINER_INDEXED_QUERY" },
+ { 0, NULL }
+};
+
+static void selector_name(int32 selector, char *buffer)
+{
+ int32 i;
+ for(i=0;selector_names[i].name;i++)
+  if (selector_names[i].selector==(selector & ~BABEL_PROFILE_INDEXED)) break;
+ if (selector_names[i].name) strcpy(buffer,selector_names[i].name);
+ else sprintf(buffer,"0x%lX",(long) (selector & ~BABEL_PROFILE_INDEXED));
+ if (selector & BABEL_PROFILE_INDEXED) strcat(buffer," (indexed)");
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+ struct babel_profile_entry *x=(struct babel_profile_entry *) a;
+ struct babel_profile_entry *y=(struct babel_profile_entry *) b;
+ int r=strcmp(x->format,y->format);
+ if (r) return r;
+ return x->selector < y->selector ? -1 : x->selector > y->selector;
+}
+
+void babel_profile_print(FILE *f)
+{
+ struct babel_profile_entry *e;
+ int32 i, n;
+ char name[64];
+
+ n=babel_profile_entries(NULL,0);
+ e=(struct babel_profile_entry *) my_malloc((n+1)*sizeof(struct babel_profile_entry),"profile");
+ i=babel_profile_entries(e,n);
+ if (i<n) n=i;
+ qsort(e,n,sizeof(struct babel_profile_entry),compare_entries);
+ fprintf(f,"%-12s %-41s %9s %10s %8s %8s %10s %9s %9s\n",
+         "Format","Selector","Calls","MB read","Invalid","No reply",
+         "Total ms","Median ms","99% ms");
+ for(i=0;i<n;i++)
+ {
+  selector_name(e[i].selector,name);
+  fprintf(f,"%-12s %-41s %9lu %10.2f %8lu %8lu %10.3f %9.3f %9.3f\n",
+          e[i].format,name,e[i].calls,e[i].bytes/1048576.0,
+          e[i].invalid,e[i].no_reply,e[i].seconds*1e3,
+          babel_profile_percentile(e+i,0.5)*1e3,
+          babel_profile_percentile(e+i,0.99)*1e3);
+ }
+ free(e);
+}
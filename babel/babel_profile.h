@@ -0,0 +1,61 @@
+/* babel_profile.h  declarations for the babel treaty call profiler
+ *
+ * This file depends upon treaty.h
+ *
+ * When the profiler is on, every call which the babel handler makes to a
+ * treaty or container module (including the claims made while identifying
+ * a story) is timed and counted.  Calls are grouped by module and selector;
+ * indexed queries are counted under the selector they ask, separately from
+ * the same selector asked directly.  For each group the profiler keeps the
+ * number of calls, the bytes of story file handed to the module (for
+ * selectors which read the story), how many calls returned
+ * INVALID_STORY_FILE_RV and NO_REPLY_RV, the total time, and a histogram
+ * of the time taken, whose bucket i counts calls of less than 2^i
+ * microseconds (the last bucket counts the rest).
+ *
+ * The profiler is off unless babel_profile_enable is called.  It may be
+ * used from any number of threads; the groups are locked on platforms with
+ * POSIX threads.
+ */
+
+#ifndef BABEL_PROFILE_H
+#define BABEL_PROFILE_H
+
+#include "treaty.h"
+#include <stdio.h>
+
+#define BABEL_PROFILE_BUCKETS 24
+#define BABEL_PROFILE_INDEXED 0x10000   /* selector flag for indexed queries */
+
+struct babel_profile_entry {
+ char format[TREATY_MINIMUM_EXTENT];
+ int32 selector;                /* possibly with BABEL_PROFILE_INDEXED */
+ unsigned long calls;
+ double bytes;
+ unsigned long invalid;         /* calls returning INVALID_STORY_FILE_RV */
+ unsigned long no_reply;        /* calls returning NO_REPLY_RV */
+ double seconds;
+ double slowest;
+ unsigned long histogram[BABEL_PROFILE_BUCKETS];
+};
+
+extern int32 babel_profiling;
+ /* Nonzero while the profiler is on.  Do not set this directly */
+
+void babel_profile_enable(int32 on);
+ /* Turn the profiler on or off */
+void babel_profile_reset(void);
+ /* Forget everything recorded so far */
+int32 babel_profile_call(TREATY module, int32 selector, void *story_file, int32 extent,
+                         void *output, int32 output_extent);
+ /* Make a treaty call, recording it */
+int32 babel_profile_entries(struct babel_profile_entry *entries, int32 n);
+ /* Copy up to n groups, ordered by module and selector.  Returns the
+    number of groups there are */
+double babel_profile_percentile(struct babel_profile_entry *entry, double p);
+ /* The time (in seconds) within which fraction p of the calls of a group
+    finished, as an upper bound from its histogram */
+void babel_profile_print(FILE *f);
+ /* Print a summary table */
+
+#endif
@@ -0,0 +1,51 @@
+/* babel_registry.h  declarations for the babel module registry
+ *
+ * This file depends upon treaty.h
+ *
+ * The babel handler finds its treaty and container modules through the
+ * registry.  register.c provides the fixed registry of the modules built
+ * into babel; extras/hotload.c provides one whose modules may be loaded
+ * and retired while the program runs.
+ *
+ * A babel context takes a reference to the registry when it identifies a
+ * story, and keeps it (and so the modules it chose) until the context is
+ * released.  The registry handed out is never changed: a registry which
+ * changes its modules publishes a new one, and the old one is only freed
+ * once the last context using it lets it go.  Contexts may therefore be
+ * used from any number of threads while modules come and go.
+ *
+ * Each module has a count of the treaty calls babel_treaty made to it.
+ */
+
+#ifndef BABEL_REGISTRY_H
+#define BABEL_REGISTRY_H
+
+#include "treaty.h"
+
+struct babel_registry_module {
+ char format[TREATY_MINIMUM_EXTENT];
+ int32 container;       /* a container module, rather than a treaty module */
+ int32 retired;         /* no longer registered, but still in use */
+ unsigned long calls;
+};
+
+void *babel_registry_acquire(TREATY **treaties, TREATY **containers);
+ /* Take a reference to the registry, setting *treaties and *containers to
+    its NULL-terminated module lists.  Returns the reference */
+void babel_registry_release(void *registry);
+ /* Let go of a reference from babel_registry_acquire */
+unsigned long *babel_registry_counter(void *registry, TREATY module);
+ /* The call counter of a module of a registry, or NULL if it has none.
+    The counter is valid while the reference is held */
+int32 babel_registry_modules(struct babel_registry_module *modules, int32 n);
+ /* Describe up to n modules, including retired ones still in use.
+    Returns the number of modules there are */
+
+/* Counts a call to a module */
+#if defined(__GNUC__)
+#define BABEL_REGISTRY_COUNT(c) do { if (c) __sync_fetch_and_add((c),1); } while(0)
+#else
+#define BABEL_REGISTRY_COUNT(c) do { if (c) ++*(c); } while(0)
+#endif
+
+#endif
@@ -73,7 +73,7 @@ static void deep_babel_ifiction(char stopped)
 
   ep=strtok(buffer, ",");
   }
-  else ep="-";
+  else { ep="-"; buffer[0]=0; }
   i=babel_treaty(GET_STORY_FILE_METADATA_EXTENT_SEL,NULL,0);
   if (i<=0)
   {
@@ -113,98 +113,36 @@ void babel_story_ifiction()
 {
  deep_babel_ifiction(1);
 }
-static char *get_jpeg_dim(void *img, int32 extent)
+/* Finds the cover art, in place if possible and otherwise by copying it
+   out into *copy, which the caller frees.  Returns the image, or NULL */
+static char *get_cover(struct babel_image *im, char **copy)
 {
-  unsigned char *dp=(unsigned char *) img;
-  unsigned char *ep=dp+extent;
-  static char buffer[256];
-  unsigned int t1, t2, w, h;
-
-
-  t1=*(dp++);
-  t2=*(dp++);
-  if (t1!=0xff || t2!=0xD8 )
-  {
-   return "(invalid)";
-  }
-
-  while(1)
-  {
-   if (dp>ep) return "(invalid)";
-   for(t1=*(dp++);t1!=0xff;t1=*(dp++)) if (dp>ep) return "(invalid)";
-   do { t1=*(dp++); if (dp>ep) return "(invalid 4)";} while (t1 == 0xff);
-
-   if ((t1 & 0xF0) == 0xC0 && !(t1==0xC4 || t1==0xC8 || t1==0xCC))
-   {
-    dp+=3;
-    if (dp>ep) return "(invalid)";
-    h=*(dp++) << 8;
-    if (dp>ep) return "(invalid)";
-    h|=*(dp++);
-    if (dp>ep) return "(invalid)";
-    w=*(dp++) << 8;
-    if (dp>ep) return "(invalid)";
-    w|=*(dp);
-    sprintf(buffer, "(%dx%d)",w,h);
-    return buffer;
-   }
-   else if (t1==0xD8 || t1==0xD9)
-    break;
-   else
-   { int l;
-
-    if (dp>ep) return "(invalid)";
-     l=*(dp++) << 8;
-    if (dp>ep) return "(invalid)";
-     l|= *(dp++);
-     l-=2;
-     dp+=l;
-     if (dp>ep) return "(invalid)";
-    }
-   }
-  return "(invalid)";
-}
-
-static int32 read_int(unsigned char  *mem)
-{
-  int32 i4 = mem[0],
-                    i3 = mem[1],
-                    i2 = mem[2],
-                    i1 = mem[3];
-  return i1 | (i2<<8) | (i3<<16) | (i4<<24);
-}
-
-
-static char *get_png_dim(void *img, int32 extent)
-{
- unsigned char *dp=(unsigned char *)img;
- static char buffer[256];
- int32 w, h;
- if (extent<33 ||
- !(dp[0]==137 && dp[1]==80 && dp[2]==78 && dp[3]==71 &&
-        dp[4]==13 && dp[5] == 10 && dp[6] == 26 && dp[7]==10)||
- !(dp[12]=='I' && dp[13]=='H' && dp[14]=='D' && dp[15]=='R'))
- return "(invalid)";
- w=read_int(dp+16);
- h=read_int(dp+20);
- sprintf(buffer,"(%dx%d)",w,h);
- return buffer;
-}
-static char *get_image_dim(void *img, int32 extent, int fmt)
-{
- if (fmt==JPEG_COVER_FORMAT) return get_jpeg_dim(img,extent);
- else if (fmt==PNG_COVER_FORMAT) return get_png_dim(img, extent);
- return "(unknown)";
-
+ char *md;
+ *copy=NULL;
+ if (babel_get_cover(im)) return (char *)babel_get_file()+im->offset;
+ im->length=babel_treaty(GET_STORY_FILE_COVER_EXTENT_SEL,NULL,0);
+ im->format=babel_treaty(GET_STORY_FILE_COVER_FORMAT_SEL,NULL,0);
+ if (im->length<=0 || im->format<=0) return NULL;
+ md=(char *)my_malloc(im->length,"Image buffer");
+ if (babel_treaty(GET_STORY_FILE_COVER_SEL,md,im->length)<0)
+ {
+  free(md);
+  return NULL;
+ }
+ if (!babel_image_probe(md,im->length,im->format,&im->width,&im->height))
+  im->width=im->height=0;
+ *copy=md;
+ return md;
 }
 static void deep_babel_cover(char stopped)
 {
   char buffer[TREATY_MINIMUM_EXTENT];
-  void *md;
+  struct babel_image im;
+  char *md, *copy;
   char *ep;
   char *ext;
-  char *dim;
-  int32 i,j;
+  char dim[32];
+  int32 i;
   FILE *f;
   i=babel_treaty(GET_STORY_FILE_IFID_SEL,buffer,TREATY_MINIMUM_EXTENT);
   if (i==0)
@@ -218,39 +156,33 @@ static void deep_babel_cover(char stopped)
   else 
 
   ep=strtok(buffer, ",");
-  i=babel_treaty(GET_STORY_FILE_COVER_EXTENT_SEL,NULL,0);
-  j=babel_treaty(GET_STORY_FILE_COVER_FORMAT_SEL,NULL,0);
-
-  if (i<=0 || j<=0)
-  {
-   if (stopped) printf("No cover art for %s\n",buffer);
-   return;
-  }
-  if (j==PNG_COVER_FORMAT) ext=".png";
-  else if (j==JPEG_COVER_FORMAT) ext=".jpg";
-  md=my_malloc(i,"Image buffer");
-  if (babel_treaty(GET_STORY_FILE_COVER_SEL,md,i)<0)
+  md=get_cover(&im,&copy);
+  if (!md)
   {
+   if (im.length>0 && im.format>0)
     fprintf(stderr,"A serious error occurred while retrieving cover art.\n");
-    free(md);
-    return;
+   else if (stopped) printf("No cover art for %s\n",buffer);
+   return;
   }
-  dim=get_image_dim(md,i,j);
+  if (im.format==PNG_COVER_FORMAT) ext=".png";
+  else ext=".jpg";
+  babel_image_dim(&im,dim);
   while(ep)
   {
    char epb[TREATY_MINIMUM_EXTENT+9];
    strcpy(epb,ep);
    strcat(epb, ext);
 
+   /* The image is written straight from the story where it lies */
    f=fopen(epb,"wb");
-   if (!f || fwrite(md,1,i,f)==EOF)
+   if (!f || fwrite(md,1,im.length,f)!=(size_t) im.length)
     fprintf(stderr,"A serious error occurred writing to disk.\n");
    else printf("Extracted %s %s\n",epb, dim);
    if (f) fclose(f);
    if (stopped) break;
    ep=strtok(NULL,",");
   }
-  free(md);
+  if (copy) free(copy);
 }
 
 void babel_story_cover()
@@ -320,8 +252,10 @@ static char *get_biblio(void)
 }
 void babel_story_identify()
 {
- int32 i, j, l;
- char *b, *cf, *dim;
+ struct babel_image im;
+ int32 l;
+ char *b, *cf, *copy;
+ char dim[32];
  char buffer[TREATY_MINIMUM_EXTENT];
 
  printf("%s\n",get_biblio());
@@ -331,30 +265,20 @@ void babel_story_identify()
  l=babel_get_length() / 1024;
  
 
- i=babel_treaty(GET_STORY_FILE_COVER_EXTENT_SEL,NULL,0);
- j=babel_treaty(GET_STORY_FILE_COVER_FORMAT_SEL,NULL,0);
-
- if (i<=0 || j<=0)
+ if (!get_cover(&im,&copy))
  {
   cf="no cover"; 
  }
  else
  {
-  char *md=my_malloc(i,"Image buffer");
-  if (babel_treaty(GET_STORY_FILE_COVER_SEL,md,i)<0)
-  {
-   cf="no cover";
-  }
-  else
-  {
-   dim=get_image_dim(md,i,j)+1;
-   dim[strlen(dim)-1]=0;
-   if (j==JPEG_COVER_FORMAT) cf="jpeg";
-   else if (j==PNG_COVER_FORMAT) cf="png";
-   else cf="unknown format";
-   sprintf(buffer,"cover %s %s",dim,cf);
-   cf=buffer;
-  }
+  babel_image_dim(&im,dim);
+  dim[strlen(dim)-1]=0;
+  if (im.format==JPEG_COVER_FORMAT) cf="jpeg";
+  else if (im.format==PNG_COVER_FORMAT) cf="png";
+  else cf="unknown format";
+  sprintf(buffer,"cover %s %s",dim+1,cf);
+  cf=buffer;
+  if (copy) free(copy);
  }
  printf("%s, %dk, %s\n",b, l,cf);
 }
@@ -28,11 +28,12 @@
 #define HOME_PAGE "http://eblong.com/zarf/blorb"
 #define FORMAT_EXT ".blorb,.blb,.zblorb,.zlb,.gblorb,.glb"
 #define CONTAINER_FORMAT
+#define CONTAINER_INDEX
 #include "treaty_builder.h"
+#include "babel_registry.h"
 #include <stdlib.h>
 #include <ctype.h>
 
-extern TREATY treaty_registry[];
 /* The following is the translation table of Blorb chunk types to
    babel formats.  it is NULL-terminated. */
 static char *TranslateExec[] = { "ZCOD", "zcode",
@@ -54,70 +55,242 @@ static int32 read_int(void *inp)
   return i1 | (i2<<8) | (i3<<16) | (i4<<24);
 }
 
+/* The blorb index.  This is built once by get_story_index into a buffer
+   provided by the caller (the babel handler keeps it in its context), and
+   handed back with each CONTAINER_INDEXED_QUERY_SEL.  It holds a hash
+   table of the first chunk of each type, followed by the resource index
+   sorted by usage and number, so that neither chunks nor resources need
+   be searched linearly.  Each of the lookup functions below takes an
+   index, or NULL to search the file directly.
+*/
+struct blorb_ichunk {
+ char id[4];
+ int32 begin, extent;           /* begin is 0 for an empty slot */
+};
+struct blorb_ires {
+ char usage[4];
+ int32 number, order, begin, extent;
+};
+struct blorb_index {
+ int32 nslots;                  /* a power of two */
+ int32 nres;
+};
+#define BLORB_CHUNKS(ix) ((struct blorb_ichunk *)((struct blorb_index *)(ix)+1))
+#define BLORB_RES(ix) ((struct blorb_ires *)(BLORB_CHUNKS(ix)+(ix)->nslots))
 
-static int32 blorb_get_chunk(void *blorb_file, int32 extent, char *id, int32 *begin, int32 *output_extent)
+static struct blorb_ichunk *blorb_chunk_slot(struct blorb_index *ix, char *id)
+{
+ struct blorb_ichunk *c=BLORB_CHUNKS(ix);
+ int32 h=(((unsigned) read_int(id) * 2654435761U) >> 16) & (ix->nslots-1);
+ while(c[h].begin && memcmp(c[h].id,id,4)) h=(h+1) & (ix->nslots-1);
+ return c+h;
+}
+
+/* Checks that data said to be in the file lies within it */
+static int32 blorb_in_file(int32 extent, int32 begin, int32 length)
+{
+ return begin>=0 && length>=0 && begin<=extent && length<=extent-begin;
+}
+
+static int32 blorb_get_chunk(void *blorb_file, int32 extent, struct blorb_index *ix, char *id, int32 *begin, int32 *output_extent)
 {
  int32 i=12, j;
+ if (ix)
+ {
+  struct blorb_ichunk *c=blorb_chunk_slot(ix,id);
+  if (!c->begin || !blorb_in_file(extent,c->begin,c->extent)) return NO_REPLY_RV;
+  *begin=c->begin;
+  *output_extent=c->extent;
+  return 1;
+ }
  while(i<extent-8)
  {
   if (memcmp(((char *)blorb_file)+i,id,4)==0)
   {
    *output_extent=read_int((char *)blorb_file+i+4);
-   if (*output_extent > extent) return NO_REPLY_RV;
+   if (!blorb_in_file(extent,i+8,*output_extent)) return NO_REPLY_RV;
    *begin=i+8;
    return 1;
   }
 
   j=read_int((char *)blorb_file+i+4);
+  if (j<0 || j>extent-i-8) break;
   if (j%2) j++;
   i+=j+8;
 
  }
  return NO_REPLY_RV;
 }
-static int32 blorb_get_resource(void *blorb_file, int32 extent, char *rid, int32 number, int32 *begin, int32 *output_extent)
+static int blorb_compare_res(const void *a, const void *b)
+{
+ const struct blorb_ires *ra=(const struct blorb_ires *) a;
+ const struct blorb_ires *rb=(const struct blorb_ires *) b;
+ int c=memcmp(ra->usage,rb->usage,4);
+ if (c) return c;
+ if (ra->number!=rb->number) return ra->number < rb->number ? -1 : 1;
+ return ra->order < rb->order ? -1 : ra->order > rb->order;
+}
+static int32 blorb_get_resource(void *blorb_file, int32 extent, struct blorb_index *ix, char *rid, int32 number, int32 *begin, int32 *output_extent)
 {
  int32 ridx_len;
  int32 i,j;
  void *ridx;
- if (blorb_get_chunk(blorb_file, extent,"RIdx",&i,&ridx_len)==NO_REPLY_RV)
+ if (ix)
+ { /* Find the first entry for (rid, number) */
+  struct blorb_ires *r=BLORB_RES(ix), key;
+  int32 lo=0, hi=ix->nres;
+  memcpy(key.usage,rid,4);
+  key.number=number;
+  key.order=-1;
+  while(lo<hi)
+  {
+   i=(lo+hi)/2;
+   if (blorb_compare_res(r+i,&key)<0) lo=i+1;
+   else hi=i;
+  }
+  if (lo==ix->nres || memcmp(r[lo].usage,rid,4) || r[lo].number!=number ||
+      !blorb_in_file(extent,r[lo].begin,r[lo].extent))
+   return NO_REPLY_RV;
+  *begin=r[lo].begin;
+  *output_extent=r[lo].extent;
+  return 1;
+ }
+ if (blorb_get_chunk(blorb_file, extent, NULL, "RIdx",&i,&ridx_len)==NO_REPLY_RV)
   return NO_REPLY_RV;
 
+ if (ridx_len<4) return NO_REPLY_RV;
+ j=(ridx_len-4)/12;
  ridx=(char *)blorb_file+i+4;
  ridx_len=read_int((char *)blorb_file+i);
+ if (ridx_len>j) ridx_len=j;
  for(i=0;i<ridx_len;i++)
  { 
   if(memcmp((char *)ridx+(i*12),rid,4)==0 && read_int((char *)ridx+(i*12)+4)==number)
   {
    j=i;
    i=read_int((char *)ridx+(j*12)+8);
+   if (i<0 || i>extent-8) return NO_REPLY_RV;
    *begin=i+8;
    *output_extent=read_int((char *)blorb_file+i+4);
+   if (!blorb_in_file(extent,*begin,*output_extent)) return NO_REPLY_RV;
    return 1;
   }
  }
  return NO_REPLY_RV;
 }
+
+/* Counts the chunks in the file, and the entries in its (first) resource
+   index which lie within the file */
+static void blorb_count(void *blorb_file, int32 extent, int32 *chunks, int32 *resources)
+{
+ int32 i=12, j;
+ int ridx=0;
+ *chunks=0;
+ *resources=0;
+ while(i<extent-8)
+ {
+  (*chunks)++;
+  j=read_int((char *)blorb_file+i+4);
+  if (memcmp((char *)blorb_file+i,"RIdx",4)==0 && !ridx++ &&
+      j>=4 && j<=extent-i-8)
+  {
+   *resources=read_int((char *)blorb_file+i+8);
+   if (*resources<0 || *resources>(j-4)/12) *resources=(j-4)/12;
+  }
+  if (j<0 || j>extent-i-8) break;
+  if (j%2) j++;
+  i+=j+8;
+ }
+}
+static int32 blorb_index_extent(int32 chunks, int32 resources, int32 *slots)
+{
+ for(*slots=8;*slots<2*chunks;*slots*=2);
+ return sizeof(struct blorb_index)+*slots*sizeof(struct blorb_ichunk)+
+        resources*sizeof(struct blorb_ires);
+}
+static int32 get_story_index_extent(void *blorb_file, int32 extent)
+{
+ int32 chunks, resources, slots;
+ blorb_count(blorb_file, extent, &chunks, &resources);
+ return blorb_index_extent(chunks, resources, &slots);
+}
+static int32 get_story_index(void *blorb_file, int32 extent, void *output, int32 output_extent)
+{
+ struct blorb_index *ix=(struct blorb_index *) output;
+ struct blorb_ichunk *c;
+ struct blorb_ires *r;
+ int32 chunks, i, j, k, n;
+ char *ridx=NULL;
+
+ blorb_count(blorb_file, extent, &chunks, &n);
+ ASSERT_OUTPUT_SIZE(blorb_index_extent(chunks, n, &i));
+ ix->nslots=i;
+ memset(BLORB_CHUNKS(ix),0,ix->nslots*sizeof(struct blorb_ichunk));
+ i=12;
+ while(i<extent-8)
+ {
+  j=read_int((char *)blorb_file+i+4);
+  c=blorb_chunk_slot(ix,(char *)blorb_file+i);
+  if (!c->begin)
+  {
+   memcpy(c->id,(char *)blorb_file+i,4);
+   c->begin=i+8;
+   c->extent=j;
+   if (memcmp(c->id,"RIdx",4)==0) ridx=(char *)blorb_file+i+12;
+  }
+  if (j<0 || j>extent-i-8) break;
+  if (j%2) j++;
+  i+=j+8;
+ }
+
+ r=BLORB_RES(ix);
+ ix->nres=0;
+ for(k=0;ridx && k<n;k++)
+ {
+  i=read_int(ridx+(k*12)+8);
+  if (i<0 || i>extent-8) continue;
+  j=read_int((char *)blorb_file+i+4);
+  if (j<0 || j>extent-i-8) continue;
+  memcpy(r->usage,ridx+(k*12),4);
+  r->number=read_int(ridx+(k*12)+4);
+  r->order=k;
+  r->begin=i+8;
+  r->extent=j;
+  r++;
+  ix->nres++;
+ }
+ qsort(BLORB_RES(ix),ix->nres,sizeof(struct blorb_ires),blorb_compare_res);
+ return output_extent;
+}
+
 static int32 blorb_get_story_file(void *blorb_file, int32 extent, int32 *begin, int32 *output_extent)
 {
- return blorb_get_resource(blorb_file, extent, "Exec", 0, begin, output_extent);
+ return blorb_get_resource(blorb_file, extent, NULL, "Exec", 0, begin, output_extent);
 
 }
 
-static int32 get_story_extent(void *blorb_file, int32 extent)
+static int32 blorb_story_extent(void *blorb_file, int32 extent, struct blorb_index *ix)
 {
  int32 i,j;
- if (blorb_get_resource(blorb_file, extent, "Exec", 0, &i, &j))
+ if (blorb_get_resource(blorb_file, extent, ix, "Exec", 0, &i, &j))
  {
   return j;
  }
  return NO_REPLY_RV;
 
 }
-static int32 get_story_file(void *blorb_file, int32 extent, void *output, int32 output_extent)
+static int32 blorb_story_offset(void *blorb_file, int32 extent, struct blorb_index *ix)
+{
+ int32 i,j;
+ if (blorb_get_resource(blorb_file, extent, ix, "Exec", 0, &i, &j) &&
+     i > 0 && j >= 0 && i <= extent - j)
+  return i;
+ return NO_REPLY_RV;
+}
+static int32 blorb_story_file(void *blorb_file, int32 extent, struct blorb_index *ix, void *output, int32 output_extent)
 {
  int32 i,j;
- if (blorb_get_resource(blorb_file, extent, "Exec", 0, &i, &j))
+ if (blorb_get_resource(blorb_file, extent, ix, "Exec", 0, &i, &j))
  {
   ASSERT_OUTPUT_SIZE(j);
   memcpy(output,(char *)blorb_file+i,j);
@@ -127,54 +300,58 @@ static int32 get_story_file(void *blorb_file, int32 extent, void *output, int32
 
 }
 
-char *blorb_chunk_for_name(char *name)
+/* buffer must have room for at least 5 characters; the result is
+   either a constant string or buffer */
+char *blorb_chunk_for_name(char *name, char *buffer)
 {
- static char buffer[5];
  int j;
  for(j=0;TranslateExec[j];j+=2)
   if (strcmp(name,TranslateExec[j+1])==0) return TranslateExec[j];
- for(j=0;j<4 && name[j];j++) buffer[j]=toupper(buffer[j]);
+ for(j=0;j<4 && name[j];j++) buffer[j]=toupper(name[j]);
  while(j<4) buffer[j++]=' ';
  buffer[4]=0;
  return buffer;
 
 }
-static char *blorb_get_story_format(void *blorb_file, int32 extent)
+static int32 blorb_get_story_format(void *blorb_file, int32 extent, struct blorb_index *ix, char *fn, int32 fn_extent)
 {
- int32 i, j;
+ int32 i, j, rv=0;
+ char chunk[5];
+ TREATY *treaty_registry, *container_registry;
+ void *registry;
 
- for(j=0;treaty_registry[j];j++)
+ registry=babel_registry_acquire(&treaty_registry,&container_registry);
+ for(j=0;treaty_registry[j] && !rv;j++)
  {
-  static char fn[512];
-  treaty_registry[j](GET_FORMAT_NAME_SEL,NULL,0,fn,512);
-  if (blorb_get_chunk(blorb_file,extent,blorb_chunk_for_name(fn),&i, &i)) return fn;
+  if (treaty_registry[j](GET_FORMAT_NAME_SEL,NULL,0,fn,fn_extent)<0) continue;
+  if (blorb_get_chunk(blorb_file,extent,ix,blorb_chunk_for_name(fn,chunk),&i, &i)) rv=1;
  }
- return NULL;
+ babel_registry_release(registry);
+ return rv;
 }
 
-static int32 get_story_format(void *blorb_file, int32 extent, char *output, int32 output_extent)
+static int32 blorb_story_format(void *blorb_file, int32 extent, struct blorb_index *ix, char *output, int32 output_extent)
 {
- char *o;
- o=blorb_get_story_format(blorb_file, extent);
- if (!o) return NO_REPLY_RV;
+ char o[TREATY_MINIMUM_EXTENT];
+ if (!blorb_get_story_format(blorb_file, extent, ix, o, TREATY_MINIMUM_EXTENT)) return NO_REPLY_RV;
  ASSERT_OUTPUT_SIZE((signed) strlen(o)+1);
  strcpy(output,o);
  return strlen(o)+1;
 }
-static int32 get_story_file_metadata_extent(void *blorb_file, int32 extent)
+static int32 blorb_metadata_extent(void *blorb_file, int32 extent, struct blorb_index *ix)
 {
  int32 i,j;
- if (blorb_get_chunk(blorb_file,extent,"IFmd",&i,&j)) return j+1;
+ if (blorb_get_chunk(blorb_file,extent,ix,"IFmd",&i,&j)) return j+1;
  return NO_REPLY_RV;
 }
-static int32 blorb_get_cover(void *blorb_file, int32 extent, int32 *begin, int32 *output_extent)
+static int32 blorb_get_cover(void *blorb_file, int32 extent, struct blorb_index *ix, int32 *begin, int32 *output_extent)
 {
  int i,j;
- if (blorb_get_chunk(blorb_file,extent,"Fspc",&i,&j))
+ if (blorb_get_chunk(blorb_file,extent,ix,"Fspc",&i,&j))
  {
   if (j<4) return NO_REPLY_RV;
   i=read_int((char *)blorb_file+i);
-  if (!blorb_get_resource(blorb_file,extent,"Pict",i,&i,&j)) return NO_REPLY_RV;
+  if (!blorb_get_resource(blorb_file,extent,ix,"Pict",i,&i,&j)) return NO_REPLY_RV;
   *begin=i;
   *output_extent=j;
   if (memcmp((char *)blorb_file+i-8,"PNG ",4)==0) return PNG_COVER_FORMAT;
@@ -184,27 +361,44 @@ static int32 blorb_get_cover(void *blorb_file, int32 extent, int32 *begin, int32
 
 }
 
-static int32 get_story_file_cover_extent(void *blorb_file, int32 extent)
+static int32 blorb_cover_extent(void *blorb_file, int32 extent, struct blorb_index *ix)
 {
  int32 i,j;
- if (blorb_get_cover(blorb_file,extent,&i,&j)) return j;
+ if (blorb_get_cover(blorb_file,extent,ix,&i,&j)) return j;
  return NO_REPLY_RV;
 }
 
-static int32 get_story_file_cover_format(void *blorb_file, int32 extent)
+static int32 blorb_cover_format(void *blorb_file, int32 extent, struct blorb_index *ix)
 {
  int32 i,j;
- return blorb_get_cover(blorb_file, extent, &i,&j);
+ return blorb_get_cover(blorb_file, extent, ix, &i,&j);
 }
 
-static int32 get_story_file_IFID(void *b, int32 e, char *output, int32 output_extent)
+static int32 blorb_cover_offset(void *blorb_file, int32 extent, struct blorb_index *ix)
+{
+ int32 i,j;
+ if (blorb_get_cover(blorb_file,extent,ix,&i,&j)) return i;
+ return NO_REPLY_RV;
+}
+
+static int32 blorb_metadata(void *blorb_file, int32 extent, struct blorb_index *ix, char *output, int32 output_extent)
+{
+ int32 i,j;
+ if (!blorb_get_chunk(blorb_file, extent,ix,"IFmd",&i,&j)) return NO_REPLY_RV;
+ ASSERT_OUTPUT_SIZE(j+1);
+ memcpy(output,(char *)blorb_file+i,j);
+ output[j]=0;
+ return j+1;
+}
+
+static int32 blorb_IFID(void *b, int32 e, struct blorb_index *ix, char *output, int32 output_extent)
 {
  int32 j;
  char *md;
- j=get_story_file_metadata_extent(b,e);
+ j=blorb_metadata_extent(b,e,ix);
  if (j<=0) return NO_REPLY_RV;
  md=(char *)my_malloc(j, "Metadata buffer");
- j=get_story_file_metadata(b,e,md,j);
+ j=blorb_metadata(b,e,ix,md,j);
  if (j<=0) return NO_REPLY_RV;
 
  j=ifiction_get_IFID(md,output,output_extent);
@@ -212,22 +406,91 @@ static int32 get_story_file_IFID(void *b, int32 e, char *output, int32 output_ex
  return j;
 }
 
-static int32 get_story_file_metadata(void *blorb_file, int32 extent, char *output, int32 output_extent)
+static int32 blorb_cover(void *blorb_file, int32 extent, struct blorb_index *ix, void *output, int32 output_extent)
 {
  int32 i,j;
- if (!blorb_get_chunk(blorb_file, extent,"IFmd",&i,&j)) return NO_REPLY_RV;
- ASSERT_OUTPUT_SIZE(j+1);
+ if (!blorb_get_cover(blorb_file, extent,ix,&i,&j)) return NO_REPLY_RV;
+ ASSERT_OUTPUT_SIZE(j);
  memcpy(output,(char *)blorb_file+i,j);
- output[j]=0;
- return j+1;
+ return j;
+}
+
+/* The treaty functions, which search the file, and their indexed
+   counterpart */
+static int32 get_story_extent(void *blorb_file, int32 extent)
+{
+ return blorb_story_extent(blorb_file, extent, NULL);
+}
+static int32 get_story_offset(void *blorb_file, int32 extent)
+{
+ return blorb_story_offset(blorb_file, extent, NULL);
+}
+static int32 get_story_file(void *blorb_file, int32 extent, void *output, int32 output_extent)
+{
+ return blorb_story_file(blorb_file, extent, NULL, output, output_extent);
+}
+static int32 get_story_format(void *blorb_file, int32 extent, char *output, int32 output_extent)
+{
+ return blorb_story_format(blorb_file, extent, NULL, output, output_extent);
+}
+static int32 get_story_file_metadata_extent(void *blorb_file, int32 extent)
+{
+ return blorb_metadata_extent(blorb_file, extent, NULL);
+}
+static int32 get_story_file_cover_extent(void *blorb_file, int32 extent)
+{
+ return blorb_cover_extent(blorb_file, extent, NULL);
+}
+static int32 get_story_file_cover_format(void *blorb_file, int32 extent)
+{
+ return blorb_cover_format(blorb_file, extent, NULL);
+}
+static int32 get_story_file_cover_offset(void *blorb_file, int32 extent)
+{
+ return blorb_cover_offset(blorb_file, extent, NULL);
+}
+static int32 get_story_file_IFID(void *blorb_file, int32 extent, char *output, int32 output_extent)
+{
+ return blorb_IFID(blorb_file, extent, NULL, output, output_extent);
+}
+static int32 get_story_file_metadata(void *blorb_file, int32 extent, char *output, int32 output_extent)
+{
+ return blorb_metadata(blorb_file, extent, NULL, output, output_extent);
 }
 static int32 get_story_file_cover(void *blorb_file, int32 extent, void *output, int32 output_extent)
 {
- int32 i,j;
- if (!blorb_get_cover(blorb_file, extent,&i,&j)) return NO_REPLY_RV;
- ASSERT_OUTPUT_SIZE(j);
- memcpy(output,(char *)blorb_file+i,j);
- return j;
+ return blorb_cover(blorb_file, extent, NULL, output, output_extent);
+}
+
+static int32 indexed_query(int32 selector, void *blorb_file, int32 extent, void *index, void *output, int32 output_extent)
+{
+ struct blorb_index *ix=(struct blorb_index *) index;
+ switch(selector)
+ {
+  case GET_STORY_FILE_METADATA_EXTENT_SEL:
+                return blorb_metadata_extent(blorb_file, extent, ix);
+  case GET_STORY_FILE_METADATA_SEL:
+                return blorb_metadata(blorb_file, extent, ix, (char *)output, output_extent);
+  case GET_STORY_FILE_COVER_EXTENT_SEL:
+                return blorb_cover_extent(blorb_file, extent, ix);
+  case GET_STORY_FILE_COVER_FORMAT_SEL:
+                return blorb_cover_format(blorb_file, extent, ix);
+  case GET_STORY_FILE_COVER_OFFSET_SEL:
+                return blorb_cover_offset(blorb_file, extent, ix);
+  case GET_STORY_FILE_COVER_SEL:
+                return blorb_cover(blorb_file, extent, ix, output, output_extent);
+  case GET_STORY_FILE_IFID_SEL:
+                return blorb_IFID(blorb_file, extent, ix, (char *)output, output_extent);
+  case CONTAINER_GET_STORY_FORMAT_SEL:
+                return blorb_story_format(blorb_file, extent, ix, (char *)output, output_extent);
+  case CONTAINER_GET_STORY_EXTENT_SEL:
+                return blorb_story_extent(blorb_file, extent, ix);
+  case CONTAINER_GET_STORY_FILE_SEL:
+                return blorb_story_file(blorb_file, extent, ix, output, output_extent);
+  case CONTAINER_GET_STORY_OFFSET_SEL:
+                return blorb_story_offset(blorb_file, extent, ix);
+ }
+ return UNAVAILABLE_RV;
 }
 
 static int32 claim_story_file(void *story_file, int32 extent)
@@ -0,0 +1,238 @@
+/* blorb_writer.c   the streaming blorb writer
+ *
+ * This file depends upon blorb_writer.h, treaty.h and misc.c
+ *
+ * See blorb_writer.h for usage.
+ *
+ * On Linux, file data is copied to the blorb with sendfile, so it never
+ * passes through user space; elsewhere (or if BABEL_NO_SENDFILE is
+ * defined), it is copied through a small buffer.
+ */
+
+#include "blorb_writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && !defined(BABEL_NO_SENDFILE)
+#define BABEL_USE_SENDFILE
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+void *my_malloc(int32, char *);
+
+#define BLORB_COPY_BUFFER 65536
+
+struct blorb_wchunk {
+ char type[4];
+ char raw;                      /* data includes its own chunk header */
+ char usage[4];
+ char indexed;                  /* entered in the resource index */
+ int32 number;
+ char *path;                    /* source file, or NULL */
+ int32 offset;
+ void *data;                    /* source buffer, if path is NULL */
+ int32 extent;
+ struct blorb_wchunk *next;
+};
+
+struct blorb_writer {
+ struct blorb_wchunk *first, *last;
+ int32 resources;
+};
+
+struct blorb_writer *blorb_writer_create(void)
+{
+ return (struct blorb_writer *) my_malloc(sizeof(struct blorb_writer),"blorb writer");
+}
+
+static struct blorb_wchunk *blorb_writer_add(struct blorb_writer *w, char *type, char *usage, int32 number, int32 extent)
+{
+ struct blorb_wchunk *c;
+ if (extent<0) return NULL;
+ c=(struct blorb_wchunk *) my_malloc(sizeof(struct blorb_wchunk),"blorb chunk");
+ if (type) memcpy(c->type,type,4);
+ else c->raw=1;
+ if (usage)
+ {
+  memcpy(c->usage,usage,4);
+  c->indexed=1;
+  w->resources++;
+ }
+ c->number=number;
+ c->extent=extent;
+ if (w->last) w->last->next=c;
+ else w->first=c;
+ w->last=c;
+ return c;
+}
+
+int32 blorb_writer_add_buffer(struct blorb_writer *w, char *type, char *usage, int32 number, void *data, int32 extent)
+{
+ struct blorb_wchunk *c;
+ if (!type) return 0;
+ c=blorb_writer_add(w,type,usage,number,extent);
+ if (!c) return 0;
+ c->data=data;
+ return 1;
+}
+
+int32 blorb_writer_add_file(struct blorb_writer *w, char *type, char *usage, int32 number, char *path, int32 offset, int32 extent)
+{
+ struct blorb_wchunk *c;
+ struct stat st;
+ if (stat(path,&st) || offset<0 || offset>st.st_size) return 0;
+ if (extent<0)
+ {
+  if (st.st_size-offset>0x7FFFFFF0L) return 0;
+  extent=st.st_size-offset;
+ }
+ else if (extent>st.st_size-offset) return 0;
+ if (!type && extent<8) return 0;
+ c=blorb_writer_add(w,type,usage,number,extent);
+ if (!c) return 0;
+ c->path=(char *) my_malloc(strlen(path)+1,"blorb chunk path");
+ strcpy(c->path,path);
+ c->offset=offset;
+ return 1;
+}
+
+void blorb_writer_release(struct blorb_writer *w)
+{
+ struct blorb_wchunk *c, *n;
+ for(c=w->first;c;c=n)
+ {
+  n=c->next;
+  if (c->path) free(c->path);
+  free(c);
+ }
+ free(w);
+}
+
+/* The number of bytes a chunk occupies in the blorb */
+static int32 blorb_chunk_size(struct blorb_wchunk *c)
+{
+ return (c->raw ? 0 : 8) + c->extent + (c->extent%2);
+}
+
+static void blorb_write_int(int32 i, FILE *f)
+{
+ char bf[4];
+ bf[0]=(((unsigned) i) >> 24) & 0xFF;
+ bf[1]=(((unsigned) i) >> 16) & 0xFF;
+ bf[2]=(((unsigned) i) >> 8) & 0xFF;
+ bf[3]=(((unsigned) i)) & 0xFF;
+ fwrite(bf,1,4,f);
+}
+
+/* Copies extent bytes of path, from offset, to f */
+static int32 blorb_copy_file(char *path, int32 offset, int32 extent, FILE *f)
+{
+ FILE *in;
+ char *buf;
+ int32 l;
+#ifdef BABEL_USE_SENDFILE
+ int fd=open(path,O_RDONLY);
+ if (fd>=0)
+ {
+  off_t off=offset;
+  ssize_t n=0;
+  fflush(f);
+  while(extent>0 && (n=sendfile(fileno(f),fd,&off,extent))>0)
+   extent-=n;
+  close(fd);
+  /* Bring stdio back into step with the descriptor */
+  fseek(f,0,SEEK_END);
+  /* If sendfile could not be used at all, copy through a buffer below */
+  if (!(n<0 && off==offset)) return extent==0;
+ }
+#endif
+ in=fopen(path,"rb");
+ if (!in || fseek(in,offset,SEEK_SET))
+ {
+  if (in) fclose(in);
+  return 0;
+ }
+ buf=(char *) my_malloc(BLORB_COPY_BUFFER,"blorb copy buffer");
+ while(extent>0)
+ {
+  l=fread(buf,1,extent<BLORB_COPY_BUFFER ? extent : BLORB_COPY_BUFFER,in);
+  if (l<=0 || fwrite(buf,1,l,f)!=(size_t) l) break;
+  extent-=l;
+ }
+ free(buf);
+ fclose(in);
+ return extent==0;
+}
+
+int32 blorb_writer_write(struct blorb_writer *w, FILE *f)
+{
+ struct blorb_wchunk *c;
+ int32 total, pos;
+ double check;
+
+ /* Work out the size of the file, and so the position of each chunk */
+ total=4+8+4+12*w->resources;
+ check=total;
+ for(c=w->first;c;c=c->next)
+ {
+  total+=blorb_chunk_size(c);
+  check+=blorb_chunk_size(c);
+ }
+ if (check>0x7FFFFFF0L) return 0;
+
+ fwrite("FORM",1,4,f);
+ blorb_write_int(total,f);
+ fwrite("IFRSRIdx",1,8,f);
+ blorb_write_int(4+12*w->resources,f);
+ blorb_write_int(w->resources,f);
+ pos=12+8+4+12*w->resources;
+ for(c=w->first;c;c=c->next)
+ {
+  if (c->indexed)
+  {
+   fwrite(c->usage,1,4,f);
+   blorb_write_int(c->number,f);
+   blorb_write_int(pos,f);
+  }
+  pos+=blorb_chunk_size(c);
+ }
+
+ for(c=w->first;c;c=c->next)
+ {
+  if (!c->raw)
+  {
+   fwrite(c->type,1,4,f);
+   blorb_write_int(c->extent,f);
+  }
+  if (c->path)
+  {
+   if (!blorb_copy_file(c->path,c->offset,c->extent,f)) return 0;
+  }
+  else if (c->extent && fwrite(c->data,1,c->extent,f)!=(size_t) c->extent)
+   return 0;
+  if (c->extent%2) fwrite("\0",1,1,f);
+ }
+ return !ferror(f);
+}
+
+int32 blorb_resource_type(void *data, int32 extent, char **type, char **usage)
+{
+ unsigned char *d=(unsigned char *) data;
+ *usage="Pict";
+ if (extent>=8 && memcmp(d,"\211PNG\r\n\032\n",8)==0) *type="PNG ";
+ else if (extent>=3 && d[0]==0xFF && d[1]==0xD8 && d[2]==0xFF) *type="JPEG";
+ else
+ {
+  *usage="Snd ";
+  if (extent>=12 && memcmp(d,"FORM",4)==0 && memcmp(d+8,"AIFF",4)==0) *type=NULL;
+  else if (extent>=4 && memcmp(d,"OggS",4)==0) *type="OGGV";
+  else if (extent>=1084 && (memcmp(d+1080,"M.K.",4)==0 || memcmp(d+1080,"M!K!",4)==0))
+   *type="MOD ";
+  else return 0;
+ }
+ return 1;
+}
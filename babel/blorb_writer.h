@@ -0,0 +1,40 @@
+/* blorb_writer.h  declarations for the streaming blorb writer
+ *
+ * This file depends upon treaty.h
+ *
+ * A blorb writer collects the chunks of a blorb file, each taken from a
+ * region of a file or from a buffer, and then writes the blorb in one pass.
+ * File data is copied straight from the source file when it is written,
+ * so a blorb of any size is assembled in constant memory.  The resource
+ * index is computed from the chunk sizes before anything is written.
+ */
+
+#ifndef BLORB_WRITER_H
+#define BLORB_WRITER_H
+
+#include "treaty.h"
+#include <stdio.h>
+
+struct blorb_writer *blorb_writer_create(void);
+ /* Create an empty blorb writer */
+int32 blorb_writer_add_buffer(struct blorb_writer *, char *type, char *usage,
+                              int32 number, void *data, int32 extent);
+ /* Add a chunk of the given type whose data is in a buffer.  If usage
+    is not NULL (eg. "Exec", "Pict" or "Snd "), the chunk is entered in
+    the resource index under that usage and number.  The buffer must
+    remain valid until the blorb is written. */
+int32 blorb_writer_add_file(struct blorb_writer *, char *type, char *usage,
+                            int32 number, char *path, int32 offset, int32 extent);
+ /* As above, but the data is extent bytes of the named file, starting
+    at offset.  If extent is negative, the rest of the file is used.
+    If type is NULL, the data is already a complete chunk (eg. an AIFF
+    file), and is written as it stands. */
+int32 blorb_writer_write(struct blorb_writer *, FILE *);
+ /* Write the blorb.  Returns nonzero on success */
+void blorb_writer_release(struct blorb_writer *);
+ /* Free the writer */
+int32 blorb_resource_type(void *data, int32 extent, char **type, char **usage);
+ /* Deduce the chunk type and usage of a picture or sound from its first
+    bytes.  Returns zero if the data is not recognized */
+
+#endif
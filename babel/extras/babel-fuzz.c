@@ -0,0 +1,921 @@
+/*
+  babel-fuzz : fuzzing and benchmark harness for the babel treaty modules
+  This code is freely usable for all purposes.
+
+  This work is licensed under the Creative Commons Attribution2.5 License.
+  To view a copy of this license, visit
+  http://creativecommons.org/licenses/by/2.5/ or send a letter to
+  Creative Commons,
+  543 Howard Street, 5th Floor,
+  San Francisco, California, 94105, USA.
+
+  To build:
+  compile this file. Link it with babel.a and ifiction.a (or babel.lib
+  and ifiction.lib), made by the babel makefile, or use
+  "make babel-fuzz" there.
+
+  To build a libFuzzer target, define BABEL_LIBFUZZER, eg.
+   clang -g -fsanitize=fuzzer,address -DBABEL_LIBFUZZER -I.. babel-fuzz.c
+         ../babel.a ../ifiction.a
+  and define BABEL_FUZZ_SELECTOR as well (eg. -DBABEL_FUZZ_SELECTOR=0x308)
+  to make a target which asks only that selector.
+
+  Usage:
+   babel-fuzz -corpus <directory>
+     Writes a synthetic story file of every format into the directory,
+     as seeds for a fuzzer (or for -bench)
+   babel-fuzz -bench [<directory>] [-seconds <n>]
+     Identifies each story in the directory (or, with no directory, each
+     synthetic story) over and over for about n seconds (default 5),
+     fetching its IFID and metadata, and reports the files and megabytes
+     per second achieved for each format, and how many claims babel made
+     of the modules to identify each file
+   babel-fuzz -uuid [<directory>] [-seconds <n>]
+     Looks for an embedded UUID:// IFID in each story in the directory
+     (eg. Glulx images taken from gblorbs with babel -story) or, with no
+     directory, in two synthetic 16MB Glulx images, over and over for
+     about n seconds (default 5), with babel_find_uuid and with the loop
+     the zcode, glulx and hugo modules used before it, and reports the
+     megabytes per second each achieves
+   babel-fuzz -md5 <directory> [-threads <n>] [-seconds <n>]
+     Computes the MD5 IFID of each file in the directory over and over for
+     about n seconds (default 5): as babel did before it could stream,
+     reading each file whole and hashing it with one call to md5.c; with
+     babel_md5_ifid_file; and with babel_md5_ifid_file from n threads
+     (default 4) at once, as babel -batch -md5 -j does.  It reports the
+     megabytes per second each achieves.  The files are read once first,
+     so this measures hashing from the page cache rather than the disk
+   babel-fuzz <file>...
+     Asks every selector of every module about each file, directly and
+     through the babel handler.  This is a target for AFL (babel-fuzz @@)
+     or any fuzzer which runs a program on a file
+
+  Each story is copied into a buffer of its exact size, and each reply is
+  written into a buffer of exactly the extent the module is told it has,
+  so that an address sanitizer sees any access out of bounds.
+*/
+
+#include "babel_handler.h"
+#include "babel_registry.h"
+#include "babel_profile.h"
+#include "blorb_writer.h"
+#include "md5.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_THREADS)
+#define BABEL_USE_THREADS
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+void *my_malloc(int32, char *);
+int32 babel_find_uuid(void *, int32, int32 *);
+
+/* Replies are limited to this, whatever extent a module asks for */
+#define FUZZ_MAX_REPLY 0x1000000
+
+/* The selectors which are asked about a story */
+static int32 story_selectors[] = {
+ CLAIM_STORY_FILE_SEL,
+ GET_STORY_FILE_METADATA_EXTENT_SEL,
+ GET_STORY_FILE_COVER_EXTENT_SEL,
+ GET_STORY_FILE_COVER_FORMAT_SEL,
+ GET_STORY_FILE_COVER_OFFSET_SEL,
+ GET_STORY_FILE_IFID_SEL,
+ GET_STORY_FILE_METADATA_SEL,
+ GET_STORY_FILE_COVER_SEL,
+ GET_STORY_FILE_EXTENSION_SEL,
+ 0
+};
+
+static int32 container_selectors[] = {
+ CONTAINER_GET_STORY_FORMAT_SEL,
+ CONTAINER_GET_STORY_EXTENT_SEL,
+ CONTAINER_GET_STORY_FILE_SEL,
+ CONTAINER_GET_STORY_OFFSET_SEL,
+ CONTAINER_GET_INDEX_EXTENT_SEL,
+ 0
+};
+
+/* Selectors whose reply is as long as another selector says */
+static int32 reply_extent(int32 sel)
+{
+ switch(sel)
+ {
+  case GET_STORY_FILE_METADATA_SEL: return GET_STORY_FILE_METADATA_EXTENT_SEL;
+  case GET_STORY_FILE_COVER_SEL: return GET_STORY_FILE_COVER_EXTENT_SEL;
+  case CONTAINER_GET_STORY_FILE_SEL: return CONTAINER_GET_STORY_EXTENT_SEL;
+ }
+ return 0;
+}
+
+static int32 wanted(int32 sel)
+{
+#ifdef BABEL_FUZZ_SELECTOR
+ return sel==BABEL_FUZZ_SELECTOR || sel==CLAIM_STORY_FILE_SEL;
+#else
+ return sel!=0;
+#endif
+}
+
+/* Asks a module one selector, with a reply buffer of exactly the extent
+   it is given */
+static void fuzz_call(TREATY t, int32 sel, void *sf, int32 extent)
+{
+ void *out;
+ int32 l=TREATY_MINIMUM_EXTENT;
+ if (reply_extent(sel))
+ {
+  l=t(reply_extent(sel),sf,extent,NULL,0);
+  if (l<=0 || l>FUZZ_MAX_REPLY) return;
+ }
+ if (!(sel & TREATY_SELECTOR_OUTPUT)) l=0;
+ out=l ? malloc(l) : NULL;
+ if (l && !out) return;
+ t(sel,sf,extent,out,l);
+ if (out) free(out);
+}
+
+/* Runs one input through every module and the babel handler */
+static void fuzz_one(const unsigned char *data, int32 extent)
+{
+ TREATY *treaties, *containers;
+ void *registry, *sf, *ctx;
+ struct babel_image im;
+ int32 i, j, l;
+ char *buf;
+
+ /* An exact copy, so that reading past the end is caught */
+ sf=malloc(extent ? extent : 1);
+ if (!sf) return;
+ memcpy(sf,data,extent);
+
+ registry=babel_registry_acquire(&treaties,&containers);
+ for(i=0;treaties[i];i++)
+  for(j=0;story_selectors[j];j++)
+   if (wanted(story_selectors[j])) fuzz_call(treaties[i],story_selectors[j],sf,extent);
+ for(i=0;containers[i];i++)
+ {
+  for(j=0;story_selectors[j];j++)
+   if (wanted(story_selectors[j])) fuzz_call(containers[i],story_selectors[j],sf,extent);
+  for(j=0;container_selectors[j];j++)
+   if (wanted(container_selectors[j])) fuzz_call(containers[i],container_selectors[j],sf,extent);
+ }
+ babel_registry_release(registry);
+
+ /* The handler's own path, with the indexes it builds */
+ ctx=get_babel_ctx();
+ if (babel_init_raw_ctx(sf,extent,ctx))
+ {
+  babel_get_cover_ctx(&im,ctx);
+  for(j=0;story_selectors[j];j++)
+  {
+   if (!wanted(story_selectors[j]) || story_selectors[j]==CLAIM_STORY_FILE_SEL) continue;
+   l=TREATY_MINIMUM_EXTENT;
+   if (reply_extent(story_selectors[j]))
+   {
+    l=babel_treaty_ctx(reply_extent(story_selectors[j]),NULL,0,ctx);
+    if (l<=0 || l>FUZZ_MAX_REPLY) continue;
+   }
+   if (!(story_selectors[j] & TREATY_SELECTOR_OUTPUT)) l=0;
+   buf=l ? (char *) malloc(l) : NULL;
+   if (l && !buf) continue;
+   babel_treaty_ctx(story_selectors[j],buf,l,ctx);
+   if (buf) free(buf);
+  }
+ }
+ babel_release_ctx(ctx);
+ release_babel_ctx(ctx);
+ free(sf);
+}
+
+#ifdef BABEL_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+ if (size<=0x7FFFFFFFL) fuzz_one(data,(int32) size);
+ return 0;
+}
+
+#else
+
+/* A synthetic story file */
+struct story {
+ char *name;
+ unsigned char *data;
+ int32 extent;
+};
+
+static unsigned char *story_buffer(struct story *s, char *name, int32 extent)
+{
+ s->name=name;
+ s->extent=extent;
+ s->data=(unsigned char *) my_malloc(extent,"synthetic story");
+ return s->data;
+}
+
+static void put_be(unsigned char *p, int32 n, int32 v)
+{
+ while(n--) { p[n]=(unsigned char) v; v>>=8; }
+}
+
+static void put_le(unsigned char *p, int32 n, int32 v)
+{
+ int32 i;
+ for(i=0;i<n;i++) { p[i]=(unsigned char) v; v>>=8; }
+}
+
+static char game_info[] = "Name: Synthetic Story\nAuthor: babel-fuzz\nIFID: FUZZ-0001\n";
+
+static char ifiction[] =
+ "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+ "<ifindex version=\"1.0\" xmlns=\"http://babel.ifarchive.org/protocol/iFiction/\">\n"
+ "<story><identification><ifid>FUZZ-0002</ifid><format>zcode</format></identification>\n"
+ "<bibliographic><title>Synthetic Story</title><author>babel-fuzz</author></bibliographic>\n"
+ "</story></ifindex>\n";
+
+static void make_zcode(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.z5",0x400);
+ int32 i;
+ sf[0]=5;
+ put_be(sf+2,2,1);
+ for(i=4;i<=14;i+=2) put_be(sf+i,2,0x40);
+ memcpy(sf+0x12,"060101",6);
+}
+
+static void make_glulx(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.ulx",0x400);
+ memcpy(sf,"Glul",4);
+ put_be(sf+4,4,0x00030102L);
+ put_be(sf+8,4,0x100);
+ put_be(sf+12,4,0x400);
+ put_be(sf+16,4,0x400);
+ put_be(sf+20,4,0x1000);
+ memcpy(sf+0x24,"Info",4);
+ put_be(sf+0x34,2,1);
+ memcpy(sf+0x36,"060101",6);
+}
+
+static void make_tads2(struct story *s)
+{
+ unsigned char *sf;
+ int32 l=strlen(game_info), end;
+ static char header[] = "TADS2 bin\012\015\032\000v2.2.0\000\000\000Sat Apr 15 12:00:00 2006  ";
+ /* Header, HTMLRES section holding GameInfo.txt, and $EOF section */
+ end=48+8+4+8+10+12+l;
+ sf=story_buffer(s,"synthetic.gam",end+9);
+ memcpy(sf,header,48);
+ sf[48]=7;
+ memcpy(sf+49,"HTMLRES",7);
+ put_le(sf+56,4,end);
+ put_le(sf+60,4,1);
+ put_le(sf+68,4,0);
+ put_le(sf+72,4,l);
+ put_le(sf+76,2,12);
+ memcpy(sf+78,"GameInfo.txt",12);
+ memcpy(sf+90,game_info,l);
+ sf[end]=4;
+ memcpy(sf+end+1,"$EOF",4);
+ put_le(sf+end+5,4,end+9);
+}
+
+static void make_tads3(struct story *s)
+{
+ unsigned char *sf, *p;
+ int32 l=strlen(game_info), i;
+ /* Header, ENTP, MRES holding GameInfo.txt, and EOF blocks */
+ sf=story_buffer(s,"synthetic.t3",69+14+10+2+21+l+10);
+ memcpy(sf,"T3-image\015\012\032",11);
+ put_le(sf+11,2,1);
+ memcpy(sf+45,"Sat Apr 15 12:00:00 2006",24);
+ p=sf+69;
+ memcpy(p,"ENTP",4);
+ put_le(p+4,4,4);
+ p+=14;
+ memcpy(p,"MRES",4);
+ put_le(p+4,4,2+21+l);
+ p+=10;
+ put_le(p,2,1);
+ put_le(p+2,4,2+21);
+ put_le(p+6,4,l);
+ p[10]=12;
+ for(i=0;i<12;i++) p[11+i]=(unsigned char) ~"GameInfo.txt"[i];
+ memcpy(p+23,game_info,l);
+ p+=23+l;
+ memcpy(p,"EOF ",4);
+}
+
+static void make_hugo(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.hex",0x100);
+ sf[0]=31;
+ memcpy(sf+3,"06-01-01",8);
+}
+
+static void make_agt(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.agx",0x100);
+ memcpy(sf,"\x58\xC7\xC1\x51",4);
+}
+
+/* A version 2 game, with the length and checksum of the first entry of
+   the level9 module's registry */
+static void make_level9(struct story *s)
+{
+ unsigned char *sf, sum;
+ int32 i, l=0x0fd8;
+ sf=story_buffer(s,"synthetic.l9",l+32);
+ sf[4]=0x20;
+ sf[0x0b]=0x80;
+ put_le(sf+0x1c,2,l);
+ for(sum=0,i=0;i<l;i++) sum+=sf[i];
+ sf[l]=(unsigned char) -sum;
+}
+
+static void make_magscrolls(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.mag",42);
+ memcpy(sf,"MaSc",4);
+}
+
+/* ADRIFT files are obfuscated with the Visual Basic random number
+   generator, as adrift.c describes */
+static void make_adrift(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.taf",64);
+ int32 state=0x00A09E86L, i;
+ for(i=0;i<12;i++)
+ {
+  state=(state*0x43FD43FDL+0x00C39EC3L) & 0x00FFFFFFL;
+  sf[i]="Version 4.00"[i] ^ (unsigned char) (255UL*(unsigned long) state/0x01000000UL);
+ }
+}
+
+static void make_alan(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.acd",0x100);
+ int32 i, crc=0;
+ put_be(sf+4,4,0x40);
+ for(i=160;i<0x100;i++) crc+=sf[i]=(unsigned char) i;
+ put_be(sf+152,4,crc);
+}
+
+static void make_advsys(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.dat",64);
+ int32 i;
+ for(i=0;i<6;i++) sf[i+2]=(unsigned char) (~"ADVSYS"[i]-30);
+}
+
+static void make_executable(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"synthetic.exe",64);
+ memcpy(sf,"MZ",2);
+}
+
+/* A blorb of the z-code story and some iFiction, made by the blorb writer */
+static void make_blorb(struct story *s, struct story *zcode)
+{
+ struct blorb_writer *w;
+ FILE *f;
+ long l;
+ w=blorb_writer_create();
+ blorb_writer_add_buffer(w,"ZCOD","Exec",0,zcode->data,zcode->extent);
+ blorb_writer_add_buffer(w,"IFmd",NULL,0,ifiction,strlen(ifiction));
+ f=tmpfile();
+ if (!f || !blorb_writer_write(w,f))
+ {
+  fprintf(stderr,"Error: could not make a blorb\n");
+  exit(1);
+ }
+ blorb_writer_release(w);
+ l=ftell(f);
+ rewind(f);
+ fread(story_buffer(s,"synthetic.zblorb",l),1,l,f);
+ fclose(f);
+}
+
+/* A regression case: a blorb whose only chunk claims to be nearly 2GB
+   long, which once made the chunk walkers' offsets wrap negative */
+static void make_overlong_blorb(struct story *s)
+{
+ unsigned char *sf=story_buffer(s,"overlong.blorb",100);
+ memset(sf,0,100);
+ memcpy(sf,"FORM",4);
+ put_be(sf+4,4,92);
+ memcpy(sf+8,"IFRSABCD",8);
+ put_be(sf+16,4,0x7FFFFFF5L);
+}
+
+#define CORPUS_SIZE 14
+
+static void make_corpus(struct story *c)
+{
+ make_zcode(c);
+ make_glulx(c+1);
+ make_tads2(c+2);
+ make_tads3(c+3);
+ make_hugo(c+4);
+ make_agt(c+5);
+ make_level9(c+6);
+ make_magscrolls(c+7);
+ make_adrift(c+8);
+ make_alan(c+9);
+ make_advsys(c+10);
+ make_executable(c+11);
+ make_blorb(c+12,c);
+ make_overlong_blorb(c+13);
+}
+
+static void write_corpus(char *dir)
+{
+ struct story c[CORPUS_SIZE];
+ char *path;
+ FILE *f;
+ int32 i;
+ make_corpus(c);
+ for(i=0;i<CORPUS_SIZE;i++)
+ {
+  path=(char *) my_malloc(strlen(dir)+strlen(c[i].name)+2,"path");
+  sprintf(path,"%s/%s",dir,c[i].name);
+  f=fopen(path,"wb");
+  if (!f || fwrite(c[i].data,1,c[i].extent,f)!=(size_t) c[i].extent)
+  {
+   fprintf(stderr,"Error: could not write %s\n",path);
+   exit(1);
+  }
+  fclose(f);
+  printf("%s\n",path);
+  free(path);
+  free(c[i].data);
+ }
+}
+
+static unsigned char *read_file(char *name, int32 *extent)
+{
+ FILE *f;
+ unsigned char *data;
+ long l;
+ f=fopen(name,"rb");
+ if (!f) return NULL;
+ fseek(f,0,SEEK_END);
+ l=ftell(f);
+ fseek(f,0,SEEK_SET);
+ if (l<0 || l>0x7FFFFFFFL) { fclose(f); return NULL; }
+ data=(unsigned char *) my_malloc(l ? l : 1,"story file");
+ *extent=fread(data,1,l,f);
+ fclose(f);
+ return data;
+}
+
+/* Reads the regular files of a directory, returning how many there are */
+static int32 read_dir(char *dir, struct story **stories)
+{
+ DIR *d;
+ struct dirent *de;
+ int32 n=0, size=0;
+ struct story *s=NULL, *ns;
+ char *path;
+
+ d=opendir(dir);
+ if (!d) return 0;
+ while((de=readdir(d))!=NULL)
+ {
+  if (de->d_name[0]=='.') continue;
+  if (n==size)
+  {
+   size=size ? size*2 : 64;
+   ns=(struct story *) my_malloc(size*sizeof(struct story),"story list");
+   if (s) { memcpy(ns,s,n*sizeof(struct story)); free(s); }
+   s=ns;
+  }
+  path=(char *) my_malloc(strlen(dir)+strlen(de->d_name)+2,"path");
+  sprintf(path,"%s/%s",dir,de->d_name);
+  s[n].data=read_file(path,&s[n].extent);
+  s[n].name=path;
+  if (s[n].data) n++;
+  else free(path);
+ }
+ closedir(d);
+ *stories=s;
+ return n;
+}
+
+/* The results of a benchmark, for one format */
+struct bench_format {
+ char format[TREATY_MINIMUM_EXTENT];
+ double files;
+ double bytes;
+ double seconds;
+ double claims;                 /* claims made identifying each file once */
+ double counted;                /* the files whose claims were counted */
+};
+
+/* Identifies a story as babel would, putting its format (or nothing) in
+   format, and returns the time it took */
+static double bench_one(struct story *s, void *ctx, char *format)
+{
+ char buf[TREATY_MINIMUM_EXTENT], *md, *f;
+ clock_t start;
+ int32 l;
+ start=clock();
+ f=babel_init_raw_ctx(s->data,s->extent,ctx);
+ format[0]=0;
+ if (f)
+ {
+  strncpy(format,f,TREATY_MINIMUM_EXTENT-1);
+  format[TREATY_MINIMUM_EXTENT-1]=0;
+  babel_treaty_ctx(GET_STORY_FILE_IFID_SEL,buf,TREATY_MINIMUM_EXTENT,ctx);
+  l=babel_treaty_ctx(GET_STORY_FILE_METADATA_EXTENT_SEL,NULL,0,ctx);
+  if (l>0)
+  {
+   md=(char *) my_malloc(l,"metadata");
+   babel_treaty_ctx(GET_STORY_FILE_METADATA_SEL,md,l,ctx);
+   free(md);
+  }
+  babel_treaty_ctx(GET_STORY_FILE_COVER_EXTENT_SEL,NULL,0,ctx);
+ }
+ babel_release_ctx(ctx);
+ return (double) (clock()-start)/CLOCKS_PER_SEC;
+}
+
+/* Returns the number of claims babel makes of the modules to identify a
+   story, counted by the profiler on a run of its own */
+static double count_claims(struct story *s, void *ctx)
+{
+ struct babel_profile_entry *e;
+ char format[TREATY_MINIMUM_EXTENT];
+ double claims=0;
+ int32 i, n;
+
+ babel_profile_reset();
+ babel_profile_enable(1);
+ bench_one(s,ctx,format);
+ babel_profile_enable(0);
+ n=babel_profile_entries(NULL,0);
+ e=(struct babel_profile_entry *) my_malloc((n+1)*sizeof(struct babel_profile_entry),"profile");
+ n=babel_profile_entries(e,n);
+ for(i=0;i<n;i++)
+  if (e[i].selector==CLAIM_STORY_FILE_SEL) claims+=e[i].calls;
+ free(e);
+ babel_profile_reset();
+ return claims;
+}
+
+static void bench(struct story *s, int32 n, double seconds)
+{
+ struct bench_format *r;
+ void *ctx;
+ char format[TREATY_MINIMUM_EXTENT];
+ double t, total=0;
+ int32 i, j, nr=0, pass;
+
+ r=(struct bench_format *) my_malloc((n+1)*sizeof(struct bench_format),"benchmark");
+ ctx=get_babel_ctx();
+ for(pass=0;pass==0 || total<seconds;pass++)
+  for(i=0;i<n;i++)
+  {
+   t=bench_one(s+i,ctx,format);
+   if (!format[0]) strcpy(format,"(unrecognized)");
+   for(j=0;j<nr && strcmp(r[j].format,format);j++);
+   if (j==nr) strcpy(r[nr++].format,format);
+   r[j].files++;
+   r[j].bytes+=s[i].extent;
+   r[j].seconds+=t;
+   total+=t;
+   if (pass==0)
+   {
+    r[j].claims+=count_claims(s+i,ctx);
+    r[j].counted++;
+   }
+  }
+ release_babel_ctx(ctx);
+
+ printf("%-24s %12s %12s %12s %12s\n","Format","Files","Files/s","MB/s","Claims/file");
+ for(j=0;j<nr;j++)
+  printf("%-24s %12.0f %12.0f %12.2f %12.1f\n",r[j].format,r[j].files,
+         r[j].seconds>0 ? r[j].files/r[j].seconds : 0,
+         r[j].seconds>0 ? r[j].bytes/1048576.0/r[j].seconds : 0,
+         r[j].counted>0 ? r[j].claims/r[j].counted : 0);
+ free(r);
+}
+
+/* The size of the synthetic images for -uuid */
+#define UUID_IMAGE 0x1000000
+
+/* Where the scanners' results go, so that the calls are not optimised away */
+static volatile int32 uuid_found;
+
+/* Finds an embedded IFID as the zcode, glulx and hugo modules did before
+   babel_find_uuid, comparing "UUID://" at every offset */
+static int32 old_find_uuid(void *story_file, int32 extent, int32 *length)
+{
+ int32 i, j;
+ for(i=0;i<extent-7;i++) if (memcmp((char *)story_file+i,"UUID://",7)==0) break;
+ if (i>=extent-7) return -1;
+ for(j=i+7;j<extent && ((char *)story_file)[j]!='/';j++);
+ if (j>=extent) return -1;
+ *length=j-i-7;
+ return i+7;
+}
+
+/* Makes a Glulx image of UUID_IMAGE bytes of noise, with an IFID just
+   before the end if ifid is set */
+static void make_uuid_image(struct story *s, char *name, int ifid)
+{
+ unsigned char *p=story_buffer(s,name,UUID_IMAGE);
+ unsigned long r=1;
+ int32 i;
+ for(i=0;i<UUID_IMAGE;i++)
+ {
+  r=r*1103515245L+12345;
+  p[i]=(unsigned char) (r>>16);
+ }
+ memcpy(p,"Glul",4);
+ if (ifid) memcpy(p+UUID_IMAGE-64,"UUID://FUZZ-UUID-0001//",23);
+}
+
+static void uuid_bench(struct story *s, int32 n, double seconds)
+{
+ int32 (*find[2])(void *, int32, int32 *);
+ static char *method[2] = { "per-byte memcmp", "babel_find_uuid" };
+ double bytes[2], t[2];
+ clock_t start;
+ int32 i, m, a, b, la=0, lb=0;
+
+ find[0]=old_find_uuid;
+ find[1]=babel_find_uuid;
+ for(i=0;i<n;i++)
+ {
+  a=old_find_uuid(s[i].data,s[i].extent,&la);
+  b=babel_find_uuid(s[i].data,s[i].extent,&lb);
+  if (a!=b || (a>=0 && la!=lb))
+   printf("Warning: %s: the scanners disagree (%ld and %ld)\n",s[i].name,(long) a,(long) b);
+ }
+ for(m=0;m<2;m++)
+ {
+  bytes[m]=t[m]=0;
+  start=clock();
+  while(t[m]<seconds/2)
+  {
+   for(i=0;i<n;i++)
+   {
+    uuid_found=find[m](s[i].data,s[i].extent,&la);
+    bytes[m]+=s[i].extent;
+   }
+   t[m]=(double) (clock()-start)/CLOCKS_PER_SEC;
+  }
+ }
+ printf("%-24s %12s\n","Scanner","MB/s");
+ for(m=0;m<2;m++)
+  printf("%-24s %12.1f\n",method[m],t[m]>0 ? bytes[m]/1048576.0/t[m] : 0);
+}
+
+/* Returns the time in seconds.  The threads of -md5 are timed by the
+   wall clock, as clock() would count the time of every thread */
+static double md5_clock(void)
+{
+#ifdef BABEL_USE_THREADS
+ struct timeval tv;
+ gettimeofday(&tv,NULL);
+ return tv.tv_sec+tv.tv_usec/1000000.0;
+#else
+ return (double) clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* Computes a file's MD5 IFID as babel did before babel_md5_ifid_file,
+   reading the whole file into memory and hashing it in one call */
+static int32 old_md5_ifid(char *name, char *buffer)
+{
+ md5_state_t md5;
+ unsigned char *data, ob[16];
+ int32 i, extent;
+ data=read_file(name,&extent);
+ if (!data) return 0;
+ md5_init(&md5);
+ md5_append(&md5,data,extent);
+ md5_finish(&md5,ob);
+ free(data);
+ for(i=0;i<16;i++) sprintf(buffer+2*i,"%02X",ob[i]);
+ return 1;
+}
+
+/* One pass of -md5 over the files, which the threads claim in turn */
+struct md5_job {
+ struct story *s;
+ int32 n, next;
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_t lock;
+#endif
+};
+
+static void *md5_worker(void *jp)
+{
+ struct md5_job *job=(struct md5_job *) jp;
+ char ifid[TREATY_MINIMUM_EXTENT];
+ int32 i;
+ for(;;)
+ {
+#ifdef BABEL_USE_THREADS
+  pthread_mutex_lock(&job->lock);
+#endif
+  i=job->next<job->n ? job->next++ : -1;
+#ifdef BABEL_USE_THREADS
+  pthread_mutex_unlock(&job->lock);
+#endif
+  if (i<0) break;
+  babel_md5_ifid_file(job->s[i].name,ifid,TREATY_MINIMUM_EXTENT);
+ }
+ return NULL;
+}
+
+#ifdef BABEL_USE_THREADS
+#define MD5_METHODS 3
+#else
+#define MD5_METHODS 2
+#endif
+
+static void md5_bench(struct story *s, int32 n, int32 threads, double seconds)
+{
+ struct md5_job job;
+ char a[TREATY_MINIMUM_EXTENT], b[TREATY_MINIMUM_EXTENT], name[64];
+ double bytes[MD5_METHODS], t[MD5_METHODS], start, pass=0;
+ int32 i, m;
+#ifdef BABEL_USE_THREADS
+ pthread_t *tid;
+ int32 started;
+ tid=(pthread_t *) my_malloc(threads*sizeof(pthread_t),"threads");
+ pthread_mutex_init(&job.lock,NULL);
+#endif
+
+ job.s=s;
+ job.n=n;
+ for(i=0;i<n;i++)
+ {
+  pass+=s[i].extent;
+  if (!old_md5_ifid(s[i].name,a) ||
+      !babel_md5_ifid_file(s[i].name,b,TREATY_MINIMUM_EXTENT) || strcmp(a,b))
+   printf("Warning: %s: the hashes differ\n",s[i].name);
+ }
+ for(m=0;m<MD5_METHODS;m++)
+ {
+  bytes[m]=t[m]=0;
+  start=md5_clock();
+  while(t[m]<seconds/MD5_METHODS)
+  {
+   job.next=0;
+   if (m==0)
+    for(i=0;i<n;i++) old_md5_ifid(s[i].name,a);
+   else if (m==1) md5_worker(&job);
+#ifdef BABEL_USE_THREADS
+   else
+   {
+    for(started=0;started<threads;started++)
+     if (pthread_create(tid+started,NULL,md5_worker,&job)) break;
+    if (!started) md5_worker(&job);
+    while(started) pthread_join(tid[--started],NULL);
+   }
+#endif
+   bytes[m]+=pass;
+   t[m]=md5_clock()-start;
+  }
+ }
+#ifdef BABEL_USE_THREADS
+ pthread_mutex_destroy(&job.lock);
+ free(tid);
+#endif
+
+ printf("%-24s %12s\n","Method","MB/s");
+ for(m=0;m<MD5_METHODS;m++)
+ {
+  if (m==0) strcpy(name,"md5.c, whole file");
+  else if (m==1) strcpy(name,"streamed");
+  else sprintf(name,"streamed, %ld threads",(long) threads);
+  printf("%-24s %12.1f\n",name,t[m]>0 ? bytes[m]/1048576.0/t[m] : 0);
+ }
+}
+
+int main(int argc, char **argv)
+{
+ struct story *s;
+ unsigned char *data;
+ double seconds=5;
+ char *dir=NULL;
+ int32 i, n, extent, threads=4;
+
+ if (argc==3 && strcmp(argv[1],"-corpus")==0)
+ {
+  write_corpus(argv[2]);
+  return 0;
+ }
+ if (argc>=2 && strcmp(argv[1],"-bench")==0)
+ {
+  for(i=2;i<argc;i++)
+   if (strcmp(argv[i],"-seconds")==0 && i+1<argc) seconds=atof(argv[++i]);
+   else dir=argv[i];
+  if (dir)
+  {
+   n=read_dir(dir,&s);
+   if (!n)
+   {
+    fprintf(stderr,"Error: no files in %s\n",dir);
+    return 1;
+   }
+  }
+  else
+  {
+   s=(struct story *) my_malloc(CORPUS_SIZE*sizeof(struct story),"corpus");
+   make_corpus(s);
+   n=CORPUS_SIZE;
+  }
+  bench(s,n,seconds);
+  for(i=0;i<n;i++)
+  {
+   free(s[i].data);
+   if (dir) free(s[i].name);
+  }
+  free(s);
+  return 0;
+ }
+ if (argc>=2 && strcmp(argv[1],"-uuid")==0)
+ {
+  for(i=2;i<argc;i++)
+   if (strcmp(argv[i],"-seconds")==0 && i+1<argc) seconds=atof(argv[++i]);
+   else dir=argv[i];
+  if (dir)
+  {
+   n=read_dir(dir,&s);
+   if (!n)
+   {
+    fprintf(stderr,"Error: no files in %s\n",dir);
+    return 1;
+   }
+  }
+  else
+  {
+   n=2;
+   s=(struct story *) my_malloc(n*sizeof(struct story),"images");
+   make_uuid_image(s,"glulx without IFID",0);
+   make_uuid_image(s+1,"glulx with IFID",1);
+  }
+  uuid_bench(s,n,seconds);
+  for(i=0;i<n;i++)
+  {
+   free(s[i].data);
+   if (dir) free(s[i].name);
+  }
+  free(s);
+  return 0;
+ }
+ if (argc>=2 && strcmp(argv[1],"-md5")==0)
+ {
+  for(i=2;i<argc;i++)
+   if (strcmp(argv[i],"-seconds")==0 && i+1<argc) seconds=atof(argv[++i]);
+   else if (strcmp(argv[i],"-threads")==0 && i+1<argc) threads=atoi(argv[++i]);
+   else dir=argv[i];
+  n=dir ? read_dir(dir,&s) : 0;
+  if (!n || threads<1)
+  {
+   fprintf(stderr,"Error: no files in %s\n",dir ? dir : "(none)");
+   return 1;
+  }
+  md5_bench(s,n,threads,seconds);
+  for(i=0;i<n;i++)
+  {
+   free(s[i].data);
+   free(s[i].name);
+  }
+  free(s);
+  return 0;
+ }
+ if (argc<2 || argv[1][0]=='-')
+ {
+  printf("Usage: babel-fuzz -corpus <directory>\n"
+         "       babel-fuzz -bench [<directory>] [-seconds <n>]\n"
+         "       babel-fuzz -uuid [<directory>] [-seconds <n>]\n"
+         "       babel-fuzz -md5 <directory> [-threads <n>] [-seconds <n>]\n"
+         "       babel-fuzz <file>...\n");
+  return 1;
+ }
+ for(i=1;i<argc;i++)
+ {
+  data=read_file(argv[i],&extent);
+  if (!data)
+  {
+   fprintf(stderr,"Error: could not read %s\n",argv[i]);
+   return 1;
+  }
+  fuzz_one(data,extent);
+  free(data);
+ }
+ return 0;
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+  babel-stress : threaded stress test of the babel module registry
+  This code is freely usable for all purposes.
+
+  This work is licensed under the Creative Commons Attribution2.5 License.
+  To view a copy of this license, visit
+  http://creativecommons.org/licenses/by/2.5/ or send a letter to
+  Creative Commons,
+  543 Howard Street, 5th Floor,
+  San Francisco, California, 94105, USA.
+
+  To build:
+  compile this file and hotload.c, and link them with babel.a and
+  ifiction.a (made by the babel makefile) and the POSIX threads library,
+  or use "make babel-stress" there.  hotload.c takes the place of
+  register.c, which is then not linked from babel.a.  A thread sanitizer
+  (-fsanitize=thread) or address sanitizer makes the test more telling.
+
+  Usage:
+   babel-stress <directory> [-threads <n>] [-seconds <n>]
+     Identifies each story in the directory (eg. one written by
+     babel-fuzz -corpus) from n threads (default 8) for about n seconds
+     (default 5), each thread taking and releasing the registry through
+     its own babel contexts, while another thread reloads every module
+     and retires and registers a module of its own over and over.
+
+  The format and IFID found for each story in every thread must be those
+  found for it before the threads start, and once they have stopped no
+  retired module may be left in use.  babel-stress reports any difference
+  and returns 1 if there was one.
+*/
+
+#include "modules.h"
+#include "babel_handler.h"
+#include "babel_registry.h"
+#include "hotload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_THREADS)
+#define BABEL_USE_THREADS
+#include <pthread.h>
+#endif
+
+void *my_malloc(int32, char *);
+
+static TREATY treaties[] = {
+        #define TREATY_REGISTER
+        #include "modules.h"
+        NULL
+        };
+
+static TREATY containers[] = {
+        #define CONTAINER_REGISTER
+        #include "modules.h"
+        NULL
+        };
+
+/* A story, and what babel makes of it */
+struct story {
+ char *name;
+ unsigned char *data;
+ int32 extent;
+ char format[TREATY_MINIMUM_EXTENT];
+ char ifid[TREATY_MINIMUM_EXTENT];
+};
+
+static struct story *stories;
+static int32 story_count;
+static time_t deadline;
+
+/* A module which claims nothing, to be retired and registered again
+   while the other modules are in use */
+static int32 stress_treaty(int32 selector, void *story_file, int32 extent, void *output, int32 output_extent)
+{
+ if (selector==GET_FORMAT_NAME_SEL || selector==GET_FILE_EXTENSIONS_SEL)
+ {
+  if (output_extent<8) return INVALID_USAGE_RV;
+  strcpy((char *) output,selector==GET_FORMAT_NAME_SEL ? "stress" : ".stress");
+  return 7;
+ }
+ if (selector==CLAIM_STORY_FILE_SEL) return INVALID_STORY_FILE_RV;
+ return UNAVAILABLE_RV;
+}
+
+static unsigned char *read_file(char *name, int32 *extent)
+{
+ FILE *f;
+ unsigned char *data;
+ long l;
+ f=fopen(name,"rb");
+ if (!f) return NULL;
+ fseek(f,0,SEEK_END);
+ l=ftell(f);
+ fseek(f,0,SEEK_SET);
+ if (l<0 || l>0x7FFFFFFFL) { fclose(f); return NULL; }
+ data=(unsigned char *) my_malloc(l ? l : 1,"story file");
+ *extent=fread(data,1,l,f);
+ fclose(f);
+ return data;
+}
+
+/* Reads the regular files of a directory, returning how many there are */
+static int32 read_dir(char *dir, struct story **stories)
+{
+ DIR *d;
+ struct dirent *de;
+ int32 n=0, size=0;
+ struct story *s=NULL, *ns;
+ char *path;
+
+ d=opendir(dir);
+ if (!d) return 0;
+ while((de=readdir(d))!=NULL)
+ {
+  if (de->d_name[0]=='.') continue;
+  if (n==size)
+  {
+   size=size ? size*2 : 64;
+   ns=(struct story *) my_malloc(size*sizeof(struct story),"story list");
+   if (s) { memcpy(ns,s,n*sizeof(struct story)); free(s); }
+   s=ns;
+  }
+  path=(char *) my_malloc(strlen(dir)+strlen(de->d_name)+2,"path");
+  sprintf(path,"%s/%s",dir,de->d_name);
+  s[n].data=read_file(path,&s[n].extent);
+  s[n].name=path;
+  if (s[n].data) n++;
+  else free(path);
+ }
+ closedir(d);
+ *stories=s;
+ return n;
+}
+
+/* Identifies a story in ctx, putting its format and IFID (or nothing) in
+   format and ifid, and releases it */
+static void identify(struct story *s, void *ctx, char *format, char *ifid)
+{
+ char *f;
+ f=babel_init_raw_ctx(s->data,s->extent,ctx);
+ format[0]=ifid[0]=0;
+ if (f)
+ {
+  strncpy(format,f,TREATY_MINIMUM_EXTENT-1);
+  format[TREATY_MINIMUM_EXTENT-1]=0;
+  if (babel_treaty_ctx(GET_STORY_FILE_IFID_SEL,ifid,TREATY_MINIMUM_EXTENT,ctx)<=0)
+   ifid[0]=0;
+ }
+ babel_release_ctx(ctx);
+}
+
+/* Registers every module babel is built with, in the order of modules.h,
+   replacing any which are already registered */
+static void register_modules(void)
+{
+ int32 i;
+ for(i=0;containers[i];i++) babel_hotload_add(containers[i],1);
+ for(i=0;treaties[i];i++) babel_hotload_add(treaties[i],0);
+}
+
+#ifdef BABEL_USE_THREADS
+
+/* Identifies the stories over and over until the deadline, counting the
+   differences found in *arg */
+static void *worker(void *arg)
+{
+ char format[TREATY_MINIMUM_EXTENT], ifid[TREATY_MINIMUM_EXTENT];
+ long *errors=(long *) arg;
+ void *ctx;
+ int32 i;
+
+ ctx=get_babel_ctx();
+ while(time(NULL)<deadline)
+  for(i=0;i<story_count;i++)
+  {
+   identify(stories+i,ctx,format,ifid);
+   if (strcmp(format,stories[i].format) || strcmp(ifid,stories[i].ifid))
+   {
+    if (!*errors)
+     fprintf(stderr,"Error: %s was identified as %s %s, not %s %s\n",
+             stories[i].name,format,ifid,stories[i].format,stories[i].ifid);
+    ++*errors;
+   }
+  }
+ release_babel_ctx(ctx);
+ return NULL;
+}
+
+/* Reloads the modules until the deadline, counting the reloads in *arg */
+static void *reloader(void *arg)
+{
+ long *reloads=(long *) arg;
+ while(time(NULL)<deadline)
+ {
+  register_modules();
+  babel_hotload_retire("stress");
+  babel_hotload_add(stress_treaty,0);
+  ++*reloads;
+ }
+ return NULL;
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef BABEL_USE_THREADS
+ struct babel_registry_module *m;
+ pthread_t *workers, reload;
+ long *errors, reloads=0, total=0;
+ char *dir=NULL;
+ void *ctx;
+ double seconds=5;
+ int32 i, n, threads=8;
+
+ for(i=1;i<argc;i++)
+  if (strcmp(argv[i],"-threads")==0 && i+1<argc) threads=atoi(argv[++i]);
+  else if (strcmp(argv[i],"-seconds")==0 && i+1<argc) seconds=atof(argv[++i]);
+  else if (argv[i][0]!='-' && !dir) dir=argv[i];
+  else { dir=NULL; break; }
+ if (!dir || threads<1)
+ {
+  printf("Usage: babel-stress <directory> [-threads <n>] [-seconds <n>]\n");
+  return 1;
+ }
+ story_count=read_dir(dir,&stories);
+ if (!story_count)
+ {
+  fprintf(stderr,"Error: no files in %s\n",dir);
+  return 1;
+ }
+
+ register_modules();
+ babel_hotload_add(stress_treaty,0);
+ ctx=get_babel_ctx();
+ for(i=0;i<story_count;i++)
+  identify(stories+i,ctx,stories[i].format,stories[i].ifid);
+ release_babel_ctx(ctx);
+
+ workers=(pthread_t *) my_malloc(threads*sizeof(pthread_t),"threads");
+ errors=(long *) my_malloc(threads*sizeof(long),"threads");
+ deadline=time(NULL)+(time_t) (seconds+0.5);
+ for(i=0;i<=threads;i++)
+  if (i==threads ? pthread_create(&reload,NULL,reloader,&reloads)
+                 : pthread_create(workers+i,NULL,worker,errors+i))
+  {
+   fprintf(stderr,"Error: could not start a thread\n");
+   return 1;
+  }
+ for(i=0;i<threads;i++)
+ {
+  pthread_join(workers[i],NULL);
+  total+=errors[i];
+ }
+ pthread_join(reload,NULL);
+
+ n=babel_registry_modules(NULL,0);
+ m=(struct babel_registry_module *) my_malloc((n+1)*sizeof(struct babel_registry_module),"modules");
+ babel_registry_modules(m,n);
+ for(i=0;i<n;i++)
+  if (m[i].retired)
+  {
+   fprintf(stderr,"Error: the retired %s module is still in use\n",m[i].format);
+   total++;
+  }
+ printf("%ld threads, %ld stories, %ld reloads, %ld differences\n",
+        (long) threads,(long) story_count,reloads,total);
+
+ for(i=0;i<story_count;i++)
+ {
+  free(stories[i].data);
+  free(stories[i].name);
+ }
+ free(stories);
+ free(workers);
+ free(errors);
+ free(m);
+ return total!=0;
+#else
+ printf("babel-stress needs POSIX threads\n");
+ return 1;
+#endif
+}
@@ -10,105 +10,404 @@
   San Francisco, California, 94105, USA.
  
 
-  This file provides the babel_hotload function, which can be used to
-  implement a dynamic loader for babel treaty modules.
+  This file provides a babel module registry whose modules may be loaded
+  and retired while the program runs, for programs which use the
+  babel_handler API for a long time.
 
+  int32 babel_hotload_add(TREATY module, int32 container);
+                Registers a module linked into the program (eg. zcode_treaty
+                from babel.a).  Returns 1 if it was registered.
+  int32 babel_hotload_file(char *path, char *symbol, int32 container);
+                Loads a plugin (a .so file) and registers the treaty function
+                called symbol in it.  If symbol is NULL, it is the file name
+                up to its first '.', followed by "_treaty": so "zcode.so" and
+                "zcode.2.so" provide zcode_treaty, as zcode.c builds it.
+                Returns 1 if it was registered.
+  int32 babel_hotload_dir(char *tdir, char *cdir);
+                Loads every plugin in tdir as a treaty module and every plugin
+                in cdir as a container module (either may be NULL).  Plugins
+                which are already registered are skipped, so the directories
+                may be scanned again to pick up new plugins.  Returns the
+                number of modules registered.
+  int32 babel_hotload_retire(char *format);
+                Takes the modules for the named format out of the registry.
+                Returns the number retired.
   int babel_hotload(char *tdir, char *cdir, load_treaty loader,
                     void *tctx, void *cctx);
-  tdir:         the directory in which Treaty modules are stored
-  cdir:         the directory in which container modules are stored
-  loader:       this function, given a file name, loads the file from the
-                current working directory and returns a TREATY function pointer.
-  tctx:         Passed as second parameter to loader when loading a treaty module
-  cctx:         Passed as second parameter to loader when loading a container
-
-  babel_hotload returns the number of treaty modules loaded.
-
-  The idea behind the babel hotloader is to provide support for a plugin-based
-  architecture to provide treaty and container modules to a program using
-  the babel_handler API. The idea is that plugins for each supported format
-  (these would be DLL files in windows, or .so files in linux, DXE files in
-  DOS, etc.) would be stored in some directory.  babel_hotload scans that
-  directory and builds the babel module registry from its contents.
-
-  To use the babel hotloader, link hotload.c instead of register.c,
-  and invoke babel_hotload before using the babel API.
+                As babel_hotload_dir, but each file is loaded by calling
+                loader with its path and tctx (for a treaty module) or cctx
+                (for a container), which returns a TREATY function pointer or
+                NULL.  Returns the number of treaty modules registered.
+
+  A module replaces any registered module of the same kind (treaty or
+  container) and format, taking its place in the order in which babel asks
+  them; otherwise new modules go last.
+
+  To use the babel hotloader, link hotload.c instead of register.c, and
+  register some modules before using the babel API.  Plugins call babel's
+  own functions (such as my_malloc), so a program which loads them must
+  export its symbols (with gcc, link it with -rdynamic).
+
+  The registry may be changed from any thread while babel contexts are in
+  use in others.  Each change publishes a new registry, and the old one is
+  kept for the contexts which took it (see babel_registry.h); a retired
+  plugin is unloaded once no context is left using it.  Note that dlopen
+  hands back the plugin already loaded from a path, so a new version of a
+  plugin must be given a new name (eg. "zcode.2.so") to be loaded while the
+  old one is still in use.
+
+  Plugins are only loaded with dlopen on platforms which have it (and not
+  if BABEL_NO_DLOPEN is defined); elsewhere, babel_hotload_file always
+  fails, and babel_hotload can be given a loader for the platform.  The
+  registry is only locked on platforms with POSIX threads (and not if
+  BABEL_NO_THREADS is defined).
 */
 
 #include "hotload.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 
-#ifdef __cplusplus
-extern "C" {
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_DLOPEN)
+#define BABEL_USE_DLOPEN
+#include <dlfcn.h>
 #endif
-int chdir(const char *);
-char *getcwd(char *, int);
-#ifdef __cplusplus
+
+#if !defined(_WIN32) && !defined(__BORLANDC__) && !defined(BABEL_NO_THREADS)
+#define BABEL_USE_THREADS
+#include <pthread.h>
+static pthread_mutex_t hotload_lock=PTHREAD_MUTEX_INITIALIZER;
+#define HOTLOAD_LOCK() pthread_mutex_lock(&hotload_lock)
+#define HOTLOAD_UNLOCK() pthread_mutex_unlock(&hotload_lock)
+#else
+#define HOTLOAD_LOCK()
+#define HOTLOAD_UNLOCK()
+#endif
+
+void * my_malloc(int32, char *);
+
+struct hotload_module {
+ TREATY treaty;
+ void *plugin;                  /* the dlopen handle, or NULL */
+ char *path;                    /* the file it came from, or NULL */
+ char format[TREATY_MINIMUM_EXTENT];
+ int32 container;
+ int32 registered;              /* in the current registry */
+ int32 users;                   /* registries which include it */
+ unsigned long calls;
+ struct hotload_module *next;
+};
+
+/* A registry, which is never changed once it is published */
+struct hotload_registry {
+ TREATY *treaties;              /* NULL-terminated */
+ TREATY *containers;            /* NULL-terminated */
+ struct hotload_module **modules;
+ int32 count;
+ int32 users;                   /* references, and one while current */
+};
+
+/* The following are guarded by hotload_lock */
+static struct hotload_registry *current;
+static struct hotload_module *modules;  /* every module which is in use */
+
+static TREATY no_modules[] = { NULL };
+
+void *babel_registry_acquire(TREATY **treaties, TREATY **containers)
+{
+ struct hotload_registry *r;
+ HOTLOAD_LOCK();
+ r=current;
+ if (r) r->users++;
+ HOTLOAD_UNLOCK();
+ *treaties=r ? r->treaties : no_modules;
+ *containers=r ? r->containers : no_modules;
+ return r;
 }
+
+static void unload_module(struct hotload_module *m)
+{
+ struct hotload_module **p;
+ for(p=&modules;*p!=m;p=&(*p)->next);
+ *p=m->next;
+#ifdef BABEL_USE_DLOPEN
+ if (m->plugin) dlclose(m->plugin);
 #endif
+ if (m->path) free(m->path);
+ free(m);
+}
 
-void * my_malloc(int, char *);
-TREATY *treaty_registry;
-TREATY *container_registry;
-char **format_registry;
+/* Drops a reference to r; hotload_lock must be held */
+static void drop_registry(struct hotload_registry *r)
+{
+ int32 i;
+ if (--r->users) return;
+ for(i=0;i<r->count;i++)
+  if (!--r->modules[i]->users) unload_module(r->modules[i]);
+ free(r->modules);
+ free(r->treaties);
+ free(r->containers);
+ free(r);
+}
 
-int babel_hotload(char *tdir, char *cdir, load_treaty hdlr, void *tctx, void *cctx)
+void babel_registry_release(void *registry)
 {
-DIR *d;
-int i;
-struct dirent *de;
-char buf[512];
-char cwd[1024];
-getcwd(cwd,1024);
-d=opendir(cdir);
-if (d)
-{
- chdir(cdir);
- i=0;
- for(de=readdir(d);de;de=readdir(d)) i++;
- i++;
- container_registry=(TREATY *)my_malloc(i*sizeof(TREATY),"Container Registry");
- rewinddir(d);
- i=0;
- for(de=readdir(d);de;de=readdir(d),i++) if (de->d_name[0]!='.')
-  container_registry[i]=hdlr(de->d_name, cctx);
- container_registry[i]=NULL;
- closedir(d);
- chdir(cwd);
-}
-else
- container_registry=(TREATY *)my_malloc(sizeof(TREATY),"Container Registry");
-d=opendir(tdir);
-i=0;
-if (d)
-{
- chdir(tdir);
- for(de=readdir(d);de;de=readdir(d)) i++;
- i++;
- treaty_registry=(TREATY *)my_malloc(i*sizeof(TREATY),"Treaty Registry");
- format_registry=(char **)my_malloc(i*sizeof(char *),"Format Name Registry");
- rewinddir(d);
- i=0;
- for(de=readdir(d);de;de=readdir(d),i++) if (de->d_name[0]!='.')
- { treaty_registry[i]=hdlr(de->d_name, tctx);
-   if (!treaty_registry[i]) i--;
-   else {
-   treaty_registry[i](GET_FORMAT_NAME_SEL,NULL,0,buf,512);
-   format_registry[i]=strdup(buf);
+ if (!registry) return;
+ HOTLOAD_LOCK();
+ drop_registry((struct hotload_registry *) registry);
+ HOTLOAD_UNLOCK();
+}
+
+unsigned long *babel_registry_counter(void *registry, TREATY module)
+{
+ struct hotload_registry *r=(struct hotload_registry *) registry;
+ int32 i;
+ if (!r) return NULL;
+ for(i=0;i<r->count;i++)
+  if (r->modules[i]->treaty==module) return &r->modules[i]->calls;
+ return NULL;
+}
+
+int32 babel_registry_modules(struct babel_registry_module *out, int32 n)
+{
+ struct hotload_module *m;
+ int32 found=0;
+ HOTLOAD_LOCK();
+ for(m=modules;m;m=m->next,found++)
+  if (found<n)
+  {
+   strcpy(out[found].format,m->format);
+   out[found].container=m->container;
+   out[found].retired=!m->registered;
+   out[found].calls=m->calls;
+  }
+ HOTLOAD_UNLOCK();
+ return found;
+}
+
+static int32 same_module(struct hotload_module *a, struct hotload_module *b)
+{
+ return a->container==b->container && strcmp(a->format,b->format)==0;
+}
+
+/* Publishes a registry made from the current one, without the modules of
+   format retire, and with the new modules added (each replacing a module
+   of the same kind and format).  Returns the number of modules which are
+   no longer registered */
+static int32 publish(struct hotload_module **add, int32 nadd, char *retire)
+{
+ struct hotload_registry *r, *old;
+ struct hotload_module *m;
+ char *used;
+ int32 i, j, nt, nc, gone=0;
+
+ used=(char *) my_malloc(nadd+1,"hotload list");
+ r=(struct hotload_registry *) my_malloc(sizeof(struct hotload_registry),"hotload registry");
+ HOTLOAD_LOCK();
+ old=current;
+ r->modules=(struct hotload_module **) my_malloc(((old ? old->count : 0)+nadd+1)*sizeof(struct hotload_module *),"hotload registry");
+ for(i=0;old && i<old->count;i++)
+ {
+  m=old->modules[i];
+  for(j=0;j<nadd;j++)
+   if (!used[j] && same_module(add[j],m)) break;
+  if (j<nadd) { used[j]=1; m=add[j]; gone++; }
+  else if (retire && strcmp(m->format,retire)==0) { gone++; continue; }
+  r->modules[r->count++]=m;
+ }
+ for(j=0;j<nadd;j++)
+  if (!used[j]) r->modules[r->count++]=add[j];
+
+ nt=nc=0;
+ r->treaties=(TREATY *) my_malloc((r->count+1)*sizeof(TREATY),"hotload registry");
+ r->containers=(TREATY *) my_malloc((r->count+1)*sizeof(TREATY),"hotload registry");
+ for(i=0;i<r->count;i++)
+ {
+  m=r->modules[i];
+  if (m->container) r->containers[nc++]=m->treaty;
+  else r->treaties[nt++]=m->treaty;
+  m->users++;
+ }
+ for(j=0;j<nadd;j++)
+ {
+  add[j]->next=modules;
+  modules=add[j];
+ }
+ if (old)
+  for(i=0;i<old->count;i++) old->modules[i]->registered=0;
+ for(i=0;i<r->count;i++) r->modules[i]->registered=1;
+ r->users=1;
+ current=r;
+ if (old) drop_registry(old);
+ HOTLOAD_UNLOCK();
+ free(used);
+ return gone;
+}
+
+/* Makes a module record, or returns NULL if t does not give its format */
+static struct hotload_module *new_module(TREATY t, void *plugin, char *path, int32 container)
+{
+ struct hotload_module *m;
+ m=(struct hotload_module *) my_malloc(sizeof(struct hotload_module),"hotload module");
+ if (t(GET_FORMAT_NAME_SEL,NULL,0,m->format,TREATY_MINIMUM_EXTENT)<0 || !m->format[0])
+ {
+  free(m);
+  return NULL;
+ }
+ m->treaty=t;
+ m->plugin=plugin;
+ m->container=container;
+ if (path)
+ {
+  m->path=(char *) my_malloc(strlen(path)+1,"hotload module");
+  strcpy(m->path,path);
+ }
+ return m;
+}
+
+/* Tells whether the file at path is a registered module */
+static int32 is_registered(char *path)
+{
+ struct hotload_module *m;
+ HOTLOAD_LOCK();
+ for(m=modules;m;m=m->next)
+  if (m->registered && m->path && strcmp(m->path,path)==0) break;
+ HOTLOAD_UNLOCK();
+ return m!=NULL;
+}
+
+/* Loads the plugin at path, or returns NULL */
+static struct hotload_module *load_plugin(char *path, char *symbol, int32 container)
+{
+#ifdef BABEL_USE_DLOPEN
+ struct hotload_module *m;
+ void *plugin;
+ TREATY t;
+ char *name, *s=NULL;
+ int32 l;
+
+ plugin=dlopen(path,RTLD_NOW|RTLD_LOCAL);
+ if (!plugin) return NULL;
+ if (!symbol)
+ {
+  name=strrchr(path,'/');
+  name=name ? name+1 : path;
+  for(l=0;name[l] && name[l]!='.';l++);
+  s=(char *) my_malloc(l+8,"hotload symbol");
+  memcpy(s,name,l);
+  strcpy(s+l,"_treaty");
+  symbol=s;
+ }
+ *(void **)(&t)=dlsym(plugin,symbol);
+ if (s) free(s);
+ m=t ? new_module(t,plugin,path,container) : NULL;
+ if (!m) dlclose(plugin);
+ return m;
+#else
+ return NULL;
+#endif
+}
+
+int32 babel_hotload_add(TREATY module, int32 container)
+{
+ struct hotload_module *m;
+ m=new_module(module,NULL,NULL,container);
+ if (!m) return 0;
+ publish(&m,1,NULL);
+ return 1;
+}
+
+int32 babel_hotload_file(char *path, char *symbol, int32 container)
+{
+ struct hotload_module *m;
+ m=load_plugin(path,symbol,container);
+ if (!m) return 0;
+ publish(&m,1,NULL);
+ return 1;
+}
+
+int32 babel_hotload_retire(char *format)
+{
+ return publish(NULL,0,format);
+}
+
+/* A growable list of new modules */
+struct hotload_list {
+ struct hotload_module **m;
+ int32 n, size;
+};
+
+/* Loads the files in dir which are not already registered, with loader
+   if it is given or as plugins if not.  Returns the number loaded */
+static int32 scan(char *dir, int32 container, load_treaty loader, void *ctx, struct hotload_list *l)
+{
+ DIR *d;
+ struct dirent *de;
+ struct hotload_module *m;
+ char *path;
+ TREATY t;
+ int32 n=0;
+
+ if (!dir || (d=opendir(dir))==NULL) return 0;
+ while((de=readdir(d))!=NULL)
+ {
+  if (de->d_name[0]=='.') continue;
+  path=(char *) my_malloc(strlen(dir)+strlen(de->d_name)+2,"hotload path");
+  sprintf(path,"%s/%s",dir,de->d_name);
+  m=NULL;
+  if (!is_registered(path))
+  {
+   if (!loader) m=load_plugin(path,NULL,container);
+   else if ((t=loader(path,ctx))!=NULL) m=new_module(t,NULL,path,container);
+  }
+  free(path);
+  if (!m) continue;
+  if (l->n==l->size)
+  {
+   struct hotload_module **nm;
+   l->size=l->size ? l->size*2 : 16;
+   nm=(struct hotload_module **) my_malloc(l->size*sizeof(struct hotload_module *),"hotload list");
+   if (l->m)
+   {
+    memcpy(nm,l->m,l->n*sizeof(struct hotload_module *));
+    free(l->m);
    }
+   l->m=nm;
+  }
+  l->m[l->n++]=m;
+  n++;
  }
- treaty_registry[i]=NULL;
- format_registry[i]=NULL;
  closedir(d);
- chdir(cwd);
+ return n;
 }
-else
+
+/* Registers the new modules of both directories at once.  Returns the
+   number registered, and the number of those which are treaty modules in
+   *treaties */
+static int32 scan_both(char *tdir, char *cdir, load_treaty loader, void *tctx, void *cctx, int32 *treaties)
 {
- treaty_registry=(TREATY *)my_malloc(sizeof(TREATY),"Treaty Registry");
- format_registry=(char **)my_malloc(sizeof(char *),"Format Name Registry");
+ struct hotload_list l;
+ int32 n;
+ l.m=NULL;
+ l.n=l.size=0;
+ scan(cdir,1,loader,cctx,&l);
+ *treaties=scan(tdir,0,loader,tctx,&l);
+ n=l.n;
+ if (n) publish(l.m,n,NULL);
+ if (l.m) free(l.m);
+ return n;
+}
 
+int32 babel_hotload_dir(char *tdir, char *cdir)
+{
+ int32 treaties;
+ return scan_both(tdir,cdir,NULL,NULL,NULL,&treaties);
 }
 
-return i;
+int babel_hotload(char *tdir, char *cdir, load_treaty hdlr, void *tctx, void *cctx)
+{
+ int32 treaties;
+ scan_both(tdir,cdir,hdlr,tctx,cctx,&treaties);
+ return treaties;
 }
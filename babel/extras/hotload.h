@@ -12,8 +12,12 @@
 */
 
 #include "treaty.h"
+#include "babel_registry.h"
 
 typedef TREATY (*load_treaty)(char *, void *);
 
 int babel_hotload(char *, char *, load_treaty, void *, void *);
-
+int32 babel_hotload_add(TREATY module, int32 container);
+int32 babel_hotload_file(char *path, char *symbol, int32 container);
+int32 babel_hotload_dir(char *tdir, char *cdir);
+int32 babel_hotload_retire(char *format);
@@ -2,14 +2,14 @@
   ifiction-aggregate : combine multiple ifiction files
   L. Ross Raszewski
   This code is freely usable for all purposes.
- 
+
   This work is licensed under the Creative Commons Attribution2.5 License.
   To view a copy of this license, visit
   http://creativecommons.org/licenses/by/2.5/ or send a letter to
   Creative Commons,
   543 Howard Street, 5th Floor,
   San Francisco, California, 94105, USA.
- 
+
   To build:
   compile this file. Link it with
   ifiction.c,  misc.c, register_ifiction.c,
@@ -19,6 +19,16 @@
   (ifiction.lib or ifiction.a) and link this
   file to them
 
+  Usage: ifiction-aggregate ifiction-file [new-data-file...]
+
+  The stories of the new data (read from the named files in turn, or from
+  stdin if there are none) are merged into the ifiction file.  Stories
+  are matched by IFID in a hash table.  When two stories share an IFID,
+  the one with the later <originated> date in its colophon is kept (the
+  newer input wins if either has no date, or if the dates are equal), and
+  it inherits the loser's <annotation> if it has none of its own.
+  Stories are written in the order in which each IFID was first seen, so
+  the existing file is never reordered and new stories follow it.
 
 */
 
@@ -36,69 +46,171 @@ static const char xml_husk[] =
         "<!-- Metadata aggregated by babel-aggregate -->\n"
         "<ifindex version=\"1.0\" xmlns=\"http://babel.ifarchive.org/protocol/iFiction/\">\n";
 
-/* A <story> tag from an iFiction file */
+/* A <story> tag from an iFiction file.  The text is left where it was
+   read, and is not copied */
 struct storyblock
 {
  char *story;
- char ifid[512];
- struct storyblock *next;
+ int32 length;
+ char *anno;                    /* <annotation> block, own or inherited */
+ int32 anno_length;
+ int32 own_anno;
+ long date;                     /* colophon's <originated> as YYYYMMDD, or -1 */
 };
 
-/* The linked list of story blocks */
-struct storyblock *stories=NULL;
-/* temporary storage for the last ifid encountered */
-char current_ifid[512];
+/* The stories which survive, one per IFID, in order of first appearance */
+struct storyblock **winners=NULL;
+int32 nwinners=0, winners_size=0;
 
-/* If fromsf contains <annotation> and tosf does not, move it over */
-void merge_anno(struct storyblock *tosf, struct storyblock *fromsf)
+/* The hash table from IFID to index in winners */
+struct ifid_slot
 {
- char *annos, *ane;
+ char *ifid;
+ int32 length;
+ int32 winner;
+};
+struct ifid_slot *table=NULL;
+int32 table_size=0, table_used=0;
 
- if (strstr(tosf->story,"<annotation>")) return;
- annos=strstr(fromsf->story,"<annotation>");
+/* The IFIDs seen since the last story was closed */
+char *pending[64];
+int32 pending_length[64];
+int32 npending=0;
 
- if (!annos) return;
- ane=strstr(annos,"</annotation>");
+static unsigned long hash_ifid(char *s, int32 l)
+{
+ unsigned long h=2166136261UL;
+ while(l--) h=((h ^ (unsigned char) *s++)*16777619UL) & 0xFFFFFFFFUL;
+ return h;
+}
+
+/* Finds the slot for an IFID (empty if it is not in the table) */
+static struct ifid_slot *find_slot(char *ifid, int32 l)
+{
+ unsigned long i=hash_ifid(ifid,l) & (table_size-1);
+ while(table[i].ifid && (table[i].length!=l || memcmp(table[i].ifid,ifid,l)))
+  i=(i+1) & (table_size-1);
+ return table+i;
+}
+
+static void add_ifid(char *ifid, int32 l, int32 winner)
+{
+ struct ifid_slot *s;
+ if (2*(table_used+1)>table_size)
+ {
+  struct ifid_slot *old=table;
+  int32 i, old_size=table_size;
+  table_size=table_size ? table_size*2 : 1024;
+  table=(struct ifid_slot *)my_malloc(table_size*sizeof(struct ifid_slot),"IFID table");
+  for(i=0;i<old_size;i++)
+   if (old[i].ifid) *find_slot(old[i].ifid,old[i].length)=old[i];
+  if (old) free(old);
+ }
+ s=find_slot(ifid,l);
+ if (s->ifid) return;
+ s->ifid=ifid;
+ s->length=l;
+ s->winner=winner;
+ table_used++;
+}
+
+/* Finds a block within a story, returning its start and setting *end past
+   its close tag */
+static char *find_block(char *s, char *open, char *close, char **end)
+{
+ char *b=strstr(s,open), *e;
+ if (!b) return NULL;
+ e=strstr(b,close);
+ if (!e) return NULL;
+ *end=e+strlen(close);
+ return b;
+}
 
- if (!ane) return;
- /* Move the end pointer past the close tag */
- ane+=13;
- *ane=0;
- tosf->story=(char *)realloc(tosf->story,strlen(tosf->story)+strlen(annos)+4);
- strcat(tosf->story,annos);
- strcat(tosf->story,"\n");
+/* Decides whether newer should replace older */
+static int newer_wins(struct storyblock *newer, struct storyblock *older)
+{
+ if (newer->date<0 || older->date<0) return 1;
+ return newer->date >= older->date;
+}
 
+/* Keeps the winner of two stories with the same IFID, which inherits
+   the loser's annotation if it has none of its own */
+static struct storyblock *adjudicate(struct storyblock *newer, struct storyblock *older)
+{
+ struct storyblock *w, *l;
+ if (newer_wins(newer,older)) { w=newer; l=older; }
+ else { w=older; l=newer; }
+ if (!w->anno && l->anno)
+ {
+  w->anno=l->anno;
+  w->anno_length=l->anno_length;
+ }
+ free(l);
+ return w;
 }
 
 /* Close tag function: builds a storyblock for each story encountered and
-adds it to the list */
+merges it into the table */
 void steal_story(struct XMLTag *xtg, void *ctx)
 {
  if (ctx) {}
  if (strcmp(xtg->tag,"ifid")==0)
  {
-  char c;
-  c=*(xtg->end);
-  *(xtg->end)=0;
-  strcpy(current_ifid,xtg->begin);
-  *(xtg->end)=c;
+  if (npending<64)
+  {
+   pending[npending]=xtg->begin;
+   pending_length[npending++]=xtg->end-xtg->begin;
+  }
  }
- else if (strcmp(xtg->tag,"story")==0 && current_ifid[0])
+ else if (strcmp(xtg->tag,"story")==0 && npending)
  {
-  char c;
+  char c, *b, *e, *dp;
   struct storyblock *n;
+  struct ifid_slot *s=NULL;
+  int32 i, w=-1;
+  int y, m=0, d=0;
+
+  n=(struct storyblock *)my_malloc(sizeof(struct storyblock), "story block");
+  n->story=xtg->begin;
+  n->length=xtg->end-xtg->begin;
+  n->date=-1;
+  /* Find the date and annotation once, while the story is a string */
   c=*(xtg->end);
   *(xtg->end)=0;
-  n=(struct storyblock *)my_malloc(sizeof(struct storyblock), "story block");
-  n->next=stories;
-  stories=n;
-  strcpy(n->ifid,current_ifid);
-/*  printf("created %s\n", current_ifid);*/
-  n->story=(char *)my_malloc(strlen(xtg->begin)+16, "Story record");
-  strcpy(n->story,xtg->begin);
+  b=find_block(n->story,"<colophon>","</colophon>",&e);
+  if (b && (dp=strstr(b,"<originated>"))!=NULL && dp<e &&
+      sscanf(dp+12,"%d-%d-%d",&y,&m,&d)>=1)
+   n->date=(long) y*10000+m*100+d;
+  b=find_block(n->story,"<annotation>","</annotation>",&e);
+  if (b)
+  {
+   n->anno=b;
+   n->anno_length=e-b;
+   n->own_anno=1;
+  }
   *(xtg->end)=c;
-  current_ifid[0]=0;
 
+  for(i=0;table_size && i<npending && w<0;i++)
+  {
+   s=find_slot(pending[i],pending_length[i]);
+   if (s->ifid) w=s->winner;
+  }
+  if (w>=0) winners[w]=adjudicate(n,winners[w]);
+  else
+  {
+   if (nwinners==winners_size)
+   {
+    struct storyblock **nw;
+    winners_size=winners_size ? winners_size*2 : 1024;
+    nw=(struct storyblock **)my_malloc(winners_size*sizeof(struct storyblock *),"story list");
+    if (winners) { memcpy(nw,winners,nwinners*sizeof(struct storyblock *)); free(winners); }
+    winners=nw;
+   }
+   w=nwinners++;
+   winners[w]=n;
+  }
+  for(i=0;i<npending;i++) add_ifid(pending[i],pending_length[i],w);
+  npending=0;
  }
 }
 
@@ -108,163 +220,95 @@ void null_eh(char *md, void *ctx)
  if (md || ctx) { }
 }
 
+/* Reads a whole stream, up to the end of its <ifindex> */
+static char *read_ifiction(FILE *f)
+{
+ char *md=NULL, *tt, *ep;
+ int32 ll=0, size=0, ii;
+ while(1)
+ {
+  if (size-ll<1024)
+  {
+   size=size ? size*2 : 65536;
+   tt=(char *)my_malloc(size+1,"file buffer");
+   if (md) { memcpy(tt,md,ll); free(md); }
+   md=tt;
+  }
+  ii=fread(md+ll,1,size-ll,f);
+  if (ii<=0) break;
+  ll+=ii;
+ }
+ md[ll]=0;
+ if (!ll) { free(md); return NULL; }
+ ep=strstr(md,"</ifindex>");
+ if (ep) *(ep+10)=0;
+ return md;
+}
+
 int main(int argc, char **argv)
 {
  FILE *f;
- char *md=NULL, *mdo, *ep;
- int ll=0;
+ char **md;
+ int32 i;
 
- struct storyblock *sf, *sf2, *sf3;
- if (argc!=2)
+ if (argc<2)
  {
-  printf("Usage: ifiction-aggregate ifiction-file < new-data\n");
+  printf("Usage: ifiction-aggregate ifiction-file [new-data-file...] [< new-data]\n");
   exit(1);
  }
 
- /* Read stdin into md */
- while(!feof(stdin))
-  {
-   char *tt, mdb[1024];
-   int ii;
-   ii=fread(mdb,1,1024,stdin);
-   tt=(char *)my_malloc(ll+ii,"file buffer");
-   if (md) { memcpy(tt,md,ll); free(md); }
-   memcpy(tt+ll,mdb,ii);
-   md=tt;
-   ll+=ii;
-   if (ii<1024) break;
-  }
-
-  /* read input file into mdo */
-  f=fopen(argv[1],"r");
+ /* Read the existing file, then the new data; all are kept in memory
+    until the output is written */
+ md=(char **)my_malloc((argc>2 ? argc : 3)*sizeof(char *),"file list");
+ f=fopen(argv[1],"r");
+ if (f)
+ {
+  md[0]=read_ifiction(f);
+  fclose(f);
+ }
+ if (argc==2) md[1]=read_ifiction(stdin);
+ for(i=2;i<argc;i++)
+ {
+  f=fopen(argv[i],"r");
   if (!f)
   {
-   mdo=NULL;
-   
+   printf("Error opening input file %s\n",argv[i]);
+   exit(1);
   }
-  else
-  {
-  fseek(f,0,SEEK_END);
-  ll=ftell(f);
-  if (ll) {
-  mdo=(char *)my_malloc(ll+2,"file buffer");
-  fseek(f,0,SEEK_SET);
-  fread(mdo,1,ll,f);
-  mdo[ll]=0;
-  ep=strstr(mdo,"</ifindex>");
-  if (ep) *(ep+10)=0;
-  }
-  else mdo=NULL;
+  md[i-1]=read_ifiction(f);
   fclose(f);
-  }
-
-  /* Reopen the file for output */
-  f=fopen(argv[1],"w");
-  if (!f) {
-           printf("Error opening output file %s\n",argv[1]);
-                exit(1);
-          }
-  /* Spit out an XML header */
-  fputs(xml_husk,f);
-
-  /* Load all the story chunks from the old file */
-  current_ifid[0]=0;
-  if (mdo) ifiction_parse(mdo, steal_story, NULL, null_eh, NULL);
+ }
 
-  /* Reverse the order of the linked list -- this ensures that if nothing
-     happens, the output file will not be reordered
-  */
-  sf=stories;
-  sf3=NULL;
-  while(sf)
+ /* Merge the stories, oldest first */
+ for(i=0;i<(argc>2 ? argc-1 : 2);i++)
+  if (md[i])
   {
-   stories=sf;
-   sf2=sf->next;
-   sf->next=sf3;
-   sf3=sf;
-   sf=sf2;
+   npending=0;
+   ifiction_parse(md[i], steal_story, NULL, null_eh, NULL);
   }
-  /* Load the new story chunks */
-  current_ifid[0]=0;
-  ifiction_parse(md, steal_story, NULL, null_eh, NULL);
 
-  /* Output each story chunk */
-  for(sf=stories;sf;sf=sf->next)
+ /* Reopen the file for output */
+ f=fopen(argv[1],"w");
+ if (!f) {
+          printf("Error opening output file %s\n",argv[1]);
+               exit(1);
+         }
+ /* Spit out an XML header */
+ fputs(xml_husk,f);
+ for(i=0;i<nwinners;i++)
+ {
+  struct storyblock *sf=winners[i];
+  fputs("<story>",f);
+  fwrite(sf->story,1,sf->length,f);
+  if (sf->anno && !sf->own_anno)
   {
-    char buf[512];
-    int fl=0;
-    /* the story has been nulled out if it lost an adjudication round */
-    if (!sf->story) continue;
-/*    printf("Considering %s (%d bytes)\n",sf->ifid, strlen(sf->story));*/
-    sprintf(buf,"<ifid>%s</ifid>",sf->ifid);
-    for(sf2=sf->next;sf2;sf2=sf2->next)
-    /* Check the remaining chunks for a collision */
-    if (/*printf("Checking for collision %x with %x\n", sf, sf2) && */sf2->story && strstr(sf2->story,buf))
-    {
-      /* A collision occurred (the current chunk has the same ifid as
-         a later chunk) We adjudicate.  If the current one loses, we
-         set a flag. If the other does, we null its story.
-         Before we do either, though, we call merge_anno to
-         save the loser's annotation tag */
-      char *cp1, *cp2, *ep1, *ep2, *dp1, *dp2;
-      int dt1, dt2;
-      /* Adjudication: Round 1: If either story lacks a colophon,
-         the current one wins (Since it's more likely to be the one
-         we just tried to add) */
-      cp1=strstr(sf->story,"<colophon>");
-      cp2=strstr(sf2->story,"<colophon>");
-      if (!cp1 || !cp2) { merge_anno(sf, sf2); free(sf2->story); sf2->story=NULL; }
-      ep1=strstr(cp1,"</colophon>");
-      ep2=strstr(cp2,"</colophon>");
-      dp1=strstr(cp1,"<originated>");
-      dp2=strstr(cp2,"<originated>");
-      if (dp1 > ep1 || dp2 > ep2) { merge_anno(sf, sf2); free(sf2->story); sf2->story=NULL; }
-      /* Adjudication: Round 2: Compare the years. Newest wins */
-      dp1+=12; dp2+=12;
-      sscanf(dp1,"%d",&dt1);
-      sscanf(dp2,"%d",&dt2);
-      dp1+=5;
-      dp2+=5;
-      if (dt1 < dt2) { merge_anno(sf2, sf); fl=1; break; }
-      else if (dt2 < dt1) { merge_anno(sf, sf2); free(sf2->story); sf2->story=NULL; }
-      else
-      {
-       /* Adjudication: Round 3: Compare the months. Newest wins. */
-       dt1=0; dt2=0;
-       sscanf(dp1,"%d",&dt1);
-       sscanf(dp2,"%d",&dt2);
-       if (dt1<10) dp1+=2; else dp1+=3;
-       if (dt2<10) dp2+=2; else dp2+=3;
-       if (dt1 < dt2) { merge_anno(sf2, sf); fl=1; break; }
-       else if (dt2 < dt1) { merge_anno(sf, sf2); free(sf2->story); sf2->story=NULL; }
-       else
-       {      
-       /* Adjudication: Round 3: Compare the days. Newest wins. */
-       /* If round 3 does not declare a winner, the current one wins */
-        dt1=0; dt2=0;
-        sscanf(dp1,"%d",&dt1);
-        sscanf(dp2,"%d",&dt2);
-        if (dt1 <= dt2) { merge_anno(sf2, sf); fl=1; break; }
-        else { merge_anno(sf, sf2); free(sf2->story); sf2->story=NULL; }
-       }
-
-      }
-    }
-
-    /* if we didn't declare this one a loser, zap it into the output file */
-    if (!fl)
-    { fputs("<story>",f);
-      fputs(sf->story,f);
-/*      printf("Zap complete\n");*/
-      fputs("</story>\n",f);
-    }
-   free(sf->story);
-   sf->story=NULL;
-    
-
+   fwrite(sf->anno,1,sf->anno_length,f);
+   fputs("\n",f);
   }
-  /* Close the ifiction file */
-  fputs("</ifindex>\n",f);
-  fclose(f);
-  return 0;
+  fputs("</story>\n",f);
+ }
+ /* Close the ifiction file */
+ fputs("</ifindex>\n",f);
+ fclose(f);
+ return 0;
 }
@@ -53,21 +53,11 @@ int main(int argc, char **argv)
   ft=babel_init(argv[1]);
  else
  {
-  int ll=0;
-  while(!feof(stdin))
-  {
-   char *tt, mdb[1024];
-   int ii;
-   ii=fread(mdb,1,1024,stdin);
-   tt=(char *)my_malloc(ll+ii,"file buffer");
-   if (md) { memcpy(tt,md,ll); free(md); }
-   memcpy(tt+ll,mdb,ii);
-   md=tt;
-   ll+=ii;
-   if (ii<1024) break;
-  }
-  ft=babel_init_raw(md,ll);
-  free(md);
+  int32 ll;
+  md=(char *)babel_read_stream(stdin,&ll);
+  if (!md) exit(1);
+  ft=babel_init_raw_owned(md,ll);
+  md=NULL;
  }
 
 
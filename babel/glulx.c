@@ -36,18 +36,13 @@ static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, i
 
 
  if (extent<256) return INVALID_STORY_FILE_RV;
- for(i=0;i<extent;i++) if (memcmp((char *)story_file+i,"UUID://",7)==0) break;
- if (i<extent) /* Found explicit IFID */
+ i=babel_find_uuid(story_file,extent,&j);
+ if (i>=0) /* Found explicit IFID */
   {
-   for(j=i+7;j<extent && ((char *)story_file)[j]!='/';j++);
-   if (j<extent)
-   {
-    i+=7;
-    ASSERT_OUTPUT_SIZE(j-i);
-    memcpy(output,(char *)story_file+i,j-i);
-    output[j-i]=0;
-    return 1;
-   }
+   ASSERT_OUTPUT_SIZE(j+1);
+   memcpy(output,(char *)story_file+i,j);
+   output[j]=0;
+   return 1;
   }
 
  /* Did not find intact IFID.  Build one */
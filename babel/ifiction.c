@@ -27,6 +27,17 @@
  * it strictly checks the ifiction record against the Treaty of Babel
  * requirements
  *
+ * struct ifiction_tree *ifiction_build_tree(char *md)
+ * tokenizes the metadata in a single pass into a tree of tags, which
+ * ifiction_parse then walks.  The tree refers into md, which must outlive it.
+ * ifiction_find_tag(tree, parent, tag, after) returns the next tag (in the
+ * order the tags close) after the tag numbered after (or the first, if after
+ * is -1) which is named tag and whose parent is named parent (or which is at
+ * the top level, if parent is NULL), or -1 if there is none.
+ * ifiction_tag_content(tree, tag) returns a malloc'd copy of a tag's content;
+ * ifiction_tag_offset(tree, tag, &extent) returns its offset in md instead.
+ * ifiction_release_tree(tree) frees the tree.
+ *
  */
 
 #include "ifiction.h"
@@ -39,16 +50,7 @@ void *my_malloc(int, char *);
 extern char *format_registry[];
 
 
-static int32 llp;
-static char *lnlst;
-
 static char utfeol[3] = { 0xe2, 0x80, 0xa8 };
-static int32 getln(char *endp)
-{
- for(;lnlst<endp;lnlst++) if (*lnlst=='\n' || memcmp(lnlst,utfeol,3)==0) llp++;
- return llp;
-}
-
 
 static int32 ifiction_get_first_IFID(char *metadata, char *output, int32 output_extent)
 {
@@ -84,7 +86,7 @@ int32 ifiction_get_IFID(char *metadata, char *output, int32 output_extent)
  *output=',';
  output++;
  }
- if (*(output-1)==',') *(output-1)=0;
+ if (j && *(output-1)==',') *(output-1)=0;
  return j;
 }
 
@@ -358,177 +360,368 @@ static void ifiction_validate_tag(struct XMLTag *xtg, struct ifiction_info *xti,
 
 
 
-void ifiction_parse(char *md, IFCloseTag close_tag, void *close_ctx, IFErrorHandler error_handler, void *error_ctx)
+/* The tag tree.  Nodes are numbered in document order, and refer to the
+   metadata and to one another by offset and index, so the whole tree is a
+   single array which grows by doubling. */
+struct ifiction_node {
+ int32 name, name_len;          /* the tag's name (and full text), in md */
+ int32 full_len;
+ int32 begin, end;              /* the tag's content, in md */
+ int32 line;
+ int32 parent, child, last, sibling;
+ int32 seq;                     /* position in closing order */
+};
+
+/* A structural error, reported after seq tags have been closed */
+struct ifiction_error {
+ int32 seq;
+ int32 node;                    /* unclosed tag, or -1 */
+ int32 name, name_len;          /* unmatched end tag */
+ int32 line;
+};
+
+struct ifiction_tree {
+ char *md;
+ char *fatal;                   /* error which stopped the parse, or NULL */
+ struct ifiction_node *nodes;
+ int32 count, size;
+ int32 *closed;                 /* nodes in closing order */
+ int32 nclosed;
+ struct ifiction_error *errors;
+ int32 nerrors, esize;
+ int32 first, last;             /* top-level tags */
+ int32 depth;
+};
+
+static int32 ifiction_new_node(struct ifiction_tree *t)
+{
+ if (t->count==t->size)
+ {
+  struct ifiction_node *n;
+  int32 *c;
+  t->size=t->size ? t->size*2 : 64;
+  n=(struct ifiction_node *)my_malloc(t->size*sizeof(struct ifiction_node),"ifiction tree");
+  c=(int32 *)my_malloc(t->size*sizeof(int32),"ifiction tree");
+  if (t->nodes)
+  {
+   memcpy(n,t->nodes,t->count*sizeof(struct ifiction_node));
+   memcpy(c,t->closed,t->nclosed*sizeof(int32));
+   free(t->nodes);
+   free(t->closed);
+  }
+  t->nodes=n;
+  t->closed=c;
+ }
+ return t->count++;
+}
+
+static void ifiction_add_error(struct ifiction_tree *t, int32 node, int32 name, int32 name_len, int32 line)
 {
-char *xml, buffer[2400], *aep, *mda=md, ebuffer[512];
-struct XMLTag *parse=NULL, *xtg;
-struct ifiction_info xti;
-char BOM[3]={ 0xEF, 0xBB, 0xBF};
-xti.width=0;
-xti.height=0;
-xti.format=-1;
-llp=1;
-lnlst=md;
-
-while(*mda && isspace(*mda)) mda++;
-if (memcmp(mda,BOM,3)==0)
-{ mda+=3;
-  while(*mda && isspace(*mda)) mda++;
+ struct ifiction_error *e;
+ if (t->nerrors==t->esize)
+ {
+  t->esize=t->esize ? t->esize*2 : 8;
+  e=(struct ifiction_error *)my_malloc(t->esize*sizeof(struct ifiction_error),"ifiction errors");
+  if (t->errors)
+  {
+   memcpy(e,t->errors,t->nerrors*sizeof(struct ifiction_error));
+   free(t->errors);
+  }
+  t->errors=e;
+ }
+ e=t->errors+t->nerrors++;
+ e->seq=t->nclosed;
+ e->node=node;
+ e->name=name;
+ e->name_len=name_len;
+ e->line=line;
 }
 
+static int ifiction_node_is(struct ifiction_tree *t, int32 n, char *name, int32 len)
+{
+ return t->nodes[n].name_len==len && memcmp(t->md+t->nodes[n].name,name,len)==0;
+}
 
-if (strncmp("<?xml version=\"1.0\" encoding=\"UTF-8\"?>",mda,
-        strlen("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"))
-    &&
-    strncmp("<?xml version=\"1.0\" encoding=\"utf-8\"?>",mda,
-        strlen("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"))
-   )
+static void ifiction_close(struct ifiction_tree *t, int32 n, char *end)
 {
- error_handler("Error: XML header not found.",error_ctx);
- return;
+ t->nodes[n].end=end-t->md;
+ t->nodes[n].seq=t->nclosed;
+ t->closed[t->nclosed++]=n;
 }
 
-xml=strstr(md,"<ifindex");
-if (!xml) {
- error_handler("Error: <ifindex> not found",error_ctx);
- return;
+/* Moves p to the next character in set (or the end of the metadata),
+   counting the lines passed on the way */
+static char *ifiction_scan(char *p, char *set, int32 *line)
+{
+ while(1)
+ {
+  p+=strcspn(p,set);
+  if (*p=='\n') (*line)++;
+  else if (*p==utfeol[0])
+  {
+   if (p[1]==utfeol[1] && p[2]==utfeol[2]) (*line)++;
+  }
+  else return p;
+  p++;
  }
-while(xml && *xml)
+}
+
+struct ifiction_tree *ifiction_build_tree(char *md)
 {
- char *bp, *ep, *tp;
- while(*xml&&*xml!='<') xml++;
- if (!*xml) break;
+ struct ifiction_tree *t;
+ char *xml, *bp, *ep, *mda=md;
+ char BOM[3]={ 0xEF, 0xBB, 0xBF};
+ int32 line=1, tag_line, cur=-1, depth=0, n, i;
+
+ t=(struct ifiction_tree *)my_malloc(sizeof(struct ifiction_tree),"ifiction tree");
+ t->md=md;
+ t->first=t->last=-1;
+
+ while(*mda && isspace(*mda)) mda++;
+ if (memcmp(mda,BOM,3)==0)
+ { mda+=3;
+   while(*mda && isspace(*mda)) mda++;
+ }
+ if (strncmp("<?xml version=\"1.0\" encoding=\"UTF-8\"?>",mda,
+         strlen("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"))
+     &&
+     strncmp("<?xml version=\"1.0\" encoding=\"utf-8\"?>",mda,
+         strlen("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"))
+    )
+ {
+  t->fatal="Error: XML header not found.";
+  return t;
+ }
+ xml=strstr(md,"<ifindex");
+ if (!xml)
+ {
+  t->fatal="Error: <ifindex> not found";
+  return t;
+ }
+ for(bp=md;bp<xml;bp++)
+  if (*bp=='\n' || (*bp==utfeol[0] && memcmp(bp,utfeol,3)==0)) line++;
+
  bp=xml;
- tp=strchr(bp+1,'<');
- ep=strchr(bp+1,'>');
- if (!ep) break;
- if (tp && tp < ep)
-  { xml=tp; continue; }
- if (!tp) tp=ep+1; 
- if (bp[1]=='/') /* end tag */
+ while(*bp)
  {
-   strncpy(buffer,bp+2,(ep-bp)-2);
-   buffer[(ep-bp)-2]=0;
-   if (parse && strcmp(buffer,parse->tag)==0)
+  /* bp is at a '<'; find the end of the tag, or a '<' which supersedes it.
+     The tag is reported at the line it begins on */
+  tag_line=line;
+  ep=ifiction_scan(bp+1,"<>\n\342",&line);
+  if (!*ep) break;
+  if (*ep=='<') { bp=ep; continue; }
+  if (bp[1]=='/') /* end tag */
+  {
+   char *name=bp+2;
+   int32 len=ep-name;
+   if (cur>=0 && ifiction_node_is(t,cur,name,len))
    { /* copasetic. Close the tag */
-    xtg=parse;
-    parse=xtg->next;
-    xtg->end=ep-strlen(buffer)-2;
-    ifiction_validate_tag(xtg,&xti,error_handler, error_ctx);
-    close_tag(xtg,close_ctx);
-    free(xtg);
+    ifiction_close(t,cur,bp);
+    cur=t->nodes[cur].parent;
+    depth--;
    }
    else
    {
-    for(xtg=parse;xtg && strcmp(buffer,xtg->tag);xtg=xtg->next);
-    if (xtg) /* Intervening unclosed tags */
-    { for(xtg=parse;xtg && strcmp(buffer,parse->tag);xtg=parse)
-     {
-      xtg->end=xml-1;
-      parse=xtg->next;
-      sprintf(ebuffer,"Error: (line %d) unclosed <%s> tag",xtg->beginl,xtg->tag);
-      error_handler(ebuffer,error_ctx);
-      ifiction_validate_tag(xtg,&xti,error_handler, error_ctx);
-      close_tag(xtg,close_ctx);
-      free(xtg);
-     }
-     xtg=parse;
-     if (xtg)
+    for(n=cur;n>=0 && !ifiction_node_is(t,n,name,len);n=t->nodes[n].parent);
+    if (n>=0) /* Intervening unclosed tags */
+    {
+     for(;cur!=n;cur=t->nodes[cur].parent,depth--)
      {
-      xtg->end=xml-1;
-      parse=xtg->next;
-      ifiction_validate_tag(xtg,&xti, error_handler, error_ctx);
-      close_tag(xtg,close_ctx);
-      free(xtg);
+      ifiction_add_error(t,cur,0,0,t->nodes[cur].line);
+      ifiction_close(t,cur,bp-1);
      }
+     ifiction_close(t,cur,bp-1);
+     cur=t->nodes[cur].parent;
+     depth--;
+    }
+    else ifiction_add_error(t,-1,name-md,len,tag_line);
+   }
+  }
+  else if (*(ep-1)!='/' && bp[1]!='!') /* Terminated tag beginning */
+  {
+   for(i=0;bp[i+1]=='_' || bp[i+1]=='-' || isalnum(bp[i+1]);i++);
+   if (i)
+   {
+    struct ifiction_node *x;
+    n=ifiction_new_node(t);
+    x=t->nodes+n;
+    x->name=bp+1-md;
+    x->name_len=i;
+    x->full_len=ep-bp-1;
+    x->begin=ep+1-md;
+    x->line=tag_line;
+    x->parent=cur;
+    x->child=x->last=x->sibling=-1;
+    if (cur>=0)
+    {
+     if (t->nodes[cur].last>=0) t->nodes[t->nodes[cur].last].sibling=n;
+     else t->nodes[cur].child=n;
+     t->nodes[cur].last=n;
     }
     else
-    { 
-      sprintf(ebuffer,"Error: (line %d) saw </%s> without <%s>",getln(xml), buffer,buffer);
-      error_handler(ebuffer,error_ctx);
+    {
+     if (t->last>=0) t->nodes[t->last].sibling=n;
+     else t->first=n;
+     t->last=n;
     }
+    cur=n;
+    if (++depth>t->depth) t->depth=depth;
    }
-
- }
- else if(*(ep-1)=='/' || bp[1]=='!') /* unterminated tag */
- {
-  /* Do nothing */
- }
- else /* Terminated tag beginning */
- {
-  int i;
-  xtg=(struct XMLTag *)my_malloc(sizeof(struct XMLTag),"XML Tag");
-  xtg->next=parse;
-  xtg->beginl=getln(bp);
-  for(i=0;bp[i+1]=='_' || bp[i+1]=='-' || isalnum(bp[i+1]);i++)
-   xtg->tag[i]=bp[i+1];
-  if (i==0)
-  { xml=tp;
-    free(xtg);
-    continue;
   }
-  parse=xtg;
-  parse->tag[i]=0;
-  strncpy(parse->fulltag,bp+1,ep-bp-1);
-  parse->fulltag[ep-bp-1]=0;
-  parse->begin=ep+1;
+  bp=ifiction_scan(ep+1,"<\n\342",&line);
  }
- xml=tp;
+ /* Close whatever remains open at the end of the metadata */
+ bp+=strlen(bp);
+ for(;cur>=0;cur=t->nodes[cur].parent)
+  ifiction_close(t,cur,bp);
+ return t;
 }
- while (parse)
+
+void ifiction_release_tree(struct ifiction_tree *t)
+{
+ if (t->nodes) free(t->nodes);
+ if (t->closed) free(t->closed);
+ if (t->errors) free(t->errors);
+ free(t);
+}
+
+static void ifiction_report(struct ifiction_tree *t, struct ifiction_error *e, IFErrorHandler error_handler, void *error_ctx)
+{
+ char ebuffer[512], name[201];
+ int32 l;
+ if (e->node>=0)
+ {
+  l=t->nodes[e->node].name_len;
+  if (l>200) l=200;
+  memcpy(name,t->md+t->nodes[e->node].name,l);
+  name[l]=0;
+  sprintf(ebuffer,"Error: (line %d) unclosed <%.200s> tag",e->line,name);
+ }
+ else
  {
-      xtg=parse;
-      xtg->end=aep-1;
-      parse=xtg->next;
-      sprintf(ebuffer,"Error: (line %d) Unclosed tag <%s>",xtg->beginl,xtg->tag);
-      ifiction_validate_tag(xtg,&xti,error_handler, error_ctx);
-      close_tag(xtg,close_ctx);
-      free(xtg);
+  l=e->name_len < 200 ? e->name_len : 200;
+  memcpy(name,t->md+e->name,l);
+  name[l]=0;
+  sprintf(ebuffer,"Error: (line %d) saw </%.200s> without <%.200s>",e->line,name,name);
  }
+ error_handler(ebuffer,error_ctx);
 }
 
-struct get_tag
+static void ifiction_copy(char *to, char *from, int32 l)
 {
- char *tag;
- char *parent;
- char *output;
- char *target;
-};
+ if (l>255) l=255;
+ memcpy(to,from,l);
+ to[l]=0;
+}
 
-static void ifiction_null_eh(char *e, void *c)
+void ifiction_parse(char *md, IFCloseTag close_tag, void *close_ctx, IFErrorHandler error_handler, void *error_ctx)
 {
- if (e || c) { }
-
+ struct ifiction_tree *t;
+ struct ifiction_info xti;
+ struct ifiction_node *x;
+ struct XMLTag *stack, *xtg;
+ int32 n, d=0, e=0;
+
+ t=ifiction_build_tree(md);
+ if (t->fatal)
+ {
+  error_handler(t->fatal,error_ctx);
+  ifiction_release_tree(t);
+  return;
+ }
+ xti.width=0;
+ xti.height=0;
+ xti.format=-1;
+ stack=t->depth ? (struct XMLTag *)my_malloc(t->depth*sizeof(struct XMLTag),"XML Tag") : NULL;
+
+ /* Walk the tree, closing each tag after its children as the tags were
+    closed in the document */
+ n=t->first;
+ while(n>=0)
+ {
+  x=t->nodes+n;
+  xtg=stack+d;
+  xtg->beginl=x->line;
+  ifiction_copy(xtg->tag,md+x->name,x->name_len);
+  ifiction_copy(xtg->fulltag,md+x->name,x->full_len);
+  xtg->begin=md+x->begin;
+  memset(xtg->occurences,0,sizeof(xtg->occurences));
+  memset(xtg->rocurrences,0,sizeof(xtg->rocurrences));
+  xtg->next=d ? stack+d-1 : NULL;
+  d++;
+  if (x->child>=0) { n=x->child; continue; }
+  while(1)
+  {
+   x=t->nodes+n;
+   xtg=stack+--d;
+   xtg->end=md+x->end;
+   while(e<t->nerrors && t->errors[e].seq<=x->seq)
+    ifiction_report(t,t->errors+e++,error_handler,error_ctx);
+   ifiction_validate_tag(xtg,&xti,error_handler, error_ctx);
+   close_tag(xtg,close_ctx);
+   if (x->sibling>=0) { n=x->sibling; break; }
+   n=x->parent;
+   if (n<0) break;
+  }
+ }
+ while(e<t->nerrors)
+  ifiction_report(t,t->errors+e++,error_handler,error_ctx);
+ if (stack) free(stack);
+ ifiction_release_tree(t);
 }
 
-static void ifiction_find_value(struct XMLTag *xtg, void *xti)
+int32 ifiction_find_tag(struct ifiction_tree *t, char *p, char *tag, int32 after)
 {
- struct get_tag *gt=(struct get_tag *)xti;
-
- if (gt->output && !gt->target) return;
- if (gt->target && gt->output && strcmp(gt->output,gt->target)==0) { gt->target=NULL; free(gt->output); gt->output=NULL; }
- if (((!xtg->next && !gt->parent) || (xtg->next && gt->parent && strcmp(xtg->next->tag,gt->parent)==0)) &&
-      strcmp(xtg->tag,gt->tag)==0)
+ int32 k, n, par;
+ for(k=after<0 ? 0 : t->nodes[after].seq+1;k<t->nclosed;k++)
  {
-  int32 l = xtg->end-xtg->begin;
-
-  if (gt->output) free(gt->output);
-  gt->output=(char *)my_malloc(l+1, "ifiction tag buffer");
-  memcpy(gt->output, xtg->begin, l);
-  gt->output[l]=0;
-
+  n=t->closed[k];
+  par=t->nodes[n].parent;
+  if (ifiction_node_is(t,n,tag,strlen(tag)) &&
+      ((par<0 && !p) || (par>=0 && p && ifiction_node_is(t,par,p,strlen(p)))))
+   return n;
  }
+ return -1;
 }
 
+char *ifiction_tag_content(struct ifiction_tree *t, int32 tag)
+{
+ int32 l=t->nodes[tag].end-t->nodes[tag].begin;
+ char *s;
+ if (l<0) l=0;
+ s=(char *)my_malloc(l+1, "ifiction tag buffer");
+ memcpy(s,t->md+t->nodes[tag].begin,l);
+ s[l]=0;
+ return s;
+}
+
+int32 ifiction_tag_offset(struct ifiction_tree *t, int32 tag, int32 *extent)
+{
+ *extent=t->nodes[tag].end-t->nodes[tag].begin;
+ if (*extent<0) *extent=0;
+ return t->nodes[tag].begin;
+}
 
 char *ifiction_get_tag(char *md, char *p, char *t, char *from)
 {
- struct get_tag gt;
- gt.output=NULL;
- gt.parent=p;
- gt.tag=t;
- gt.target=from;
- ifiction_parse(md,ifiction_find_value,&gt,ifiction_null_eh,NULL);
- if (gt.target){ if (gt.output) free(gt.output); return NULL; }
- return gt.output;
+ struct ifiction_tree *tree;
+ struct ifiction_node *x;
+ char *rv=NULL;
+ int32 n;
+ tree=ifiction_build_tree(md);
+ n=ifiction_find_tag(tree,p,t,-1);
+ if (from)
+ {
+  /* Find the tag following the first whose content is from */
+  for(;n>=0;n=ifiction_find_tag(tree,p,t,n))
+  {
+   x=tree->nodes+n;
+   if (x->end-x->begin==(int32) strlen(from) && memcmp(md+x->begin,from,x->end-x->begin)==0)
+    break;
+  }
+  if (n>=0) n=ifiction_find_tag(tree,p,t,n);
+ }
+ if (n>=0) rv=ifiction_tag_content(tree,n);
+ ifiction_release_tree(tree);
+ return rv;
 }
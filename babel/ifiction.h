@@ -42,4 +42,11 @@ typedef void (*IFErrorHandler)(char *, void *);
 void ifiction_parse(char *md, IFCloseTag close_tag, void *close_ctx, IFErrorHandler error_handler, void *error_ctx);
 int32 ifiction_get_IFID(char *metadata, char *output, int32 output_extent);
 char *ifiction_get_tag(char *md, char *p, char *t, char *from);
+
+struct ifiction_tree;
+struct ifiction_tree *ifiction_build_tree(char *md);
+int32 ifiction_find_tag(struct ifiction_tree *, char *p, char *t, int32 after);
+char *ifiction_tag_content(struct ifiction_tree *, int32 tag);
+int32 ifiction_tag_offset(struct ifiction_tree *, int32 tag, int32 *extent);
+void ifiction_release_tree(struct ifiction_tree *);
 #endif
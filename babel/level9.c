@@ -18,10 +18,13 @@
 #define FORMAT_EXT ".l9,.sna"
 #define NO_METADATA
 #define NO_COVER
+#define STORY_INDEX
+#define REGISTRY_CHECK
 
 #include "treaty_builder.h"
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct l9rec {
@@ -31,312 +34,320 @@ struct l9rec {
 };
 
 
+/* The registry of known Level 9 games, by the length and checksum of
+   their A-code.  It is sorted by length and then by checksum, so that it
+   may be searched by bisection; "babel -verify-registry" checks that it
+   still is, and that each entry is identified as itself */
 static struct l9rec l9_registry[] = {
-      { 0x3a31, 0xe5, "LEVEL9-001-1" },
-      { 0x8333, 0xb7, "LEVEL9-001-1" },
-      { 0x7c6f, 0x0f, "LEVEL9-001-1" },
-      { 0x72fa, 0x8b, "LEVEL9-001-1" },
-      { 0x38dd, 0x31, "LEVEL9-001-A" },
-      { 0x39c0, 0x44, "LEVEL9-001-B" },
-      { 0x3a12, 0x8f, "LEVEL9-001-C" },
+      { 0x0fd8, 0x00, "LEVEL9-004-en" },
+      { 0x110f, 0x00, "LEVEL9-004-fr" },
+      { 0x11f5, 0x00, "LEVEL9-004-de" },
+      { 0x14a3, 0x00, "LEVEL9-004-en" },
+      { 0x1929, 0x00, "LEVEL9-004-DEMO" },
+      { 0x34b3, 0x20, "LEVEL9-008" },
+      { 0x34b3, 0x53, "LEVEL9-008" },
+      { 0x34b3, 0xc7, "LEVEL9-008" },
+      { 0x3511, 0xcc, "LEVEL9-001-9" },
+      { 0x361e, 0x7e, "LEVEL9-001-7" },
+      { 0x378c, 0x8d, "LEVEL9-007" },
       { 0x37f1, 0x77, "LEVEL9-001-2" },
-      { 0x844d, 0x50, "LEVEL9-001-2" },
-      { 0x738e, 0x5b, "LEVEL9-001-2" },
+      { 0x38a5, 0x0f, "LEVEL9-001-6" },
+      { 0x38dd, 0x31, "LEVEL9-001-A" },
       { 0x3900, 0x1c, "LEVEL9-001-3" },
-      { 0x8251, 0x5f, "LEVEL9-001-3" },
-      { 0x7375, 0xe5, "LEVEL9-001-3" },
       { 0x3910, 0xac, "LEVEL9-001-4" },
-      { 0x7a78, 0x5e, "LEVEL9-001-4" },
-      { 0x78d5, 0xe3, "LEVEL9-001-4" },
-      { 0x3ad6, 0xa7, "LEVEL9-001-5" },
-      { 0x38a5, 0x0f, "LEVEL9-001-6" },
-      { 0x361e, 0x7e, "LEVEL9-001-7" },
       { 0x3934, 0x75, "LEVEL9-001-8" },
-      { 0x3511, 0xcc, "LEVEL9-001-9" },
-      { 0x593a, 0xaf, "LEVEL9-002-1" },
-      { 0x7931, 0xb9, "LEVEL9-002-1" },
-      { 0x6841, 0x4a, "LEVEL9-002-1" },
-      { 0x57e6, 0x8a, "LEVEL9-002-2" },
-      { 0x7cdf, 0xa5, "LEVEL9-002-2" },
-      { 0x6bc0, 0x62, "LEVEL9-002-2" },
-      { 0x5819, 0xcd, "LEVEL9-002-3" },
-      { 0x7a0c, 0x97, "LEVEL9-002-3" },
-      { 0x692c, 0x21, "LEVEL9-002-3" },
-      { 0x579b, 0xad, "LEVEL9-002-4" },
-      { 0x7883, 0xe2, "LEVEL9-002-4" },
-      { 0x670a, 0x94, "LEVEL9-002-4" },
-      { 0x5323, 0xb7, "LEVEL9-003" },
-      { 0x6e60, 0x83, "LEVEL9-003" },
-      { 0x5b58, 0x50, "LEVEL9-003" },
-      { 0x63b6, 0x2e, "LEVEL9-003" },
-      { 0x6968, 0x32, "LEVEL9-003" },
-      { 0x5b50, 0x66, "LEVEL9-003" },
-      { 0x6970, 0xd6, "LEVEL9-003" },
-      { 0x5ace, 0x11, "LEVEL9-003" },
-      { 0x6e5c, 0xf6, "LEVEL9-003" },
-      { 0x1929, 0x00, "LEVEL9-004-DEMO" },
-      { 0x40e0, 0x02, "LEVEL9-004-DEMO" },
-      { 0x3ebb, 0x00, "LEVEL9-004-en" },
+      { 0x39c0, 0x44, "LEVEL9-001-B" },
+      { 0x3a12, 0x8f, "LEVEL9-001-C" },
+      { 0x3a31, 0xe5, "LEVEL9-001-1" },
+      { 0x3ad6, 0xa7, "LEVEL9-001-5" },
       { 0x3e4f, 0x00, "LEVEL9-004-en" },
       { 0x3e8f, 0x00, "LEVEL9-004-en" },
-      { 0x0fd8, 0x00, "LEVEL9-004-en" },
-      { 0x14a3, 0x00, "LEVEL9-004-en" },
-      { 0x110f, 0x00, "LEVEL9-004-fr" },
-      { 0x4872, 0x00, "LEVEL9-004-de" },
+      { 0x3ebb, 0x00, "LEVEL9-004-en" },
+      { 0x40e0, 0x02, "LEVEL9-004-DEMO" },
+      { 0x46ec, 0x64, "LEVEL9-011-1" },
       { 0x4846, 0x00, "LEVEL9-004-de" },
-      { 0x11f5, 0x00, "LEVEL9-004-de" },
-      { 0x11f5, 0x00, "LEVEL9-004-de" },
-      { 0x76f4, 0x5e, "LEVEL9-005" },
+      { 0x4872, 0x00, "LEVEL9-004-de" },
+      { 0x4dac, 0xa8, "LEVEL9-012-2" },
+      { 0x4f96, 0x22, "LEVEL9-012-3" },
+      { 0x4fd2, 0x9d, "LEVEL9-012-1" },
+      { 0x505d, 0x32, "LEVEL9-015" },
+      { 0x506c, 0xf0, "LEVEL9-015" },
+      { 0x51bc, 0xe3, "LEVEL9-017-3" },
+      { 0x52aa, 0xdf, "LEVEL9-009-1" },
+      { 0x531a, 0xed, "LEVEL9-010-2" },
+      { 0x5323, 0xb7, "LEVEL9-003" },
+      { 0x53a2, 0x1e, "LEVEL9-012-2" },
+      { 0x546c, 0xb7, "LEVEL9-020" },
+      { 0x54a4, 0x01, "LEVEL9-019-4" },
+      { 0x54a6, 0xa9, "LEVEL9-017-2" },
+      { 0x5500, 0x50, "LEVEL9-015" },
+      { 0x55ce, 0xa1, "LEVEL9-017-1" },
+      { 0x5671, 0xbc, "LEVEL9-014" },
+      { 0x56dd, 0x51, "LEVEL9-019-2" },
+      { 0x579a, 0x2a, "LEVEL9-014" },
+      { 0x579b, 0xad, "LEVEL9-002-4" },
+      { 0x579e, 0x97, "LEVEL9-013" },
+      { 0x57e4, 0x19, "LEVEL9-010-3" },
+      { 0x57e6, 0x8a, "LEVEL9-002-2" },
+      { 0x5801, 0x53, "LEVEL9-019-3" },
+      { 0x5819, 0xcd, "LEVEL9-002-3" },
+      { 0x5828, 0xbd, "LEVEL9-020" },
+      { 0x5834, 0x42, "LEVEL9-019-1" },
+      { 0x5860, 0x95, "LEVEL9-017-3" },
+      { 0x58a3, 0x38, "LEVEL9-006" },
+      { 0x58a6, 0x24, "LEVEL9-006" },
+      { 0x5914, 0x22, "LEVEL9-012-3" },
+      { 0x5932, 0x4e, "LEVEL9-017-2" },
+      { 0x593a, 0x80, "LEVEL9-006" },
+      { 0x593a, 0xaf, "LEVEL9-002-1" },
+      { 0x5a38, 0xf7, "LEVEL9-010-1" },
+      { 0x5a50, 0xa9, "LEVEL9-014" },
+      { 0x5a8e, 0xf2, "LEVEL9-005" },
+      { 0x5aa4, 0xc1, "LEVEL9-014" },
+      { 0x5ace, 0x11, "LEVEL9-003" },
       { 0x5b16, 0x3b, "LEVEL9-005" },
-      { 0x6c8e, 0xb6, "LEVEL9-005" },
-      { 0x6f4d, 0xcb, "LEVEL9-005" },
-      { 0x6f6a, 0xa5, "LEVEL9-005" },
+      { 0x5b50, 0x66, "LEVEL9-003" },
+      { 0x5b58, 0x50, "LEVEL9-003" },
+      { 0x5bd6, 0x35, "LEVEL9-017-2" },
+      { 0x5c7a, 0x44, "LEVEL9-012-1" },
+      { 0x5ca1, 0x33, "LEVEL9-016" },
+      { 0x5cb7, 0x64, "LEVEL9-016" },
+      { 0x5cb7, 0xfe, "LEVEL9-016" },
+      { 0x5cbc, 0xa5, "LEVEL9-017-1" },
       { 0x5e31, 0x7c, "LEVEL9-005" },
-      { 0x6f70, 0x40, "LEVEL9-005" },
-      { 0x6f6e, 0x78, "LEVEL9-005" },
-      { 0x5a8e, 0xf2, "LEVEL9-005" },
-      { 0x76f4, 0x5a, "LEVEL9-005" },
+      { 0x5eb9, 0x30, "LEVEL9-013" },
+      { 0x5eb9, 0x5d, "LEVEL9-013" },
+      { 0x5eb9, 0x6e, "LEVEL9-013" },
+      { 0x5ebb, 0xf1, "LEVEL9-020" },
+      { 0x5f43, 0xca, "LEVEL9-016" },
+      { 0x5fab, 0x2f, "LEVEL9-018" },
+      { 0x5fab, 0x5c, "LEVEL9-018" },
+      { 0x5ff0, 0xf8, "LEVEL9-009-1" },
+      { 0x6024, 0x01, "LEVEL9-009-2" },
+      { 0x6030, 0x47, "LEVEL9-020" },
+      { 0x6036, 0x3d, "LEVEL9-009-3" },
+      { 0x6047, 0x6c, "LEVEL9-016" },
+      { 0x6064, 0x01, "LEVEL9-016" },
+      { 0x6064, 0x95, "LEVEL9-016" },
+      { 0x6064, 0xbd, "LEVEL9-016" },
+      { 0x6064, 0xda, "LEVEL9-016" },
+      { 0x60c4, 0x28, "LEVEL9-016" },
+      { 0x60dd, 0xf2, "LEVEL9-020" },
+      { 0x60f7, 0x68, "LEVEL9-016" },
+      { 0x6108, 0xdd, "LEVEL9-014" },
+      { 0x6140, 0x18, "LEVEL9-011-2" },
+      { 0x6161, 0xf3, "LEVEL9-020" },
       { 0x630e, 0x8d, "LEVEL9-006" },
       { 0x630e, 0xbe, "LEVEL9-006" },
-      { 0x6f0c, 0x95, "LEVEL9-006" },
-      { 0x593a, 0x80, "LEVEL9-006" },
+      { 0x639c, 0x8b, "LEVEL9-016" },
+      { 0x63b6, 0x2e, "LEVEL9-003" },
+      { 0x63be, 0x0a, "LEVEL9-007" },
+      { 0x63be, 0xd6, "LEVEL9-007" },
+      { 0x640e, 0xc1, "LEVEL9-011-3" },
+      { 0x6541, 0x02, "LEVEL9-018" },
+      { 0x670a, 0x94, "LEVEL9-002-4" },
+      { 0x67a3, 0x9d, "LEVEL9-018" },
+      { 0x6841, 0x4a, "LEVEL9-002-1" },
+      { 0x6888, 0x8d, "LEVEL9-015" },
+      { 0x68da, 0xc1, "LEVEL9-019-2" },
+      { 0x692c, 0x21, "LEVEL9-002-3" },
+      { 0x6968, 0x32, "LEVEL9-003" },
+      { 0x6970, 0xd6, "LEVEL9-003" },
+      { 0x69fe, 0x56, "LEVEL9-013" },
+      { 0x6bc0, 0x62, "LEVEL9-002-2" },
       { 0x6bd2, 0x65, "LEVEL9-006" },
+      { 0x6bf8, 0x3f, "LEVEL9-018" },
+      { 0x6c67, 0x9a, "LEVEL9-019-3" },
+      { 0x6c8e, 0xb6, "LEVEL9-005" },
+      { 0x6ce5, 0x58, "LEVEL9-019-1" },
+      { 0x6d84, 0xc8, "LEVEL9-020" },
+      { 0x6d84, 0xf9, "LEVEL9-020" },
+      { 0x6d91, 0xb9, "LEVEL9-019-4" },
+      { 0x6da0, 0xb8, "LEVEL9-015" },
+      { 0x6dbc, 0x97, "LEVEL9-011-2" },
       { 0x6dc0, 0x63, "LEVEL9-006" },
-      { 0x58a6, 0x24, "LEVEL9-006" },
       { 0x6de8, 0x4c, "LEVEL9-006" },
-      { 0x58a3, 0x38, "LEVEL9-006" },
-      { 0x63be, 0xd6, "LEVEL9-007" },
-      { 0x378c, 0x8d, "LEVEL9-007" },
-      { 0x63be, 0x0a, "LEVEL9-007" },
-      { 0x34b3, 0x20, "LEVEL9-008" },
-      { 0x34b3, 0xc7, "LEVEL9-008" },
-      { 0x34b3, 0x53, "LEVEL9-008" },
-      { 0xb1a9, 0x80, "LEVEL9-009-1" },
-      { 0x908e, 0x0d, "LEVEL9-009-1" },
-      { 0xad41, 0xa8, "LEVEL9-009-1" },
-      { 0xb1aa, 0xad, "LEVEL9-009-1" },
-      { 0x8aab, 0xc0, "LEVEL9-009-1" },
-      { 0xb0ec, 0xc2, "LEVEL9-009-1" },
-      { 0xb19e, 0x92, "LEVEL9-009-1" },
-      { 0x5ff0, 0xf8, "LEVEL9-009-1" },
-      { 0x52aa, 0xdf, "LEVEL9-009-1" },
-      { 0xab9d, 0x31, "LEVEL9-009-2" },
-      { 0x8f6f, 0x0a, "LEVEL9-009-2" },
-      { 0xa735, 0xf7, "LEVEL9-009-2" },
-      { 0xab8b, 0xbf, "LEVEL9-009-2" },
-      { 0x8ac8, 0x9a, "LEVEL9-009-2" },
-      { 0xaf82, 0x83, "LEVEL9-009-2" },
-      { 0x6024, 0x01, "LEVEL9-009-2" },
+      { 0x6e58, 0x07, "LEVEL9-019-2" },
+      { 0x6e5c, 0xf6, "LEVEL9-003" },
+      { 0x6e60, 0x83, "LEVEL9-003" },
+      { 0x6f0c, 0x95, "LEVEL9-006" },
+      { 0x6f1e, 0xda, "LEVEL9-013" },
+      { 0x6f4d, 0xcb, "LEVEL9-005" },
+      { 0x6f6a, 0xa5, "LEVEL9-005" },
+      { 0x6f6e, 0x78, "LEVEL9-005" },
+      { 0x6f70, 0x40, "LEVEL9-005" },
+      { 0x6fa8, 0xa4, "LEVEL9-017-3" },
+      { 0x6fc6, 0x14, "LEVEL9-014" },
       { 0x6ffa, 0xdb, "LEVEL9-009-2" },
-      { 0xae28, 0x87, "LEVEL9-009-3" },
-      { 0x9060, 0xbb, "LEVEL9-009-3" },
-      { 0xa9c0, 0x9e, "LEVEL9-009-3" },
-      { 0xae16, 0x81, "LEVEL9-009-3" },
-      { 0x8a93, 0x4f, "LEVEL9-009-3" },
-      { 0xb3e6, 0xab, "LEVEL9-009-3" },
-      { 0x6036, 0x3d, "LEVEL9-009-3" },
       { 0x723a, 0x69, "LEVEL9-009-3" },
-      { 0xd188, 0x13, "LEVEL9-010-1" },
-      { 0x9089, 0xce, "LEVEL9-010-1" },
-      { 0xb770, 0x03, "LEVEL9-010-1" },
-      { 0xd19b, 0xad, "LEVEL9-010-1" },
-      { 0x8ab7, 0x68, "LEVEL9-010-1" },
-      { 0xd183, 0x83, "LEVEL9-010-1" },
-      { 0x5a38, 0xf7, "LEVEL9-010-1" },
-      { 0x76a0, 0x3a, "LEVEL9-010-1" },
-      { 0xc594, 0x03, "LEVEL9-010-2" },
-      { 0x908d, 0x80, "LEVEL9-010-2" },
-      { 0xb741, 0xb6, "LEVEL9-010-2" },
-      { 0xc5a5, 0xfe, "LEVEL9-010-2" },
-      { 0x8b1e, 0x84, "LEVEL9-010-2" },
-      { 0xc58f, 0x65, "LEVEL9-010-2" },
-      { 0x531a, 0xed, "LEVEL9-010-2" },
-      { 0x7674, 0x0b, "LEVEL9-010-2" },
-      { 0xd79f, 0xb5, "LEVEL9-010-3" },
-      { 0x909e, 0x9f, "LEVEL9-010-3" },
-      { 0xb791, 0xa1, "LEVEL9-010-3" },
-      { 0xd7ae, 0x9e, "LEVEL9-010-3" },
-      { 0x8b1c, 0xa8, "LEVEL9-010-3" },
-      { 0xd79a, 0x57, "LEVEL9-010-3" },
-      { 0x57e4, 0x19, "LEVEL9-010-3" },
-      { 0x765e, 0xba, "LEVEL9-010-3" },
-      { 0xbb93, 0x36, "LEVEL9-011-1" },
-      { 0x898a, 0x43, "LEVEL9-011-1" },
-      { 0x8970, 0x6b, "LEVEL9-011-1" },
-      { 0xbb6e, 0xa6, "LEVEL9-011-1" },
-      { 0x86d0, 0xb7, "LEVEL9-011-1" },
-      { 0xbb6e, 0xad, "LEVEL9-011-1" },
-      { 0x46ec, 0x64, "LEVEL9-011-1" },
+      { 0x72fa, 0x8b, "LEVEL9-001-1" },
+      { 0x7363, 0x65, "LEVEL9-018" },
+      { 0x7375, 0xe5, "LEVEL9-001-3" },
+      { 0x738e, 0x5b, "LEVEL9-001-2" },
+      { 0x7402, 0x07, "LEVEL9-011-3" },
+      { 0x7410, 0x5e, "LEVEL9-014" },
       { 0x74e0, 0x92, "LEVEL9-011-1" },
-      { 0xc58e, 0x4a, "LEVEL9-011-2" },
-      { 0x8b9f, 0x61, "LEVEL9-011-2" },
-      { 0x8b90, 0x4e, "LEVEL9-011-2" },
-      { 0xc58e, 0x43, "LEVEL9-011-2" },
-      { 0x8885, 0x22, "LEVEL9-011-2" },
-      { 0x6140, 0x18, "LEVEL9-011-2" },
-      { 0x6dbc, 0x97, "LEVEL9-011-2" },
-      { 0xcb9a, 0x0f, "LEVEL9-011-3" },
-      { 0x8af9, 0x61, "LEVEL9-011-3" },
-      { 0x8aea, 0x4e, "LEVEL9-011-3" },
-      { 0xcb9a, 0x08, "LEVEL9-011-3" },
+      { 0x762e, 0x82, "LEVEL9-017-1" },
+      { 0x765d, 0xcd, "LEVEL9-019-1" },
+      { 0x765e, 0x4f, "LEVEL9-012-3" },
+      { 0x765e, 0xba, "LEVEL9-010-3" },
+      { 0x7674, 0x0b, "LEVEL9-010-2" },
+      { 0x768c, 0xe8, "LEVEL9-012-1" },
+      { 0x76a0, 0x3a, "LEVEL9-010-1" },
+      { 0x76b0, 0x1d, "LEVEL9-012-2" },
+      { 0x76f4, 0x5a, "LEVEL9-005" },
+      { 0x76f4, 0x5e, "LEVEL9-005" },
+      { 0x772b, 0xcd, "LEVEL9-020" },
+      { 0x772f, 0xca, "LEVEL9-016" },
+      { 0x7883, 0xe2, "LEVEL9-002-4" },
+      { 0x788d, 0x72, "LEVEL9-020" },
+      { 0x78d5, 0xe3, "LEVEL9-001-4" },
+      { 0x7931, 0xb9, "LEVEL9-002-1" },
+      { 0x7a0c, 0x97, "LEVEL9-002-3" },
+      { 0x7a78, 0x5e, "LEVEL9-001-4" },
+      { 0x7b2f, 0x70, "LEVEL9-018" },
+      { 0x7b31, 0x6e, "LEVEL9-018" },
+      { 0x7c55, 0x18, "LEVEL9-016" },
+      { 0x7c6f, 0x0f, "LEVEL9-001-1" },
+      { 0x7cd7, 0x0e, "LEVEL9-020" },
+      { 0x7cd9, 0x0c, "LEVEL9-020" },
+      { 0x7cdf, 0xa5, "LEVEL9-002-2" },
+      { 0x7cf8, 0x24, "LEVEL9-016" },
+      { 0x7cff, 0xf8, "LEVEL9-016" },
+      { 0x7d14, 0xe8, "LEVEL9-016" },
+      { 0x7d16, 0xe6, "LEVEL9-016" },
+      { 0x7e98, 0x6a, "LEVEL9-019-3" },
+      { 0x81e2, 0xd5, "LEVEL9-019-4" },
+      { 0x8251, 0x5f, "LEVEL9-001-3" },
+      { 0x8333, 0xb7, "LEVEL9-001-1" },
+      { 0x844d, 0x50, "LEVEL9-001-2" },
+      { 0x86d0, 0xb7, "LEVEL9-011-1" },
       { 0x87e5, 0x0e, "LEVEL9-011-3" },
-      { 0x640e, 0xc1, "LEVEL9-011-3" },
-      { 0x7402, 0x07, "LEVEL9-011-3" },
-      { 0xbba4, 0x94, "LEVEL9-012-1" },
-      { 0xc0cf, 0x4e, "LEVEL9-012-1" },
-      { 0x8afc, 0x07, "LEVEL9-012-1" },
-      { 0x8feb, 0xba, "LEVEL9-012-1" },
-      { 0xb4c9, 0x94, "LEVEL9-012-1" },
-      { 0xc0bd, 0x57, "LEVEL9-012-1" },
+      { 0x8813, 0x11, "LEVEL9-015" },
+      { 0x8885, 0x22, "LEVEL9-011-2" },
+      { 0x8950, 0xa1, "LEVEL9-013" },
+      { 0x8970, 0x6b, "LEVEL9-011-1" },
+      { 0x898a, 0x43, "LEVEL9-011-1" },
+      { 0x8a12, 0xe3, "LEVEL9-017-2" },
+      { 0x8a16, 0xcc, "LEVEL9-017-3" },
+      { 0x8a21, 0xf4, "LEVEL9-017-1" },
+      { 0x8a60, 0x2a, "LEVEL9-014" },
+      { 0x8a93, 0x4f, "LEVEL9-009-3" },
+      { 0x8aab, 0xc0, "LEVEL9-009-1" },
+      { 0x8ab3, 0xc1, "LEVEL9-012-3" },
+      { 0x8ab7, 0x68, "LEVEL9-010-1" },
+      { 0x8aba, 0x0d, "LEVEL9-012-3" },
+      { 0x8ac8, 0x9a, "LEVEL9-009-2" },
       { 0x8ade, 0xf2, "LEVEL9-012-1" },
-      { 0x4fd2, 0x9d, "LEVEL9-012-1" },
-      { 0x5c7a, 0x44, "LEVEL9-012-1" },
-      { 0x768c, 0xe8, "LEVEL9-012-1" },
-      { 0xd0c0, 0x56, "LEVEL9-012-2" },
-      { 0xd5e9, 0x6a, "LEVEL9-012-2" },
+      { 0x8aea, 0x4e, "LEVEL9-011-3" },
       { 0x8aec, 0x13, "LEVEL9-012-2" },
-      { 0x8f6b, 0xfa, "LEVEL9-012-2" },
-      { 0xb729, 0x51, "LEVEL9-012-2" },
-      { 0xd5d7, 0x99, "LEVEL9-012-2" },
+      { 0x8af9, 0x61, "LEVEL9-011-3" },
+      { 0x8afc, 0x07, "LEVEL9-012-1" },
       { 0x8b0e, 0xfb, "LEVEL9-012-2" },
-      { 0x4dac, 0xa8, "LEVEL9-012-2" },
-      { 0x53a2, 0x1e, "LEVEL9-012-2" },
-      { 0x76b0, 0x1d, "LEVEL9-012-2" },
-      { 0xb6ac, 0xc6, "LEVEL9-012-3" },
-      { 0xbb8f, 0x1a, "LEVEL9-012-3" },
-      { 0x8aba, 0x0d, "LEVEL9-012-3" },
-      { 0x8f71, 0x2f, "LEVEL9-012-3" },
-      { 0xb702, 0xe4, "LEVEL9-012-3" },
-      { 0xbb7d, 0x17, "LEVEL9-012-3" },
-      { 0x8ab3, 0xc1, "LEVEL9-012-3" },
-      { 0x4f96, 0x22, "LEVEL9-012-3" },
-      { 0x5914, 0x22, "LEVEL9-012-3" },
-      { 0x765e, 0x4f, "LEVEL9-012-3" },
-      { 0x5eb9, 0x30, "LEVEL9-013" },
-      { 0x5eb9, 0x5d, "LEVEL9-013" },
-      { 0x5eb9, 0x6e, "LEVEL9-013" },
-      { 0xb257, 0xf8, "LEVEL9-013" },
-      { 0xb576, 0x2a, "LEVEL9-013" },
+      { 0x8b1c, 0xa8, "LEVEL9-010-3" },
+      { 0x8b1e, 0x84, "LEVEL9-010-2" },
+      { 0x8b90, 0x4e, "LEVEL9-011-2" },
+      { 0x8b9f, 0x61, "LEVEL9-011-2" },
+      { 0x8c46, 0xf0, "LEVEL9-014" },
+      { 0x8d56, 0xd3, "LEVEL9-015" },
       { 0x8d78, 0x3a, "LEVEL9-013" },
+      { 0x8f43, 0xc9, "LEVEL9-017-2" },
+      { 0x8f51, 0xb2, "LEVEL9-014" },
+      { 0x8f6b, 0xfa, "LEVEL9-012-2" },
+      { 0x8f6f, 0x0a, "LEVEL9-009-2" },
+      { 0x8f71, 0x2f, "LEVEL9-012-3" },
+      { 0x8feb, 0xba, "LEVEL9-012-1" },
+      { 0x903f, 0x6b, "LEVEL9-015" },
+      { 0x9058, 0xcf, "LEVEL9-017-1" },
+      { 0x9060, 0xbb, "LEVEL9-009-3" },
       { 0x9070, 0x43, "LEVEL9-013" },
+      { 0x9089, 0xce, "LEVEL9-010-1" },
+      { 0x908d, 0x80, "LEVEL9-010-2" },
+      { 0x908e, 0x0d, "LEVEL9-009-1" },
+      { 0x909e, 0x9f, "LEVEL9-010-3" },
+      { 0x90ac, 0x68, "LEVEL9-017-3" },
+      { 0x99bd, 0x65, "LEVEL9-017-2" },
+      { 0xa398, 0x82, "LEVEL9-015" },
+      { 0xa3a4, 0xdf, "LEVEL9-015" },
+      { 0xa4e2, 0xa6, "LEVEL9-015" },
+      { 0xa67c, 0xb8, "LEVEL9-015" },
+      { 0xa692, 0xd1, "LEVEL9-015" },
+      { 0xa698, 0x41, "LEVEL9-015" },
+      { 0xa69e, 0x6c, "LEVEL9-015" },
+      { 0xa735, 0xf7, "LEVEL9-009-2" },
+      { 0xa9c0, 0x9e, "LEVEL9-009-3" },
+      { 0xab8b, 0xbf, "LEVEL9-009-2" },
+      { 0xab9d, 0x31, "LEVEL9-009-2" },
+      { 0xad41, 0xa8, "LEVEL9-009-1" },
+      { 0xae16, 0x81, "LEVEL9-009-3" },
+      { 0xae28, 0x87, "LEVEL9-009-3" },
+      { 0xaf82, 0x83, "LEVEL9-009-2" },
+      { 0xb0ec, 0xc2, "LEVEL9-009-1" },
+      { 0xb19e, 0x92, "LEVEL9-009-1" },
+      { 0xb1a9, 0x80, "LEVEL9-009-1" },
+      { 0xb1aa, 0xad, "LEVEL9-009-1" },
+      { 0xb257, 0xf8, "LEVEL9-013" },
+      { 0xb260, 0xe5, "LEVEL9-013" },
       { 0xb38c, 0x37, "LEVEL9-013" },
+      { 0xb3e6, 0xab, "LEVEL9-009-3" },
+      { 0xb451, 0xa8, "LEVEL9-014" },
+      { 0xb4c9, 0x94, "LEVEL9-012-1" },
       { 0xb563, 0x6a, "LEVEL9-013" },
-      { 0xb57c, 0x44, "LEVEL9-013" },
-      { 0xb260, 0xe5, "LEVEL9-013" },
-      { 0x8950, 0xa1, "LEVEL9-013" },
+      { 0xb576, 0x2a, "LEVEL9-013" },
       { 0xb579, 0x89, "LEVEL9-013" },
-      { 0x579e, 0x97, "LEVEL9-013" },
-      { 0x69fe, 0x56, "LEVEL9-013" },
-      { 0x6f1e, 0xda, "LEVEL9-013" },
-      { 0x5671, 0xbc, "LEVEL9-014" },
-      { 0x6fc6, 0x14, "LEVEL9-014" },
-      { 0x5aa4, 0xc1, "LEVEL9-014" },
-      { 0x7410, 0x5e, "LEVEL9-014" },
-      { 0x5aa4, 0xc1, "LEVEL9-014" },
-      { 0x5aa4, 0xc1, "LEVEL9-014" },
+      { 0xb57c, 0x44, "LEVEL9-013" },
+      { 0xb6ac, 0xc6, "LEVEL9-012-3" },
+      { 0xb702, 0xe4, "LEVEL9-012-3" },
+      { 0xb729, 0x51, "LEVEL9-012-2" },
+      { 0xb741, 0xb6, "LEVEL9-010-2" },
+      { 0xb770, 0x03, "LEVEL9-010-1" },
+      { 0xb791, 0xa1, "LEVEL9-010-3" },
       { 0xb797, 0x1f, "LEVEL9-014" },
-      { 0xbaca, 0x3a, "LEVEL9-014" },
-      { 0x8c46, 0xf0, "LEVEL9-014" },
-      { 0x8f51, 0xb2, "LEVEL9-014" },
-      { 0xb451, 0xa8, "LEVEL9-014" },
-      { 0xbab2, 0x87, "LEVEL9-014" },
-      { 0xbac7, 0x7f, "LEVEL9-014" },
       { 0xb7a0, 0x7e, "LEVEL9-014" },
-      { 0x8a60, 0x2a, "LEVEL9-014" },
+      { 0xbab2, 0x87, "LEVEL9-014" },
       { 0xbac4, 0x80, "LEVEL9-014" },
-      { 0x579a, 0x2a, "LEVEL9-014" },
-      { 0x5a50, 0xa9, "LEVEL9-014" },
-      { 0x6108, 0xdd, "LEVEL9-014" },
-      { 0x506c, 0xf0, "LEVEL9-015" },
-      { 0x505d, 0x32, "LEVEL9-015" },
-      { 0xa398, 0x82, "LEVEL9-015" },
-      { 0xa692, 0xd1, "LEVEL9-015" },
-      { 0x8d56, 0xd3, "LEVEL9-015" },
-      { 0x903f, 0x6b, "LEVEL9-015" },
-      { 0xa4e2, 0xa6, "LEVEL9-015" },
-      { 0xa67c, 0xb8, "LEVEL9-015" },
-      { 0xa69e, 0x6c, "LEVEL9-015" },
-      { 0xa3a4, 0xdf, "LEVEL9-015" },
-      { 0x8813, 0x11, "LEVEL9-015" },
-      { 0xa698, 0x41, "LEVEL9-015" },
-      { 0x5500, 0x50, "LEVEL9-015" },
-      { 0x6888, 0x8d, "LEVEL9-015" },
-      { 0x6da0, 0xb8, "LEVEL9-015" },
-      { 0x6064, 0xbd, "LEVEL9-016" },
-      { 0x6064, 0x01, "LEVEL9-016" },
-      { 0x6047, 0x6c, "LEVEL9-016" },
-      { 0x6064, 0xda, "LEVEL9-016" },
-      { 0x6064, 0x95, "LEVEL9-016" },
-      { 0x60c4, 0x28, "LEVEL9-016" },
-      { 0x5cb7, 0xfe, "LEVEL9-016" },
-      { 0x5ca1, 0x33, "LEVEL9-016" },
-      { 0x5cb7, 0x64, "LEVEL9-016" },
-      { 0x7d16, 0xe6, "LEVEL9-016" },
-      { 0x639c, 0x8b, "LEVEL9-016" },
-      { 0x60f7, 0x68, "LEVEL9-016" },
-      { 0x772f, 0xca, "LEVEL9-016" },
-      { 0x7cff, 0xf8, "LEVEL9-016" },
-      { 0x7cf8, 0x24, "LEVEL9-016" },
-      { 0x7d14, 0xe8, "LEVEL9-016" },
-      { 0x7c55, 0x18, "LEVEL9-016" },
-      { 0x5f43, 0xca, "LEVEL9-016" },
-      { 0xc132, 0x14, "LEVEL9-017-1" },
-      { 0xbeab, 0x2d, "LEVEL9-017-1" },
-      { 0x9058, 0xcf, "LEVEL9-017-1" },
-      { 0xbe94, 0xcc, "LEVEL9-017-1" },
-      { 0x8a21, 0xf4, "LEVEL9-017-1" },
-      { 0x55ce, 0xa1, "LEVEL9-017-1" },
-      { 0x5cbc, 0xa5, "LEVEL9-017-1" },
-      { 0x762e, 0x82, "LEVEL9-017-1" },
-      { 0x99bd, 0x65, "LEVEL9-017-2" },
-      { 0x8f43, 0xc9, "LEVEL9-017-2" },
-      { 0x8a12, 0xe3, "LEVEL9-017-2" },
-      { 0x54a6, 0xa9, "LEVEL9-017-2" },
-      { 0x5932, 0x4e, "LEVEL9-017-2" },
-      { 0x5bd6, 0x35, "LEVEL9-017-2" },
+      { 0xbac7, 0x7f, "LEVEL9-014" },
+      { 0xbaca, 0x3a, "LEVEL9-014" },
+      { 0xbb6e, 0xa6, "LEVEL9-011-1" },
+      { 0xbb6e, 0xad, "LEVEL9-011-1" },
+      { 0xbb7d, 0x17, "LEVEL9-012-3" },
+      { 0xbb8f, 0x1a, "LEVEL9-012-3" },
+      { 0xbb93, 0x36, "LEVEL9-011-1" },
+      { 0xbba4, 0x94, "LEVEL9-012-1" },
       { 0xbcb6, 0x7a, "LEVEL9-017-3 (Amiga/PC/ST)" },
-      { 0x90ac, 0x68, "LEVEL9-017-3" },
-      { 0x8a16, 0xcc, "LEVEL9-017-3" },
-      { 0x51bc, 0xe3, "LEVEL9-017-3" },
-      { 0x5860, 0x95, "LEVEL9-017-3" },
-      { 0x6fa8, 0xa4, "LEVEL9-017-3" },
-      { 0x5fab, 0x5c, "LEVEL9-018" },
-      { 0x5fab, 0x2f, "LEVEL9-018" },
-      { 0x7b31, 0x6e, "LEVEL9-018" },
-      { 0x67a3, 0x9d, "LEVEL9-018" },
-      { 0x6bf8, 0x3f, "LEVEL9-018" },
-      { 0x7363, 0x65, "LEVEL9-018" },
-      { 0x7b2f, 0x70, "LEVEL9-018" },
-      { 0x7b2f, 0x70, "LEVEL9-018" },
-      { 0x6541, 0x02, "LEVEL9-018" },
-      { 0x5834, 0x42, "LEVEL9-019-1" },
-      { 0x765d, 0xcd, "LEVEL9-019-1" },
-      { 0x6ce5, 0x58, "LEVEL9-019-1" },
-      { 0x56dd, 0x51, "LEVEL9-019-2" },
-      { 0x6e58, 0x07, "LEVEL9-019-2" },
-      { 0x68da, 0xc1, "LEVEL9-019-2" },
-      { 0x5801, 0x53, "LEVEL9-019-3" },
-      { 0x7e98, 0x6a, "LEVEL9-019-3" },
-      { 0x6c67, 0x9a, "LEVEL9-019-3" },
-      { 0x54a4, 0x01, "LEVEL9-019-4" },
-      { 0x81e2, 0xd5, "LEVEL9-019-4" },
-      { 0x6d91, 0xb9, "LEVEL9-019-4" },
-      { 0x5828, 0xbd, "LEVEL9-020" },
-      { 0x6d84, 0xf9, "LEVEL9-020" },
-      { 0x6d84, 0xc8, "LEVEL9-020" },
-      { 0x6030, 0x47, "LEVEL9-020" },
-      { 0x772b, 0xcd, "LEVEL9-020" },
-      { 0x546c, 0xb7, "LEVEL9-020" },
-      { 0x7cd9, 0x0c, "LEVEL9-020" },
-      { 0x60dd, 0xf2, "LEVEL9-020" },
-      { 0x6161, 0xf3, "LEVEL9-020" },
-      { 0x788d, 0x72, "LEVEL9-020" },
-      { 0x7cd7, 0x0e, "LEVEL9-020" },
-      { 0x5ebb, 0xf1, "LEVEL9-020" },
-
+      { 0xbe94, 0xcc, "LEVEL9-017-1" },
+      { 0xbeab, 0x2d, "LEVEL9-017-1" },
+      { 0xc0bd, 0x57, "LEVEL9-012-1" },
+      { 0xc0cf, 0x4e, "LEVEL9-012-1" },
+      { 0xc132, 0x14, "LEVEL9-017-1" },
+      { 0xc58e, 0x43, "LEVEL9-011-2" },
+      { 0xc58e, 0x4a, "LEVEL9-011-2" },
+      { 0xc58f, 0x65, "LEVEL9-010-2" },
+      { 0xc594, 0x03, "LEVEL9-010-2" },
+      { 0xc5a5, 0xfe, "LEVEL9-010-2" },
+      { 0xcb9a, 0x08, "LEVEL9-011-3" },
+      { 0xcb9a, 0x0f, "LEVEL9-011-3" },
+      { 0xd0c0, 0x56, "LEVEL9-012-2" },
+      { 0xd183, 0x83, "LEVEL9-010-1" },
+      { 0xd188, 0x13, "LEVEL9-010-1" },
+      { 0xd19b, 0xad, "LEVEL9-010-1" },
+      { 0xd5d7, 0x99, "LEVEL9-012-2" },
+      { 0xd5e9, 0x6a, "LEVEL9-012-2" },
+      { 0xd79a, 0x57, "LEVEL9-010-3" },
+      { 0xd79f, 0xb5, "LEVEL9-010-3" },
+      { 0xd7ae, 0x9e, "LEVEL9-010-3" },
       { 0, 0, NULL }
 };
 
+#define L9_REGISTRY_SIZE ((int32) (sizeof(l9_registry)/sizeof(l9_registry[0])-1))
+
+/* What get_l9_version found out about a story, kept by the babel handler
+   so that the image is only recognised once */
+struct l9_index {
+                int version;
+                char *ifid;
+};
+
 
 
 static int32 read_l9_int(unsigned char *sf)
@@ -347,13 +358,13 @@ static int32 read_l9_int(unsigned char *sf)
 static int v2_recognition (unsigned char *sf, int32 extent, int32 *l, unsigned char *c)
 {
   int32 i, j;
-  for (i=0;i<extent-20;i++)
+  for (i=0;i<extent-0x1e;i++)
     if ((read_l9_int(sf+i+4) == 0x0020) &&
         (read_l9_int(sf+i+0x0a) == 0x8000) &&
         (read_l9_int(sf+i+0x14) == read_l9_int(sf+i+0x16)))
     {
       *l=read_l9_int(sf+i+0x1c);
-      if (*l && *l+i <=extent)
+      if (*l && *l+i <extent)
        {
          *c=0;
          for(j=0;j<=*l;j++)
@@ -403,9 +414,9 @@ static int v3_recognition_phase (int phase,unsigned char *sf, int32 extent, int3
     if (end <= (extent - 2) &&
        (
         ((phase == 2) ||
-        (((sf[end-1] == 0) &&
+        (((end >= 2) && (sf[end-1] == 0) &&
          (sf[end-2] == 0)) ||
-        ((sf[end+1] == 0) &&
+        ((end+2 < extent) && (sf[end+1] == 0) &&
          (sf[end+2] == 0))))
         && (*l>0x4000) && (*l<=0xdb00)))
       if ((*l!=0) && (sf[i+0x0d] == 0))
@@ -442,11 +453,23 @@ static int v3_recognition_phase (int phase,unsigned char *sf, int32 extent, int3
   if (ll) return *l < 0x8500 ? 3:4;
   return 0;
 }
+/* Orders a registry entry against a length and checksum */
+static int l9_compare(struct l9rec *r, int32 length, unsigned char chk)
+{
+ if (r->length!=length) return r->length < length ? -1 : 1;
+ return r->chk < chk ? -1 : r->chk > chk;
+}
 static char *get_l9_ifid(int32 length, unsigned char chk)
 {
- int i;
- for(i=0;l9_registry[i].length;i++)
-  if (length==l9_registry[i].length && chk==l9_registry[i].chk) return l9_registry[i].ifid;
+ int32 lo=0, hi=L9_REGISTRY_SIZE, mid;
+ while(lo<hi)
+ {
+  mid=lo+(hi-lo)/2;
+  if (l9_compare(l9_registry+mid,length,chk)<0) lo=mid+1;
+  else hi=mid;
+ }
+ if (lo<L9_REGISTRY_SIZE && !l9_compare(l9_registry+lo,length,chk))
+  return l9_registry[lo].ifid;
  return NULL;
 }
 static int get_l9_version(unsigned char *sf, int32 extent, char **ifid)
@@ -478,10 +501,8 @@ static int32 claim_story_file(void *story, int32 extent)
 
 
 
-static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, int32 output_extent)
+static int32 l9_IFID(int i, char *ifid, char *output, int32 output_extent)
 {
- char *ifid=NULL;
- int i=get_l9_version((unsigned char *)story_file, extent, &ifid);
  if (!i) return INVALID_STORY_FILE_RV;
  if (ifid)
  {
@@ -493,3 +514,112 @@ static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, i
  sprintf(output,"LEVEL9-%d-",i);
  return INCOMPLETE_REPLY_RV;
 }
+
+static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, int32 output_extent)
+{
+ char *ifid=NULL;
+ int i=get_l9_version((unsigned char *)story_file, extent, &ifid);
+ return l9_IFID(i, ifid, output, output_extent);
+}
+
+static int32 get_story_index(void *story_file, int32 extent, void **index)
+{
+ struct l9_index *ix;
+ char *ifid=NULL;
+ int i=get_l9_version((unsigned char *)story_file, extent, &ifid);
+ if (!i) return NO_REPLY_RV;
+ ix=(struct l9_index *) malloc(sizeof(struct l9_index));
+ if (!ix) return NO_REPLY_RV;
+ ix->version=i;
+ ix->ifid=ifid;
+ *index=ix;
+ return sizeof(struct l9_index);
+}
+
+static int32 indexed_query(int32 selector, void *story_file, int32 extent, void *index, void *output, int32 output_extent)
+{
+ struct l9_index *ix=(struct l9_index *) index;
+ switch(selector)
+ {
+  case CLAIM_STORY_FILE_SEL:
+                return ix->ifid ? VALID_STORY_FILE_RV : NO_REPLY_RV;
+  case GET_STORY_FILE_IFID_SEL:
+                return l9_IFID(ix->version, ix->ifid, (char *) output, output_extent);
+  case GET_STORY_FILE_METADATA_EXTENT_SEL:
+  case GET_STORY_FILE_METADATA_SEL:
+  case GET_STORY_FILE_COVER_EXTENT_SEL:
+  case GET_STORY_FILE_COVER_FORMAT_SEL:
+  case GET_STORY_FILE_COVER_OFFSET_SEL:
+  case GET_STORY_FILE_COVER_SEL:
+                return NO_REPLY_RV;
+ }
+ return UNAVAILABLE_RV;
+}
+
+/* Checks that the registry is in order, and that a synthetic version 2
+   header carrying each entry's length and checksum is identified as that
+   entry.  Entries with the same length and checksum as the one before are
+   reported as duplicates, or as conflicts if their IFIDs differ, since
+   only the first can ever be found */
+static int32 verify_registry(char *output, int32 output_extent)
+{
+ struct l9rec *r;
+ unsigned char *sf, sum;
+ char line[256], *ifid;
+ int32 i, j, extent, problems=0;
+ int v;
+
+ sf=(unsigned char *) malloc(0x10000+32);
+ if (!sf) return INVALID_USAGE_RV;
+ for(i=0;i<L9_REGISTRY_SIZE;i++)
+ {
+  r=l9_registry+i;
+  if (i && l9_compare(r-1,r->length,r->chk)>0)
+  {
+   sprintf(line,"level9: entry %ld (%s) is out of order",(long) i,r->ifid);
+   babel_report(output,output_extent,line);
+   problems++;
+  }
+  else if (i && !l9_compare(r-1,r->length,r->chk))
+  {
+   if (strcmp(r[-1].ifid,r->ifid))
+    sprintf(line,"level9: entry %ld (%s) conflicts with entry %ld (%s)",(long) i,r->ifid,(long) i-1,r[-1].ifid);
+   else
+    sprintf(line,"level9: entry %ld (%s) duplicates entry %ld",(long) i,r->ifid,(long) i-1);
+   babel_report(output,output_extent,line);
+   problems++;
+   continue;
+  }
+  if (r->length<0x1e || r->length>0xffff)
+  {
+   sprintf(line,"level9: entry %ld (%s) has an impossible length",(long) i,r->ifid);
+   babel_report(output,output_extent,line);
+   problems++;
+   continue;
+  }
+
+  /* The header v2_recognition looks for, at the start of the image,
+     followed by A-code whose last byte makes up the checksum */
+  extent=r->length+32;
+  memset(sf,0,extent);
+  sf[4]=0x20;
+  sf[0x0b]=0x80;
+  sf[0x1c]=(unsigned char) (r->length & 0xff);
+  sf[0x1d]=(unsigned char) (r->length >> 8);
+  for(sum=0,j=0;j<r->length;j++) sum+=sf[j];
+  sf[r->length]=(unsigned char) (r->chk-sum);
+
+  ifid=NULL;
+  v=get_l9_version(sf,extent,&ifid);
+  if (v!=2 || !ifid || strcmp(ifid,r->ifid))
+  {
+   sprintf(line,"level9: entry %ld (%s) is identified as %s",(long) i,r->ifid,ifid ? ifid : "nothing");
+   babel_report(output,output_extent,line);
+   problems++;
+  }
+ }
+ free(sf);
+ sprintf(line,"level9: %ld entries checked, %ld problems",(long) L9_REGISTRY_SIZE,(long) problems);
+ babel_report(output,output_extent,line);
+ return problems;
+}
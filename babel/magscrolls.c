@@ -12,6 +12,7 @@
 #define FORMAT_EXT ".mag"
 #define NO_COVER
 #define NO_METADATA
+#define REGISTRY_CHECK
 
 #include "treaty_builder.h"
 #include <ctype.h>
@@ -30,6 +31,10 @@ struct maginfo
 };
 
 
+/* The known games.  Most are identified by the 20 bytes of their header
+   from offset 12, by which the manifest is sorted so that it may be
+   searched by bisection; the earliest games, whose headers are not
+   distinctive, are identified by their version (byte 13) instead */
 static struct maginfo manifest[] = {
         { 0, "\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000",
           "The Pawn",
@@ -38,13 +43,6 @@ static struct maginfo manifest[] = {
           "MAGNETIC-1",
           "Rob Steggles",
         },
-        { 1, "\000\004\000\001\007\370\000\000\340\000\000\000\041\064\000\000\040\160\000\000",
-          "Guild of Thieves",
-          0,
-          1987,
-          "MAGNETIC-2",
-          "Rob Steggles",
-        },
         { 2, "\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000\000",
           "Jinxter",
           0,
@@ -52,40 +50,47 @@ static struct maginfo manifest[] = {
           "MAGNETIC-3",
           "Georgina Sinclair and Michael Bywater",
         },
-        { 4, "\000\004\000\001\045\140\000\001\000\000\000\000\161\017\000\000\035\210\000\001",
+        { 4, "\000\003\000\000\335\000\000\000\140\000\000\000\064\000\000\000\023\000\000\000",
+          "Myth",
+          0,
+          1989,
+          "MAGNETIC-6",
+          "Paul Findley",
+        },
+        { 4, "\000\003\000\000\377\000\000\000\340\000\000\000\221\000\000\000\036\000\000\001",
           "Corruption",
           0,
           1988,
           "MAGNETIC-4",
           "Rob Steggles and Hugh Steers",
         },
-        { 4, "\000\004\000\001\044\304\000\001\000\000\000\000\134\137\000\000\040\230\000\001",
+        { 4, "\000\003\000\001\000\000\000\000\340\000\000\000\175\000\000\000\037\000\000\001",
           "Fish!",
           0,
           1988,
           "MAGNETIC-5",
           "John Molloy, Pete Kemp, Phil South, Rob Steggles",
         },
-        { 4, "\000\003\000\000\377\000\000\000\340\000\000\000\221\000\000\000\036\000\000\001",
-          "Corruption",
+        { 1, "\000\004\000\001\007\370\000\000\340\000\000\000\041\064\000\000\040\160\000\000",
+          "Guild of Thieves",
           0,
-          1988,
-          "MAGNETIC-4",
-          "Rob Steggles and Hugh Steers",
+          1987,
+          "MAGNETIC-2",
+          "Rob Steggles",
         },
-        { 4, "\000\003\000\001\000\000\000\000\340\000\000\000\175\000\000\000\037\000\000\001",
+        { 4, "\000\004\000\001\044\304\000\001\000\000\000\000\134\137\000\000\040\230\000\001",
           "Fish!",
           0,
           1988,
           "MAGNETIC-5",
           "John Molloy, Pete Kemp, Phil South, Rob Steggles",
         },
-        { 4, "\000\003\000\000\335\000\000\000\140\000\000\000\064\000\000\000\023\000\000\000",
-          "Myth",
+        { 4, "\000\004\000\001\045\140\000\001\000\000\000\000\161\017\000\000\035\210\000\001",
+          "Corruption",
           0,
-          1989,
-          "MAGNETIC-6",
-          "Paul Findley",
+          1988,
+          "MAGNETIC-4",
+          "Rob Steggles and Hugh Steers",
         },
         { 4, "\000\004\000\001\122\074\000\001\000\000\000\000\114\146\000\000\057\240\000\001",
           "Wonderland",
@@ -97,23 +102,108 @@ static struct maginfo manifest[] = {
         { 0, "0", NULL, 0, 0, NULL, NULL }
         };
 
+#define MANIFEST_SIZE ((int32) (sizeof(manifest)/sizeof(manifest[0])-1))
+
+/* The manifest entries of the games identified by version, indexed by
+   version */
+static int32 by_version[3] = { 0, 5, 1 };
+
+static struct maginfo *find_manifest(unsigned char *sf)
+{
+ int32 lo=0, hi=MANIFEST_SIZE, mid;
+ if (sf[13]<3) return manifest+by_version[sf[13]];
+ while(lo<hi)
+ {
+  mid=lo+(hi-lo)/2;
+  if (memcmp(manifest[mid].header,sf+12,20)<0) lo=mid+1;
+  else hi=mid;
+ }
+ if (lo<MANIFEST_SIZE && memcmp(manifest[lo].header,sf+12,20)==0)
+  return manifest+lo;
+ return NULL;
+}
+
 static int32 get_story_file_IFID(void *story_file, int32 extent, char *output, int32 output_extent)
 {
- int i;
- unsigned char *sf=(unsigned char *)story_file;
+ struct maginfo *m;
  if (extent < 42) return INVALID_STORY_FILE_RV;
 
- for(i=0;manifest[i].title;i++)
-  if ((sf[13]<3 && manifest[i].gv==sf[13]) || memcmp(manifest[i].header,sf+12,20)==0)
+ m=find_manifest((unsigned char *)story_file);
+ if (m)
    {
-    ASSERT_OUTPUT_SIZE(((int32) strlen(manifest[i].ifid)+1));
-    strcpy(output,manifest[i].ifid);
+    ASSERT_OUTPUT_SIZE(((int32) strlen(m->ifid)+1));
+    strcpy(output,m->ifid);
     return 1;
    }
  strcpy(output,"MAGNETIC-");
  return INCOMPLETE_REPLY_RV;
 }
 
+/* Checks that the manifest is in order, and that synthetic headers for
+   each entry, by header and (for the early games) by version, are
+   identified as that entry */
+static int32 verify_registry(char *output, int32 output_extent)
+{
+ unsigned char sf[42];
+ char line[256], ifid[TREATY_MINIMUM_EXTENT];
+ struct maginfo *m;
+ int32 i, c, problems=0;
+ int by_header;
+
+ for(i=0;i<3;i++)
+  if (manifest[by_version[i]].gv!=i)
+  {
+   sprintf(line,"magscrolls: version %ld does not lead to a version %ld game",(long) i,(long) i);
+   babel_report(output,output_extent,line);
+   problems++;
+  }
+ for(i=0;i<MANIFEST_SIZE;i++)
+ {
+  m=manifest+i;
+  /* Only headers with a version of 3 or more are looked up */
+  by_header=(unsigned char) m->header[1]>=3;
+  c=i ? memcmp(m[-1].header,m->header,20) : -1;
+  if (c>0)
+  {
+   sprintf(line,"magscrolls: entry %ld (%s) is out of order",(long) i,m->ifid);
+   babel_report(output,output_extent,line);
+   problems++;
+  }
+  else if (c==0 && by_header)
+  {
+   if (strcmp(m[-1].ifid,m->ifid))
+    sprintf(line,"magscrolls: entry %ld (%s) conflicts with entry %ld (%s)",(long) i,m->ifid,(long) i-1,m[-1].ifid);
+   else
+    sprintf(line,"magscrolls: entry %ld (%s) duplicates entry %ld",(long) i,m->ifid,(long) i-1);
+   babel_report(output,output_extent,line);
+   problems++;
+   continue;
+  }
+  if (!by_header && (m->gv>=3 || by_version[m->gv]!=i))
+  {
+   sprintf(line,"magscrolls: entry %ld (%s) can never be identified",(long) i,m->ifid);
+   babel_report(output,output_extent,line);
+   problems++;
+   continue;
+  }
+
+  memset(sf,0,sizeof(sf));
+  memcpy(sf,"MaSc",4);
+  if (by_header) memcpy(sf+12,m->header,20);
+  else sf[13]=m->gv;
+  ifid[0]=0;
+  if (get_story_file_IFID(sf,sizeof(sf),ifid,sizeof(ifid))!=1 || strcmp(ifid,m->ifid))
+  {
+   sprintf(line,"magscrolls: entry %ld (%s) is identified as %.64s",(long) i,m->ifid,ifid);
+   babel_report(output,output_extent,line);
+   problems++;
+  }
+ }
+ sprintf(line,"magscrolls: %ld entries checked, %ld problems",(long) MANIFEST_SIZE,(long) problems);
+ babel_report(output,output_extent,line);
+ return problems;
+}
+
 static int32 claim_story_file(void *story_file, int32 extent)
 {
  if (extent<42 ||
@@ -5,6 +5,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include "treaty.h"
 
 void *my_malloc(int size, char *rs)
 {
@@ -17,3 +19,38 @@ void *my_malloc(int size, char *rs)
    return buf;
 }
 
+/* Finds the first "UUID://" in a story file, and the '/' which closes it.
+   Returns the offset of the IFID between them and sets *length, or returns
+   -1 if there is no such IFID.  Candidates are found with memchr, which
+   is much faster than comparing the string at every offset of large files.
+ */
+int32 babel_find_uuid(void *story_file, int32 extent, int32 *length)
+{
+ char *sf=(char *) story_file;
+ char *p=sf, *e=sf+extent, *q;
+
+ while(e-p>=7 && (p=(char *) memchr(p,'U',e-p-6))!=NULL)
+ {
+  if (memcmp(p,"UUID://",7)==0)
+  {
+   q=(char *) memchr(p+7,'/',e-p-7);
+   if (!q) return -1;
+   *length=q-p-7;
+   return p+7-sf;
+  }
+  p++;
+ }
+ return -1;
+}
+
+/* Appends a line to the report in output, which is left alone if the line
+   will not fit.  The report is a NUL-terminated string */
+void babel_report(char *output, int32 output_extent, char *line)
+{
+ int32 l=strlen(output), ll=strlen(line);
+ if (l+ll+2>output_extent) return;
+ memcpy(output+l,line,ll);
+ output[l+ll]='\n';
+ output[l+ll+1]=0;
+}
+
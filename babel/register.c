@@ -11,14 +11,18 @@
  * 543 Howard Street, 5th Floor,
  * San Francisco, California, 94105, USA.
  *
- * This file depends on modules.h
+ * This file depends on modules.h and babel_registry.h
  *
  * The purpose of this file is to create the treaty_registry array.
  * This array is a null-terminated list of the known treaty modules.
+ * It also provides the babel_registry functions (see babel_registry.h)
+ * for this fixed registry.
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "modules.h"
+#include "babel_registry.h"
 
 
 TREATY treaty_registry[] = {
@@ -34,3 +38,53 @@ TREATY container_registry[] = {
 
 };
 
+/* The call counters of the modules, in registry order */
+static unsigned long treaty_calls[sizeof(treaty_registry)/sizeof(TREATY)];
+static unsigned long container_calls[sizeof(container_registry)/sizeof(TREATY)];
+
+/* This registry never changes, so there is nothing to hold on to */
+void *babel_registry_acquire(TREATY **treaties, TREATY **containers)
+{
+ *treaties=treaty_registry;
+ *containers=container_registry;
+ return NULL;
+}
+
+void babel_registry_release(void *registry)
+{
+ if (registry) { }
+}
+
+unsigned long *babel_registry_counter(void *registry, TREATY module)
+{
+ int32 i;
+ if (registry) { }
+ for(i=0;container_registry[i];i++)
+  if (container_registry[i]==module) return container_calls+i;
+ for(i=0;treaty_registry[i];i++)
+  if (treaty_registry[i]==module) return treaty_calls+i;
+ return NULL;
+}
+
+static int32 describe_modules(TREATY *registry, unsigned long *calls, int32 container,
+                              struct babel_registry_module *modules, int32 n, int32 found)
+{
+ int32 i;
+ for(i=0;registry[i];i++,found++)
+  if (found<n)
+  {
+   if (registry[i](GET_FORMAT_NAME_SEL,NULL,0,modules[found].format,TREATY_MINIMUM_EXTENT)<0)
+    modules[found].format[0]=0;
+   modules[found].container=container;
+   modules[found].retired=0;
+   modules[found].calls=calls[i];
+  }
+ return found;
+}
+
+int32 babel_registry_modules(struct babel_registry_module *modules, int32 n)
+{
+ return describe_modules(treaty_registry,treaty_calls,0,modules,n,
+                         describe_modules(container_registry,container_calls,1,modules,n,0));
+}
+
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include "tads.h"
 #include "md5.h"
+#include "babel_image.h"
 
 #define ASSERT_OUTPUT_SIZE(x) \
     do { if (output_extent < (x)) return INVALID_USAGE_RV; } while (0)
@@ -53,6 +54,50 @@ struct resinfo
     int tads_version;
 };
 
+/*
+ *   resource index entry 
+ */
+typedef struct resentry resentry;
+struct resentry
+{
+    /* 
+     *   the name, as stored in the file, and its length; 'mask' is XORed
+     *   with each byte of the stored name to give the real name (tads 3
+     *   masks resource names with 0xFF, tads 2 doesn't mask them at all) 
+     */
+    const char *name;
+    size_t name_len;
+    int mask;
+
+    /* 
+     *   The precedence of this entry over others of the same name - the
+     *   lowest (group, seq) wins.  'group' is the number of the resource
+     *   block within the file, and 'seq' the position within the block.  
+     */
+    int32 group;
+    int32 seq;
+
+    /* the resource's location */
+    resinfo info;
+};
+
+/*
+ *   Resource index - the resource directory of a story file, read once and
+ *   sorted by name, so that looking up a resource doesn't have to walk the
+ *   whole file again 
+ */
+typedef struct resindex resindex;
+struct resindex
+{
+    /* tads major version, or 0 if this isn't a tads file */
+    int tads_version;
+
+    /* the entries, sorted by name and then precedence */
+    resentry *ents;
+    int32 cnt;
+    int32 alloced;
+};
+
 /*
  *   Name/value pair list entry 
  */
@@ -70,143 +115,298 @@ struct valinfo
     valinfo *nxt;
 };
 
+/*
+ *   Story index - everything the treaty functions report about a story
+ *   file.  This is built in one pass over the file by
+ *   tads_get_story_index(), and is allocated as a single block, with the
+ *   IFID and iFiction strings following the structure, so that the babel
+ *   handler can keep it for the life of its context and release it with
+ *   free(). 
+ */
+typedef struct tads_index tads_index;
+struct tads_index
+{
+    /* 
+     *   The IFID list (comma-separated and null-terminated), its length,
+     *   and the number of IFIDs in it.  If there's no GameInfo, the count is
+     *   zero until the default MD5 IFID is needed: there's no sense hashing
+     *   the whole file unless someone asks for the IFID.  
+     */
+    char *ifid;
+    size_t ifid_len;
+    int32 ifid_cnt;
+
+    /* the synthesized iFiction record and its size, or 0 if no GameInfo */
+    char *ifiction;
+    int32 ifiction_len;
+
+    /* the cover art, if any (the pointer is into the story file) */
+    const char *cover;
+    int32 cover_len;
+    int32 cover_format;
+    int32 cover_wid;
+    int32 cover_ht;
+};
+
+/* room for a default IFID - "TADSn-", 32 hex digits, and a null */
+#define MD5_IFID_SIZE 39
+
 
 /* ------------------------------------------------------------------------ */
 /*
  *   forward declarations 
  */
-static valinfo *parse_game_info(const void *story_file, int32 story_len,
-                                int *version);
-static int find_resource(const void *story_file, int32 story_len,
-                         const char *resname, resinfo *info);
-static int find_cover_art(const void *story_file, int32 story_len,
+static valinfo *parse_game_info(const resindex *ix, int *version);
+static int index_resources(const void *story_file, int32 story_len,
+                           resindex *ix);
+static void free_resources(resindex *ix);
+static int compare_resentry(const void *a, const void *b);
+static int find_resource(const resindex *ix, const char *resname,
+                         resinfo *info);
+static int find_cover_art(const resindex *ix,
                           resinfo *resp, int32 *image_format,
                           int32 *width, int32 *height);
-static int t2_find_res(const void *story_file, int32 story_len,
-                       const char *resname, resinfo *info);
-static int t3_find_res(const void *story_file, int32 story_len,
-                       const char *resname, resinfo *info);
+static int t2_index_res(const void *story_file, int32 story_len,
+                        resindex *ix);
+static int t3_index_res(const void *story_file, int32 story_len,
+                        resindex *ix);
 static valinfo *find_by_key(valinfo *list_head, const char *key);
 static void delete_valinfo_list(valinfo *head);
 static int32 generate_md5_ifid(void *story_file, int32 extent,
                                char *output, int32 output_extent);
 static int32 synth_ifiction(valinfo *vals, int tads_version,
                             char *buf, int32 bufsize,
-                            void *story_file, int32 extent);
-static int get_png_dim(const void *img, int32 extent,
-                       int32 *xout, int32 *yout);
-static int get_jpeg_dim(const void *img, int32 extent,
-                        int32 *xout, int32 *yout);
-
+                            const tads_index *tix);
 
 
 /* ------------------------------------------------------------------------ */
 /*
- *   Get the IFID for a given story file.  
+ *   Build the story index.  This reads the resource directory once, parses
+ *   the GameInfo, finds the cover art, and synthesizes the iFiction record,
+ *   so that every question about the story can then be answered from the
+ *   index.  Returns the size of the index, which is stored in *index.  
  */
-int32 tads_get_story_file_IFID(void *story_file, int32 extent,
-                               char *output, int32 output_extent)
+int32 tads_get_story_index(void *story_file, int32 extent, void **index)
 {
+    resindex rix;
+    resinfo res;
     valinfo *vals;
-    
-    /* if we have GameInfo, try looking for an IFID there */
-    if ((vals = parse_game_info(story_file, extent, 0)) != 0)
-    {
-        valinfo *val;
-        int found = 0;
-        
-        /* find the "IFID" key */
-        if ((val = find_by_key(vals, "IFID")) != 0)
-        {
-            char *p;
-            
-            /* copy the output as a null-terminated string */
-            ASSERT_OUTPUT_SIZE((int32)val->val_len + 1);
-            memcpy(output, val->val, val->val_len);
-            output[val->val_len] = '\0';
+    valinfo *val;
+    tads_index tix;
+    tads_index *ix;
+    char default_ifid[MD5_IFID_SIZE];
+    const char *ifid;
+    size_t ifid_room;
+    int32 siz;
+    int ver = 0;
+    const char *p;
 
-            /* 
-             *   count up the IFIDs in the buffer - there might be more than
-             *   one, separated by commas 
-             */
-            for (found = 1, p = output ; *p != '\0' ; ++p)
-            {
-                /* if this is a comma, it delimits a new IFID */
-                if (*p == ',')
-                    ++found;
-            }
-        }
+    /* we have nothing yet */
+    *index = 0;
+    if (story_file == 0)
+        return NO_REPLY_RV;
 
-        /* delete the GameInfo list */
-        delete_valinfo_list(vals);
+    /* index the resources, and parse the GameInfo if there is one */
+    index_resources(story_file, extent, &rix);
+    vals = parse_game_info(&rix, &ver);
+    memset(&tix, 0, sizeof(tix));
 
-        /* if we found an IFID, indicate how many results we found */
-        if (found != 0)
-            return found;
+    /* look for the cover art */
+    if (find_cover_art(&rix, &res, &tix.cover_format,
+                       &tix.cover_wid, &tix.cover_ht))
+    {
+        tix.cover = res.ptr;
+        tix.cover_len = res.len;
+    }
+
+    /* 
+     *   Find the IFID.  If the GameInfo lists any, use those; if there's a
+     *   GameInfo without one, the synthesized iFiction needs the default
+     *   IFID, so generate it now; and if there's no GameInfo at all, leave
+     *   the default IFID until it's asked for. 
+     */
+    ifid = 0;
+    if (vals != 0 && (val = find_by_key(vals, "IFID")) != 0)
+    {
+        /* use the IFIDs from the GameInfo */
+        ifid = val->val;
+        tix.ifid_len = val->val_len;
+
+        /* count them - there's one more IFID than there are commas */
+        for (tix.ifid_cnt = 1, p = ifid ; p < ifid + tix.ifid_len ; ++p)
+        {
+            if (*p == ',')
+                ++tix.ifid_cnt;
+        }
+    }
+    else if (vals != 0)
+    {
+        /* generate the default IFID */
+        generate_md5_ifid(story_file, extent, default_ifid, MD5_IFID_SIZE);
+        ifid = default_ifid;
+        tix.ifid_len = strlen(default_ifid);
+        tix.ifid_cnt = 1;
     }
 
+    /* leave room for a default IFID, in case we generate one later */
+    ifid_room = tix.ifid_len + 1;
+    if (ifid_room < MD5_IFID_SIZE)
+        ifid_room = MD5_IFID_SIZE;
+
     /* 
-     *   we didn't find an IFID in the GameInfo, so generate a default IFID
-     *   using the MD5 method 
+     *   Run the ifiction synthesizer with no output buffer, to calculate the
+     *   size we need.  (The synthesizer only needs the IFID and the cover
+     *   art from the index, so we can point it at the IFID in place.)  
      */
-    return generate_md5_ifid(story_file, extent, output, output_extent);
+    tix.ifid = (char *)ifid;
+    if (vals != 0)
+    {
+        tix.ifiction_len = synth_ifiction(vals, ver, 0, 0, &tix);
+        if (tix.ifiction_len < 0)
+            tix.ifiction_len = 0;
+    }
+
+    /* allocate the index, with the strings following it */
+    siz = sizeof(tads_index) + ifid_room + tix.ifiction_len;
+    if ((ix = (tads_index *)malloc(siz)) == 0)
+    {
+        delete_valinfo_list(vals);
+        free_resources(&rix);
+        return NO_REPLY_RV;
+    }
+
+    /* copy in the IFID */
+    *ix = tix;
+    ix->ifid = (char *)(ix + 1);
+    if (ifid != 0)
+        memcpy(ix->ifid, ifid, tix.ifid_len);
+    ix->ifid[tix.ifid_len] = '\0';
+
+    /* synthesize the iFiction into the index */
+    ix->ifiction = ix->ifid + ifid_room;
+    if (tix.ifiction_len != 0)
+        synth_ifiction(vals, ver, ix->ifiction, tix.ifiction_len, ix);
+
+    /* we're done with the GameInfo and the resource directory */
+    delete_valinfo_list(vals);
+    free_resources(&rix);
+
+    /* hand back the index */
+    *index = ix;
+    return siz;
 }
 
 /*
- *   Get the size of the ifiction metadata for the game 
+ *   Answer a treaty selector from an index built by tads_get_story_index() 
  */
-int32 tads_get_story_file_metadata_extent(void *story_file, int32 extent)
+int32 tads_indexed_query(int32 selector, void *story_file, int32 extent,
+                         void *index, void *output, int32 output_extent)
 {
-    valinfo *vals;
-    int32 ret;
-    int ver;
-    
-    /*
-     *   First, make sure we have a GameInfo record.  If we don't, simply
-     *   indicate that there's no metadata to fetch.  
-     */
-    if ((vals = parse_game_info(story_file, extent, &ver)) == 0)
-        return NO_REPLY_RV;
+    tads_index *ix = (tads_index *)index;
 
-    /*
-     *   Run the ifiction synthesizer with no output buffer, to calculate the
-     *   size we need. 
-     */
-    ret = synth_ifiction(vals, ver, 0, 0, story_file, extent);
+    switch (selector)
+    {
+    case GET_STORY_FILE_IFID_SEL:
+        /* if we have no IFID yet, generate the default one */
+        if (ix->ifid_cnt == 0)
+        {
+            generate_md5_ifid(story_file, extent, ix->ifid, MD5_IFID_SIZE);
+            ix->ifid_len = strlen(ix->ifid);
+            ix->ifid_cnt = 1;
+        }
 
-    /* delete the value list */
-    delete_valinfo_list(vals);
+        /* copy out the IFIDs, and indicate how many there are */
+        ASSERT_OUTPUT_SIZE((int32)ix->ifid_len + 1);
+        memcpy(output, ix->ifid, ix->ifid_len + 1);
+        return ix->ifid_cnt;
+
+    case GET_STORY_FILE_METADATA_EXTENT_SEL:
+        /* if there's no GameInfo, there's no metadata to fetch */
+        if (ix->ifiction_len == 0)
+            return NO_REPLY_RV;
+        return ix->ifiction_len;
+
+    case GET_STORY_FILE_METADATA_SEL:
+        /* copy out the synthesized record, if we have one */
+        if (ix->ifiction_len == 0)
+            return NO_REPLY_RV;
+        if (ix->ifiction_len > output_extent)
+            return INVALID_USAGE_RV;
+        memcpy(output, ix->ifiction, ix->ifiction_len);
+        return ix->ifiction_len;
+
+    case GET_STORY_FILE_COVER_EXTENT_SEL:
+        return ix->cover != 0 ? ix->cover_len : NO_REPLY_RV;
+
+    case GET_STORY_FILE_COVER_FORMAT_SEL:
+        return ix->cover != 0 ? ix->cover_format : NO_REPLY_RV;
+
+    case GET_STORY_FILE_COVER_OFFSET_SEL:
+        /* the cover art is a resource stored whole in the story file */
+        return ix->cover != 0
+            ? (int32)(ix->cover - (const char *)story_file) : NO_REPLY_RV;
+
+    case GET_STORY_FILE_COVER_SEL:
+        /* copy out the cover art, if we found any */
+        if (ix->cover == 0)
+            return NO_REPLY_RV;
+        ASSERT_OUTPUT_SIZE(ix->cover_len);
+        memcpy(output, ix->cover, ix->cover_len);
+        return ix->cover_len;
+    }
 
-    /* return the required size */
-    return ret;
+    /* we can't answer anything else from the index */
+    return UNAVAILABLE_RV;
 }
 
 /*
- *   Get the ifiction metadata for the game
+ *   Answer a treaty selector without a saved index, by building one just
+ *   for this query 
  */
-int32 tads_get_story_file_metadata(void *story_file, int32 extent,
-                                   char *buf, int32 bufsize)
+static int32 unindexed_query(int32 selector, void *story_file, int32 extent,
+                             void *output, int32 output_extent)
 {
-    valinfo *vals;
+    void *ix;
     int32 ret;
-    int ver;
 
-    /* make sure we have metadata to fetch */
-    if ((vals = parse_game_info(story_file, extent, &ver)) == 0)
+    /* build the index */
+    if (tads_get_story_index(story_file, extent, &ix) <= 0)
         return NO_REPLY_RV;
 
-    /* synthesize the ifiction data into the output buffer */
-    ret = synth_ifiction(vals, ver, buf, bufsize, story_file, extent);
+    /* ask it, and then discard it */
+    ret = tads_indexed_query(selector, story_file, extent, ix,
+                             output, output_extent);
+    free(ix);
+    return ret;
+}
 
-    /* if that required more space than we had available, return an error */
-    if (ret > bufsize)
-        ret = INVALID_USAGE_RV;
+/*
+ *   Get the IFID for a given story file.  
+ */
+int32 tads_get_story_file_IFID(void *story_file, int32 extent,
+                               char *output, int32 output_extent)
+{
+    return unindexed_query(GET_STORY_FILE_IFID_SEL, story_file, extent,
+                           output, output_extent);
+}
 
-    /* delete the value list */
-    delete_valinfo_list(vals);
+/*
+ *   Get the size of the ifiction metadata for the game 
+ */
+int32 tads_get_story_file_metadata_extent(void *story_file, int32 extent)
+{
+    return unindexed_query(GET_STORY_FILE_METADATA_EXTENT_SEL,
+                           story_file, extent, 0, 0);
+}
 
-    /* return the result */
-    return ret;
+/*
+ *   Get the ifiction metadata for the game
+ */
+int32 tads_get_story_file_metadata(void *story_file, int32 extent,
+                                   char *buf, int32 bufsize)
+{
+    return unindexed_query(GET_STORY_FILE_METADATA_SEL, story_file, extent,
+                           buf, bufsize);
 }
 
 /*
@@ -214,13 +414,8 @@ int32 tads_get_story_file_metadata(void *story_file, int32 extent,
  */
 int32 tads_get_story_file_cover_extent(void *story_file, int32 story_len)
 {
-    resinfo res;
-    
-    /* look for the cover art resource */
-    if (find_cover_art(story_file, story_len, &res, 0, 0, 0))
-        return res.len;
-    else
-        return NO_REPLY_RV;
+    return unindexed_query(GET_STORY_FILE_COVER_EXTENT_SEL,
+                           story_file, story_len, 0, 0);
 }
 
 /*
@@ -228,13 +423,17 @@ int32 tads_get_story_file_cover_extent(void *story_file, int32 story_len)
  */
 int32 tads_get_story_file_cover_format(void *story_file, int32 story_len)
 {
-    int32 typ;
+    return unindexed_query(GET_STORY_FILE_COVER_FORMAT_SEL,
+                           story_file, story_len, 0, 0);
+}
 
-    /* look for CoverArt.jpg */
-    if (find_cover_art(story_file, story_len, 0, &typ, 0, 0))
-        return typ;
-    else
-        return NO_REPLY_RV;
+/*
+ *   Get the offset of the cover art within the story file 
+ */
+int32 tads_get_story_file_cover_offset(void *story_file, int32 story_len)
+{
+    return unindexed_query(GET_STORY_FILE_COVER_OFFSET_SEL,
+                           story_file, story_len, 0, 0);
 }
 
 /*
@@ -243,21 +442,8 @@ int32 tads_get_story_file_cover_format(void *story_file, int32 story_len)
 int32 tads_get_story_file_cover(void *story_file, int32 story_len,
                                 void *outbuf, int32 output_extent)
 {
-    resinfo res;
-
-    /* look for CoverArt.jpg, then for CoverArt.png */
-    if (find_cover_art(story_file, story_len, &res, 0, 0, 0))
-    {
-        /* got it - copy the data to the buffer */
-        ASSERT_OUTPUT_SIZE(res.len);
-        memcpy(outbuf, res.ptr, res.len);
-
-        /* success */
-        return res.len;
-    }
-
-    /* otherwise, we didn't find it */
-    return NO_REPLY_RV;
+    return unindexed_query(GET_STORY_FILE_COVER_SEL, story_file, story_len,
+                           outbuf, output_extent);
 }
 
 /* ------------------------------------------------------------------------ */
@@ -356,14 +542,14 @@ static void skip_newline(const char **p, int32 *rem)
     case '\n':
         /* skip \n or \n\r */
         nextc(p, rem);
-        if (**p == '\r')
+        if (*rem != 0 && **p == '\r')
             nextc(p, rem);
         break;
 
     case '\r':
         /* skip \r or \r\n */
         nextc(p, rem);
-        if (**p == '\n')
+        if (*rem != 0 && **p == '\n')
             nextc(p, rem);
         break;
 
@@ -699,19 +885,13 @@ static int scan_author_name(const char **p, size_t *len,
  */
 static int32 synth_ifiction(valinfo *vals, int tads_version,
                             char *buf, int32 bufsize,
-                            void *story_file, int32 extent)
+                            const tads_index *tix)
 {
-    char default_ifid[TREATY_MINIMUM_EXTENT];
-    valinfo *ifid = find_by_key(vals, "IFID");
-    const char *ifid_val;
-    size_t ifid_len;
     valinfo *author = find_by_key(vals, "AuthorEmail");
     valinfo *url = find_by_key(vals, "Url");
     synthctx ctx;
     const char *p;
     size_t rem;
-    int32 art_fmt;
-    int32 art_wid, art_ht;
 
     /* initialize the output content */
     init_synthctx(&ctx, buf, bufsize, vals);
@@ -720,28 +900,6 @@ static int32 synth_ifiction(valinfo *vals, int tads_version,
     if (tads_version != 2 && tads_version != 3)
         return NO_REPLY_RV;
 
-    /* 
-     *   The IFID is mandatory.  If there's not an IFID specifically listed
-     *   in the GameInfo, we need to generate the default IFID based on the
-     *   MD5 hash of the game file. 
-     */
-    if (ifid != 0)
-    {
-        /* use the explicit IFID(s) listed in the GameInfo */
-        ifid_val = ifid->val;
-        ifid_len = ifid->val_len;
-    }
-    else
-    {
-        /* generate the default IFID */
-        generate_md5_ifid(story_file, extent,
-                          default_ifid, TREATY_MINIMUM_EXTENT);
-
-        /* use this as the IFID */
-        ifid_val = default_ifid;
-        ifid_len = strlen(default_ifid);
-    }
-
     /* write the header, and start the <identification> section */
     write_ifiction_z(
         &ctx,
@@ -757,8 +915,12 @@ static int32 synth_ifiction(valinfo *vals, int tads_version,
         "     </colophon>\n"
         "    <identification>\n");
 
-    /* write each IFID (there might be several) */
-    for (p = ifid_val, rem = ifid_len ; rem != 0 ; )
+    /* 
+     *   Write each IFID (there might be several).  The IFID is mandatory, so
+     *   if there's not one listed in the GameInfo, the index holds the
+     *   default IFID based on the MD5 hash of the game file. 
+     */
+    for (p = tix->ifid, rem = tix->ifid_len ; rem != 0 ; )
     {
         const char *start;
         const char *end;
@@ -860,8 +1022,9 @@ static int32 synth_ifiction(valinfo *vals, int tads_version,
     write_ifiction_z(&ctx, "    </bibliographic>\n");
 
     /* if there's cover art, add its information */
-    if (find_cover_art(story_file, extent, 0, &art_fmt, &art_wid, &art_ht)
-        && (art_fmt == PNG_COVER_FORMAT || art_fmt == JPEG_COVER_FORMAT))
+    if (tix->cover != 0
+        && (tix->cover_format == PNG_COVER_FORMAT
+            || tix->cover_format == JPEG_COVER_FORMAT))
     {
         char buf[200];
         
@@ -871,8 +1034,8 @@ static int32 synth_ifiction(valinfo *vals, int tads_version,
                 "        <height>%lu</height>\n"
                 "        <width>%lu</width>\n"
                 "    </cover>\n",
-                art_fmt == PNG_COVER_FORMAT ? "png" : "jpg",
-                (long)art_ht, (long)art_wid);
+                tix->cover_format == PNG_COVER_FORMAT ? "png" : "jpg",
+                (long)tix->cover_ht, (long)tix->cover_wid);
 
         write_ifiction_z(&ctx, buf);
     }
@@ -1006,8 +1169,7 @@ int tads_match_sig(const void *buf, int32 len, const char *sig)
  *   Parse a game file and retrieve the GameInfo data.  Returns the head of a
  *   linked list of valinfo entries.
  */
-static valinfo *parse_game_info(const void *story_file, int32 story_len,
-                                int *tads_version)
+static valinfo *parse_game_info(const resindex *ix, int *tads_version)
 {
     resinfo res;
     const char *p;
@@ -1018,7 +1180,7 @@ static valinfo *parse_game_info(const void *story_file, int32 story_len,
      *   first, find the GameInfo resource - if it's not there, there's no
      *   game information to parse 
      */
-    if (!find_resource(story_file, story_len, "GameInfo.txt", &res))
+    if (!find_resource(ix, "GameInfo.txt", &res))
         return 0;
 
     /* if the caller wants the TADS version number, hand it back */
@@ -1256,7 +1418,7 @@ static void delete_valinfo_list(valinfo *head)
  *   Find the cover art resource.  We'll look for CoverArt.jpg and
  *   CoverArt.png, in that order. 
  */
-static int find_cover_art(const void *story_file, int32 story_len,
+static int find_cover_art(const resindex *ix,
                           resinfo *resp, int32 *image_format,
                           int32 *width, int32 *height)
 {
@@ -1268,10 +1430,11 @@ static int find_cover_art(const void *story_file, int32 story_len,
         resp = &res;
 
     /* look for CoverArt.jpg first */
-    if (find_resource(story_file, story_len, "CoverArt.jpg", resp))
+    if (find_resource(ix, "CoverArt.jpg", resp))
     {
         /* get the width and height */
-        if (!get_jpeg_dim(resp->ptr, resp->len, &x, &y))
+        if (!babel_image_probe((void *)resp->ptr, resp->len,
+                               JPEG_COVER_FORMAT, &x, &y))
             return FALSE;
 
         /* hand back the width and height if it was requested */
@@ -1289,10 +1452,11 @@ static int find_cover_art(const void *story_file, int32 story_len,
     }
 
     /* look for CoverArt.png second */
-    if (find_resource(story_file, story_len, "CoverArt.png", resp))
+    if (find_resource(ix, "CoverArt.png", resp))
     {
         /* get the width and height */
-        if (!get_png_dim(resp->ptr, resp->len, &x, &y))
+        if (!babel_image_probe((void *)resp->ptr, resp->len,
+                               PNG_COVER_FORMAT, &x, &y))
             return FALSE;
 
         /* hand back the width and height if it was requested */
@@ -1315,13 +1479,20 @@ static int find_cover_art(const void *story_file, int32 story_len,
 
 /* ------------------------------------------------------------------------ */
 /*
- *   Find a resource in a TADS 2 or 3 story file that's been loaded into
- *   memory.  On success, fills in the offset and size of the resource and
- *   returns TRUE; if the resource isn't found, returns FALSE.
+ *   Index the resources in a TADS 2 or 3 story file that's been loaded into
+ *   memory.  The index is left empty if the file isn't one of ours; returns
+ *   TRUE if it is.  The index must be released with free_resources() in
+ *   either case.  
  */
-static int find_resource(const void *story_file, int32 story_len,
-                         const char *resname, resinfo *info)
+static int index_resources(const void *story_file, int32 story_len,
+                           resindex *ix)
 {
+    /* start with an empty index */
+    ix->tads_version = 0;
+    ix->ents = 0;
+    ix->cnt = 0;
+    ix->alloced = 0;
+
     /* if there's no file, there's no resource */
     if (story_file == 0)
         return FALSE;
@@ -1329,35 +1500,180 @@ static int find_resource(const void *story_file, int32 story_len,
     /* check for tads 2 */
     if (tads_match_sig(story_file, story_len, T2_SIGNATURE))
     {
-        info->tads_version = 2;
-        return t2_find_res(story_file, story_len, resname, info);
+        ix->tads_version = 2;
+        t2_index_res(story_file, story_len, ix);
     }
 
     /* check for tads 3 */
-    if (tads_match_sig(story_file, story_len, T3_SIGNATURE))
+    else if (tads_match_sig(story_file, story_len, T3_SIGNATURE))
     {
-        info->tads_version = 3;
-        return t3_find_res(story_file, story_len, resname, info);
+        ix->tads_version = 3;
+        t3_index_res(story_file, story_len, ix);
     }
 
     /* it's not one of ours */
+    else
+        return FALSE;
+
+    /* sort the entries by name, so that we can look them up quickly */
+    if (ix->cnt > 1)
+        qsort(ix->ents, ix->cnt, sizeof(resentry), compare_resentry);
+
+    /* success */
+    return TRUE;
+}
+
+/*
+ *   Release a resource index 
+ */
+static void free_resources(resindex *ix)
+{
+    if (ix->ents != 0)
+        free(ix->ents);
+    ix->ents = 0;
+    ix->cnt = ix->alloced = 0;
+}
+
+/*
+ *   Add an entry to a resource index.  Returns FALSE if we ran out of
+ *   memory. 
+ */
+static int add_resource(resindex *ix, const char *name, size_t name_len,
+                        int mask, int32 group, int32 seq,
+                        const char *ptr, unsigned long len)
+{
+    resentry *e;
+
+    /* make room for the new entry */
+    if (ix->cnt == ix->alloced)
+    {
+        int32 n = (ix->alloced != 0 ? ix->alloced * 2 : 16);
+
+        if ((e = (resentry *)realloc(ix->ents, n * sizeof(resentry))) == 0)
+            return FALSE;
+        ix->ents = e;
+        ix->alloced = n;
+    }
+
+    /* fill it in */
+    e = &ix->ents[ix->cnt++];
+    e->name = name;
+    e->name_len = name_len;
+    e->mask = mask;
+    e->group = group;
+    e->seq = seq;
+    e->info.ptr = ptr;
+    e->info.len = (int32)len;
+    e->info.tads_version = ix->tads_version;
+
+    /* success */
+    return TRUE;
+}
+
+/*
+ *   Compare two resource names, ignoring case.  Each name is unmasked with
+ *   its own mask as we go. 
+ */
+static int compare_res_names(const char *a, size_t alen, int amask,
+                             const char *b, size_t blen, int bmask)
+{
+    size_t i;
+
+    /* compare the common part */
+    for (i = 0 ; i < alen && i < blen ; ++i)
+    {
+        int ca = tolower((unsigned char)(a[i] ^ amask));
+        int cb = tolower((unsigned char)(b[i] ^ bmask));
+
+        if (ca != cb)
+            return ca - cb;
+    }
+
+    /* the common part matches, so the shorter name sorts first */
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
+
+/*
+ *   qsort comparison function for resource index entries - order by name,
+ *   then by precedence 
+ */
+static int compare_resentry(const void *a, const void *b)
+{
+    const resentry *ea = (const resentry *)a;
+    const resentry *eb = (const resentry *)b;
+    int c;
+
+    /* compare the names first */
+    if ((c = compare_res_names(ea->name, ea->name_len, ea->mask,
+                               eb->name, eb->name_len, eb->mask)) != 0)
+        return c;
+
+    /* the same name appears twice - put the one that takes precedence first */
+    if (ea->group != eb->group)
+        return ea->group < eb->group ? -1 : 1;
+    return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/*
+ *   Find a resource in a resource index.  On success, fills in the offset
+ *   and size of the resource and returns TRUE; if the resource isn't found,
+ *   returns FALSE.  
+ */
+static int find_resource(const resindex *ix, const char *resname,
+                         resinfo *info)
+{
+    size_t resname_len = strlen(resname);
+    int32 lo, hi;
+
+    /* find the first entry with a name not less than the one we want */
+    for (lo = 0, hi = ix->cnt ; lo < hi ; )
+    {
+        int32 mid = lo + (hi - lo) / 2;
+        const resentry *e = &ix->ents[mid];
+
+        if (compare_res_names(e->name, e->name_len, e->mask,
+                              resname, resname_len, 0) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* if that's the name we want, it's the entry that takes precedence */
+    if (lo < ix->cnt
+        && compare_res_names(ix->ents[lo].name, ix->ents[lo].name_len,
+                             ix->ents[lo].mask, resname, resname_len, 0) == 0)
+    {
+        *info = ix->ents[lo].info;
+        return TRUE;
+    }
+
+    /* not found */
     return FALSE;
 }
 
 /* ------------------------------------------------------------------------ */
 /*
- *   Find a resource in a tads 2 game file 
+ *   Index the resources in a tads 2 game file 
  */
-static int t2_find_res(const void *story_file, int32 story_len,
-                       const char *resname, resinfo *info)
+/*
+ *   Check that the data of a resource, at the given offset from base, lies
+ *   within the story file 
+ */
+static int res_in_file(const char *base, unsigned long ofs, unsigned long len,
+                       const char *endp)
+{
+    return base <= endp
+        && ofs <= (unsigned long)(endp - base)
+        && len <= (unsigned long)(endp - base) - ofs;
+}
+
+static int t2_index_res(const void *story_file, int32 story_len,
+                        resindex *ix)
 {
     const char *basep = (const char *)story_file;
     const char *endp = basep + story_len;
     const char *p;
-    size_t resname_len;
-
-    /* note the length of the name we're seeking */
-    resname_len = strlen(resname);
+    int32 group;
 
     /* 
      *   skip past the tads 2 file header (13 bytes for the signature, 7
@@ -1368,10 +1684,11 @@ static int t2_find_res(const void *story_file, int32 story_len,
 
     /* 
      *   scan the sections in the file; stop on $EOF, and skip everything
-     *   else but HTMLRES, which is the section type that 
+     *   else but HTMLRES, which is the section type that holds resources 
      */
-    while (p < endp)
+    for (group = 0 ; p + 5 <= endp && p + 5 + osrp1(p) <= endp ; ++group)
     {
+        const char *sectp = p;
         unsigned long endofs;
 
         /*
@@ -1388,12 +1705,10 @@ static int t2_find_res(const void *story_file, int32 story_len,
         /* check the type */
         if (p[0] == 7 && memcmp(p + 1, "HTMLRES", 7) == 0)
         {
-            unsigned long found_ofs;
-            int found;
+            const char *index_start;
+            const char *datap;
             unsigned long entry_cnt;
-
-            /* we haven't found the resource yet */
-            found = FALSE;
+            unsigned long i;
 
             /* 
              *   It's a multimedia resource block.  Skip the section block
@@ -1402,99 +1717,79 @@ static int t2_find_res(const void *story_file, int32 story_len,
              *   by a reserved uint32, followed by the entries.  
              */
             p += 12;
+            if (p + 8 > endp)
+                break;
             entry_cnt = osrp4(p);
 
             /* skip to the first index entry */
             p += 8;
-
-            /* scan the index entries */
-            for ( ; entry_cnt != 0 ; --entry_cnt)
-            {
-                unsigned long res_ofs;
-                unsigned long res_siz;
-                size_t name_len;
-
-                /*
-                 *   We're at the next index entry, which looks like this:
-                 *
-                 *.    <uint32>  resource-address (bytes from end of index)
-                 *.    <uint32>  resource-length (in bytes)
-                 *.    <uint2> name-length
-                 *.    <byte * name-length> name
-                 */
-                res_ofs = osrp4(p);
-                res_siz = osrp4(p + 4);
-                name_len = osrp2(p + 8);
-                p += 10;
-
-                /* check for a match to the name we're looking for */
-                if (name_len == resname_len
-                    && my_memicmp(resname, p, name_len) == 0)
-                {
-                    /* 
-                     *   it's the one we want - note its resource location
-                     *   and size, but keep scanning for now, since we need
-                     *   to find the end of the index before we'll know where
-                     *   the actual resources begin 
-                     */
-                    found = TRUE;
-                    found_ofs = res_ofs;
-                    info->len = res_siz;
-                }
-
-                /* skip this one's name */
-                p += name_len;
-            }
+            index_start = p;
+
+            /*
+             *   Each index entry looks like this:
+             *
+             *.    <uint32>  resource-address (bytes from end of index)
+             *.    <uint32>  resource-length (in bytes)
+             *.    <uint2> name-length
+             *.    <byte * name-length> name
+             *
+             *   The resource addresses are relative to the end of the
+             *   index, so skip over the index once to find where that is. 
+             */
+            for (i = 0 ; i < entry_cnt && p + 10 <= endp ; ++i)
+                p += 10 + osrp2(p + 8);
+            datap = p;
 
             /* 
-             *   if we found our resource, the current seek position is the
-             *   base of the offset we found in the directory; so we can
-             *   finally fix up the offset to give the actual file location
-             *   and return the result 
+             *   Now add the entries.  If a name appears twice in one
+             *   section, it's the last one that counts. 
              */
-            if (found)
+            for (i = 0, p = index_start ; i < entry_cnt && p + 10 <= endp ;
+                 ++i)
             {
-                /* fix up the offset with the actual file location */
-                info->ptr = p + found_ofs;
+                size_t name_len = osrp2(p + 8);
 
-                /* tell the caller we found it */
-                return TRUE;
+                if (p + 10 + name_len <= endp
+                    && res_in_file(datap, osrp4(p), osrp4(p + 4), endp)
+                    && !add_resource(ix, p + 10, name_len, 0,
+                                     group, -(int32)i,
+                                     datap + osrp4(p), osrp4(p + 4)))
+                    return FALSE;
+
+                /* skip this one */
+                p += 10 + name_len;
             }
         }
         else if (p[0] == 4 && memcmp(p + 1, "$EOF", 4) == 0)
         {
-            /* 
-             *   that's the end of the file - we've finished without finding
-             *   the resource, so return failure 
-             */
-            return FALSE;
+            /* that's the end of the file - we've seen every resource */
+            return TRUE;
         }
 
-        /* move to the next section */
+        /* move to the next section, unless the file's corrupted */
+        if (endofs <= (unsigned long)(sectp - basep))
+            break;
         p = basep + endofs;
     }
 
     /* 
-     *   reached EOF without an $EOF marker - file must be corrupted; return
-     *   'not found' 
+     *   reached EOF without an $EOF marker - file must be corrupted; keep
+     *   whatever we found 
      */
-    return FALSE;
+    return TRUE;
 }
 
 /* ------------------------------------------------------------------------ */
 /*
- *   Find a resource in a T3 image file 
+ *   Index the resources in a T3 image file 
  */
-static int t3_find_res(const void *story_file, int32 story_len,
-                       const char *resname, resinfo *info)
+static int t3_index_res(const void *story_file, int32 story_len,
+                        resindex *ix)
 {
     const char *basep = (const char *)story_file;
     const char *endp = basep + story_len;
     const char *p;
-    size_t resname_len;
-
-    /* note the length of the name we're seeking */
-    resname_len = strlen(resname);
+    int32 group;
 
     /* 
      *   skip the file header - 11 bytes for the signature, 2 bytes for the
@@ -1503,7 +1798,7 @@ static int t3_find_res(const void *story_file, int32 story_len,
     p = basep + 11 + 2 + 32 + 24;
 
     /* scan the data blocks */
-    while (p < endp)
+    for (group = 0 ; p + 10 <= endp ; ++group)
     {
         unsigned long siz;
 
@@ -1536,18 +1831,15 @@ static int t3_find_res(const void *story_file, int32 story_len,
             blockp = p;
 
             /* the first thing in the table is the number of entries */
+            if (p + 2 > endp)
+                break;
             entry_cnt = osrp2(p);
             p += 2;
 
             /* read the entries */
-            for (i = 0 ; i < entry_cnt ; ++i)
+            for (i = 0 ; i < entry_cnt && p + 9 <= endp ; ++i)
             {
-                unsigned long entry_ofs;
-                unsigned long entry_siz;
                 size_t entry_name_len;
-                char namebuf[256];
-                char *xp;
-                size_t xi;
 
                 /* 
                  *   Parse this index entry:
@@ -1556,51 +1848,33 @@ static int t3_find_res(const void *story_file, int32 story_len,
                  *.    <uint32> size (in bytes)
                  *.    <uint8> name-length
                  *.    <byte * name-length> name (all bytes XORed with 0xFF)
+                 *
+                 *   The entry offset is from the data block's starting
+                 *   location, so fix it up to an absolute location.  If a
+                 *   name appears twice, it's the first one that counts.  
                  */
-                entry_ofs = osrp4(p);
-                entry_siz = osrp4(p + 4);
                 entry_name_len = (unsigned char)p[8];
-
-                /* unmask the name */
-                memcpy(namebuf, p + 9, resname_len);
-                for (xi = resname_len, xp = namebuf ; xi != 0 ; --xi)
-                    *xp++ ^= 0xFF;
-
-                /* if this is the one we're looking for, return it */
-                if (entry_name_len == resname_len
-                    && my_memicmp(resname, namebuf, resname_len) == 0)
-                {
-                    /* 
-                     *   fill in the return information - note that the entry
-                     *   offset given in the header is an offset from data
-                     *   block's starting location, so fix this up to an
-                     *   absolute seek location for the return value 
-                     */
-                    info->ptr = blockp + entry_ofs;
-                    info->len = entry_siz;
-
-                    /* return success */
-                    return TRUE;
-                }
+                if (p + 9 + entry_name_len <= endp
+                    && res_in_file(blockp, osrp4(p), osrp4(p + 4), endp)
+                    && !add_resource(ix, p + 9, entry_name_len, 0xFF,
+                                     group, (int32)i,
+                                     blockp + osrp4(p), osrp4(p + 4)))
+                    return FALSE;
 
                 /* skip this entry (header + name length) */
                 p += 9 + entry_name_len;
             }
 
             /* 
-             *   if we got this far, we didn't find the name; so skip past
-             *   the MRES section by adding the section length to the base
-             *   pointer, and resume the main file scan 
+             *   skip past the MRES section by adding the section length to
+             *   the base pointer, and resume the main file scan 
              */
             p = blockp + siz;
         }
         else if (memcmp(p, "EOF ", 4) == 0)
         {
-            /* 
-             *   end of file - we've finished without finding the resource,
-             *   so return failure 
-             */
-            return FALSE;
+            /* end of file - we've seen every resource */
+            return TRUE;
         }
         else
         {
@@ -1615,92 +1889,9 @@ static int t3_find_res(const void *story_file, int32 story_len,
     }
 
     /* 
-     *   reached EOF without an EOF marker - file must be corrupted; return
-     *   'not found' 
+     *   reached EOF without an EOF marker - file must be corrupted; keep
+     *   whatever we found 
      */
-    return FALSE;
-}
-
-/* ------------------------------------------------------------------------ */
-/*
- *   JPEG and PNG information extraction (based on the versions in
- *   babel_story_functions.c) 
- */
-static int get_jpeg_dim(const void *img, int32 extent,
-                        int32 *xout, int32 *yout)
-{
-    const unsigned char *dp=(const unsigned char *) img;
-    const unsigned char *ep=dp+extent;
-    unsigned int t1, t2, w, h;
-
-    t1 = *dp++;
-    t2 = *dp++;
-    if (t1 != 0xff || t2 != 0xD8)
-        return FALSE;
-
-    while(1)
-    {
-        if (dp>ep) return FALSE;
-        for(t1=*(dp++);t1!=0xff;t1=*(dp++)) if (dp>ep) return FALSE;
-        do { t1=*(dp++); if (dp>ep) return FALSE;} while (t1 == 0xff);
-
-        if ((t1 & 0xF0) == 0xC0 && !(t1==0xC4 || t1==0xC8 || t1==0xCC))
-        {
-            dp+=3;
-            if (dp>ep) return FALSE;
-            h=*(dp++) << 8;
-            if (dp>ep) return FALSE;
-            h|=*(dp++);
-            if (dp>ep) return FALSE;
-            w=*(dp++) << 8;
-            if (dp>ep) return FALSE;
-            w|=*(dp);
-
-            *xout = w;
-            *yout = h;
-            return TRUE;
-        }
-        else if (t1==0xD8 || t1==0xD9)
-            break;
-        else
-        {
-            int l;
-
-            if (dp>ep) return FALSE;
-            l=*(dp++) << 8;
-            if (dp>ep) return FALSE;
-            l|= *(dp++);
-            l-=2;
-            dp+=l;
-            if (dp>ep) return FALSE;
-        }
-    }
-    return FALSE;
-}
-
-static int32 png_read_int(const unsigned char *mem)
-{
-    int32 i4 = mem[0],
-    i3 = mem[1],
-    i2 = mem[2],
-    i1 = mem[3];
-    return i1 | (i2<<8) | (i3<<16) | (i4<<24);
-}
-
-
-static int get_png_dim(const void *img, int32 extent,
-                       int32 *xout, int32 *yout)
-{
-    const unsigned char *dp=(const unsigned char *)img;
-
-    if (extent<33 ||
-        !(dp[0]==137 && dp[1]==80 && dp[2]==78 && dp[3]==71 &&
-          dp[4]==13 && dp[5] == 10 && dp[6] == 26 && dp[7]==10)||
-        !(dp[12]=='I' && dp[13]=='H' && dp[14]=='D' && dp[15]=='R'))
-        return FALSE;
-
-    *xout = png_read_int(dp+16);
-    *yout = png_read_int(dp+20);
     return TRUE;
 }
 
@@ -1719,6 +1910,7 @@ void main(int argc, char **argv)
     FILE *fp;
     int32 siz;
     void *buf;
+    resindex rix;
     valinfo *head;
     int32 rv;
     int tadsver;
@@ -1768,7 +1960,8 @@ void main(int argc, char **argv)
     /* ===== test 1 - basic parse_game_info() test ===== */
 
     /* parse the gameinfo record and print the results */
-    if ((head = parse_game_info(buf, siz, &tadsver)) != 0)
+    index_resources(buf, siz, &rix);
+    if ((head = parse_game_info(&rix, &tadsver)) != 0)
     {
         valinfo *val;
 
@@ -1783,6 +1976,8 @@ void main(int argc, char **argv)
     }
     else
         printf("no GameInfo found\n\n");
+    delete_valinfo_list(head);
+    free_resources(&rix);
 
 
 
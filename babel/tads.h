@@ -37,4 +37,17 @@ int32 tads_get_story_file_cover_extent(void *story_file, int32 extent);
 /* get the image format (jpeg, png) of the covert art in a tads story file */
 int32 tads_get_story_file_cover_format(void *story_file, int32 extent);
 
+/* get the offset of the cover art within a tads story file */
+int32 tads_get_story_file_cover_offset(void *story_file, int32 extent);
+
+/* 
+ *   build the index of a tads story file, from which the other functions
+ *   are answered; the index is a single block, to be released with free() 
+ */
+int32 tads_get_story_index(void *story_file, int32 extent, void **index);
+
+/* answer one of the selectors above from an index */
+int32 tads_indexed_query(int32 selector, void *story_file, int32 extent,
+                         void *index, void *output, int32 output_extent);
+
 #endif /* TADS_H */
@@ -15,6 +15,7 @@
 #define FORMAT tads2
 #define HOME_PAGE "http://www.tads.org"
 #define FORMAT_EXT ".gam"
+#define STORY_INDEX
 
 
 #include "treaty_builder.h"
@@ -98,3 +99,31 @@ static int32 get_story_file_cover(void *story_file, int32 story_len,
                                      outbuf, output_extent);
 }
 
+/*
+ *   Get the offset of the cover art within the story file 
+ */
+static int32 get_story_file_cover_offset(void *story_file, int32 story_len)
+{
+    /* use the common tads cover file extractor */
+    return tads_get_story_file_cover_offset(story_file, story_len);
+}
+
+/*
+ *   Build the index of what we know about the story file 
+ */
+static int32 get_story_index(void *story_file, int32 extent, void **index)
+{
+    /* use the common tads indexer */
+    return tads_get_story_index(story_file, extent, index);
+}
+
+/*
+ *   Answer a selector from the index 
+ */
+static int32 indexed_query(int32 selector, void *story_file, int32 extent,
+                           void *index, void *output, int32 output_extent)
+{
+    /* use the common tads indexer */
+    return tads_indexed_query(selector, story_file, extent, index,
+                              output, output_extent);
+}
@@ -48,11 +48,19 @@
 #define GET_STORY_FILE_METADATA_SEL             0x309
 #define GET_STORY_FILE_COVER_SEL                0x30A
 #define GET_STORY_FILE_EXTENSION_SEL            0x30B
+#define STORY_GET_INDEX_SEL                     0x20C
+#define STORY_INDEXED_QUERY_SEL                 0x20D
+#define VERIFY_REGISTRY_SEL                     0x20E
+#define GET_STORY_FILE_COVER_OFFSET_SEL         0x10F
 
 /* Container selectors */
 #define CONTAINER_GET_STORY_FORMAT_SEL                0x710
 #define CONTAINER_GET_STORY_EXTENT_SEL          0x511
 #define CONTAINER_GET_STORY_FILE_SEL            0x711
+#define CONTAINER_GET_STORY_OFFSET_SEL          0x512
+#define CONTAINER_GET_INDEX_EXTENT_SEL          0x513
+#define CONTAINER_GET_INDEX_SEL                 0x712
+#define CONTAINER_INDEXED_QUERY_SEL             0x713
 
 
 
@@ -87,5 +95,16 @@
 
 typedef int32 (*TREATY)(int32 selector, void *, int32, void *, int32);
 
+/* Output buffer for CONTAINER_INDEXED_QUERY_SEL, which asks a container
+   the given selector using an index built by CONTAINER_GET_INDEX_SEL, and
+   for STORY_INDEXED_QUERY_SEL, which does the same for a story module
+   with an index from STORY_GET_INDEX_SEL */
+struct treaty_indexed_query {
+        int32 selector;
+        void *index;
+        void *output;
+        int32 output_extent;
+};
+
 #endif
 
@@ -35,6 +35,7 @@
  *   static int32 get_story_file_cover_extent(void *, int32);
  *   static int32 get_story_file_cover_format(void *, int32);
  *   static int32 get_story_file_cover(void *, int32, void *, int32);
+ *   static int32 get_story_file_cover_offset(void *, int32);
  * Define the following if CUSTOM_EXTENSION is defined
  *   static int32 get_story_file_extension(void *, int32, char *, int32);
  *
@@ -43,14 +44,50 @@
  * buffer and its extent.  They perform the corresponding task to the
  * similarly-named selector.
  *
+ * get_story_file_cover_offset returns the offset of the cover art within
+ * the story file, so that callers may use it in place rather than copying
+ * it out, or NO_REPLY_RV if the art is not stored whole in the file.
+ *
  * This file also defines the macro ASSERT_OUTPUT_SIZE(x) which
  * returns INVALID_USAGE_RV if output_extent is less than x.
  *
  * #define CONTAINER_FORMAT  before inclusion to generate a container
- * module.  A container module should define three additional functions:
+ * module.  A container module should define four additional functions:
  *    static int32 get_story_format(void *, int32, char *, int32);
  *    static int32 get_story_extent(void *, int32);
  *    static int32 get_story_file(void *, int32, void *, int32);
+ *    static int32 get_story_offset(void *, int32);
+ * get_story_offset returns the offset of the contained story within the
+ * container, so that callers may use it in place rather than copying it out.
+ *
+ * #define CONTAINER_INDEX as well to let callers cache a parsed index of
+ * the container.  Such a module should also define:
+ *    static int32 get_story_index_extent(void *, int32);
+ *    static int32 get_story_index(void *, int32, void *, int32);
+ *    static int32 indexed_query(int32, void *, int32, void *, void *, int32);
+ * The first two build the index in a buffer provided by the caller.
+ * indexed_query answers a selector as the treaty function would, given
+ * the selector, the story file and extent, the index, and the output
+ * buffer and extent.
+ *
+ * #define STORY_INDEX in a story module to let callers cache what it has
+ * found out about a story file.  Such a module should define:
+ *    static int32 get_story_index(void *, int32, void **);
+ *    static int32 indexed_query(int32, void *, int32, void *, void *, int32);
+ * get_story_index allocates the index as a single block, which the caller
+ * releases with free(), and returns its size (or NO_REPLY_RV, leaving the
+ * pointer NULL, if there is none).  indexed_query is as for containers.
+ * Neither is preceded by claim_story_file, since the index is only asked
+ * for once the file has been claimed, and indexed_query need not repeat the
+ * work; get_story_index should check the file itself if that is cheaper
+ * than failing later.
+ *
+ * #define REGISTRY_CHECK in a module which identifies stories from a table
+ * to let babel check the table.  Such a module should define:
+ *    static int32 verify_registry(char *, int32);
+ * which checks each entry (against a synthetic story, if it can), writes
+ * a report of one line per problem, and a last line of summary, to the
+ * buffer with babel_report, and returns the number of problems found.
  *
  */
 
@@ -62,6 +99,11 @@
 
 #define ASSERT_OUTPUT_SIZE(x) do { if (output_extent < (x)) return INVALID_USAGE_RV; } while (0)
 
+/* From misc.c: finds an embedded UUID:// IFID */
+int32 babel_find_uuid(void *, int32, int32 *);
+/* From misc.c: appends a line to a report, if there is room for it */
+void babel_report(char *, int32, char *);
+
 #ifndef NO_METADATA
 static int32 get_story_file_metadata_extent(void *, int32);
 static int32 get_story_file_metadata(void *, int32, char *, int32);
@@ -70,6 +112,7 @@ static int32 get_story_file_metadata(void *, int32, char *, int32);
 static int32 get_story_file_cover_extent(void *, int32);
 static int32 get_story_file_cover_format(void *, int32);
 static int32 get_story_file_cover(void *, int32, void *, int32);
+static int32 get_story_file_cover_offset(void *, int32);
 #endif
 static int32 get_story_file_IFID(void *, int32, char *, int32);
 static int32 claim_story_file(void *, int32);
@@ -77,6 +120,19 @@ static int32 claim_story_file(void *, int32);
 static int32 get_story_file(void *, int32, void *, int32);
 static int32 get_story_format(void *, int32, char *, int32);
 static int32 get_story_extent(void *, int32);
+static int32 get_story_offset(void *, int32);
+#endif
+#ifdef CONTAINER_INDEX
+static int32 get_story_index_extent(void *, int32);
+static int32 get_story_index(void *, int32, void *, int32);
+static int32 indexed_query(int32, void *, int32, void *, void *, int32);
+#endif
+#ifdef STORY_INDEX
+static int32 get_story_index(void *, int32, void **);
+static int32 indexed_query(int32, void *, int32, void *, void *, int32);
+#endif
+#ifdef REGISTRY_CHECK
+static int32 verify_registry(char *, int32);
 #endif
 #ifdef CUSTOM_EXTENSION
 static int32 get_story_file_extension(void *, int32, char *, int32);
@@ -150,6 +206,10 @@ int32 TREATY_FUNCTION(FORMAT)(int32 selector,
   case GET_STORY_FILE_COVER_FORMAT_SEL:
 #ifndef NO_COVER
                 return get_story_file_cover_format(story_file, extent);
+#endif
+  case GET_STORY_FILE_COVER_OFFSET_SEL:
+#ifndef NO_COVER
+                return get_story_file_cover_offset(story_file, extent);
 #endif
   case GET_STORY_FILE_COVER_SEL:
 #ifndef NO_COVER
@@ -168,6 +228,45 @@ int32 TREATY_FUNCTION(FORMAT)(int32 selector,
                 return get_story_extent(story_file, extent);
   case CONTAINER_GET_STORY_FILE_SEL:
                 return get_story_file(story_file, extent, output, output_extent);
+  case CONTAINER_GET_STORY_OFFSET_SEL:
+                return get_story_offset(story_file, extent);
+#endif
+#ifdef CONTAINER_INDEX
+  case CONTAINER_GET_INDEX_EXTENT_SEL:
+                return get_story_index_extent(story_file, extent);
+  case CONTAINER_GET_INDEX_SEL:
+                return get_story_index(story_file, extent, output, output_extent);
+  case CONTAINER_INDEXED_QUERY_SEL:
+                {
+                 struct treaty_indexed_query *q=(struct treaty_indexed_query *) output;
+                 ASSERT_OUTPUT_SIZE((int32) sizeof(struct treaty_indexed_query));
+                 if (!q->index ||
+                     ((TREATY_SELECTOR_OUTPUT & q->selector) &&
+                      (q->output_extent==0 || q->output==NULL)))
+                  return INVALID_USAGE_RV;
+                 return indexed_query(q->selector, story_file, extent, q->index, q->output, q->output_extent);
+                }
+#endif
+#ifdef STORY_INDEX
+  case STORY_GET_INDEX_SEL:
+                ASSERT_OUTPUT_SIZE((int32) sizeof(void *));
+                *(void **) output=NULL;
+                return get_story_index(story_file, extent, (void **) output);
+  case STORY_INDEXED_QUERY_SEL:
+                {
+                 struct treaty_indexed_query *q=(struct treaty_indexed_query *) output;
+                 ASSERT_OUTPUT_SIZE((int32) sizeof(struct treaty_indexed_query));
+                 if (!q->index ||
+                     ((TREATY_SELECTOR_OUTPUT & q->selector) &&
+                      (q->output_extent==0 || q->output==NULL)))
+                  return INVALID_USAGE_RV;
+                 return indexed_query(q->selector, story_file, extent, q->index, q->output, q->output_extent);
+                }
+#endif
+#ifdef REGISTRY_CHECK
+  case VERIFY_REGISTRY_SEL:
+                *(char *) output=0;
+                return verify_registry((char *) output, output_extent);
 #endif
 
  }
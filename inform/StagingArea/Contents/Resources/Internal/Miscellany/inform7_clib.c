@@ -1,6 +1,13 @@
 /* This is a library of C code to support Inter code compiled to ANSI C. It was
    generated mechanically from the Inter source code, so to change this material,
-   edit that and not this file. */
+   edit that and not this file.
+
+   This copy has been edited by hand, since the Inter source is not part of this
+   tree: undo snapshots share unchanged memory pages, memory words are read and
+   written with memcpy, properties are packed into tables with their inheritance
+   resolved, the object tree keeps previous siblings and child counts, and
+   classes are numbered for ofclass. These changes must be carried back to the
+   Inter source, or the next copy generated from it will undo them. */
 
 #ifndef I7_CLIB_C_INCLUDED
 #define I7_CLIB_C_INCLUDED 1
@@ -10,6 +17,7 @@ i7state_t i7_new_state(void) {
 	S.himem = 0;
 	S.stack_pointer = 0;
 	S.object_tree_parent = NULL; S.object_tree_child = NULL; S.object_tree_sibling = NULL;
+	S.object_tree_previous = NULL; S.object_tree_children = NULL;
 	S.variables = NULL;
 	S.seed = i7_initial_rng_seed();
 	return S;
@@ -19,6 +27,7 @@ i7snapshot_t i7_new_snapshot(void) {
 	i7snapshot_t SS;
 	SS.valid = 0;
 	SS.then = i7_new_state();
+	SS.pages = NULL;
 	return SS;
 }
 
@@ -27,6 +36,8 @@ i7process_t i7_new_process(void) {
 	proc.state = i7_new_state();
 	for (int i=0; i<I7_MAX_SNAPSHOTS; i++) proc.snapshots[i] = i7_new_snapshot();
 	proc.snapshot_pos = 0;
+	proc.base_pages = NULL;
+	proc.dirty_pages = NULL;
 	proc.receiver = i7_default_receiver;
 	proc.send_count = 0;
 	proc.sender = i7_default_sender;
@@ -87,8 +98,12 @@ int i7_run_process(i7process_t *proc) {
 		i7_initialise_memory_and_stack(proc);
 		i7_initialise_variables(proc);
 		i7_empty_object_tree(proc);
+		i7_begin_properties(proc);
 		i7_initialiser(proc);
+		i7_compile_properties(proc);
+		i7_number_classes(proc);
 		i7_initialise_object_tree(proc);
+		i7_index_object_tree(proc);
 		i7_initialise_miniglk(proc);
 		i7_fn_Main(proc);
 		proc->termination_code = 0; /* terminated because the program completed */
@@ -122,6 +137,10 @@ void *i7_calloc(i7process_t *proc, size_t how_many, size_t of_size) {
 i7byte_t i7_initial_memory[];
 void i7_initialise_memory_and_stack(i7process_t *proc) {
 	if (proc->state.memory != NULL) free(proc->state.memory);
+	i7_release_pages(proc, proc->base_pages);
+	proc->base_pages = NULL;
+	if (proc->dirty_pages != NULL) free(proc->dirty_pages);
+	proc->dirty_pages = i7_calloc(proc, I7_SNAPSHOT_PAGES/8 + 1, sizeof(unsigned char));
 
 	i7byte_t *mem = i7_calloc(proc, i7_static_himem, sizeof(i7byte_t));
 	for (int i=0; i<i7_static_himem; i++) mem[i] = i7_initial_memory[i];
@@ -143,49 +162,106 @@ void i7_initialise_memory_and_stack(i7process_t *proc) {
 	proc->state.himem = i7_static_himem;
 	proc->state.stack_pointer = 0;
 }
-i7byte_t i7_read_byte(i7process_t *proc, i7word_t address) {
+/* Memory accesses are bounds-checked unless I7_UNCHECKED_MEMORY is defined, which
+   is safe only for a story already validated with checking on. With I7_DEBUG_MEMORY
+   defined, calls to the functions below go through the i7_debug_ versions, which
+   report the function making a faulty access. The names of the functions are
+   parenthesised in their definitions so that those macros do not expand there. */
+void i7_memory_fault(i7process_t *proc, i7word_t byte_position, const char *caller) {
+	if (caller) printf("Memory access out of range: %d in %s\n", byte_position, caller);
+	else printf("Memory access out of range: %d\n", byte_position);
+	i7_fatal_exit(proc);
+}
+
+i7byte_t (i7_read_byte)(i7process_t *proc, i7word_t address) {
 	return proc->state.memory[address];
 }
 
-i7word_t i7_read_sword(i7process_t *proc, i7word_t array_address, i7word_t array_index) {
+i7word_t (i7_read_sword)(i7process_t *proc, i7word_t array_address, i7word_t array_index) {
 	i7byte_t *data = proc->state.memory;
 	int byte_position = array_address + 2*array_index;
-	if ((byte_position < 0) || (byte_position >= i7_static_himem)) {
-		printf("Memory access out of range: %d\n", byte_position);
-		i7_fatal_exit(proc);
-	}
+	I7_CHECK_MEMORY(proc, byte_position, 2, NULL);
+	#ifdef I7_BIG_ENDIAN_16
+	uint16_t w; memcpy(&w, data + byte_position, 2);
+	return (i7word_t) I7_BIG_ENDIAN_16(w);
+	#else
 	return             (i7word_t) data[byte_position + 1]  +
 	            0x100*((i7word_t) data[byte_position + 0]);
+	#endif
 }
 
-i7word_t i7_read_word(i7process_t *proc, i7word_t array_address, i7word_t array_index) {
+i7word_t (i7_read_word)(i7process_t *proc, i7word_t array_address, i7word_t array_index) {
 	i7byte_t *data = proc->state.memory;
 	int byte_position = array_address + 4*array_index;
-	if ((byte_position < 0) || (byte_position >= i7_static_himem)) {
-		printf("Memory access out of range: %d\n", byte_position);
-		i7_fatal_exit(proc);
-	}
+	I7_CHECK_MEMORY(proc, byte_position, 4, NULL);
+	#ifdef I7_BIG_ENDIAN_32
+	unsigned_i7word_t w; memcpy(&w, data + byte_position, 4);
+	return (i7word_t) I7_BIG_ENDIAN_32(w);
+	#else
 	return             (i7word_t) data[byte_position + 3]  +
 	            0x100*((i7word_t) data[byte_position + 2]) +
 		      0x10000*((i7word_t) data[byte_position + 1]) +
 		    0x1000000*((i7word_t) data[byte_position + 0]);
+	#endif
 }
-void i7_write_byte(i7process_t *proc, i7word_t address, i7byte_t new_val) {
+void (i7_write_byte)(i7process_t *proc, i7word_t address, i7byte_t new_val) {
 	proc->state.memory[address] = new_val;
+	I7_MARK_DIRTY(proc, address);
 }
 
-void i7_write_word(i7process_t *proc, i7word_t address, i7word_t array_index,
+void (i7_write_word)(i7process_t *proc, i7word_t address, i7word_t array_index,
 	i7word_t new_val) {
 	int byte_position = address + 4*array_index;
-	if ((byte_position < 0) || (byte_position >= i7_static_himem)) {
-		printf("Memory access out of range: %d\n", byte_position);
-		i7_fatal_exit(proc);
-	}
+	I7_CHECK_MEMORY(proc, byte_position, 4, NULL);
+	#ifdef I7_BIG_ENDIAN_32
+	unsigned_i7word_t w = I7_BIG_ENDIAN_32((unsigned_i7word_t) new_val);
+	memcpy(proc->state.memory + byte_position, &w, 4);
+	#else
 	proc->state.memory[byte_position]   = I7BYTE_0(new_val);
 	proc->state.memory[byte_position+1] = I7BYTE_1(new_val);
 	proc->state.memory[byte_position+2] = I7BYTE_2(new_val);
 	proc->state.memory[byte_position+3] = I7BYTE_3(new_val);
+	#endif
+	I7_MARK_DIRTY(proc, byte_position);
+	I7_MARK_DIRTY(proc, byte_position+3);
+}
+
+#ifdef I7_DEBUG_MEMORY
+i7byte_t i7_debug_read_byte(i7process_t *proc, i7word_t address, const char *caller) {
+	if ((address < 0) || (address >= i7_static_himem)) i7_memory_fault(proc, address, caller);
+	return (i7_read_byte)(proc, address);
+}
+
+i7word_t i7_debug_read_sword(i7process_t *proc, i7word_t array_address, i7word_t array_index,
+	const char *caller) {
+	int byte_position = array_address + 2*array_index;
+	if ((byte_position < 0) || (byte_position > i7_static_himem - 2))
+		i7_memory_fault(proc, byte_position, caller);
+	return (i7_read_sword)(proc, array_address, array_index);
+}
+
+i7word_t i7_debug_read_word(i7process_t *proc, i7word_t array_address, i7word_t array_index,
+	const char *caller) {
+	int byte_position = array_address + 4*array_index;
+	if ((byte_position < 0) || (byte_position > i7_static_himem - 4))
+		i7_memory_fault(proc, byte_position, caller);
+	return (i7_read_word)(proc, array_address, array_index);
+}
+
+void i7_debug_write_byte(i7process_t *proc, i7word_t address, i7byte_t new_val,
+	const char *caller) {
+	if ((address < 0) || (address >= i7_static_himem)) i7_memory_fault(proc, address, caller);
+	(i7_write_byte)(proc, address, new_val);
+}
+
+void i7_debug_write_word(i7process_t *proc, i7word_t address, i7word_t array_index,
+	i7word_t new_val, const char *caller) {
+	int byte_position = address + 4*array_index;
+	if ((byte_position < 0) || (byte_position > i7_static_himem - 4))
+		i7_memory_fault(proc, byte_position, caller);
+	(i7_write_word)(proc, address, array_index, new_val);
 }
+#endif
 i7byte_t i7_change_byte(i7process_t *proc, i7word_t address, i7byte_t new_val, int way) {
 	i7byte_t old_val = i7_read_byte(proc, address);
 	i7byte_t return_val = new_val;
@@ -244,35 +320,102 @@ void i7_push(i7process_t *proc, i7word_t x) {
 void i7_copy_state(i7process_t *proc, i7state_t *to, i7state_t *from) {
 	to->himem = from->himem;
 	to->memory = i7_calloc(proc, i7_static_himem, sizeof(i7byte_t));
-	for (int i=0; i<i7_static_himem; i++) to->memory[i] = from->memory[i];
+	memcpy(to->memory, from->memory, i7_static_himem);
+	i7_copy_state_except_memory(proc, to, from);
+}
+
+void i7_copy_state_except_memory(i7process_t *proc, i7state_t *to, i7state_t *from) {
 	for (int i=0; i<I7_TMP_STORAGE_CAPACITY; i++) to->tmp[i] = from->tmp[i];
 	to->stack_pointer = from->stack_pointer;
 	for (int i=0; i<from->stack_pointer; i++) to->stack[i] = from->stack[i];
-	to->object_tree_parent  = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
-	to->object_tree_child   = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
-	to->object_tree_sibling = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
-
-	for (int i=0; i<i7_max_objects; i++) {
-		to->object_tree_parent[i] = from->object_tree_parent[i];
-		to->object_tree_child[i] = from->object_tree_child[i];
-		to->object_tree_sibling[i] = from->object_tree_sibling[i];
-	}
-	to->variables = i7_calloc(proc, i7_no_variables, sizeof(i7word_t));
-	for (int i=0; i<i7_no_variables; i++) to->variables[i] = from->variables[i];
+	if (to->object_tree_parent == NULL) {
+		to->object_tree_parent  = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+		to->object_tree_child   = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+		to->object_tree_sibling = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+		to->object_tree_previous = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+		to->object_tree_children = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+	}
+	memcpy(to->object_tree_parent, from->object_tree_parent, i7_max_objects*sizeof(i7word_t));
+	memcpy(to->object_tree_child, from->object_tree_child, i7_max_objects*sizeof(i7word_t));
+	memcpy(to->object_tree_sibling, from->object_tree_sibling, i7_max_objects*sizeof(i7word_t));
+	memcpy(to->object_tree_previous, from->object_tree_previous, i7_max_objects*sizeof(i7word_t));
+	memcpy(to->object_tree_children, from->object_tree_children, i7_max_objects*sizeof(i7word_t));
+	if (to->variables == NULL)
+		to->variables = i7_calloc(proc, i7_no_variables, sizeof(i7word_t));
+	memcpy(to->variables, from->variables, i7_no_variables*sizeof(i7word_t));
 	to->current_output_stream_ID = from->current_output_stream_ID;
 }
 
 void i7_destroy_state(i7process_t *proc, i7state_t *s) {
 	free(s->memory);
+	s->memory = NULL;
 	s->himem = 0;
 	s->stack_pointer = 0;
 	free(s->object_tree_parent);
 	free(s->object_tree_child);
 	free(s->object_tree_sibling);
+	free(s->object_tree_previous);
+	free(s->object_tree_children);
+	s->object_tree_parent = NULL; s->object_tree_child = NULL; s->object_tree_sibling = NULL;
+	s->object_tree_previous = NULL; s->object_tree_children = NULL;
 	free(s->variables);
+	s->variables = NULL;
+}
+
+/* Snapshots hold memory as a table of pages, each shared by every snapshot
+   in which it is unchanged. proc->base_pages is the table which memory matches,
+   except for the pages marked in proc->dirty_pages by writes since it was set,
+   so that saving copies only those pages, and restoring copies back only the
+   pages which differ. */
+int i7_page_extent(int page) {
+	int from = page << I7_SNAPSHOT_PAGE_SHIFT;
+	if (from + I7_SNAPSHOT_PAGE_SIZE > i7_static_himem) return i7_static_himem - from;
+	return I7_SNAPSHOT_PAGE_SIZE;
+}
+
+i7page_t **i7_snapshot_pages(i7process_t *proc) {
+	i7page_t **pages = i7_calloc(proc, I7_SNAPSHOT_PAGES, sizeof(i7page_t *));
+	for (int p=0; p<I7_SNAPSHOT_PAGES; p++) {
+		if ((proc->base_pages) && (I7_PAGE_IS_DIRTY(proc, p) == 0)) {
+			pages[p] = proc->base_pages[p];
+		} else {
+			pages[p] = malloc(sizeof(i7page_t));
+			if (pages[p] == NULL) {
+				printf("Memory allocation failed\n");
+				i7_fatal_exit(proc);
+			}
+			pages[p]->references = 0;
+			memcpy(pages[p]->data, proc->state.memory + (p << I7_SNAPSHOT_PAGE_SHIFT),
+				i7_page_extent(p));
+		}
+		pages[p]->references++;
+	}
+	i7_rebase_pages(proc, pages);
+	return pages;
+}
+
+void i7_rebase_pages(i7process_t *proc, i7page_t **pages) {
+	if (proc->base_pages == NULL)
+		proc->base_pages = i7_calloc(proc, I7_SNAPSHOT_PAGES, sizeof(i7page_t *));
+	for (int p=0; p<I7_SNAPSHOT_PAGES; p++) {
+		i7page_t *old = proc->base_pages[p];
+		pages[p]->references++;
+		if ((old) && (--(old->references) == 0)) free(old);
+		proc->base_pages[p] = pages[p];
+	}
+	memset(proc->dirty_pages, 0, I7_SNAPSHOT_PAGES/8 + 1);
+}
+
+void i7_release_pages(i7process_t *proc, i7page_t **pages) {
+	if (pages == NULL) return;
+	for (int p=0; p<I7_SNAPSHOT_PAGES; p++)
+		if ((pages[p]) && (--(pages[p]->references) == 0)) free(pages[p]);
+	free(pages);
 }
 void i7_destroy_snapshot(i7process_t *proc, i7snapshot_t *unwanted) {
 	i7_destroy_state(proc, &(unwanted->then));
+	i7_release_pages(proc, unwanted->pages);
+	unwanted->pages = NULL;
 	unwanted->valid = 0;
 }
 
@@ -288,7 +431,9 @@ void i7_save_snapshot(i7process_t *proc) {
 		i7_destroy_snapshot(proc, &(proc->snapshots[proc->snapshot_pos]));
 	proc->snapshots[proc->snapshot_pos] = i7_new_snapshot();
 	proc->snapshots[proc->snapshot_pos].valid = 1;
-	i7_copy_state(proc, &(proc->snapshots[proc->snapshot_pos].then), &(proc->state));
+	proc->snapshots[proc->snapshot_pos].then.himem = proc->state.himem;
+	i7_copy_state_except_memory(proc, &(proc->snapshots[proc->snapshot_pos].then), &(proc->state));
+	proc->snapshots[proc->snapshot_pos].pages = i7_snapshot_pages(proc);
 	int was = proc->snapshot_pos;
 	proc->snapshot_pos++;
 	if (proc->snapshot_pos == I7_MAX_SNAPSHOTS) proc->snapshot_pos = 0;
@@ -305,12 +450,22 @@ void i7_restore_snapshot(i7process_t *proc) {
 		printf("Restore impossible\n");
 		i7_fatal_exit(proc);
 	}
-	i7_destroy_state(proc, &(proc->state));
-	i7_copy_state(proc, &(proc->state), &(proc->snapshots[will_be].then));
+	i7_restore_snapshot_from(proc, &(proc->snapshots[will_be]));
 	i7_destroy_snapshot(proc, &(proc->snapshots[will_be]));
 	int was = proc->snapshot_pos;
 	proc->snapshot_pos = will_be;
 }
+
+void i7_restore_snapshot_from(i7process_t *proc, i7snapshot_t *ss) {
+	for (int p=0; p<I7_SNAPSHOT_PAGES; p++)
+		if ((proc->base_pages == NULL) || (I7_PAGE_IS_DIRTY(proc, p)) ||
+			(proc->base_pages[p] != ss->pages[p]))
+			memcpy(proc->state.memory + (p << I7_SNAPSHOT_PAGE_SHIFT), ss->pages[p]->data,
+				i7_page_extent(p));
+	i7_rebase_pages(proc, ss->pages);
+	proc->state.himem = ss->then.himem;
+	i7_copy_state_except_memory(proc, &(proc->state), &(ss->then));
+}
 void i7_opcode_call(i7process_t *proc, i7word_t fn_ref, i7word_t varargc, i7word_t *z) {
 	i7word_t args[10]; for (int i=0; i<10; i++) args[i] = 0;
 	for (int i=0; i<varargc; i++) args[i] = i7_pull(proc);
@@ -838,6 +993,20 @@ int i7_ofclass(i7process_t *proc, i7word_t id, i7word_t cl_id) {
 		if (i7_metaclass_of[id] == i7_mgl_Object) return 1;
 		return 0;
 	}
+	if ((id >= i7_max_objects) || (cl_id >= i7_max_objects)) return 0;
+	if (i7_class_numbers.first == NULL) return i7_ofclass_by_walk(proc, id, cl_id);
+	int at = i7_class_numbers.first[id], from = i7_class_numbers.first[cl_id];
+	int result = ((from < at) && (at < from + i7_class_numbers.extent[cl_id]));
+	#ifdef I7_DEBUG_CLASSES
+	if (result != i7_ofclass_by_walk(proc, id, cl_id)) {
+		printf("Class numbering disagrees: ofclass(%d, %d)\n", id, cl_id);
+		i7_fatal_exit(proc);
+	}
+	#endif
+	return result;
+}
+
+int i7_ofclass_by_walk(i7process_t *proc, i7word_t id, i7word_t cl_id) {
 	int cl_found = i7_class_of[id];
 	while (cl_found != i7_mgl_Class) {
 		if (cl_id == cl_found) return 1;
@@ -845,64 +1014,211 @@ int i7_ofclass(i7process_t *proc, i7word_t id, i7word_t cl_id) {
 	}
 	return 0;
 }
+
+/* The class hierarchy is fixed, so i7_number_classes numbers it once: each object
+   is a node whose parent is its i7_class_of entry, unless that is Class. In a
+   preorder walk of this forest, the objects below any node take the positions
+   just after it, so i7_ofclass needs only compare two positions. Compiling with
+   I7_DEBUG_CLASSES checks every answer against the walk up i7_class_of. The
+   numbering depends only on the story, so it is shared by every process, and
+   later processes keep the one made for the first. */
+i7_class_numbering i7_class_numbers;
+
+void i7_number_classes(i7process_t *proc) {
+	i7_class_numbering *N = &i7_class_numbers;
+	if (N->first) return;
+	N->first = i7_calloc(proc, i7_max_objects, sizeof(int));
+	N->extent = i7_calloc(proc, i7_max_objects, sizeof(int));
+	int *eldest = i7_calloc(proc, i7_max_objects, sizeof(int));
+	int *younger = i7_calloc(proc, i7_max_objects, sizeof(int));
+	int *order = i7_calloc(proc, i7_max_objects, sizeof(int));
+	int *stack = i7_calloc(proc, i7_max_objects, sizeof(int));
+	for (int i=0; i<i7_max_objects; i++) N->first[i] = -1;
+	for (int i=i7_max_objects-1; i>0; i--) {
+		int cl = i7_class_of[i];
+		if ((i != i7_mgl_Class) && (cl > 0) && (cl < i7_max_objects) &&
+			(cl != i7_mgl_Class) && (cl != i)) {
+			younger[i] = eldest[cl]; eldest[cl] = i;
+		}
+	}
+	int positions = 0;
+	for (int root=1; root<i7_max_objects; root++) {
+		int cl = i7_class_of[root];
+		if ((root == i7_mgl_Class) ||
+			((cl > 0) && (cl < i7_max_objects) && (cl != i7_mgl_Class) && (cl != root)))
+			continue;
+		int sp = 0;
+		stack[sp++] = root;
+		while (sp > 0) {
+			int x = stack[--sp];
+			N->first[x] = positions;
+			order[positions++] = x;
+			for (int c = eldest[x]; c; c = younger[c]) stack[sp++] = c;
+		}
+	}
+	for (int i=positions-1; i>=0; i--) {
+		int x = order[i], cl = i7_class_of[x];
+		N->extent[x]++;
+		if ((cl > 0) && (cl < i7_max_objects) && (N->first[cl] >= 0) && (cl != x))
+			N->extent[cl] += N->extent[x];
+	}
+	free(eldest); free(younger); free(order); free(stack);
+}
 void i7_empty_object_tree(i7process_t *proc) {
 	proc->state.object_tree_parent  = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
 	proc->state.object_tree_child   = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
 	proc->state.object_tree_sibling = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+	proc->state.object_tree_previous = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
+	proc->state.object_tree_children = i7_calloc(proc, i7_max_objects, sizeof(i7word_t));
 	for (int i=0; i<i7_max_objects; i++) {
 		proc->state.object_tree_parent[i] = 0;
 		proc->state.object_tree_child[i] = 0;
 		proc->state.object_tree_sibling[i] = 0;
+		proc->state.object_tree_previous[i] = 0;
+		proc->state.object_tree_children[i] = 0;
+	}
+}
+
+/* Besides parent, child and sibling, the tree keeps each object's previous sibling
+   and number of children, so that i7_move and i7_children need not search. These
+   are rebuilt from the other three once the compiled story has set up the tree. */
+void i7_index_object_tree(i7process_t *proc) {
+	i7state_t *S = &(proc->state);
+	for (int i=0; i<i7_max_objects; i++) {
+		S->object_tree_previous[i] = 0;
+		S->object_tree_children[i] = 0;
+	}
+	for (int i=0; i<i7_max_objects; i++) {
+		i7word_t p = S->object_tree_parent[i];
+		if ((p > 0) && (p < i7_max_objects)) S->object_tree_children[p]++;
+		i7word_t prev = 0;
+		for (i7word_t c = S->object_tree_child[i]; (c > 0) && (c < i7_max_objects);
+			c = S->object_tree_sibling[c]) {
+			S->object_tree_previous[c] = prev;
+			prev = c;
+		}
+	}
+}
+/* The initialiser in the compiled story fills in i7_properties, whose rows have
+   room for the story's i7_no_property_ids properties, and i7_compile_properties
+   then packs this into i7_property_tables and frees it. Each object's own
+   properties become one run of entries, and a map gives for each (object,
+   property) pair the entry which a read finds, on the object or else up its
+   class chain. The rows take 8*i7_no_property_ids bytes per object and are gone
+   before the map, at 4*i7_no_property_ids, is made: a fixed i7_properties took
+   8000 bytes per object for the whole run. The tables depend only on the story
+   and are shared by every process; the initialiser of each process still fills
+   in the rows, but only the first process packs them, so that the tables are
+   never freed while another process reads them. */
+i7_property_set *i7_properties = NULL;
+i7word_t *i7_property_rows = NULL;
+i7_property_table i7_property_tables;
+
+void i7_begin_properties(i7process_t *proc) {
+	if (i7_properties) return;
+	i7_properties = i7_calloc(proc, i7_max_objects, sizeof(i7_property_set));
+	i7_property_rows = i7_calloc(proc, 2*i7_max_objects*i7_no_property_ids + 1, sizeof(i7word_t));
+	for (int obj=0; obj<i7_max_objects; obj++) {
+		i7_properties[obj].address = i7_property_rows + 2*obj*i7_no_property_ids;
+		i7_properties[obj].len = i7_properties[obj].address + i7_no_property_ids;
+	}
+}
+
+void i7_compile_properties(i7process_t *proc) {
+	i7_property_table *T = &i7_property_tables;
+	if (T->first) {
+		free(i7_property_rows);
+		i7_property_rows = NULL;
+		free(i7_properties);
+		i7_properties = NULL;
+		return;
+	}
+	int entries = 0;
+	for (int obj=0; obj<i7_max_objects; obj++)
+		for (int pr=0; pr<i7_no_property_ids; pr++)
+			if (i7_properties[obj].address[pr]) entries++;
+	T->first = i7_calloc(proc, i7_max_objects + 1, sizeof(int));
+	T->id = i7_calloc(proc, entries + 1, sizeof(i7word_t));
+	T->address = i7_calloc(proc, entries + 1, sizeof(i7word_t));
+	T->len = i7_calloc(proc, entries + 1, sizeof(i7word_t));
+	int e = 0;
+	for (int obj=0; obj<i7_max_objects; obj++) {
+		T->first[obj] = e;
+		for (int pr=0; pr<i7_no_property_ids; pr++)
+			if (i7_properties[obj].address[pr]) {
+				T->id[e] = pr;
+				T->address[e] = i7_properties[obj].address[pr];
+				T->len[e] = i7_properties[obj].len[pr];
+				e++;
+			}
+	}
+	T->first[i7_max_objects] = e;
+	free(i7_property_rows);
+	i7_property_rows = NULL;
+	free(i7_properties);
+	i7_properties = NULL;
+
+	T->map = i7_calloc(proc, i7_max_objects*i7_no_property_ids, sizeof(int));
+	for (int obj=1; obj<i7_max_objects; obj++) {
+		int *row = T->map + obj*i7_no_property_ids;
+		for (int cl=obj, n=0; (cl > 0) && (cl < i7_max_objects) && (n < i7_max_objects);
+			cl = i7_class_of[cl], n++) {
+			if ((cl == i7_mgl_Class) && (cl != obj)) break;
+			for (int e=T->first[cl]; e<T->first[cl+1]; e++)
+				if (row[T->id[e]] == 0) row[T->id[e]] = e + 1;
+		}
 	}
 }
-i7_property_set i7_properties[i7_max_objects];
+
+int i7_property_entry(i7word_t owner_id, i7word_t prop_id) {
+	return i7_property_tables.map[owner_id*i7_no_property_ids + prop_id] - 1;
+}
 
 i7word_t i7_prop_len(i7process_t *proc, i7word_t K, i7word_t obj, i7word_t pr_array) {
 	i7word_t pr = i7_read_word(proc, pr_array, 1);
 	if ((obj <= 0) || (obj >= i7_max_objects) ||
 		(pr < 0) || (pr >= i7_no_property_ids)) return 0;
-	return 4*i7_properties[(int) obj].len[(int) pr];
+	int e = i7_property_entry(obj, pr);
+	if ((e < i7_property_tables.first[obj]) || (e >= i7_property_tables.first[obj+1])) return 0;
+	return 4*i7_property_tables.len[e];
 }
 
 i7word_t i7_prop_addr(i7process_t *proc, i7word_t K, i7word_t obj, i7word_t pr_array) {
 	i7word_t pr = i7_read_word(proc, pr_array, 1);
 	if ((obj <= 0) || (obj >= i7_max_objects) ||
 		(pr < 0) || (pr >= i7_no_property_ids)) return 0;
-	return i7_properties[(int) obj].address[(int) pr];
+	int e = i7_property_entry(obj, pr);
+	if ((e < i7_property_tables.first[obj]) || (e >= i7_property_tables.first[obj+1])) return 0;
+	return i7_property_tables.address[e];
 }
 
 int i7_provides(i7process_t *proc, i7word_t owner_id, i7word_t pr_array) {
 	i7word_t prop_id = i7_read_word(proc, pr_array, 1);
 	if ((owner_id <= 0) || (owner_id >= i7_max_objects) ||
 		(prop_id < 0) || (prop_id >= i7_no_property_ids)) return 0;
-	while (owner_id != 1) {
-		if (i7_properties[(int) owner_id].address[(int) prop_id] != 0) return 1;
-		owner_id = i7_class_of[owner_id];
-	}
+	if ((owner_id != 1) && (i7_property_entry(owner_id, prop_id) >= 0)) return 1;
 	return 0;
 }
 void i7_move(i7process_t *proc, i7word_t obj, i7word_t to) {
 	if ((obj <= 0) || (obj >= i7_max_objects)) return;
-	int p = proc->state.object_tree_parent[obj];
+	i7state_t *S = &(proc->state);
+	int p = S->object_tree_parent[obj];
 	if (p) {
-		if (proc->state.object_tree_child[p] == obj) {
-			proc->state.object_tree_child[p] = proc->state.object_tree_sibling[obj];
-		} else {
-			int c = proc->state.object_tree_child[p];
-			while (c != 0) {
-				if (proc->state.object_tree_sibling[c] == obj) {
-					proc->state.object_tree_sibling[c] = proc->state.object_tree_sibling[obj];
-					break;
-				}
-				c = proc->state.object_tree_sibling[c];
-			}
-		}
-	}
-	proc->state.object_tree_parent[obj] = to;
-	proc->state.object_tree_sibling[obj] = 0;
+		int prev = S->object_tree_previous[obj], next = S->object_tree_sibling[obj];
+		if (prev) S->object_tree_sibling[prev] = next;
+		else S->object_tree_child[p] = next;
+		if (next) S->object_tree_previous[next] = prev;
+		S->object_tree_children[p]--;
+	}
+	S->object_tree_parent[obj] = to;
+	S->object_tree_sibling[obj] = 0;
+	S->object_tree_previous[obj] = 0;
 	if (to) {
-		proc->state.object_tree_sibling[obj] = proc->state.object_tree_child[to];
-		proc->state.object_tree_child[to] = obj;
+		int next = S->object_tree_child[to];
+		S->object_tree_sibling[obj] = next;
+		if (next) S->object_tree_previous[next] = obj;
+		S->object_tree_child[to] = obj;
+		S->object_tree_children[to]++;
 	}
 }
 i7word_t i7_parent(i7process_t *proc, i7word_t id) {
@@ -915,11 +1231,7 @@ i7word_t i7_child(i7process_t *proc, i7word_t id) {
 }
 i7word_t i7_children(i7process_t *proc, i7word_t id) {
 	if (i7_metaclass(proc, id) != i7_mgl_Object) return 0;
-	i7word_t c=0;
-	for (int i=0; i<i7_max_objects; i++)
-		if (proc->state.object_tree_parent[i] == id)
-			c++;
-	return c;
+	return proc->state.object_tree_children[id];
 }
 i7word_t i7_sibling(i7process_t *proc, i7word_t id) {
 	if (i7_metaclass(proc, id) != i7_mgl_Object) return 0;
@@ -935,12 +1247,9 @@ i7word_t i7_read_prop_value(i7process_t *proc, i7word_t owner_id, i7word_t pr_ar
 	i7word_t prop_id = i7_read_word(proc, pr_array, 1);
 	if ((owner_id <= 0) || (owner_id >= i7_max_objects) ||
 		(prop_id < 0) || (prop_id >= i7_no_property_ids)) return 0;
-	while (i7_properties[(int) owner_id].address[(int) prop_id] == 0) {
-		owner_id = i7_class_of[owner_id];
-		if (owner_id == i7_mgl_Class) return 0;
-	}
-	i7word_t address = i7_properties[(int) owner_id].address[(int) prop_id];
-	return i7_read_word(proc, address, 0);
+	int e = i7_property_entry(owner_id, prop_id);
+	if (e < 0) return 0;
+	return i7_read_word(proc, i7_property_tables.address[e], 0);
 }
 
 void i7_write_prop_value(i7process_t *proc, i7word_t owner_id, i7word_t pr_array, i7word_t val) {
@@ -950,8 +1259,9 @@ void i7_write_prop_value(i7process_t *proc, i7word_t owner_id, i7word_t pr_array
 		printf("impossible property write (%d, %d)\n", owner_id, prop_id);
 		i7_fatal_exit(proc);
 	}
-	i7word_t address = i7_properties[(int) owner_id].address[(int) prop_id];
-	if (address) i7_write_word(proc, address, 0, val);
+	int e = i7_property_entry(owner_id, prop_id);
+	if ((e >= i7_property_tables.first[owner_id]) && (e < i7_property_tables.first[owner_id+1]))
+		i7_write_word(proc, i7_property_tables.address[e], 0, val);
 	else {
 		printf("impossible property write (%d, %d)\n", owner_id, prop_id);
 		i7_fatal_exit(proc);
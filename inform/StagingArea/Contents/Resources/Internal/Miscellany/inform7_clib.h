@@ -1,6 +1,9 @@
 /* This is a header file for using a library of C code to support Inter code
    compiled to ANSI C. It was generated mechanically from the Inter source code,
-   so to change this material, edit that and not this file. */
+   so to change this material, edit that and not this file.
+
+   This copy has been edited by hand, along with inform7_clib.c: see the note
+   there. */
 
 #ifndef I7_CLIB_H_INCLUDED
 #define I7_CLIB_H_INCLUDED 1
@@ -34,20 +37,34 @@ typedef struct i7state_t {
 	i7word_t *object_tree_parent;
 	i7word_t *object_tree_child;
 	i7word_t *object_tree_sibling;
+	i7word_t *object_tree_previous;
+	i7word_t *object_tree_children;
 	i7word_t *variables;
 	i7word_t tmp[I7_TMP_STORAGE_CAPACITY];
 	i7word_t current_output_stream_ID;
 	struct i7rngseed_t seed;
 } i7state_t;
+#ifndef I7_SNAPSHOT_PAGE_SHIFT
+#define I7_SNAPSHOT_PAGE_SHIFT 10
+#endif
+#define I7_SNAPSHOT_PAGE_SIZE (1 << I7_SNAPSHOT_PAGE_SHIFT)
+#define I7_SNAPSHOT_PAGES ((i7_static_himem + I7_SNAPSHOT_PAGE_SIZE - 1) >> I7_SNAPSHOT_PAGE_SHIFT)
+typedef struct i7page_t {
+	int references;
+	i7byte_t data[I7_SNAPSHOT_PAGE_SIZE];
+} i7page_t;
 typedef struct i7snapshot_t {
 	int valid;
 	struct i7state_t then;
+	i7page_t **pages;
 } i7snapshot_t;
 #define I7_MAX_SNAPSHOTS 10
 typedef struct i7process_t {
 	i7state_t state;
 	i7snapshot_t snapshots[I7_MAX_SNAPSHOTS];
 	int snapshot_pos;
+	i7page_t **base_pages;
+	unsigned char *dirty_pages;
 	jmp_buf execution_env;
 	int termination_code;
 	void (*receiver)(int id, wchar_t c, char *style);
@@ -95,10 +112,46 @@ i7word_t i7_read_word(i7process_t *proc, i7word_t array_address, i7word_t array_
 #define I7BYTE_1(V) ((V & 0x00FF0000) >> 16)
 #define I7BYTE_2(V) ((V & 0x0000FF00) >> 8)
 #define I7BYTE_3(V)  (V & 0x000000FF)
+#define I7_MARK_DIRTY(proc, address) \
+	((proc)->dirty_pages[(address) >> (I7_SNAPSHOT_PAGE_SHIFT + 3)] |= \
+		(unsigned char) (1 << (((address) >> I7_SNAPSHOT_PAGE_SHIFT) & 7)))
+#define I7_PAGE_IS_DIRTY(proc, page) \
+	((proc)->dirty_pages[(page) >> 3] & (1 << ((page) & 7)))
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define I7_BIG_ENDIAN_32(W) __builtin_bswap32(W)
+#define I7_BIG_ENDIAN_16(W) __builtin_bswap16(W)
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define I7_BIG_ENDIAN_32(W) (W)
+#define I7_BIG_ENDIAN_16(W) (W)
+#endif
+#ifdef I7_UNCHECKED_MEMORY
+#define I7_CHECK_MEMORY(proc, position, width, caller)
+#else
+#define I7_CHECK_MEMORY(proc, position, width, caller) do { \
+	if (((position) < 0) || ((position) > i7_static_himem - (width))) \
+		i7_memory_fault(proc, position, caller); } while (0)
+#endif
+void i7_memory_fault(i7process_t *proc, i7word_t byte_position, const char *caller);
 
 void i7_write_byte(i7process_t *proc, i7word_t address, i7byte_t new_val);
 void i7_write_word(i7process_t *proc, i7word_t address, i7word_t array_index,
 	i7word_t new_val);
+#ifdef I7_DEBUG_MEMORY
+i7byte_t i7_debug_read_byte(i7process_t *proc, i7word_t address, const char *caller);
+i7word_t i7_debug_read_sword(i7process_t *proc, i7word_t array_address, i7word_t array_index,
+	const char *caller);
+i7word_t i7_debug_read_word(i7process_t *proc, i7word_t array_address, i7word_t array_index,
+	const char *caller);
+void i7_debug_write_byte(i7process_t *proc, i7word_t address, i7byte_t new_val,
+	const char *caller);
+void i7_debug_write_word(i7process_t *proc, i7word_t address, i7word_t array_index,
+	i7word_t new_val, const char *caller);
+#define i7_read_byte(proc, A) i7_debug_read_byte(proc, A, __func__)
+#define i7_read_sword(proc, A, I) i7_debug_read_sword(proc, A, I, __func__)
+#define i7_read_word(proc, A, I) i7_debug_read_word(proc, A, I, __func__)
+#define i7_write_byte(proc, A, V) i7_debug_write_byte(proc, A, V, __func__)
+#define i7_write_word(proc, A, I, V) i7_debug_write_word(proc, A, I, V, __func__)
+#endif
 i7byte_t i7_change_byte(i7process_t *proc, i7word_t address, i7byte_t new_val, int way);
 i7word_t i7_change_word(i7process_t *proc, i7word_t array_address, i7word_t array_index,
 	i7word_t new_val, int way);
@@ -106,6 +159,11 @@ void i7_debug_stack(char *N);
 i7word_t i7_pull(i7process_t *proc);
 void i7_push(i7process_t *proc, i7word_t x);
 void i7_copy_state(i7process_t *proc, i7state_t *to, i7state_t *from);
+void i7_copy_state_except_memory(i7process_t *proc, i7state_t *to, i7state_t *from);
+int i7_page_extent(int page);
+i7page_t **i7_snapshot_pages(i7process_t *proc);
+void i7_rebase_pages(i7process_t *proc, i7page_t **pages);
+void i7_release_pages(i7process_t *proc, i7page_t **pages);
 void i7_destroy_state(i7process_t *proc, i7state_t *s);
 void i7_destroy_snapshot(i7process_t *proc, i7snapshot_t *unwanted);
 void i7_destroy_latest_snapshot(i7process_t *proc);
@@ -192,13 +250,32 @@ char *i7_text_to_C_string(i7word_t str);
 void i7_print_dword(i7process_t *proc, i7word_t at);
 i7word_t i7_metaclass(i7process_t *proc, i7word_t id);
 int i7_ofclass(i7process_t *proc, i7word_t id, i7word_t cl_id);
+int i7_ofclass_by_walk(i7process_t *proc, i7word_t id, i7word_t cl_id);
+typedef struct i7_class_numbering {
+	int *first;     /* position of each object in a preorder walk of the class forest, or -1 */
+	int *extent;    /* the number of positions taken by it and everything of its class */
+} i7_class_numbering;
+extern i7_class_numbering i7_class_numbers;
+void i7_number_classes(i7process_t *proc);
 void i7_empty_object_tree(i7process_t *proc);
+void i7_index_object_tree(i7process_t *proc);
 #define I7_MAX_PROPERTY_IDS 1000
 typedef struct i7_property_set {
-	i7word_t address[I7_MAX_PROPERTY_IDS];
-	i7word_t len[I7_MAX_PROPERTY_IDS];
+	i7word_t *address; /* i7_no_property_ids words, only while the initialiser runs */
+	i7word_t *len;
 } i7_property_set;
-extern i7_property_set i7_properties[];
+extern i7_property_set *i7_properties;
+typedef struct i7_property_table {
+	int *first;     /* index of each object's first entry, and one past the last object's */
+	i7word_t *id;   /* the entries: each object's own properties, in order of ID */
+	i7word_t *address;
+	i7word_t *len;
+	int *map;       /* for each (object, property), 1 + the entry a read finds, or 0 */
+} i7_property_table;
+extern i7_property_table i7_property_tables;
+void i7_begin_properties(i7process_t *proc);
+void i7_compile_properties(i7process_t *proc);
+int i7_property_entry(i7word_t owner_id, i7word_t prop_id);
 
 i7word_t i7_prop_addr(i7process_t *proc, i7word_t K, i7word_t obj, i7word_t pr);
 i7word_t i7_prop_len(i7process_t *proc, i7word_t K, i7word_t obj, i7word_t pr);
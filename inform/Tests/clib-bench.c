@@ -0,0 +1,171 @@
+/* Benchmarks for the C runtime library inform7_clib.c, which Inter code compiled
+   to ANSI C is linked with. This stands in for a compiled story, supplying the
+   few definitions the library needs from one, and times the runtime's own work.
+
+   To build:
+	cc -std=c99 -O2 -I../StagingArea/Contents/Resources/Internal/Miscellany \
+		-o clib-bench clib-bench.c -lm
+   and define I7_UNCHECKED_MEMORY or I7_DEBUG_MEMORY as a story would, to time
+   those builds of the runtime. The story's memory is 1MB unless i7_static_himem
+   is defined as something else; to see how the cost of undo grows with memory:
+	for m in 65536 1048576 16777216; do
+		cc -std=c99 -O2 -Di7_static_himem=$m \
+			-I../StagingArea/Contents/Resources/Internal/Miscellany \
+			-o clib-bench clib-bench.c -lm && ./clib-bench undo
+	done
+   In the same way, -Di7_max_objects=... sets the number of objects in the world
+   moved about by the tree benchmark, which is 10000 unless defined otherwise.
+
+   Usage:
+	clib-bench memory
+		Reads and writes words and bytes all over memory, as a story working on
+		tables does, and reports the time taken and a checksum of what was read
+		(which should not depend on how the runtime was built).
+	clib-bench undo
+		Plays turns which each change a few hundred words of memory and then
+		save an undo snapshot, as a story does before each command, and reports
+		the time a save and a restore take.
+	clib-bench tree
+		Moves things about a world of rooms and containers, asking after each
+		move how many children the destination has, and reports the time taken
+		and a checksum of the answers. */
+
+#include "inform7_clib.h"
+
+#ifndef i7_static_himem
+#define i7_static_himem 1048576
+#endif
+#ifndef i7_max_objects
+#define i7_max_objects 10000
+#endif
+#define i7_no_variables 10
+#define i7_no_property_ids 10
+#define I7VAL_FUNCTIONS_BASE 0x10000
+#define I7VAL_STRINGS_BASE 0x20000
+#define i7_mgl_Class 1
+#define i7_mgl_Object 2
+#define i7_mgl_Routine 3
+#define i7_mgl_String 4
+#define i7_var_self 0
+
+i7word_t i7_class_of[i7_max_objects];
+i7word_t i7_metaclass_of[i7_max_objects];
+i7word_t i7_initial_variable_values[i7_no_variables];
+i7byte_t i7_initial_memory[i7_static_himem];
+void i7_initialiser(i7process_t *proc) {}
+void i7_initialise_object_tree(i7process_t *proc) {}
+i7word_t i7_fn_Main(i7process_t *proc) { return 0; }
+i7word_t i7_gen_call(i7process_t *proc, i7word_t fn_ref, i7word_t *args, int argc) {
+	return 0;
+}
+
+#include "inform7_clib.c"
+
+#include <sys/time.h>
+
+double bench_now(void) {
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec/1e6;
+}
+
+#define BENCH_TABLE 0x1000
+#define BENCH_TABLE_WORDS 200000
+
+void bench_memory(i7process_t *proc) {
+	if (i7_static_himem < BENCH_TABLE + 4*(BENCH_TABLE_WORDS + 1)) {
+		printf("memory: needs i7_static_himem of at least %d\n",
+			BENCH_TABLE + 4*(BENCH_TABLE_WORDS + 1));
+		return;
+	}
+	srand(3);
+	for (int i=0; i<=BENCH_TABLE_WORDS; i++) i7_write_word(proc, BENCH_TABLE, i, rand());
+	double t0 = bench_now();
+	i7word_t sum = 0;
+	for (int pass=0; pass<100; pass++)
+		for (int i=0; i<BENCH_TABLE_WORDS; i++) {
+			i7word_t a = i7_read_word(proc, BENCH_TABLE, i);
+			i7_write_word(proc, BENCH_TABLE, (i*7) % BENCH_TABLE_WORDS, a + pass);
+			sum += a + i7_read_sword(proc, BENCH_TABLE, i) + i7_read_byte(proc, BENCH_TABLE + i);
+		}
+	printf("memory: %.3f s (checksum %d)\n", bench_now() - t0, sum);
+}
+
+#define BENCH_TURNS 2000
+#define BENCH_TURN_WRITES 200
+
+void bench_turn(i7process_t *proc) {
+	for (int k=0; k<BENCH_TURN_WRITES; k++)
+		i7_write_word(proc, 4*(rand()%(i7_static_himem/4)), 0, rand());
+}
+
+void bench_undo(i7process_t *proc) {
+	srand(1);
+	double t0 = bench_now();
+	for (int t=0; t<BENCH_TURNS; t++) bench_turn(proc);
+	double turns = bench_now() - t0;
+	srand(1);
+	t0 = bench_now();
+	for (int t=0; t<BENCH_TURNS; t++) {
+		bench_turn(proc);
+		i7_save_snapshot(proc);
+	}
+	double saves = bench_now() - t0 - turns;
+	t0 = bench_now();
+	int restores = 0;
+	while (i7_has_snapshot(proc)) {
+		i7_restore_snapshot(proc);
+		restores++;
+	}
+	double restored = bench_now() - t0;
+	printf("undo: %d bytes of memory, %.1f us per save, %.1f us per restore\n",
+		i7_static_himem, saves/BENCH_TURNS*1e6, (restores > 0)?(restored/restores*1e6):0.0);
+}
+
+#define BENCH_ROOMS 50
+#define BENCH_FIRST_ROOM 10
+#define BENCH_FIRST_THING (BENCH_FIRST_ROOM + BENCH_ROOMS)
+
+i7word_t bench_destination(void) {
+	if (rand()%4) return BENCH_FIRST_ROOM + rand()%BENCH_ROOMS;
+	return BENCH_FIRST_THING + rand()%(i7_max_objects - BENCH_FIRST_THING);
+}
+
+void bench_tree(i7process_t *proc) {
+	for (int i=1; i<i7_max_objects; i++) {
+		i7_class_of[i] = i7_mgl_Class;
+		i7_metaclass_of[i] = i7_mgl_Object;
+	}
+	srand(7);
+	for (int i=BENCH_FIRST_THING; i<i7_max_objects; i++)
+		i7_move(proc, i, BENCH_FIRST_ROOM + rand()%BENCH_ROOMS);
+	i7_index_object_tree(proc);
+	double t0 = bench_now();
+	long sum = 0;
+	for (int r=0; r<1000000; r++) {
+		i7word_t obj = BENCH_FIRST_THING + rand()%(i7_max_objects - BENCH_FIRST_THING);
+		i7word_t to = bench_destination();
+		if (to != obj) i7_move(proc, obj, to);
+		sum += i7_children(proc, to);
+	}
+	printf("tree: %d objects, %.3f s (checksum %ld)\n", i7_max_objects, bench_now() - t0, sum);
+}
+
+int main(int argc, char **argv) {
+	i7process_t proc = i7_new_process();
+	if (setjmp(proc.execution_env)) {
+		printf("the runtime halted\n");
+		return 1;
+	}
+	i7_initialise_memory_and_stack(&proc);
+	i7_initialise_variables(&proc);
+	i7_empty_object_tree(&proc);
+	if ((argc == 2) && (strcmp(argv[1], "memory") == 0)) bench_memory(&proc);
+	else if ((argc == 2) && (strcmp(argv[1], "undo") == 0)) bench_undo(&proc);
+	else if ((argc == 2) && (strcmp(argv[1], "tree") == 0)) bench_tree(&proc);
+	else {
+		printf("usage: clib-bench memory|undo|tree\n");
+		return 1;
+	}
+	return 0;
+}